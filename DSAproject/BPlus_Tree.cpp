@@ -0,0 +1,398 @@
+# include "BPlus_Tree.h"
+# include <string.h>
+# include <stdio.h>
+
+static const unsigned MAGIC = 0x54504C42;
+static const unsigned short LEAF = 1;
+static const unsigned short INNER = 2;
+
+struct Meta_Page
+{
+	unsigned magic;
+	unsigned page_size;
+	unsigned root;
+	unsigned first_leaf;
+	unsigned records;
+	unsigned height;
+	// Account_Schema::LAYOUT, or Legacy_Account_Schema::LAYOUT, or 0 in indexes
+	// written before it was kept
+	unsigned long long layout;
+};
+
+struct Page_Header
+{
+	unsigned short type;
+	unsigned short count;
+	unsigned next;
+	unsigned reserved[2];
+};
+
+// one spare slot per node so an insert can overflow in place before it splits
+static const unsigned LEAF_SLOTS = (Buffer_Pool::PAGE_SIZE - sizeof(Page_Header)) / sizeof(Account_Record);
+static const unsigned LEAF_CAPACITY = LEAF_SLOTS - 1;
+static const unsigned INNER_SLOTS = (Buffer_Pool::PAGE_SIZE - sizeof(Page_Header) - sizeof(unsigned)) / (sizeof(int) + sizeof(unsigned));
+static const unsigned INNER_CAPACITY = INNER_SLOTS - 1;
+
+static Page_Header* header(char *page)
+{
+	return (Page_Header*)page;
+}
+static Account_Record* records(char *page)
+{
+	return (Account_Record*)(page + sizeof(Page_Header));
+}
+static int* keys(char *page)
+{
+	return (int*)(page + sizeof(Page_Header));
+}
+static unsigned* children(char *page)
+{
+	return (unsigned*)(page + sizeof(Page_Header) + INNER_SLOTS * sizeof(int));
+}
+static unsigned leaf_position(char *page, int key)
+{
+	unsigned lo = 0, hi = header(page)->count;
+	Account_Record *r = records(page);
+	while (lo < hi)
+	{
+		unsigned mid = (lo + hi) / 2;
+		if (r[mid].account_number < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+static unsigned child_position(char *page, int key)
+{
+	unsigned lo = 0, hi = header(page)->count;
+	int *k = keys(page);
+	while (lo < hi)
+	{
+		unsigned mid = (lo + hi) / 2;
+		if (k[mid] <= key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+BPlus_Tree::BPlus_Tree()
+{
+	created = false;
+}
+BPlus_Tree::~BPlus_Tree()
+{
+	close();
+}
+bool BPlus_Tree::open(const string &path)
+{
+	created = false;
+	if (!pool.open(path))
+	{
+		return false;
+	}
+	if (pool.page_count == 0)
+	{
+		unsigned meta_id, root_id;
+		Meta_Page *meta = (Meta_Page*)pool.allocate(meta_id);
+		char *root = pool.allocate(root_id);
+		header(root)->type = LEAF;
+		meta->magic = MAGIC;
+		meta->page_size = Buffer_Pool::PAGE_SIZE;
+		meta->root = root_id;
+		meta->first_leaf = root_id;
+		meta->records = 0;
+		meta->height = 1;
+		meta->layout = Account_Schema::LAYOUT;
+		pool.unpin(root_id, true);
+		pool.unpin(meta_id, true);
+		pool.flush();
+		created = true;
+		return true;
+	}
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	bool known = meta->magic == MAGIC && meta->page_size == Buffer_Pool::PAGE_SIZE;
+	bool legacy = known && (meta->layout == 0 || meta->layout == Legacy_Account_Schema::LAYOUT);
+	bool valid = known && meta->layout == Account_Schema::LAYOUT;
+	pool.unpin(0, false);
+	if (legacy)
+	{
+		return upgrade(path);
+	}
+	if (!valid)
+	{
+		pool.close();
+	}
+	return valid;
+}
+// Copies the accounts of an index with plain passwords into a new index
+// without them, next to it, which then takes its place.
+bool BPlus_Tree::upgrade(const string &path)
+{
+	string temp = path + ".upgrade";
+	::remove(temp.c_str());
+	BPlus_Tree fresh;
+	bool ok = fresh.open(temp);
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	unsigned leaf = meta->first_leaf;
+	pool.unpin(0, false);
+	while (ok && leaf != 0)
+	{
+		char *page = pool.pin(leaf);
+		Page_Header *h = header(page);
+		const Legacy_Account_Record *old = (const Legacy_Account_Record*)(page + sizeof(Page_Header));
+		for (unsigned i = 0; ok && i < h->count; i++)
+		{
+			Account_Record rec;
+			memset(&rec, 0, sizeof(rec));
+			rec.account_number = old[i].account_number;
+			rec.balance = old[i].balance;
+			memcpy(rec.name, old[i].name, sizeof(rec.name));
+			memcpy(rec.adress, old[i].adress, sizeof(rec.adress));
+			ok = fresh.insert(rec);
+		}
+		unsigned next = h->next;
+		pool.unpin(leaf, false);
+		leaf = next;
+	}
+	fresh.flush();
+	fresh.close();
+	pool.close();
+	if (!ok)
+	{
+		::remove(temp.c_str());
+		return false;
+	}
+#ifdef _WIN32
+	::remove(path.c_str());
+#endif
+	return rename(temp.c_str(), path.c_str()) == 0 && open(path);
+}
+void BPlus_Tree::close()
+{
+	pool.close();
+}
+bool BPlus_Tree::is_open()
+{
+	return pool.is_open();
+}
+void BPlus_Tree::flush()
+{
+	pool.flush();
+}
+unsigned BPlus_Tree::find_leaf(int key)
+{
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	unsigned page_id = meta->root;
+	pool.unpin(0, false);
+	while (true)
+	{
+		char *page = pool.pin(page_id);
+		if (header(page)->type == LEAF)
+		{
+			pool.unpin(page_id, false);
+			return page_id;
+		}
+		unsigned child = children(page)[child_position(page, key)];
+		pool.unpin(page_id, false);
+		page_id = child;
+	}
+}
+bool BPlus_Tree::find(int accountno, Account_Record &out)
+{
+	unsigned leaf = find_leaf(accountno);
+	char *page = pool.pin(leaf);
+	unsigned pos = leaf_position(page, accountno);
+	bool found = pos < header(page)->count && records(page)[pos].account_number == accountno;
+	if (found)
+	{
+		out = records(page)[pos];
+	}
+	pool.unpin(leaf, false);
+	return found;
+}
+int BPlus_Tree::insert_into(unsigned page_id, const Account_Record &rec, int &split_key, unsigned &split_page)
+{
+	char *page = pool.pin(page_id);
+	Page_Header *h = header(page);
+	if (h->type == LEAF)
+	{
+		Account_Record *r = records(page);
+		unsigned pos = leaf_position(page, rec.account_number);
+		if (pos < h->count && r[pos].account_number == rec.account_number)
+		{
+			pool.unpin(page_id, false);
+			return -1;
+		}
+		memmove(r + pos + 1, r + pos, (h->count - pos) * sizeof(Account_Record));
+		r[pos] = rec;
+		h->count++;
+		if (h->count <= LEAF_CAPACITY)
+		{
+			pool.unpin(page_id, true);
+			return 0;
+		}
+		unsigned sibling_id;
+		char *sibling = pool.allocate(sibling_id);
+		unsigned keep = h->count / 2;
+		header(sibling)->type = LEAF;
+		header(sibling)->count = h->count - keep;
+		header(sibling)->next = h->next;
+		memcpy(records(sibling), r + keep, (h->count - keep) * sizeof(Account_Record));
+		h->count = keep;
+		h->next = sibling_id;
+		split_key = records(sibling)[0].account_number;
+		split_page = sibling_id;
+		pool.unpin(sibling_id, true);
+		pool.unpin(page_id, true);
+		return 1;
+	}
+
+	unsigned pos = child_position(page, rec.account_number);
+	int child_key;
+	unsigned child_page;
+	int result = insert_into(children(page)[pos], rec, child_key, child_page);
+	if (result != 1)
+	{
+		pool.unpin(page_id, false);
+		return result;
+	}
+	int *k = keys(page);
+	unsigned *c = children(page);
+	memmove(k + pos + 1, k + pos, (h->count - pos) * sizeof(int));
+	memmove(c + pos + 2, c + pos + 1, (h->count - pos) * sizeof(unsigned));
+	k[pos] = child_key;
+	c[pos + 1] = child_page;
+	h->count++;
+	if (h->count <= INNER_CAPACITY)
+	{
+		pool.unpin(page_id, true);
+		return 0;
+	}
+	// the middle key moves up; the sibling takes everything to its right
+	unsigned sibling_id;
+	char *sibling = pool.allocate(sibling_id);
+	unsigned mid = h->count / 2;
+	header(sibling)->type = INNER;
+	header(sibling)->count = h->count - mid - 1;
+	memcpy(keys(sibling), k + mid + 1, (h->count - mid - 1) * sizeof(int));
+	memcpy(children(sibling), c + mid + 1, (h->count - mid) * sizeof(unsigned));
+	split_key = k[mid];
+	split_page = sibling_id;
+	h->count = mid;
+	pool.unpin(sibling_id, true);
+	pool.unpin(page_id, true);
+	return 1;
+}
+bool BPlus_Tree::insert(const Account_Record &rec)
+{
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	int split_key;
+	unsigned split_page;
+	int result = insert_into(meta->root, rec, split_key, split_page);
+	if (result < 0)
+	{
+		pool.unpin(0, false);
+		return false;
+	}
+	if (result == 1)
+	{
+		unsigned root_id;
+		char *root = pool.allocate(root_id);
+		header(root)->type = INNER;
+		header(root)->count = 1;
+		keys(root)[0] = split_key;
+		children(root)[0] = meta->root;
+		children(root)[1] = split_page;
+		meta->root = root_id;
+		meta->height++;
+		pool.unpin(root_id, true);
+	}
+	meta->records++;
+	pool.unpin(0, true);
+	return true;
+}
+bool BPlus_Tree::update(const Account_Record &rec)
+{
+	unsigned leaf = find_leaf(rec.account_number);
+	char *page = pool.pin(leaf);
+	unsigned pos = leaf_position(page, rec.account_number);
+	bool found = pos < header(page)->count && records(page)[pos].account_number == rec.account_number;
+	if (found)
+	{
+		records(page)[pos] = rec;
+	}
+	pool.unpin(leaf, found);
+	return found;
+}
+bool BPlus_Tree::update_balance(int accountno, int balance)
+{
+	unsigned leaf = find_leaf(accountno);
+	char *page = pool.pin(leaf);
+	unsigned pos = leaf_position(page, accountno);
+	bool found = pos < header(page)->count && records(page)[pos].account_number == accountno;
+	if (found)
+	{
+		records(page)[pos].balance = balance;
+	}
+	pool.unpin(leaf, found);
+	return found;
+}
+bool BPlus_Tree::remove(int accountno)
+{
+	// leaves are not merged on underflow; an emptied leaf stays in the chain
+	// and is simply skipped by scans
+	unsigned leaf = find_leaf(accountno);
+	char *page = pool.pin(leaf);
+	Page_Header *h = header(page);
+	Account_Record *r = records(page);
+	unsigned pos = leaf_position(page, accountno);
+	bool found = pos < h->count && r[pos].account_number == accountno;
+	if (found)
+	{
+		memmove(r + pos, r + pos + 1, (h->count - pos - 1) * sizeof(Account_Record));
+		h->count--;
+		Meta_Page *meta = (Meta_Page*)pool.pin(0);
+		meta->records--;
+		pool.unpin(0, true);
+	}
+	pool.unpin(leaf, found);
+	return found;
+}
+void BPlus_Tree::scan(int low, int high, const function<bool(const Account_Record &)> &visit)
+{
+	unsigned leaf = find_leaf(low);
+	while (leaf != 0)
+	{
+		char *page = pool.pin(leaf);
+		Page_Header *h = header(page);
+		for (unsigned i = leaf_position(page, low); i < h->count; i++)
+		{
+			Account_Record rec = records(page)[i];
+			if (rec.account_number > high || !visit(rec))
+			{
+				pool.unpin(leaf, false);
+				return;
+			}
+		}
+		unsigned next = h->next;
+		pool.unpin(leaf, false);
+		leaf = next;
+	}
+}
+unsigned BPlus_Tree::count()
+{
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	unsigned n = meta->records;
+	pool.unpin(0, false);
+	return n;
+}
+unsigned BPlus_Tree::height()
+{
+	Meta_Page *meta = (Meta_Page*)pool.pin(0);
+	unsigned n = meta->height;
+	pool.unpin(0, false);
+	return n;
+}
@@ -0,0 +1,73 @@
+#pragma once
+# include "Buffer_Pool.h"
+# include "Record_Schema.h"
+# include <functional>
+
+// Fixed-width on-disk image of an account. Strings longer than the field are
+// truncated when they are written to the index. Passwords live only in the
+// credential table, as scrypt hashes.
+struct Account_Record
+{
+	int account_number;
+	int balance;
+	char name[64];
+	char adress[116];
+};
+
+// The index keeps the layout it was written with and is refused on open by a
+// build with another one, except for the version 1 layout below.
+typedef Record_Schema <Account_Record, 2,
+	SCHEMA_FIELD(Account_Record, name),
+	SCHEMA_FIELD(Account_Record, adress),
+	SCHEMA_FIELD(Account_Record, account_number),
+	SCHEMA_FIELD(Account_Record, balance)> Account_Schema;
+
+// An account from before the record dropped its plain password, in the order
+// of server.txt. An index with this layout (or with none, from before layouts
+// were kept) is rewritten without the passwords when it opens, and server.txt
+// is imported through it.
+struct Legacy_Account_Record
+{
+	int account_number;
+	int password;
+	int balance;
+	char name[64];
+	char adress[116];
+};
+
+typedef Record_Schema <Legacy_Account_Record, 1,
+	SCHEMA_FIELD(Legacy_Account_Record, name),
+	SCHEMA_FIELD(Legacy_Account_Record, adress),
+	SCHEMA_FIELD(Legacy_Account_Record, account_number),
+	SCHEMA_FIELD(Legacy_Account_Record, password),
+	SCHEMA_FIELD(Legacy_Account_Record, balance)> Legacy_Account_Schema;
+
+// Page-oriented B+tree keyed by account number. Leaves are chained left to
+// right for range scans and every operation only pins the pages on one
+// root-to-leaf path, so nothing has to be loaded before the first lookup.
+class BPlus_Tree
+{
+public:
+	BPlus_Tree();
+	~BPlus_Tree();
+	bool open(const string &);
+	void close();
+	bool is_open();
+	void flush();
+	bool find(int, Account_Record &);
+	bool insert(const Account_Record &);
+	bool update(const Account_Record &);
+	bool update_balance(int, int);
+	bool remove(int);
+	void scan(int, int, const function<bool(const Account_Record &)> &);
+	unsigned count();
+	unsigned height();
+
+	Buffer_Pool pool;
+	bool created;
+
+private:
+	bool upgrade(const string &);
+	unsigned find_leaf(int);
+	int insert_into(unsigned, const Account_Record &, int &, unsigned &);
+};
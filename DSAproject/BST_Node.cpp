@@ -1,5 +1,6 @@
 
 # include "BST_Node.h"
+# include "Placement.h"
 
 BST_Node:: BST_Node()
 {
@@ -8,10 +9,9 @@ BST_Node:: BST_Node()
 	name = "";
     adress = "";
     account_number = 0;
-    password = 0;
     balance = 0;
 }
-BST_Node:: BST_Node(string name, string adress, int accountno, int password, int balance)
+BST_Node:: BST_Node(string name, string adress, int accountno, int balance)
 {
 	left = nullptr;
 	right = nullptr;
@@ -19,5 +19,12 @@ BST_Node:: BST_Node(string name, string adress, int accountno, int password, int
 	this->account_number = accountno;
 	this->adress = adress;
 	this->balance = balance;
-	this->password = password;
+}
+void* BST_Node::operator new(size_t size)
+{
+	return Node_Arena::allocate(size);
+}
+void BST_Node::operator delete(void *p, size_t size)
+{
+	Node_Arena::release(p, size);
 }
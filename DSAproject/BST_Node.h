@@ -12,10 +12,12 @@ public:
 	string name;
 	string adress;
 	int account_number;
-	int password;
 	int balance;
 
 	BST_Node();
-	BST_Node(string, string, int, int, int);
+	BST_Node(string, string, int, int);
+	// from the node arena, so the tree can sit on huge pages
+	static void* operator new(size_t);
+	static void operator delete(void *, size_t);
 	
 };
\ No newline at end of file
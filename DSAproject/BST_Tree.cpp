@@ -1,46 +1,121 @@
 
 # include "BST_Tree.h"
 # include "Hashtable.h"
-BST_Tree:: BST_Tree() {
+# include "Metrics.h"
+# include "Tracer.h"
+# include "Workload.h"
+# include "Change_Feed.h"
+# include "History_Archive.h"
+# include "Journal.h"
+# include <string.h>
+# include <limits.h>
+# include <algorithm>
+# include <sstream>
+# include <thread>
+# include <unordered_map>
+
+static Account_Record to_record(BST_Node *node)
+{
+	Account_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.account_number = node->account_number;
+	rec.balance = node->balance;
+	memcpy(rec.name, node->name.c_str(), min(node->name.size(), sizeof(rec.name) - 1));
+	memcpy(rec.adress, node->adress.c_str(), min(node->adress.size(), sizeof(rec.adress) - 1));
+	return rec;
+}
+static BST_Node* from_record(const Account_Record &rec)
+{
+	return new BST_Node(rec.name, rec.adress, rec.account_number, rec.balance);
+}
+static void delete_nodes(BST_Node *root)
+{
+	if (root)
+	{
+		delete_nodes(root->left);
+		delete_nodes(root->right);
+		delete root;
+	}
+}
 
+BST_Tree:: BST_Tree() {
+	Root = nullptr;
+	batch_open = false;
+	names_built = false;
+}
+BST_Tree::~BST_Tree()
+{
+	end_batch();
+	history_chain.close();
+	index.close();
+	delete_nodes(Root);
+}
+void BST_Tree::set_directory(const string &dir)
+{
+	directory = dir;
+	if (!directory.empty() && directory[directory.size() - 1] != '/' && directory[directory.size() - 1] != '\\')
+	{
+		directory += '/';
+	}
+	h.directory = directory;
+}
+string BST_Tree::file(const char *name)
+{
+	return directory + name;
+}
+// The key that signs history.chain; without one the history is not chained.
+string BST_Tree::chain_key()
+{
+	return History_Chain::key_file;
 }
 void BST_Tree::add_Account(string name, string adress, int accountno, int password, int balance)
 {
+	load_Server();
 	h.add(accountno, password);
-	ofstream write;
-	write.open("server.txt", ios::app);
-	write << name << endl << adress << endl << accountno << endl << password << endl << balance << endl;
-	write.close();
-	BST_Node * temp = new BST_Node(name, adress, accountno, password, balance);
-
+	Workload::record_add(accountno, balance);
+	BST_Node * temp = new BST_Node(name, adress, accountno, balance);
+	index.insert(to_record(temp));
+	index.flush();
+	index_names(to_record(temp), true);
+	insert_node(temp);
+	filter.add(accountno);
+	if (filter.keys > filter.capacity)
+	{
+		rebuild_filter();
+	}
+}
+void BST_Tree::insert_node(BST_Node *temp)
+{
 	BST_Node * current = Root;
 	if (Root == nullptr)
 	{
 		Root = temp;
+		return;
 	}
-	else
+	while (true)
 	{
-		while (true)
+		if (temp->account_number < current->account_number)
 		{
-			if (accountno < current->account_number)
+			if (current->left == nullptr)
 			{
-				if (current->left == nullptr)
-				{
-					current->left = temp;
-					break;
-				}
-				current = current->left;
+				current->left = temp;
+				return;
 			}
-
-			if (accountno > current->account_number)
+			current = current->left;
+		}
+		else if (temp->account_number > current->account_number)
+		{
+			if (current->right == nullptr)
 			{
-				if (current->right == nullptr)
-				{
-					current->right = temp;
-					break;
-				}
-				current = current->right;
+				current->right = temp;
+				return;
 			}
+			current = current->right;
+		}
+		else
+		{
+			delete temp;
+			return;
 		}
 	}
 }
@@ -49,23 +124,39 @@ void BST_Tree::add_Account(string name, string adress, int accountno, int passwo
 BST_Node* BST_Tree:: delete_Account(BST_Node * root, int accountno)
 {
 	//cout << "accountno"<<root->account_number;
+	if (root == Root)
+	{
+		BST_Node *node = lookup(Root, accountno);
+		Workload::record_delete(accountno, node != nullptr ? node->balance : 0);
+		Account_Record rec;
+		if (names_built && index.find(accountno, rec))
+		{
+			index_names(rec, false);
+		}
+		index.remove(accountno);
+		index.flush();
+	}
 	if (root == nullptr)
 		cout << "it seems that Tree is empty OR You have entered wrong data" << endl;
 	else if (accountno < root->account_number)
 		root->left = delete_Account(root->left, accountno);
-	else if (accountno > Root->account_number)
+	else if (accountno > root->account_number)
 		root->right = delete_Account(root->right, accountno);
 	else
 	{
 		if (root->left && root->right)
 		{
+			v.clear();
 			findMax(root->left);
-			root->account_number = v.back();
+			BST_Node *max = search(root->left, v.back());
+			root->account_number = max->account_number;
+			root->name = max->name;
+			root->adress = max->adress;
+			root->balance = max->balance;
 			root->left = delete_Account(root->left, root->account_number);
 		}
 		else
 		{
-			cout << "aya" << endl;
 			BST_Node* temp = root;
 			if (root->left == nullptr)
 				root = root->right;
@@ -76,154 +167,341 @@ BST_Node* BST_Tree:: delete_Account(BST_Node * root, int accountno)
 	}
 	return(root);
 }
-void BST_Tree::withdraw(int accountno,int amount)
+// A posting with a nonzero idempotency key is made once within the dedupe
+// window; a repeat of the key posts nothing and gives the balance the first
+// one left. Returns whether it posted, and the account's balance after it.
+bool BST_Tree::withdraw(int accountno,int amount, unsigned long long key, int *balance)
 {
+	Metrics_Timer timer(Metrics::WITHDRAW);
+	Trace_Span span("withdraw");
 	load_Server();
+	if (repeated(key, balance))
+	{
+		return false;
+	}
 	BST_Node *temp = search(Root, accountno);
+	Workload::record_posting(Workload::WITHDRAW, accountno, temp->balance, amount);
 	temp->balance = temp->balance - amount;
-	vector <int> data;
-	ifstream read;
-	read.open("transaction.txt", ios::app);
-	int line = 0;
-	while (!read.eof())
-	{
-		read >> line;
-		if (line == accountno)
-		{
-			data.push_back(line);
-			line = (amount*-1);
-			data.push_back(line);
-			continue;
-		}
-		data.push_back(line);
+	posted(temp, amount*-1, key);
+	if (key != 0)
+	{
+		dedupe.insert(key, temp->balance, history_index.last_time);
 	}
-	read.close();
-
-	ofstream write;
-	write.open("temp.txt", ios::app);
-	for (int i = 0; i < data.size(); i++)
+	if (balance != nullptr)
 	{
-		write << data[i]<<endl;
+		*balance = temp->balance;
 	}
-	write.close();
-	remove("transaction.txt");
-	rename("temp.txt", "transaction.txt");
-	
-	update_server(Root);
+	return true;
 }
-void BST_Tree::deposit(int accountno,int amount)
+bool BST_Tree::deposit(int accountno,int amount, unsigned long long key, int *balance)
 {
+	Metrics_Timer timer(Metrics::DEPOSIT);
+	Trace_Span span("deposit");
 	load_Server();
+	if (repeated(key, balance))
+	{
+		return false;
+	}
 	BST_Node *temp = search(Root, accountno);
+	Workload::record_posting(Workload::DEPOSIT, accountno, temp->balance, amount);
 	temp->balance = temp->balance + amount;
-
-	vector <int> data;
-	ifstream read;
-	read.open("transaction.txt", ios::app);
-	int line = 0;
-	while (!read.eof())
-	{
-		read >> line;
-		if (line == accountno)
-		{
-			data.push_back(line);
-			line = amount;
-			data.push_back(line);
-			continue;
-		}
-		data.push_back(line);
+	posted(temp, amount, key);
+	if (key != 0)
+	{
+		dedupe.insert(key, temp->balance, history_index.last_time);
 	}
-	read.close();
-
-	ofstream write;
-	write.open("temp.txt", ios::app);
-	for (int i = 0; i < data.size(); i++)
+	if (balance != nullptr)
 	{
-		write << data[i] << endl;
+		*balance = temp->balance;
 	}
-	write.close();
-	remove("transaction.txt");
-	rename("temp.txt", "transaction.txt");
-
-
-	update_server(Root);
+	return true;
 }
 void BST_Tree::editaccount_byAdmin()
 {
 
 }
-void BST_Tree::transfer(int sender_accountno,int reciever_accountno,int sender_amount)
+// The balance given back for a transfer is the sender's.
+bool BST_Tree::transfer(int sender_accountno,int reciever_accountno,int sender_amount, unsigned long long key, int *balance)
 {
+	Metrics_Timer timer(Metrics::TRANSFER);
+	Trace_Span span("transfer");
+	load_Server();
+	if (repeated(key, balance))
+	{
+		return false;
+	}
 	// happening in tree
 	BST_Node *sender = search(Root, sender_accountno);
-	sender->balance = sender->balance -sender_amount;
 	BST_Node *reciever = search(Root, reciever_accountno);
+	Workload::record_transfer(sender_accountno, sender->balance, reciever_accountno, reciever->balance, sender_amount);
+	sender->balance = sender->balance -sender_amount;
 	reciever->balance = reciever->balance + sender_amount;
-	update_server(Root);
-
-	// Now happening in the transacton file
 
-	//  for sender
-	vector <int> data;
-	ifstream read;
-	read.open("transaction.txt", ios::app);
-	int line = 0;
-	while (!read.eof())
-	{
-		read >> line;
-		if (line == sender_accountno)
+	// Now happening in the index and the transacton file
+	// the key goes with the sender's entry
+	posted(sender, sender_amount*-1, key);
+	posted(reciever, sender_amount);
+	if (key != 0)
+	{
+		dedupe.insert(key, sender->balance, history_index.last_time);
+	}
+	if (balance != nullptr)
+	{
+		*balance = sender->balance;
+	}
+	return true;
+}
+// Whether a posting with this key was already made within the window. Keys
+// are checked and added at the time of the latest posting, so the check reads
+// no clock; a key is kept at least its window.
+bool BST_Tree::repeated(unsigned long long key, int *balance)
+{
+	int original;
+	if (key == 0 || !dedupe.find(key, original, history_index.last_time))
+	{
+		return false;
+	}
+	Metrics::count(Metrics::DEDUPED_POSTINGS);
+	if (balance != nullptr)
+	{
+		*balance = original;
+	}
+	return true;
+}
+// Persists one posting, or holds it for end_batch() while a batch is open.
+// The node already carries the new balance, so checks made by later postings
+// in the batch see it.
+void BST_Tree::posted(BST_Node *node, int amount, unsigned long long key)
+{
+	History_Entry entry = stamp(node->account_number, amount, node->balance);
+	if (batch_open)
+	{
+		batch.push_back(entry);
+		batch_keys.push_back(key);
+		return;
+	}
+	record_transaction(entry, key);
+	update_account(node);
+	Change_Feed::publish(node->account_number, amount, node->balance);
+}
+// Postings made until end_batch() change balances in memory at once and are
+// written out together: each account's balance once, with its net change, and
+// every posting as its own entry in the transaction file.
+void BST_Tree::begin_batch()
+{
+	load_Server();
+	batch_open = true;
+}
+void BST_Tree::end_batch()
+{
+	batch_open = false;
+	if (batch.empty())
+	{
+		return;
+	}
+	Trace_Span span("end_batch");
+	vector <int> accounts;
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		accounts.push_back(batch[i].account);
+	}
+	sort(accounts.begin(), accounts.end());
+	accounts.erase(unique(accounts.begin(), accounts.end()), accounts.end());
+	for (size_t i = 0; i < accounts.size(); i++)
+	{
+		// an account deleted during the batch has nothing left to write
+		BST_Node *node = search(Root, accounts[i]);
+		if (node != nullptr)
 		{
-			data.push_back(line);
-			line = (sender_amount*-1);
-			data.push_back(line);
-			continue;
+			index.update_balance(node->account_number, node->balance);
+			Metrics::count(Metrics::ACCOUNT_WRITES);
 		}
-		data.push_back(line);
 	}
-	read.close();
+	index.flush();
 
 	ofstream write;
-	write.open("temp.txt", ios::app);
-	for (int i = 0; i < data.size(); i++)
+	write.open(file("transaction.txt").c_str(), ios::app);
+	write.seekp(0, ios::end);
+	unsigned long long base = (unsigned long long)write.tellp();
+	ostringstream lines;
+	vector <unsigned long long> offsets;
+	for (size_t i = 0; i < batch.size(); i++)
 	{
-		write << data[i] << endl;
+		offsets.push_back(base + (unsigned long long)lines.tellp());
+		History_Archive::write_live(lines, batch[i], batch_keys[i]);
 	}
+	string text = lines.str();
+	write.write(text.data(), text.size());
 	write.close();
-	remove("transaction.txt");
-	rename("temp.txt", "transaction.txt");
-
-
-	//  for reciever 
-
-
-	vector <int> data;
-	ifstream read;
-	read.open("transaction.txt", ios::app);
-	int line = 0;
-	while (!read.eof())
-	{
-		read >> line;
-		if (line == reciever_accountno)
-		{
-			data.push_back(line);
-			line = sender_amount;
-			data.push_back(line);
-			continue;
-		}
-		data.push_back(line);
+	Metrics::count(Metrics::BYTES_WRITTEN, text.size());
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		history_index.add(batch[i], offsets[i]);
+		history_chain.add(batch[i], offsets[i]);
 	}
-	read.close();
 
-	ofstream write;
-	write.open("temp.txt", ios::app);
-	for (int i = 0; i < data.size(); i++)
+	for (size_t i = 0; i < batch.size(); i++)
 	{
-		write << data[i] << endl;
+		Change_Feed::publish(batch[i].account, batch[i].amount, batch[i].balance);
 	}
+	Metrics::count(Metrics::BATCHED_POSTINGS, batch.size());
+	batch.clear();
+	batch_keys.clear();
+}
+bool BST_Tree::batching()
+{
+	return batch_open;
+}
+// Numbers a posting and stamps it with a time that never goes back.
+History_Entry BST_Tree::stamp(int accountno, int amount, int balance)
+{
+	History_Entry entry;
+	entry.account = accountno;
+	entry.amount = amount;
+	entry.balance = balance;
+	entry.seq = history_index.next_seq++;
+	entry.time = max(Journal::now_us(), history_index.last_time);
+	history_index.last_time = entry.time;
+	return entry;
+}
+// Appends one entry to the transaction file and indexes it.
+void BST_Tree::record_transaction(const History_Entry &entry, unsigned long long key)
+{
+	Trace_Span span("record_transaction");
+	ofstream write;
+	write.open(file("transaction.txt").c_str(), ios::app);
+	write.seekp(0, ios::end);
+	unsigned long long offset = (unsigned long long)write.tellp();
+	History_Archive::write_live(write, entry, key);
+	write.flush();
+	Metrics::count(Metrics::BYTES_WRITTEN, (unsigned long long)write.tellp() - offset);
 	write.close();
-	remove("transaction.txt");
-	rename("temp.txt", "transaction.txt");
+	history_index.add(entry, offset);
+	history_chain.add(entry, offset);
+}
+// Visits the postings of an account between two times, inclusive: first the
+// sealed ones in the archive, then those still in transaction.txt.
+void BST_Tree::history(int accountno, long long from, long long to, const function<void(const History_Entry &)> &visit)
+{
+	load_Server();
+	History_Archive::history(file("history.arc"), accountno, from, to, visit);
+	history_index.find(accountno, from, to, visit);
+}
+// The balance of an account at a time. The checkpoints in the history index
+// answer for postings still in transaction.txt and the balances recorded in
+// the archive for sealed ones. An account with no known balance by then had
+// its current balance less whatever it posted since.
+bool BST_Tree::balance_at(int accountno, long long time, int &balance)
+{
+	Trace_Span span("balance_at");
+	load_Server();
+	bool indexed = history_index.balance_at(accountno, time, balance);
+	if (indexed && balance != History_Archive::NO_BALANCE)
+	{
+		return true;
+	}
+	if (!indexed && History_Archive::balance_at(file("history.arc"), accountno, time, balance))
+	{
+		return true;
+	}
+	Account_Record rec;
+	if (!index.find(accountno, rec))
+	{
+		return false;
+	}
+	long long since = 0;
+	history(accountno, time == LLONG_MAX ? time : time + 1, LLONG_MAX, [&](const History_Entry &entry) {
+		since += entry.amount;
+	});
+	balance = (int)(rec.balance - since);
+	return true;
+}
+// Visits every account in order with its balance at a time, worked out in one
+// pass over what was posted after it: the archive split by account range and
+// transaction.txt split by byte range, one of each per thread.
+void BST_Tree::balances_at(long long time, unsigned threads, const function<void(int, int)> &visit)
+{
+	Trace_Span span("balances_at");
+	load_Server();
+	vector <int> accounts;
+	vector <int> current;
+	index.scan(INT_MIN, INT_MAX, [&](const Account_Record &rec) {
+		accounts.push_back(rec.account_number);
+		current.push_back(rec.balance);
+		return true;
+	});
+	if (accounts.empty())
+	{
+		return;
+	}
+	threads = max(1u, min(threads, (unsigned)accounts.size()));
+	long long after = time == LLONG_MAX ? time : time + 1;
+	string archive = file("history.arc");
+	string live = file("transaction.txt");
+	unsigned long long size = 0;
+	ifstream probe(live.c_str(), ios::binary | ios::ate);
+	if (probe)
+	{
+		size = (unsigned long long)probe.tellg();
+	}
+	probe.close();
 
+	vector <long long> sealed(accounts.size(), 0);
+	vector <unordered_map <int, long long> > recent(threads);
+	vector <thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.push_back(thread([&, t]() {
+			// sealed postings of this thread's accounts; each writes only its own slice
+			size_t lo = accounts.size() * t / threads;
+			size_t hi = accounts.size() * (t + 1) / threads;
+			History_Archive::scan(archive, accounts[lo], accounts[hi - 1], after, LLONG_MAX, [&](const History_Entry &entry) {
+				vector <int>::iterator it = lower_bound(accounts.begin() + lo, accounts.begin() + hi, entry.account);
+				if (it != accounts.begin() + hi && *it == entry.account)
+				{
+					sealed[it - accounts.begin()] += entry.amount;
+				}
+			});
+			// the lines that start in this thread's share of transaction.txt;
+			// lines from before postings were stamped have no time and are skipped
+			unsigned long long start = size * t / threads;
+			unsigned long long end = size * (t + 1) / threads;
+			ifstream read(live.c_str(), ios::binary);
+			string line;
+			if (start > 0)
+			{
+				read.seekg((streamoff)(start - 1));
+				getline(read, line);
+			}
+			History_Entry entry;
+			while (read && (unsigned long long)read.tellg() < end && getline(read, line))
+			{
+				istringstream one(line);
+				if (History_Archive::read_live(one, entry) && entry.time >= after)
+				{
+					recent[t][entry.account] += entry.amount;
+				}
+			}
+			Metrics::count(Metrics::BYTES_READ, end - start);
+		}));
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	for (size_t i = 0; i < accounts.size(); i++)
+	{
+		long long since = sealed[i];
+		for (unsigned t = 0; t < threads; t++)
+		{
+			unordered_map <int, long long>::iterator it = recent[t].find(accounts[i]);
+			if (it != recent[t].end())
+			{
+				since += it->second;
+			}
+		}
+		visit(accounts[i], (int)(current[i] - since));
+	}
 }
 void BST_Tree::transaction_history()
 {
@@ -240,111 +518,216 @@ void BST_Tree:: findMax(BST_Node* root)
 }
 void BST_Tree::load_Server()
 {
-	ifstream read;
-	read.open("server.txt", ios::app);
-
-	string name = "";
-	string adress = "";
-	int accountno = 0;
-	int password = 0;
-	int balance = 0;
-	//cin.ignore();
-	while (!read.eof())
-	{
-		
-		
-		
-		getline(read, name);
-		getline(read, adress);
-		read >> accountno;
-		read >> password;
-		read >> balance;
-		read.ignore();
-		read.ignore();
-/*
-		cout << name << endl;
-		cout << adress << endl;
-		cout << accountno << endl;
-		cout << password << endl;
-		cout << balance << endl;
-		
-		*/
-		if (name!="" && adress != "" && accountno != 0 && password != 0 )
+	Metrics_Timer timer(Metrics::LOAD_SERVER);
+	Trace_Span span("load_Server");
+	// accounts are paged in from the index on demand; opening it only reads the
+	// meta page, and server.txt is imported once when the index is first created
+	if (index.is_open())
+	{
+		return;
+	}
+	if (index.open(file("accounts.idx")) && index.created)
+	{
+		import_server();
+	}
+	// finish a history seal that was interrupted before transaction.txt was cut
+	History_Archive::recover(file("transaction.txt"), file("history.arc"));
+	history_index.open(file("history.tix"), file("transaction.txt"), History_Archive::next_seq(file("history.arc")));
+	history_chain.open(file("history.chain"), chain_key(), file("transaction.txt"));
+	rebuild_filter();
+	load_keys();
+}
+// Refills the dedupe table from the keys written with the postings of its
+// window, so a retry is still recognised after the ledger was reopened.
+void BST_Tree::load_keys()
+{
+	long long since = Journal::now_us() - dedupe.window();
+	ifstream read(file("transaction.txt").c_str(), ios::binary);
+	unsigned long long offset = history_index.offset_since(since);
+	read.seekg((streamoff)offset);
+	History_Entry entry;
+	unsigned long long key;
+	while (History_Archive::read_live(read, entry, &key))
+	{
+		if (key != 0 && entry.time >= since)
 		{
-			//cout << "enter hua" << endl;
-			BST_Node * temp = new BST_Node(name, adress, accountno, password, balance);
-			BST_Node * current = Root;
-			if (Root == nullptr)
-			{
-
-				Root = temp;
-			}
-			else
-			{
-				while (true)
-				{
-
-					if (accountno < current->account_number)
-					{
-						if (current->left == nullptr)
-						{
-							current->left = temp;
-							break;
-						}
-						current = current->left;
-					}
-
-					if (accountno > current->account_number)
-					{
-						if (current->right == nullptr)
-						{
-							current->right = temp;
-							break;
-						}
-						current = current->right;
-					}
-					if (accountno == current->account_number)
-					{
-						break;
-					}
-				}
-			}
+			dedupe.insert(key, entry.balance, entry.time);
 		}
 	}
-	read.close();
+	read.clear();
+	read.seekg(0, ios::end);
+	Metrics::count(Metrics::BYTES_READ, (unsigned long long)read.tellg() - offset);
 }
-void BST_Tree:: update_server(BST_Node *root)
+void BST_Tree::rebuild_filter()
 {
-	static int i = 0;
-	if (i == 0)
+	if (!index.is_open())
 	{
-		i++;
-		remove("server.txt");
+		filter.clear();
+		return;
 	}
-	ofstream write;
-	write.open("server.txt");
+	filter.reset(2 * index.count());
+	index.scan(INT_MIN, INT_MAX, [this](const Account_Record &rec) {
+		filter.add(rec.account_number);
+		return true;
+	});
+}
+void BST_Tree::build_names()
+{
+	names.clear();
+	addresses.clear();
+	index.scan(INT_MIN, INT_MAX, [this](const Account_Record &rec) {
+		names.add(rec.name, rec.account_number);
+		addresses.add(rec.adress, rec.account_number);
+		return true;
+	});
+	names_built = true;
+}
+// Keeps the customer indexes in step once they are built.
+void BST_Tree::index_names(const Account_Record &rec, bool add)
+{
+	if (!names_built)
+	{
+		return;
+	}
+	if (add)
+	{
+		names.add(rec.name, rec.account_number);
+		addresses.add(rec.adress, rec.account_number);
+	}
+	else
+	{
+		names.remove(rec.name, rec.account_number);
+		addresses.remove(rec.adress, rec.account_number);
+	}
+}
+void BST_Tree::import_server()
+{
+	unsigned long long bytes = 0;
+	string imported;
+	// its passwords are in hashtable.txt already and stay out of the index
+	bool read = Legacy_Account_Schema::read_text_file(file("server.txt"), [this, &imported](const Legacy_Account_Record &old) {
+		if (old.name[0] != '\0' && old.adress[0] != '\0' && old.account_number != 0 && old.password != 0)
+		{
+			Account_Record rec;
+			memset(&rec, 0, sizeof(rec));
+			rec.account_number = old.account_number;
+			rec.balance = old.balance;
+			memcpy(rec.name, old.name, sizeof(rec.name));
+			memcpy(rec.adress, old.adress, sizeof(rec.adress));
+			index.insert(rec);
+			Account_Schema::append_text(rec, imported);
+		}
+	}, &bytes);
+	Metrics::count(Metrics::BYTES_READ, bytes);
+	index.flush();
+	if (read && bytes > 0)
+	{
+		// the plain passwords go: server.txt is replaced by what was imported
+		ofstream write(file("server.txt.imported").c_str(), ios::binary | ios::trunc);
+		write.write(imported.data(), imported.size());
+		write.close();
+		if (write)
+		{
+			remove(file("server.txt").c_str());
+		}
+	}
+}
+void BST_Tree:: update_server(BST_Node *root)
+{
+	Metrics_Timer timer(Metrics::UPDATE_SERVER);
+	Trace_Span span("update_server");
+	write_back(root);
+	index.flush();
+}
+void BST_Tree::write_back(BST_Node *root)
+{
 	if (root)
 	{
-		update_server(root->left);
-		write << root->name<<endl;
-		write << root->adress<<endl;
-		write << root->account_number<<endl;
-		write << root->password<<endl;
-		write << root->balance<<endl;
-		update_server(root->right);
+		write_back(root->left);
+		Account_Record rec = to_record(root);
+		Account_Record old;
+		if (names_built && index.find(rec.account_number, old)
+			&& (strcmp(old.name, rec.name) != 0 || strcmp(old.adress, rec.adress) != 0))
+		{
+			// an edited name or address moves in the customer indexes
+			index_names(old, false);
+			index_names(rec, true);
+		}
+		index.update(rec);
+		write_back(root->right);
 	}
-	write.close();
-	
-	
+}
+void BST_Tree::update_account(BST_Node *node)
+{
+	Trace_Span span("update_account");
+	index.update_balance(node->account_number, node->balance);
+	Metrics::count(Metrics::ACCOUNT_WRITES);
+	index.flush();
 }
 BST_Node* BST_Tree:: search (BST_Node* root, int accountno)
+{
+	if (root != Root)
+	{
+		return (lookup(root, accountno));
+	}
+	Metrics_Timer timer(Metrics::SEARCH);
+	Trace_Span span("search");
+	// unknown account numbers are rejected by the filter without touching
+	// the tree or the index
+	load_Server();
+	if (!filter.may_contain(accountno))
+	{
+		return (nullptr);
+	}
+	BST_Node *node = lookup(root, accountno);
+	if (node == nullptr)
+	{
+		// not cached yet: fault the account in from the index
+		Account_Record rec;
+		if (index.find(accountno, rec))
+		{
+			node = from_record(rec);
+			insert_node(node);
+		}
+		else
+		{
+			filter.record_false_positive();
+		}
+	}
+	return (node);
+}
+// One page of the customers whose name (or address) has a word starting with
+// the prefix, from the cursor on. True when there are more pages.
+bool BST_Tree::find_customers(bool by_address, const string &prefix, size_t limit, Prefix_Index::Cursor &cursor, vector <Account_Record> &out)
+{
+	Metrics_Timer timer(Metrics::PREFIX_SEARCH);
+	Trace_Span span("find_customers");
+	load_Server();
+	if (!names_built)
+	{
+		build_names();
+	}
+	vector <int> accounts;
+	bool more = (by_address ? addresses : names).find(prefix, limit, accounts, cursor);
+	out.clear();
+	for (size_t i = 0; i < accounts.size(); i++)
+	{
+		Account_Record rec;
+		if (index.find(accounts[i], rec))
+		{
+			out.push_back(rec);
+		}
+	}
+	return more;
+}
+BST_Node* BST_Tree:: lookup (BST_Node* root, int accountno)
 {
 	if (root == nullptr)
 		return (nullptr);
 	else if (accountno < root->account_number)
-		return (search(root->left, accountno));
+		return (lookup(root->left, accountno));
 	else if (accountno > root->account_number)
-		return (search(root->right, accountno));
+		return (lookup(root->right, accountno));
 	return (root);
 
 }
@@ -354,11 +737,18 @@ void BST_Tree:: printoinfo(BST_Node* root)
 	if (root)
 	{
 		printoinfo(root->left);
-		cout << root->name << endl;
-		cout << root->adress<<endl;
-		cout << root->account_number<<endl;
-		cout << root->password<<endl;
-		cout << root->balance<<endl;
+		char text[Account_Schema::TEXT_SIZE];
+		cout.write(text, Account_Schema::write_text(to_record(root), text) - text);
 		printoinfo(root->right);
 	}
 }
+void BST_Tree::print_accounts()
+{
+	load_Server();
+	string text;
+	index.scan(INT_MIN, INT_MAX, [&text](const Account_Record &rec) {
+		Account_Schema::append_text(rec, text);
+		return true;
+	});
+	cout << text << flush;
+}
@@ -1,25 +1,74 @@
 #pragma once
 # include "BST_Node.h"
 # include "Hashtable.h"
+# include "BPlus_Tree.h"
+# include "Bloom_Filter.h"
+# include "History_Index.h"
+# include "History_Chain.h"
+# include "Dedupe_Table.h"
+# include "Prefix_Index.h"
 # include <stdio.h>
 class BST_Tree
 {
 	vector <int> v;
-	
+
 public:
 	BST_Tree();
+	~BST_Tree();
 	Hashtable h;
+	BPlus_Tree index;
+	Bloom_Filter filter;
+	History_Index history_index;
+	History_Chain history_chain;
+	// idempotency keys of the postings made through this tree
+	Dedupe_Table dedupe;
+	// customers by name and by address, built on the first search
+	Prefix_Index names;
+	Prefix_Index addresses;
 	BST_Node *Root;
+	string directory;
+	void set_directory(const string &);
+	string file(const char *);
+	string chain_key();
 	void add_Account(string, string, int, int, int);
-	BST_Node* BST_Tree::delete_Account(BST_Node *, int);
-	void withdraw(int,int);
-	void deposit(int,int);
+	BST_Node* delete_Account(BST_Node *, int);
+	bool withdraw(int,int, unsigned long long key = 0, int *balance = nullptr);
+	bool deposit(int,int, unsigned long long key = 0, int *balance = nullptr);
 	void editaccount_byAdmin();
-	void transfer(int,int,int);
+	bool transfer(int,int,int, unsigned long long key = 0, int *balance = nullptr);
+	bool repeated(unsigned long long, int *);
 	void transaction_history();
 	void findMax(BST_Node*);
 	void load_Server();
 	void update_server(BST_Node *);
+	void update_account(BST_Node *);
+	void begin_batch();
+	void end_batch();
+	bool batching();
+	void history(int, long long, long long, const function<void(const History_Entry &)> &);
+	bool balance_at(int, long long, int &);
+	void balances_at(long long, unsigned, const function<void(int, int)> &);
 	BST_Node* search(BST_Node*,int);
+	bool find_customers(bool, const string &, size_t, Prefix_Index::Cursor &, vector <Account_Record> &);
 	void printoinfo(BST_Node*);
-};
\ No newline at end of file
+	void print_accounts();
+
+private:
+	void import_server();
+	void posted(BST_Node *, int, unsigned long long key = 0);
+	History_Entry stamp(int, int, int);
+	void record_transaction(const History_Entry &, unsigned long long key = 0);
+	void load_keys();
+	void write_back(BST_Node *);
+	void rebuild_filter();
+	void build_names();
+	void index_names(const Account_Record &, bool);
+	void insert_node(BST_Node *);
+	BST_Node* lookup(BST_Node*,int);
+
+	bool batch_open;
+	bool names_built;
+	// postings held back until end_batch()
+	vector <History_Entry> batch;
+	vector <unsigned long long> batch_keys;
+};
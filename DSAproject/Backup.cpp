@@ -0,0 +1,385 @@
+# include "Backup.h"
+# include "History_Archive.h"
+# include "Journal.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <fstream>
+# include <sstream>
+# include <vector>
+# include <unordered_set>
+# include <stddef.h>
+# include <string.h>
+# include <stdio.h>
+# include <limits.h>
+
+static const char BACKUP_MAGIC[4] = { 'B', 'K', 'B', 'K' };
+static const char TRAILER_MAGIC[4] = { 'B', 'K', 'E', 'N' };
+static const unsigned VERSION = 2;
+// version 1 backups have no chain records, and 0 in their place
+static const unsigned FIRST_VERSION = 1;
+static const size_t CHUNK = 1 << 20;
+
+// The sections follow in this order: the index pages, hashtable.txt, the
+// prefix of transaction.txt, the prefix of history.arc and the records of
+// history.chain.
+struct Backup_Header
+{
+	char magic[4];
+	unsigned version;
+	// last posting in the backup
+	unsigned long long seq;
+	long long time;
+	unsigned page_size;
+	unsigned pages;
+	unsigned long long credential_bytes;
+	unsigned long long history_bytes;
+	unsigned long long archive_bytes;
+	unsigned checksum;
+	unsigned chain_records;
+};
+
+// hash covers every byte between the header and the trailer
+struct Backup_Trailer
+{
+	char magic[4];
+	unsigned pad;
+	unsigned long long hash;
+};
+
+static const unsigned long long FNV64_BASIS = 14695981039346656037ull;
+
+static unsigned long long fnv64(const char *data, size_t n, unsigned long long hash)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+// covers the chain record count too, which follows the checksum for the
+// layout of version 1
+static unsigned header_checksum(const Backup_Header &header)
+{
+	unsigned long long hash = fnv64((const char*)&header, offsetof(Backup_Header, checksum), FNV64_BASIS);
+	if (header.version > FIRST_VERSION)
+	{
+		hash = fnv64((const char*)&header.chain_records, sizeof(header.chain_records), hash);
+	}
+	return (unsigned)hash;
+}
+static unsigned long long file_size(const string &path)
+{
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	return probe ? (unsigned long long)probe.tellg() : 0;
+}
+
+namespace
+{
+	// Hashes what is written and hands it to the file in large chunks.
+	struct Sink
+	{
+		ofstream write;
+		string chunk;
+		unsigned long long hash;
+		unsigned long long bytes;
+
+		void put(const char *data, size_t n)
+		{
+			hash = fnv64(data, n, hash);
+			chunk.append(data, n);
+			bytes += n;
+			if (chunk.size() >= CHUNK)
+			{
+				drain();
+			}
+		}
+		void drain()
+		{
+			write.write(chunk.data(), chunk.size());
+			Metrics::count(Metrics::BYTES_WRITTEN, chunk.size());
+			chunk.clear();
+		}
+	};
+}
+
+// Copies the first n bytes of a file.
+static bool copy_prefix(const string &path, unsigned long long n, Sink &sink)
+{
+	ifstream read(path.c_str(), ios::binary);
+	vector <char> buffer(CHUNK);
+	while (n > 0)
+	{
+		size_t take = n < buffer.size() ? (size_t)n : buffer.size();
+		if (!read.read(buffer.data(), take))
+		{
+			return false;
+		}
+		Metrics::count(Metrics::BYTES_READ, take);
+		sink.put(buffer.data(), take);
+		n -= take;
+	}
+	return true;
+}
+
+Backup::Backup()
+{
+	tree = nullptr;
+	streaming = false;
+	ok = false;
+	history_bytes = 0;
+	archive_bytes = 0;
+	chain_bytes = 0;
+	saved_before = 0;
+	memset(&report, 0, sizeof(report));
+}
+Backup::~Backup()
+{
+	Report ignored;
+	finish(ignored);
+}
+// Takes the snapshot and starts streaming it. Call it between postings, with
+// no batch open, from the thread that posts.
+bool Backup::start(BST_Tree &t, const string &file)
+{
+	Trace_Span span("backup_start");
+	if (worker.joinable() || t.batching())
+	{
+		return false;
+	}
+	tree = &t;
+	path = file;
+	t.load_Server();
+	begin = chrono::steady_clock::now();
+	memset(&report, 0, sizeof(report));
+	report.seq = t.history_index.next_seq - 1;
+	saved_before = Metrics::total(Metrics::SNAPSHOT_PAGES_SAVED);
+	report.pages = t.index.pool.begin_snapshot();
+	history_bytes = file_size(t.file("transaction.txt"));
+	archive_bytes = file_size(t.file("history.arc"));
+	// whole records only; the segment still open is chained again on restore
+	chain_bytes = file_size(t.file("history.chain")) / sizeof(History_Chain::Record) * sizeof(History_Chain::Record);
+	report.segments = chain_bytes / sizeof(History_Chain::Record);
+	ifstream read(t.file("hashtable.txt").c_str(), ios::binary);
+	ostringstream text;
+	text << read.rdbuf();
+	credentials = text.str();
+	if (report.pages == 0)
+	{
+		return false;
+	}
+	streaming = true;
+	worker = thread(&Backup::stream, this);
+	return true;
+}
+bool Backup::running()
+{
+	return streaming;
+}
+// Waits for the stream to end; true when the backup file is complete.
+bool Backup::finish(Report &out)
+{
+	if (!worker.joinable())
+	{
+		return false;
+	}
+	worker.join();
+	out = report;
+	return ok;
+}
+void Backup::stream()
+{
+	Trace_Span span("backup_stream");
+	Backup_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BACKUP_MAGIC, sizeof(BACKUP_MAGIC));
+	header.version = VERSION;
+	header.seq = report.seq;
+	header.time = Journal::now_us();
+	header.page_size = Buffer_Pool::PAGE_SIZE;
+	header.pages = report.pages;
+	header.credential_bytes = credentials.size();
+	header.history_bytes = history_bytes;
+	header.archive_bytes = archive_bytes;
+	header.chain_records = (unsigned)report.segments;
+	header.checksum = header_checksum(header);
+
+	string temp = path + ".tmp";
+	Sink sink;
+	sink.write.open(temp.c_str(), ios::binary | ios::trunc);
+	sink.write.write((const char*)&header, sizeof(header));
+	sink.hash = FNV64_BASIS;
+	sink.bytes = 0;
+	ok = sink.write.is_open();
+	vector <char> page(Buffer_Pool::PAGE_SIZE);
+	for (unsigned i = 0; ok && i < report.pages; i++)
+	{
+		ok = tree->index.pool.snapshot_page(i, page.data());
+		sink.put(page.data(), page.size());
+	}
+	tree->index.pool.end_snapshot();
+	sink.put(credentials.data(), credentials.size());
+	ok = ok && copy_prefix(tree->file("transaction.txt"), history_bytes, sink)
+		&& copy_prefix(tree->file("history.arc"), archive_bytes, sink)
+		&& copy_prefix(tree->file("history.chain"), chain_bytes, sink);
+
+	Backup_Trailer trailer;
+	memset(&trailer, 0, sizeof(trailer));
+	memcpy(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+	trailer.hash = sink.hash;
+	sink.drain();
+	sink.write.write((const char*)&trailer, sizeof(trailer));
+	sink.write.close();
+	ok = ok && sink.write && Journal::sync_path(temp);
+#ifdef _WIN32
+	remove(path.c_str());
+#endif
+	ok = ok && rename(temp.c_str(), path.c_str()) == 0;
+	if (!ok)
+	{
+		remove(temp.c_str());
+	}
+	report.bytes = sizeof(header) + sink.bytes + sizeof(trailer);
+	report.pages_saved = Metrics::total(Metrics::SNAPSHOT_PAGES_SAVED) - saved_before;
+	report.seconds = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - begin).count();
+	streaming = false;
+}
+
+// Copies the next n bytes of a backup into a file of its own.
+static bool unpack(ifstream &read, const string &path, unsigned long long n, unsigned long long &hash)
+{
+	ofstream write(path.c_str(), ios::binary | ios::trunc);
+	vector <char> buffer(CHUNK);
+	while (n > 0)
+	{
+		size_t take = n < buffer.size() ? (size_t)n : buffer.size();
+		if (!read.read(buffer.data(), take))
+		{
+			return false;
+		}
+		hash = fnv64(buffer.data(), take, hash);
+		write.write(buffer.data(), take);
+		n -= take;
+		Metrics::count(Metrics::BYTES_READ, take);
+		Metrics::count(Metrics::BYTES_WRITTEN, take);
+	}
+	write.close();
+	return write && Journal::sync_path(path);
+}
+
+static void remove_ledger(const string &prefix)
+{
+	remove((prefix + "accounts.idx").c_str());
+	remove((prefix + "hashtable.txt").c_str());
+	remove((prefix + "transaction.txt").c_str());
+	remove((prefix + "history.arc").c_str());
+	remove((prefix + "history.chain").c_str());
+}
+
+// Unpacks a backup into an existing directory that holds no ledger. A backup
+// with a history chain needs the chain's key, kept outside that directory,
+// and is only kept when the restored chain verifies against it.
+bool Backup::restore(const string &file, const string &directory, const string &key, Report &out)
+{
+	Trace_Span span("backup_restore");
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	memset(&out, 0, sizeof(out));
+	string prefix = directory;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+	{
+		prefix += '/';
+	}
+	ifstream existing((prefix + "accounts.idx").c_str());
+	if (existing)
+	{
+		return false;
+	}
+	ifstream read(file.c_str(), ios::binary);
+	Backup_Header header;
+	if (!read.read((char*)&header, sizeof(header)) || memcmp(header.magic, BACKUP_MAGIC, sizeof(BACKUP_MAGIC)) != 0
+		|| header.version < FIRST_VERSION || header.version > VERSION || header.checksum != header_checksum(header)
+		|| header.page_size != Buffer_Pool::PAGE_SIZE)
+	{
+		return false;
+	}
+	out.segments = header.chain_records;
+	if (header.chain_records > 0 && !History_Chain::key_outside(key, prefix + "history.chain"))
+	{
+		return false;
+	}
+	unsigned long long hash = FNV64_BASIS;
+	Backup_Trailer trailer;
+	if (!unpack(read, prefix + "accounts.idx", (unsigned long long)header.pages * header.page_size, hash)
+		|| !unpack(read, prefix + "hashtable.txt", header.credential_bytes, hash)
+		|| !unpack(read, prefix + "transaction.txt", header.history_bytes, hash)
+		|| (header.archive_bytes > 0 && !unpack(read, prefix + "history.arc", header.archive_bytes, hash))
+		|| (header.chain_records > 0 && !unpack(read, prefix + "history.chain", (unsigned long long)header.chain_records * sizeof(History_Chain::Record), hash))
+		|| !read.read((char*)&trailer, sizeof(trailer)) || memcmp(trailer.magic, TRAILER_MAGIC, sizeof(TRAILER_MAGIC)) != 0
+		|| trailer.hash != hash)
+	{
+		// leave nothing behind that could be taken for a ledger
+		remove_ledger(prefix);
+		return false;
+	}
+	// postings after the last segment are chained when the ledger opens
+	History_Chain::Verify_Report chain;
+	unsigned threads = thread::hardware_concurrency();
+	if (header.chain_records > 0 && !History_Chain::verify(prefix + "history.chain", key, prefix + "transaction.txt",
+		prefix + "history.arc", threads > 0 ? threads : 1, chain))
+	{
+		remove_ledger(prefix);
+		return false;
+	}
+	// the history index is derived from transaction.txt and built again on open
+	remove((prefix + "history.tix").c_str());
+	out.seq = header.seq;
+	out.pages = header.pages;
+	out.bytes = file_size(file);
+	out.seconds = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+// Walks the account index of a ledger in order and checks each balance
+// against the last one its history records, and that it has credentials.
+bool Backup::verify(const string &directory, Verify_Report &out)
+{
+	Trace_Span span("backup_verify");
+	memset(&out, 0, sizeof(out));
+	out.ordered = true;
+	BST_Tree t;
+	t.set_directory(directory);
+	t.load_Server();
+	unordered_set <int> credentials;
+	Hashtable::read_file(t.file("hashtable.txt"), [&credentials](const Credential_Record &rec) {
+		credentials.insert(rec.account_number);
+	}, [&credentials](const Legacy_Credential &rec) {
+		credentials.insert(rec.account_number);
+	});
+	string archive = t.file("history.arc");
+	int previous = INT_MIN;
+	t.index.scan(INT_MIN, INT_MAX, [&](const Account_Record &rec) {
+		out.accounts++;
+		if (out.accounts > 1 && rec.account_number <= previous)
+		{
+			out.ordered = false;
+		}
+		previous = rec.account_number;
+		if (credentials.count(rec.account_number) == 0)
+		{
+			out.without_credentials++;
+		}
+		int balance;
+		bool indexed = t.history_index.balance_at(rec.account_number, LLONG_MAX, balance);
+		if ((indexed && balance != History_Archive::NO_BALANCE)
+			|| (!indexed && History_Archive::balance_at(archive, rec.account_number, LLONG_MAX, balance)))
+		{
+			out.checked++;
+			if (balance != rec.balance)
+			{
+				out.mismatched++;
+			}
+		}
+		return true;
+	});
+	return out.ordered && out.mismatched == 0 && out.accounts == t.index.count();
+}
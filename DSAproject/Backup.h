@@ -0,0 +1,69 @@
+#pragma once
+# include "BST_Tree.h"
+# include <string>
+# include <thread>
+# include <atomic>
+# include <chrono>
+using namespace std;
+
+// Online backup of a single-tree ledger into one file. start() flushes the
+// account index and takes a copy-on-write snapshot of it, notes the last
+// posting and how long transaction.txt and history.arc are, and reads
+// hashtable.txt; a thread then streams all of it to the backup file while the
+// ledger goes on posting. The history files and history.chain only grow, so
+// their prefixes are the history up to the snapshot and the segments signed
+// over it. history.tix is left out and rebuilt on open, and the chain's
+// signing key is never backed up.
+//
+// restore() unpacks a backup into a directory, checking its checksum and the
+// restored chain against the signing key it is given, and verify() opens a
+// ledger and checks every account against the balance its history ends on
+// and against the credential table.
+class Backup
+{
+public:
+	struct Report
+	{
+		unsigned long long seq;
+		unsigned pages;
+		unsigned long long bytes;
+		unsigned long long pages_saved;
+		// chain segments in the backup
+		unsigned long long segments;
+		double seconds;
+	};
+	struct Verify_Report
+	{
+		unsigned accounts;
+		unsigned checked;
+		unsigned mismatched;
+		unsigned without_credentials;
+		bool ordered;
+	};
+
+	Backup();
+	~Backup();
+	bool start(BST_Tree &, const string &);
+	bool running();
+	bool finish(Report &);
+	static bool restore(const string &, const string &, const string &, Report &);
+	static bool verify(const string &, Verify_Report &);
+
+private:
+	Backup(const Backup &);
+	Backup& operator=(const Backup &);
+	void stream();
+
+	BST_Tree *tree;
+	string path;
+	thread worker;
+	atomic<bool> streaming;
+	bool ok;
+	Report report;
+	string credentials;
+	unsigned long long history_bytes;
+	unsigned long long archive_bytes;
+	unsigned long long chain_bytes;
+	unsigned long long saved_before;
+	chrono::steady_clock::time_point begin;
+};
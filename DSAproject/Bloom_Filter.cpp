@@ -0,0 +1,114 @@
+# include "Bloom_Filter.h"
+# include "Metrics.h"
+# include <math.h>
+
+static unsigned long long mix(unsigned long long x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+Bloom_Filter::Bloom_Filter()
+{
+	keys = 0;
+	capacity = 0;
+	lookups = 0;
+	negatives = 0;
+	false_positives = 0;
+	offset = 0;
+	blocks = 0;
+}
+void Bloom_Filter::reset(unsigned expected_keys)
+{
+	if (expected_keys < 64)
+	{
+		expected_keys = 64;
+	}
+	blocks = (unsigned)(((unsigned long long)expected_keys * BITS_PER_KEY + BLOCK_WORDS * 64 - 1) / (BLOCK_WORDS * 64));
+	storage.assign((size_t)blocks * BLOCK_WORDS + BLOCK_WORDS, 0);
+	// start the first block on a cache-line boundary
+	offset = (unsigned)((64 - ((size_t)storage.data() % 64)) % 64 / sizeof(unsigned long long));
+	keys = 0;
+	capacity = expected_keys;
+}
+void Bloom_Filter::clear()
+{
+	storage.clear();
+	blocks = 0;
+	keys = 0;
+	capacity = 0;
+}
+unsigned long long* Bloom_Filter::block(unsigned long long hash)
+{
+	unsigned long long b = ((hash >> 32) * blocks) >> 32;
+	return storage.data() + offset + b * BLOCK_WORDS;
+}
+void Bloom_Filter::add(int key)
+{
+	if (blocks == 0)
+	{
+		return;
+	}
+	unsigned long long hash = mix((unsigned)key);
+	unsigned long long *words = block(hash);
+	unsigned long long bits = mix(hash);
+	for (unsigned i = 0; i < HASHES; i++)
+	{
+		unsigned bit = (unsigned)(bits >> (i * 9)) & 511;
+		words[bit >> 6] |= 1ULL << (bit & 63);
+	}
+	keys++;
+}
+bool Bloom_Filter::may_contain(int key)
+{
+	lookups++;
+	Metrics::count(Metrics::FILTER_LOOKUPS);
+	if (blocks == 0)
+	{
+		return true;
+	}
+	unsigned long long hash = mix((unsigned)key);
+	unsigned long long *words = block(hash);
+	unsigned long long bits = mix(hash);
+	for (unsigned i = 0; i < HASHES; i++)
+	{
+		unsigned bit = (unsigned)(bits >> (i * 9)) & 511;
+		if ((words[bit >> 6] & (1ULL << (bit & 63))) == 0)
+		{
+			negatives++;
+			Metrics::count(Metrics::FILTER_NEGATIVES);
+			return false;
+		}
+	}
+	return true;
+}
+void Bloom_Filter::record_false_positive()
+{
+	if (blocks != 0)
+	{
+		false_positives++;
+		Metrics::count(Metrics::FILTER_FALSE_POSITIVES);
+	}
+}
+double Bloom_Filter::false_positive_rate()
+{
+	unsigned long long absent = negatives + false_positives;
+	if (absent == 0)
+	{
+		return 0.0;
+	}
+	return (double)false_positives / absent;
+}
+double Bloom_Filter::expected_false_positive_rate()
+{
+	if (blocks == 0)
+	{
+		return 1.0;
+	}
+	double bits = (double)blocks * BLOCK_WORDS * 64;
+	return pow(1.0 - exp(-(double)HASHES * keys / bits), (double)HASHES);
+}
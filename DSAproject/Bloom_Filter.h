@@ -0,0 +1,37 @@
+#pragma once
+# include <vector>
+using namespace std;
+
+// Blocked Bloom filter over account numbers. Every key maps to a single
+// 64-byte block, so a "definitely absent" answer costs one cache line.
+// Deleted keys are never cleared; they only cost an extra lookup until the
+// next rebuild. An unsized filter cannot rule anything out.
+class Bloom_Filter
+{
+public:
+	static const unsigned BLOCK_WORDS = 8;
+	static const unsigned BITS_PER_KEY = 10;
+	static const unsigned HASHES = 6;
+
+	Bloom_Filter();
+	void reset(unsigned);
+	void clear();
+	void add(int);
+	bool may_contain(int);
+	void record_false_positive();
+	double false_positive_rate();
+	double expected_false_positive_rate();
+
+	unsigned keys;
+	unsigned capacity;
+	unsigned long long lookups;
+	unsigned long long negatives;
+	unsigned long long false_positives;
+
+private:
+	unsigned long long* block(unsigned long long);
+
+	vector <unsigned long long> storage;
+	unsigned offset;
+	unsigned blocks;
+};
@@ -0,0 +1,312 @@
+# include "Buffer_Pool.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <string.h>
+
+static const unsigned NO_PAGE = 0xFFFFFFFF;
+unsigned Buffer_Pool::default_frames = 64;
+
+Buffer_Pool::Buffer_Pool(unsigned count)
+{
+	page_count = 0;
+	page_reads = 0;
+	page_writes = 0;
+	hand = 0;
+	snapshot_open = false;
+	snapshot_pages = 0;
+	if (count == 0)
+	{
+		count = default_frames;
+	}
+	region = Placement::allocate((size_t)count * PAGE_SIZE);
+	backing = region.backing;
+	placed = region.data != nullptr ? count : 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		Frame f;
+		f.page_id = NO_PAGE;
+		f.pin_count = 0;
+		f.dirty = false;
+		f.referenced = false;
+		f.data = i < placed ? region.data + (size_t)i * PAGE_SIZE : new char[PAGE_SIZE];
+		frames.push_back(f);
+	}
+}
+Buffer_Pool::~Buffer_Pool()
+{
+	close();
+	for (unsigned i = placed; i < frames.size(); i++)
+	{
+		delete[] frames[i].data;
+	}
+	Placement::release(region);
+}
+// Moves the frames to a node; only before the pool is opened.
+bool Buffer_Pool::place(int node)
+{
+	if (file.is_open() || placed == 0)
+	{
+		return false;
+	}
+	Placement::Region moved = Placement::allocate((size_t)placed * PAGE_SIZE, node);
+	if (moved.data == nullptr)
+	{
+		return false;
+	}
+	Placement::release(region);
+	region = moved;
+	backing = region.backing;
+	for (unsigned i = 0; i < placed; i++)
+	{
+		frames[i].data = region.data + (size_t)i * PAGE_SIZE;
+	}
+	return true;
+}
+bool Buffer_Pool::open(const string &path)
+{
+	close();
+	this->path = path;
+	file.open(path.c_str(), ios::in | ios::out | ios::binary);
+	if (!file.is_open())
+	{
+		ofstream create(path.c_str(), ios::binary);
+		create.close();
+		file.clear();
+		file.open(path.c_str(), ios::in | ios::out | ios::binary);
+	}
+	if (!file.is_open())
+	{
+		return false;
+	}
+	file.seekg(0, ios::end);
+	page_count = (unsigned)((unsigned long long)file.tellg() / PAGE_SIZE);
+	return true;
+}
+void Buffer_Pool::close()
+{
+	if (!file.is_open())
+	{
+		return;
+	}
+	end_snapshot();
+	flush();
+	file.close();
+	table.clear();
+	for (unsigned i = 0; i < frames.size(); i++)
+	{
+		frames[i].page_id = NO_PAGE;
+		frames[i].pin_count = 0;
+		frames[i].dirty = false;
+		frames[i].referenced = false;
+	}
+}
+bool Buffer_Pool::is_open()
+{
+	return file.is_open();
+}
+char* Buffer_Pool::pin(unsigned page_id)
+{
+	unordered_map <unsigned, int>::iterator it = table.find(page_id);
+	if (it != table.end())
+	{
+		Frame &f = frames[it->second];
+		f.pin_count++;
+		f.referenced = true;
+		return f.data;
+	}
+	int v = victim();
+	Frame &f = frames[v];
+	read_page(page_id, f.data);
+	f.page_id = page_id;
+	f.pin_count = 1;
+	f.dirty = false;
+	f.referenced = true;
+	table[page_id] = v;
+	return f.data;
+}
+void Buffer_Pool::unpin(unsigned page_id, bool dirty)
+{
+	unordered_map <unsigned, int>::iterator it = table.find(page_id);
+	if (it == table.end())
+	{
+		return;
+	}
+	Frame &f = frames[it->second];
+	if (f.pin_count > 0)
+	{
+		f.pin_count--;
+	}
+	if (dirty)
+	{
+		f.dirty = true;
+	}
+}
+char* Buffer_Pool::allocate(unsigned &page_id)
+{
+	page_id = page_count++;
+	int v = victim();
+	Frame &f = frames[v];
+	memset(f.data, 0, PAGE_SIZE);
+	f.page_id = page_id;
+	f.pin_count = 1;
+	f.dirty = true;
+	f.referenced = true;
+	table[page_id] = v;
+	return f.data;
+}
+void Buffer_Pool::flush()
+{
+	if (!file.is_open())
+	{
+		return;
+	}
+	Trace_Span span("index_flush");
+	bool wrote = false;
+	for (unsigned i = 0; i < frames.size(); i++)
+	{
+		if (frames[i].page_id != NO_PAGE && frames[i].dirty)
+		{
+			write_page(frames[i].page_id, frames[i].data);
+			frames[i].dirty = false;
+			wrote = true;
+		}
+	}
+	file.flush();
+	if (wrote)
+	{
+		Metrics::count(Metrics::FSYNCS);
+	}
+}
+int Buffer_Pool::victim()
+{
+	// clock sweep: give every referenced frame a second chance, never evict a pinned one
+	for (unsigned step = 0; step < 2 * frames.size(); step++)
+	{
+		unsigned i = hand;
+		hand = (hand + 1) % frames.size();
+		Frame &f = frames[i];
+		if (f.pin_count > 0)
+		{
+			continue;
+		}
+		if (f.referenced)
+		{
+			f.referenced = false;
+			continue;
+		}
+		if (f.page_id != NO_PAGE)
+		{
+			if (f.dirty)
+			{
+				write_page(f.page_id, f.data);
+			}
+			table.erase(f.page_id);
+		}
+		f.page_id = NO_PAGE;
+		f.dirty = false;
+		return i;
+	}
+	// every frame is pinned, so grow instead of failing the caller
+	Frame f;
+	f.page_id = NO_PAGE;
+	f.pin_count = 0;
+	f.dirty = false;
+	f.referenced = false;
+	f.data = new char[PAGE_SIZE];
+	frames.push_back(f);
+	return (int)frames.size() - 1;
+}
+void Buffer_Pool::read_page(unsigned page_id, char *data)
+{
+	file.clear();
+	file.seekg((streamoff)page_id * PAGE_SIZE);
+	file.read(data, PAGE_SIZE);
+	streamsize got = file.gcount();
+	if (got < (streamsize)PAGE_SIZE)
+	{
+		memset(data + got, 0, PAGE_SIZE - (size_t)got);
+	}
+	file.clear();
+	page_reads++;
+	Metrics::count(Metrics::BYTES_READ, PAGE_SIZE);
+}
+void Buffer_Pool::write_page(unsigned page_id, const char *data)
+{
+	if (before_write)
+	{
+		before_write();
+	}
+	{
+		lock_guard <mutex> guard(snapshot_lock);
+		if (snapshot_open && page_id < snapshot_pages && !snapshot_taken[page_id])
+		{
+			// copy on write: keep the frozen page for the snapshot reader
+			vector <char> &saved = snapshot_saved[page_id];
+			saved.resize(PAGE_SIZE);
+			file.clear();
+			file.seekg((streamoff)page_id * PAGE_SIZE);
+			file.read(saved.data(), PAGE_SIZE);
+			file.clear();
+			snapshot_taken[page_id] = true;
+			Metrics::count(Metrics::BYTES_READ, PAGE_SIZE);
+			Metrics::count(Metrics::SNAPSHOT_PAGES_SAVED);
+		}
+	}
+	file.clear();
+	file.seekp((streamoff)page_id * PAGE_SIZE);
+	file.write(data, PAGE_SIZE);
+	page_writes++;
+	Metrics::count(Metrics::BYTES_WRITTEN, PAGE_SIZE);
+}
+// Flushes the pool and freezes the file as it is now; returns the number of
+// pages in the snapshot.
+unsigned Buffer_Pool::begin_snapshot()
+{
+	end_snapshot();
+	flush();
+	lock_guard <mutex> guard(snapshot_lock);
+	snapshot_file.open(path.c_str(), ios::binary);
+	snapshot_pages = page_count;
+	snapshot_taken.assign(page_count, false);
+	snapshot_open = snapshot_file.is_open();
+	return snapshot_open ? snapshot_pages : 0;
+}
+// Reads a page as it was when the snapshot began. Safe to call from another
+// thread while the pool is in use.
+bool Buffer_Pool::snapshot_page(unsigned page_id, char *data)
+{
+	lock_guard <mutex> guard(snapshot_lock);
+	if (!snapshot_open || page_id >= snapshot_pages)
+	{
+		return false;
+	}
+	unordered_map <unsigned, vector <char> >::iterator saved = snapshot_saved.find(page_id);
+	if (saved != snapshot_saved.end())
+	{
+		memcpy(data, saved->second.data(), PAGE_SIZE);
+		snapshot_saved.erase(saved);
+		return true;
+	}
+	snapshot_taken[page_id] = true;
+	snapshot_file.clear();
+	snapshot_file.seekg((streamoff)page_id * PAGE_SIZE);
+	snapshot_file.read(data, PAGE_SIZE);
+	streamsize got = snapshot_file.gcount();
+	if (got < (streamsize)PAGE_SIZE)
+	{
+		memset(data + got, 0, PAGE_SIZE - (size_t)got);
+	}
+	Metrics::count(Metrics::BYTES_READ, PAGE_SIZE);
+	return true;
+}
+void Buffer_Pool::end_snapshot()
+{
+	lock_guard <mutex> guard(snapshot_lock);
+	snapshot_open = false;
+	snapshot_taken.clear();
+	snapshot_saved.clear();
+	if (snapshot_file.is_open())
+	{
+		snapshot_file.close();
+	}
+}
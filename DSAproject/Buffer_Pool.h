@@ -0,0 +1,81 @@
+#pragma once
+# include <fstream>
+# include <string>
+# include <vector>
+# include <unordered_map>
+# include <functional>
+# include <mutex>
+# include "Placement.h"
+using namespace std;
+
+// Fixed-size page cache over a single file. Pages are pinned while in use and
+// written back only when a dirty frame is evicted or the pool is flushed.
+//
+// A snapshot freezes the file as it is after a flush. Another thread can then
+// read the frozen pages with snapshot_page() while the pool keeps writing: the
+// first write of a page that has not been read yet saves its old contents
+// first, so only pages that change during the snapshot are ever copied.
+//
+// The frames are one placement region, so they can be backed by huge pages
+// and bound to the NUMA node of the thread that uses the pool.
+class Buffer_Pool
+{
+public:
+	static const unsigned PAGE_SIZE = 4096;
+
+	Buffer_Pool(unsigned frames = 0);
+	~Buffer_Pool();
+	bool place(int);
+	bool open(const string &);
+	void close();
+	bool is_open();
+	char* pin(unsigned);
+	void unpin(unsigned, bool);
+	char* allocate(unsigned &);
+	void flush();
+	unsigned begin_snapshot();
+	bool snapshot_page(unsigned, char *);
+	void end_snapshot();
+
+	unsigned page_count;
+	unsigned long long page_reads;
+	unsigned long long page_writes;
+	Placement::Backing backing;
+	// frames of pools made from now on when none are given
+	static unsigned default_frames;
+	// runs before a dirty page reaches the file, so a log can be forced first
+	function<void()> before_write;
+
+private:
+	struct Frame
+	{
+		unsigned page_id;
+		int pin_count;
+		bool dirty;
+		bool referenced;
+		char *data;
+	};
+
+	Buffer_Pool(const Buffer_Pool &);
+	Buffer_Pool& operator=(const Buffer_Pool &);
+	int victim();
+	void read_page(unsigned, char *);
+	void write_page(unsigned, const char *);
+
+	string path;
+	fstream file;
+	vector <Frame> frames;
+	// the first frames live in the region, any grown later on the heap
+	Placement::Region region;
+	unsigned placed;
+	unordered_map <unsigned, int> table;
+	unsigned hand;
+
+	// the snapshot; taken pages are those already read or saved
+	mutex snapshot_lock;
+	bool snapshot_open;
+	unsigned snapshot_pages;
+	vector <bool> snapshot_taken;
+	unordered_map <unsigned, vector <char> > snapshot_saved;
+	ifstream snapshot_file;
+};
@@ -0,0 +1,472 @@
+# include "Change_Feed.h"
+# include "Sharded_Ledger.h"
+# include "History_Archive.h"
+# include <atomic>
+# include <thread>
+# include <fstream>
+# include <sstream>
+# include <algorithm>
+# include <limits.h>
+# include <stdio.h>
+
+namespace
+{
+	// stamp is 2 * ticket + 1 while the slot is written and 2 * ticket + 2 once
+	// the event of that ticket is in it
+	struct Feed_Slot
+	{
+		atomic<unsigned long long> stamp;
+		Change_Event event;
+	};
+
+	Feed_Slot ring[Change_Feed::RING_SIZE];
+	atomic<unsigned long long> next_ticket(0);
+	atomic<int> subscribers(0);
+}
+
+const unsigned Change_Feed::RING_SIZE;
+
+bool Change_Feed::active()
+{
+	return subscribers.load(memory_order_relaxed) > 0;
+}
+void Change_Feed::publish(int account, int delta, int balance, int shard, long long time)
+{
+	if (!active())
+	{
+		return;
+	}
+	unsigned long long ticket = next_ticket.fetch_add(1, memory_order_relaxed);
+	Feed_Slot &slot = ring[ticket % RING_SIZE];
+	unsigned long long stamp = slot.stamp.load(memory_order_acquire);
+	for (;;)
+	{
+		if (stamp > 2 * ticket)
+		{
+			// a writer a whole ring ahead already took the slot; readers count this one lost
+			return;
+		}
+		if (stamp & 1)
+		{
+			// the writer a ring behind has not finished yet
+			this_thread::yield();
+			stamp = slot.stamp.load(memory_order_acquire);
+			continue;
+		}
+		if (slot.stamp.compare_exchange_weak(stamp, 2 * ticket + 1, memory_order_acquire))
+		{
+			break;
+		}
+	}
+	atomic_thread_fence(memory_order_release);
+	slot.event.seq = ticket + 1;
+	slot.event.time = time != 0 ? time : Journal::now_us();
+	slot.event.shard = shard;
+	slot.event.account = account;
+	slot.event.delta = delta;
+	slot.event.balance = balance;
+	slot.stamp.store(2 * ticket + 2, memory_order_release);
+}
+void Change_Feed::publish(const Journal_Record &rec, int shard)
+{
+	if (!active())
+	{
+		return;
+	}
+	vector <Change_Event> out;
+	events(rec, out);
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		publish(out[i].account, out[i].delta, out[i].balance, shard, rec.time);
+	}
+}
+unsigned long long Change_Feed::head()
+{
+	return next_ticket.load(memory_order_acquire);
+}
+// The balance changes a journal record stands for; COMMIT moves no money, and
+// neither does a sweep of escrow slots into their account.
+void Change_Feed::events(const Journal_Record &rec, vector <Change_Event> &out)
+{
+	if ((rec.flags & Journal_Record::FROM_ESCROW) != 0 || rec.type == Journal_Record::ESCROW_RELEASE)
+	{
+		return;
+	}
+	Change_Event event;
+	event.seq = rec.seq;
+	event.time = rec.time;
+	event.shard = -1;
+	event.account = rec.account;
+	event.balance = rec.balance;
+	switch (rec.type)
+	{
+	case Journal_Record::OPEN:
+	case Journal_Record::DEPOSIT:
+	case Journal_Record::ESCROW_DEPOSIT:
+	case Journal_Record::CREDIT:
+	case Journal_Record::ABORT:
+		event.delta = rec.amount;
+		out.push_back(event);
+		break;
+	case Journal_Record::WITHDRAW:
+	case Journal_Record::RESERVE:
+		event.delta = -rec.amount;
+		out.push_back(event);
+		break;
+	case Journal_Record::CLOSE:
+		// a CLOSE record keeps the balance the account had
+		event.delta = -rec.balance;
+		event.balance = 0;
+		out.push_back(event);
+		break;
+	case Journal_Record::LOCAL_TRANSFER:
+	case Journal_Record::ESCROW_TRANSFER:
+		event.delta = -rec.amount;
+		out.push_back(event);
+		event.account = rec.counterparty;
+		event.delta = rec.amount;
+		event.balance = rec.counter_balance;
+		out.push_back(event);
+		break;
+	}
+}
+
+Change_Subscriber::Change_Subscriber()
+{
+	subscribers.fetch_add(1, memory_order_relaxed);
+	cursor = next_ticket.load(memory_order_acquire);
+	dropped = 0;
+}
+Change_Subscriber::~Change_Subscriber()
+{
+	subscribers.fetch_sub(1, memory_order_relaxed);
+}
+// Non-blocking. Returns false when the subscriber has caught up, or when the
+// next event is claimed but not written yet.
+bool Change_Subscriber::next(Change_Event &event)
+{
+	for (;;)
+	{
+		unsigned long long head = next_ticket.load(memory_order_acquire);
+		if (cursor >= head)
+		{
+			return false;
+		}
+		if (head - cursor > Change_Feed::RING_SIZE)
+		{
+			dropped += head - Change_Feed::RING_SIZE - cursor;
+			cursor = head - Change_Feed::RING_SIZE;
+		}
+		Feed_Slot &slot = ring[cursor % Change_Feed::RING_SIZE];
+		unsigned long long stamp = slot.stamp.load(memory_order_acquire);
+		if (stamp < 2 * cursor + 2)
+		{
+			return false;
+		}
+		if (stamp == 2 * cursor + 2)
+		{
+			event = slot.event;
+			atomic_thread_fence(memory_order_acquire);
+			if (slot.stamp.load(memory_order_relaxed) == stamp)
+			{
+				cursor++;
+				return true;
+			}
+			continue;
+		}
+		// overwritten by a writer a ring ahead
+		dropped++;
+		cursor++;
+	}
+}
+
+Feed_Check::Feed_Check() : running(false)
+{
+	subscriber = nullptr;
+	first = expected = 0;
+	published = delivered = dropped = gaps = 0;
+}
+Feed_Check::~Feed_Check()
+{
+	finish();
+}
+void Feed_Check::start()
+{
+	if (subscriber != nullptr)
+	{
+		return;
+	}
+	subscriber = new Change_Subscriber();
+	first = subscriber->cursor;
+	expected = first + 1;
+	published = delivered = dropped = gaps = 0;
+	running = true;
+	reader = thread(&Feed_Check::drain, this);
+}
+// Stops the reader once it has caught up with the head. True when the
+// sequence numbers had no gaps and every published event was delivered or
+// counted lost.
+bool Feed_Check::finish()
+{
+	if (subscriber == nullptr)
+	{
+		return false;
+	}
+	running = false;
+	reader.join();
+	published = Change_Feed::head() - first;
+	dropped = subscriber->dropped;
+	delete subscriber;
+	subscriber = nullptr;
+	return gaps == 0 && delivered + dropped == published;
+}
+void Feed_Check::drain()
+{
+	Change_Event event;
+	for (;;)
+	{
+		bool stopping = !running.load();
+		unsigned long long lost = subscriber->dropped;
+		if (subscriber->next(event))
+		{
+			if (event.seq != expected + (subscriber->dropped - lost))
+			{
+				gaps++;
+			}
+			expected = event.seq + 1;
+			delivered++;
+			continue;
+		}
+		if (stopping && subscriber->cursor >= Change_Feed::head())
+		{
+			return;
+		}
+		this_thread::yield();
+	}
+}
+
+static const char CURSOR_MAGIC[] = "BKCDC1";
+static const char LIVE_CURSOR_MAGIC[] = "BKLIVE1";
+
+// Replaces a cursor file through a synced temporary, so a crash leaves the
+// old cursor or the new one.
+static bool save_cursor(const string &path, const string &text)
+{
+	string temp = path + ".tmp";
+	ofstream write(temp.c_str(), ios::trunc);
+	write << text;
+	write.close();
+	if (!write || !Journal::sync_path(temp))
+	{
+		return false;
+	}
+#ifdef _WIN32
+	remove(path.c_str());
+#endif
+	return rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool Journal_Tailer::open(const string &dir, const string &path)
+{
+	vector <int> splits;
+	if (!Sharded_Ledger::read_splits(dir, splits))
+	{
+		return false;
+	}
+	journals.clear();
+	for (unsigned i = 0; i <= splits.size(); i++)
+	{
+		journals.push_back(Sharded_Ledger::shard_prefix(dir, i) + "journal.log");
+	}
+	cursor_path = path;
+	cursor.assign(journals.size(), 1);
+	ifstream read(cursor_path.c_str());
+	if (!read)
+	{
+		// no cursor yet: start from the first record
+		return true;
+	}
+	string magic;
+	size_t count = 0;
+	read >> magic >> count;
+	if (magic != CURSOR_MAGIC || count != journals.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!(read >> cursor[i]) || cursor[i] == 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+unsigned Journal_Tailer::poll(const function<void(const Change_Event &)> &visit, unsigned max)
+{
+	unsigned records = 0;
+	vector <Change_Event> out;
+	for (size_t i = 0; i < journals.size() && records < max; i++)
+	{
+		unsigned long long offset = (cursor[i] - 1) * sizeof(Journal_Record);
+		Journal::scan_file(journals[i], offset, [&](const Journal_Record &rec, unsigned long long) {
+			if (rec.seq != cursor[i])
+			{
+				return false;
+			}
+			out.clear();
+			Change_Feed::events(rec, out);
+			for (size_t j = 0; j < out.size(); j++)
+			{
+				out[j].shard = (int)i;
+				visit(out[j]);
+			}
+			cursor[i]++;
+			return ++records < max;
+		});
+	}
+	return records;
+}
+bool Journal_Tailer::commit()
+{
+	ostringstream text;
+	text << CURSOR_MAGIC << "\n" << cursor.size() << "\n";
+	for (size_t i = 0; i < cursor.size(); i++)
+	{
+		text << cursor[i] << "\n";
+	}
+	return save_cursor(cursor_path, text.str());
+}
+
+static Change_Event live_event(const History_Entry &entry)
+{
+	Change_Event event;
+	event.seq = entry.seq;
+	event.time = entry.time;
+	event.shard = -1;
+	event.account = entry.account;
+	event.delta = entry.amount;
+	event.balance = entry.balance;
+	return event;
+}
+bool History_Tailer::open(const string &dir, const string &path)
+{
+	string prefix = dir;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+	{
+		prefix += '/';
+	}
+	live = prefix + "transaction.txt";
+	archive = prefix + "history.arc";
+	cursor_path = path;
+	last_seq = 0;
+	offset = 0;
+	if (!ifstream(live.c_str()))
+	{
+		return false;
+	}
+	ifstream read(cursor_path.c_str());
+	if (!read)
+	{
+		// no cursor yet: start from the first posting
+		return true;
+	}
+	string magic;
+	read >> magic >> last_seq >> offset;
+	return magic == LIVE_CURSOR_MAGIC && !read.fail();
+}
+// Whether the line at offset is still the last posting read; leaves read
+// after that line when it is.
+bool History_Tailer::in_place(ifstream &read)
+{
+	if (last_seq == 0)
+	{
+		return false;
+	}
+	if (offset > 0)
+	{
+		read.seekg((streamoff)(offset - 1));
+		if (read.get() != '\n')
+		{
+			return false;
+		}
+	}
+	History_Entry entry;
+	return History_Archive::read_live(read, entry) && !read.eof() && entry.seq == last_seq;
+}
+// Visits the sealed postings after the last one read and before seq, in seq
+// order, all at once.
+unsigned History_Tailer::catch_up(unsigned long long seq, const function<void(const Change_Event &)> &visit)
+{
+	vector <History_Entry> missed;
+	History_Archive::scan(archive, INT_MIN, INT_MAX, LLONG_MIN, LLONG_MAX, [&](const History_Entry &entry) {
+		if (entry.seq > last_seq && entry.seq < seq)
+		{
+			missed.push_back(entry);
+		}
+	});
+	sort(missed.begin(), missed.end(), [](const History_Entry &a, const History_Entry &b) { return a.seq < b.seq; });
+	for (size_t i = 0; i < missed.size(); i++)
+	{
+		visit(live_event(missed[i]));
+		last_seq = missed[i].seq;
+		// the line of an archived posting is gone; the next poll finds its place by seq
+		offset = 0;
+	}
+	return (unsigned)missed.size();
+}
+unsigned History_Tailer::poll(const function<void(const Change_Event &)> &visit, unsigned max)
+{
+	ifstream read(live.c_str(), ios::binary);
+	if (!read)
+	{
+		return 0;
+	}
+	unsigned records = 0;
+	History_Entry entry;
+	if (!in_place(read))
+	{
+		// first poll, or the file was rewritten by a seal since the last one
+		read.clear();
+		read.seekg(0);
+		unsigned long long first = ULLONG_MAX;
+		while (History_Archive::read_live(read, entry) && !read.eof())
+		{
+			if (entry.seq != 0)
+			{
+				first = entry.seq;
+				break;
+			}
+		}
+		if (first > last_seq + 1)
+		{
+			records += catch_up(first, visit);
+		}
+		read.clear();
+		read.seekg(0);
+	}
+	while (records < max)
+	{
+		unsigned long long at = (unsigned long long)read.tellg();
+		if (!History_Archive::read_live(read, entry) || read.eof())
+		{
+			// the end, or a line the ledger is still writing
+			break;
+		}
+		if (entry.seq == 0 || entry.seq <= last_seq)
+		{
+			continue;
+		}
+		visit(live_event(entry));
+		last_seq = entry.seq;
+		offset = at;
+		records++;
+	}
+	return records;
+}
+bool History_Tailer::commit()
+{
+	ostringstream text;
+	text << LIVE_CURSOR_MAGIC << "\n" << last_seq << "\n" << offset << "\n";
+	return save_cursor(cursor_path, text.str());
+}
@@ -0,0 +1,136 @@
+#pragma once
+# include "Journal.h"
+# include <string>
+# include <vector>
+# include <functional>
+# include <atomic>
+# include <thread>
+# include <fstream>
+using namespace std;
+
+// One committed change to a balance. delta is signed; balance is the balance
+// after the change. Events from the in-process feed are numbered by the feed
+// (shard is -1 for the BST_Tree ledger); events from a Journal_Tailer carry
+// the shard and the journal sequence number of the record they came from.
+// A credit held in an escrow slot of a hot account reports the slot's balance,
+// and moving a slot into the account is not a change.
+struct Change_Event
+{
+	unsigned long long seq;
+	long long time;
+	int shard;
+	int account;
+	int delta;
+	int balance;
+};
+
+// Process-wide broadcast ring of committed postings. Writers claim a ticket
+// with one atomic add and fill the slot under a per-slot sequence stamp;
+// they never look at the readers. A reader that falls a full ring behind is
+// skipped forward and told how many events it lost, so a slow subscriber
+// costs the posting path nothing. Nothing is written while no one listens.
+class Change_Feed
+{
+public:
+	static const unsigned RING_SIZE = 1 << 14;
+
+	static bool active();
+	static void publish(int, int, int, int shard = -1, long long time = 0);
+	static void publish(const Journal_Record &, int);
+	static unsigned long long head();
+	static void events(const Journal_Record &, vector <Change_Event> &);
+};
+
+// A cursor on the feed. Subscribes at the current head on construction.
+class Change_Subscriber
+{
+public:
+	Change_Subscriber();
+	~Change_Subscriber();
+	bool next(Change_Event &);
+
+	unsigned long long cursor;
+	unsigned long long dropped;
+
+private:
+	Change_Subscriber(const Change_Subscriber &);
+	Change_Subscriber& operator=(const Change_Subscriber &);
+};
+
+// An in-process consumer that checks the feed while a ledger runs. It drains
+// a subscriber on its own thread and checks that every event carries the
+// sequence number after the last one it saw, plus the events the subscriber
+// was told it lost. When it finishes, delivered plus dropped must equal what
+// was published while it listened.
+class Feed_Check
+{
+public:
+	Feed_Check();
+	~Feed_Check();
+	void start();
+	bool finish();
+
+	unsigned long long published;
+	unsigned long long delivered;
+	unsigned long long dropped;
+	unsigned long long gaps;
+
+private:
+	Feed_Check(const Feed_Check &);
+	Feed_Check& operator=(const Feed_Check &);
+	void drain();
+
+	Change_Subscriber *subscriber;
+	unsigned long long first;
+	unsigned long long expected;
+	atomic<bool> running;
+	thread reader;
+};
+
+// Follows the shard journals of a Sharded_Ledger directory from another
+// process. The position in every journal is kept in a cursor file that is
+// rewritten only by commit(), so a consumer that stops between poll() and
+// commit() sees the same events again when it resumes.
+class Journal_Tailer
+{
+public:
+	bool open(const string &, const string &);
+	unsigned poll(const function<void(const Change_Event &)> &, unsigned max = 4096);
+	bool commit();
+
+	// next journal sequence number to read, per shard
+	vector <unsigned long long> cursor;
+
+private:
+	vector <string> journals;
+	string cursor_path;
+};
+
+// Follows transaction.txt, the history of the BST_Tree ledger that the menus,
+// kiosks and customers post to, from another process. The cursor file holds
+// the seq of the last posting read and the offset of its line. Sealing
+// history rewrites the file, so when the line at the offset no longer holds
+// that posting, the tailer finds its place again by seq, reading postings
+// that were sealed before it got to them from history.arc. Lines from before
+// postings were stamped have no seq and are skipped; a line still being
+// written is left for the next poll.
+class History_Tailer
+{
+public:
+	bool open(const string &, const string &);
+	unsigned poll(const function<void(const Change_Event &)> &, unsigned max = 4096);
+	bool commit();
+
+	// seq of the last posting read, 0 before the first
+	unsigned long long last_seq;
+	// offset of its line in transaction.txt
+	unsigned long long offset;
+
+private:
+	bool in_place(ifstream &);
+	unsigned catch_up(unsigned long long, const function<void(const Change_Event &)> &);
+
+	string live;
+	string archive;
+	string cursor_path;
+};
@@ -0,0 +1,212 @@
+# include "Dedupe_Table.h"
+# include "Journal.h"
+# include <stdint.h>
+# include <string.h>
+# include <limits.h>
+
+const unsigned Dedupe_Table::TICKS;
+const unsigned Dedupe_Table::WAYS;
+const long long Dedupe_Table::DEFAULT_WINDOW_US;
+long long Dedupe_Table::window_us = Dedupe_Table::DEFAULT_WINDOW_US;
+
+static const size_t FIRST_BUCKETS = 64;
+
+Dedupe_Table::Dedupe_Table(long long window)
+{
+	if (window <= 0)
+	{
+		window = window_us;
+	}
+	tick_us = window / TICKS;
+	if (tick_us < 1000)
+	{
+		tick_us = 1000;
+	}
+	origin = -1;
+	tick = 0;
+	tick_end = LLONG_MIN;
+	memset(added, 0, sizeof(added));
+	recent = 0;
+	buckets = nullptr;
+	mask = 0;
+	grow(FIRST_BUCKETS, 0);
+}
+// Gives the result stored with a key added within the window.
+bool Dedupe_Table::find(unsigned long long key, int &result, long long now_us)
+{
+	unsigned now = advance(now_us);
+	size_t b = home(key);
+	for (size_t probe = 0; probe <= mask; probe++)
+	{
+		const Bucket &bucket = buckets[(b + probe) & mask];
+		for (unsigned w = 0; w < WAYS; w++)
+		{
+			if (bucket.keys[w] == key && live(bucket.ticks[w], now))
+			{
+				result = bucket.results[w];
+				return true;
+			}
+		}
+		if (!live(bucket.overflow, now))
+		{
+			break;
+		}
+	}
+	return false;
+}
+// Adds a key with its result. A key already in the window keeps the tick it
+// was first added in and takes the new result.
+void Dedupe_Table::insert(unsigned long long key, int result, long long now_us)
+{
+	unsigned now = advance(now_us);
+	size_t b = home(key);
+	for (size_t probe = 0; probe <= mask; probe++)
+	{
+		Bucket &bucket = buckets[(b + probe) & mask];
+		for (unsigned w = 0; w < WAYS; w++)
+		{
+			if (bucket.keys[w] == key && live(bucket.ticks[w], now))
+			{
+				bucket.results[w] = result;
+				return;
+			}
+		}
+		if (!live(bucket.overflow, now))
+		{
+			break;
+		}
+	}
+	if ((recent + 1) * 2 > (mask + 1) * WAYS)
+	{
+		grow((mask + 1) * 2, now);
+	}
+	place(key, result, now, now);
+	added[now % (TICKS + 1)]++;
+	recent++;
+}
+void Dedupe_Table::reserve(size_t keys)
+{
+	size_t n = mask + 1;
+	while (n * WAYS < keys * 2)
+	{
+		n *= 2;
+	}
+	if (n > mask + 1)
+	{
+		grow(n, advance(0));
+	}
+}
+// The keys added within the window.
+size_t Dedupe_Table::size(long long now_us)
+{
+	advance(now_us);
+	return (size_t)recent;
+}
+size_t Dedupe_Table::memory()
+{
+	return storage.size();
+}
+long long Dedupe_Table::window()
+{
+	return tick_us * TICKS;
+}
+// Moves to the tick of a time; a time before the end of the current tick,
+// including one from a clock that went back, stays in it. Each tick passed
+// ages out the keys added TICKS + 1 ticks before it; their slots are reused
+// as they are found.
+unsigned Dedupe_Table::advance(long long now_us)
+{
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	if (now_us < tick_end)
+	{
+		return tick;
+	}
+	if (origin < 0)
+	{
+		origin = now_us;
+	}
+	long long elapsed = now_us > origin ? now_us - origin : 0;
+	unsigned now = (unsigned)(elapsed / tick_us) + 1;
+	if ((int)(now - tick) <= 0)
+	{
+		return tick;
+	}
+	tick_end = origin + (long long)now * tick_us;
+	for (unsigned steps = 0; tick != now; steps++)
+	{
+		if (steps > TICKS)
+		{
+			tick = now;
+			break;
+		}
+		tick++;
+		recent -= added[tick % (TICKS + 1)];
+		added[tick % (TICKS + 1)] = 0;
+	}
+	return tick;
+}
+bool Dedupe_Table::live(unsigned stamp, unsigned now)
+{
+	return stamp != 0 && now - stamp <= TICKS;
+}
+size_t Dedupe_Table::home(unsigned long long key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+	return (size_t)key & mask;
+}
+// Puts a key in the first bucket from its home with a slot that has aged
+// out, marking the full buckets it passes as overflowing until stamp ages out.
+void Dedupe_Table::place(unsigned long long key, int result, unsigned stamp, unsigned now)
+{
+	size_t b = home(key);
+	for (size_t probe = 0; probe <= mask; probe++)
+	{
+		Bucket &bucket = buckets[(b + probe) & mask];
+		for (unsigned w = 0; w < WAYS; w++)
+		{
+			if (!live(bucket.ticks[w], now))
+			{
+				bucket.keys[w] = key;
+				bucket.results[w] = result;
+				bucket.ticks[w] = stamp;
+				return;
+			}
+		}
+		if (!live(bucket.overflow, now) || (int)(stamp - bucket.overflow) > 0)
+		{
+			bucket.overflow = stamp;
+		}
+	}
+}
+// Rebuilds the table with n buckets, keeping only the keys still in the window.
+void Dedupe_Table::grow(size_t n, unsigned now)
+{
+	vector <unsigned char> old;
+	old.swap(storage);
+	Bucket *old_buckets = buckets;
+	size_t old_count = buckets != nullptr ? mask + 1 : 0;
+
+	// one spare bucket so the first can start on a cache line
+	storage.assign((n + 1) * sizeof(Bucket), 0);
+	uintptr_t at = (uintptr_t)storage.data();
+	at = (at + sizeof(Bucket) - 1) & ~(uintptr_t)(sizeof(Bucket) - 1);
+	buckets = (Bucket*)at;
+	mask = n - 1;
+	for (size_t i = 0; i < old_count; i++)
+	{
+		for (unsigned w = 0; w < WAYS; w++)
+		{
+			if (live(old_buckets[i].ticks[w], now))
+			{
+				place(old_buckets[i].keys[w], old_buckets[i].results[w], old_buckets[i].ticks[w], now);
+			}
+		}
+	}
+}
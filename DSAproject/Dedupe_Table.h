@@ -0,0 +1,63 @@
+#pragma once
+# include <vector>
+# include <stddef.h>
+using namespace std;
+
+// Idempotency keys of recent postings, each with the balance the posting left
+// behind, so a request retried after a timeout gets the first attempt's result
+// instead of being posted twice. Keys are kept for a window split into TICKS
+// ticks. Every entry is stamped with the tick it was added in and counts as
+// gone once the window has passed it, so ageing out a tick is advancing a
+// counter, not a sweep. Entries live in cache-line buckets of WAYS; a lookup
+// reads one bucket, and the next only while that one has overflowed into it
+// within the window. The table doubles when the keys added within the window
+// would fill more than half of it. Keys are kept in memory only.
+class Dedupe_Table
+{
+public:
+	static const unsigned TICKS = 16;
+	static const unsigned WAYS = 3;
+	static const long long DEFAULT_WINDOW_US = 24 * 3600 * 1000000LL;
+
+	Dedupe_Table(long long window = 0);
+	bool find(unsigned long long, int &, long long now_us = 0);
+	void insert(unsigned long long, int, long long now_us = 0);
+	void reserve(size_t);
+	size_t size(long long now_us = 0);
+	size_t memory();
+	long long window();
+
+	// the window of tables made from now on
+	static long long window_us;
+
+private:
+	struct Bucket
+	{
+		unsigned long long keys[WAYS];
+		int results[WAYS];
+		unsigned ticks[WAYS];
+		// last tick an entry was pushed on to the next bucket
+		unsigned overflow;
+		char pad[12];
+	};
+
+	Dedupe_Table(const Dedupe_Table &);
+	Dedupe_Table& operator=(const Dedupe_Table &);
+	unsigned advance(long long);
+	bool live(unsigned, unsigned);
+	size_t home(unsigned long long);
+	void place(unsigned long long, int, unsigned, unsigned);
+	void grow(size_t, unsigned);
+
+	vector <unsigned char> storage;
+	Bucket *buckets;
+	size_t mask;
+	long long origin;
+	long long tick_us;
+	unsigned tick;
+	// the time the current tick ends
+	long long tick_end;
+	// keys added in each of the last TICKS + 1 ticks, and their sum
+	unsigned long long added[TICKS + 1];
+	unsigned long long recent;
+};
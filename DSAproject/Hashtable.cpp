@@ -1,14 +1,105 @@
 # include <iostream>
 using namespace std;
 # include "Hashtable.h"
+# include "Metrics.h"
+# include "Tracer.h"
 # include <vector>
+# include <sstream>
+# include <string.h>
+
+unsigned Hashtable::kdf_cost = Hashtable::DEFAULT_KDF_COST;
+const unsigned Hashtable::DEFAULT_KDF_COST;
+
+static const char KDF_NAME[] = "scrypt";
+static const char HEX[] = "0123456789abcdef";
+
+static void to_hex(const unsigned char *bytes, size_t n, char *out)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		out[2 * i] = HEX[bytes[i] >> 4];
+		out[2 * i + 1] = HEX[bytes[i] & 15];
+	}
+	out[2 * n] = '\0';
+}
+static int hex_digit(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+static bool from_hex(const char *text, size_t n, unsigned char *out)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		int high = hex_digit(text[2 * i]);
+		int low = hex_digit(text[2 * i + 1]);
+		if (high < 0 || low < 0)
+		{
+			return false;
+		}
+		out[i] = (unsigned char)(high << 4 | low);
+	}
+	return true;
+}
+// Compares hashes in time that does not depend on where they differ.
+static bool same_hash(const unsigned char *a, const unsigned char *b)
+{
+	unsigned char diff = 0;
+	for (unsigned i = 0; i < Kdf_Pool::HASH_SIZE; i++)
+	{
+		diff |= a[i] ^ b[i];
+	}
+	return diff == 0;
+}
+static Credential_Record to_record(int account, const Kdf_Pool::Job &job)
+{
+	Credential_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	memcpy(rec.kdf, KDF_NAME, sizeof(KDF_NAME));
+	rec.account_number = account;
+	rec.cost = (int)job.cost;
+	to_hex(job.salt, Kdf_Pool::SALT_SIZE, rec.salt);
+	to_hex(job.hash, Kdf_Pool::HASH_SIZE, rec.hash);
+	return rec;
+}
+// Hashes the passwords of the legacy records on the pool's threads.
+static void hash_legacy(const vector <Legacy_Credential> &legacy, vector <Credential_Record> &out)
+{
+	vector <Kdf_Pool::Job> jobs(legacy.size());
+	vector <Kdf_Pool::Job *> pending;
+	for (size_t i = 0; i < legacy.size(); i++)
+	{
+		jobs[i].password = legacy[i].password;
+		jobs[i].cost = Hashtable::kdf_cost;
+		Kdf_Pool::make_salt(jobs[i].salt);
+		pending.push_back(&jobs[i]);
+	}
+	Kdf_Pool::bank().run(pending);
+	for (size_t i = 0; i < legacy.size(); i++)
+	{
+		out.push_back(to_record(legacy[i].account_number, jobs[i]));
+	}
+}
 
 Hashtable:: Hashtable()
 {
 	start = nullptr;
 }
+// Builds the buckets once, and loads the credentials into them again on every
+// call, so a reload sees deleted and changed passwords.
 void Hashtable:: starthash()
 {
+	if (start != nullptr)
+	{
+		clear_chains();
+		loadhashtable();
+		return;
+	}
 	for (int i = 0; i < 12; i++)
 	{
 		Node * temp1 = new Node(i);
@@ -28,45 +119,105 @@ void Hashtable:: starthash()
 	}
 	loadhashtable();
 }
+// Stores a salted hash of the password; the derivation runs on the pool.
 void Hashtable::add(int a, int p)
 {
-	static int i = 0;
-	ofstream write;
-	write.open("hashtable.txt",ios::app);
-	if (i != 0)
+	Kdf_Pool::Job job;
+	job.password = p;
+	job.cost = kdf_cost;
+	Kdf_Pool::make_salt(job.salt);
+	Kdf_Pool::bank().run(vector <Kdf_Pool::Job *>(1, &job));
+	Credential_Record rec = to_record(a, job);
+	string text;
+	// files written before every record ended in a newline stop after the password
+	ifstream read(file("hashtable.txt").c_str(), ios::binary | ios::ate);
+	if (read && read.tellg() > 0)
 	{
-		write << endl;
-		write << a << endl << p;
-	}
-	else
-	{
-		i++;
-		write << a << endl << p;
+		read.seekg(-1, ios::end);
+		if (read.get() != '\n')
+		{
+			text += '\n';
+		}
 	}
+	read.close();
+	Credential_Schema::append_text(rec, text);
+	ofstream write;
+	write.open(file("hashtable.txt").c_str(), ios::app | ios::binary);
+	write.write(text.data(), text.size());
 	write.close();
+	Metrics::count(Metrics::BYTES_WRITTEN, text.size());
 
 	starthash();
 }
 bool Hashtable::match(int a, int p)
 {
-	bool flag = false;
-	int r = a % 10;
-	Node * c = start;
-	while (c->data != r)
+	vector <char> results;
+	match_all(vector <pair <int, int> >(1, make_pair(a, p)), results);
+	return results[0] != 0;
+}
+// Checks account and password pairs. Pairs verified recently are answered
+// from the cache; the rest are derived together on the pool's threads.
+void Hashtable::match_all(const vector <pair <int, int> > &checks, vector <char> &results)
+{
+	Metrics_Timer timer(Metrics::MATCH);
+	Trace_Span span("match");
+	Verify_Cache &cache = Verify_Cache::bank();
+	results.assign(checks.size(), 0);
+	// a check that missed the cache keeps its node and cache tag beside its job
+	struct Derivation
 	{
-		c = c->next;
+		Kdf_Pool::Job job;
+		size_t check;
+		Node_1 *node;
+		unsigned long long tag;
+	};
+	vector <Derivation> derivations;
+	derivations.reserve(checks.size());
+	for (size_t i = 0; i < checks.size(); i++)
+	{
+		if (!filter.may_contain(checks[i].first))
+		{
+			continue;
+		}
+		Node_1 *c1 = find(checks[i].first);
+		if (c1 == nullptr)
+		{
+			filter.record_false_positive();
+			continue;
+		}
+		unsigned long long tag = cache.tag(checks[i].first, checks[i].second, c1->salt);
+		if (cache.hit(tag))
+		{
+			results[i] = 1;
+			continue;
+		}
+		Derivation d;
+		d.job.password = checks[i].second;
+		d.job.cost = c1->cost;
+		memcpy(d.job.salt, c1->salt, sizeof(d.job.salt));
+		d.check = i;
+		d.node = c1;
+		d.tag = tag;
+		derivations.push_back(d);
 	}
-	Node_1 *c1 = c->pre;
-	while (c1 != nullptr)
+	vector <Kdf_Pool::Job *> pending;
+	for (size_t i = 0; i < derivations.size(); i++)
 	{
-		if (c1->accountNumber == a && c1->password == p)
+		pending.push_back(&derivations[i].job);
+	}
+	Kdf_Pool::bank().run(pending);
+	for (size_t i = 0; i < derivations.size(); i++)
+	{
+		if (same_hash(derivations[i].job.hash, derivations[i].node->hash))
 		{
-			flag = true;
-			break;
+			results[derivations[i].check] = 1;
+			cache.insert(derivations[i].tag);
 		}
-		c1 = c1->next;
 	}
-	return flag;
+}
+string Hashtable::file(const char *name)
+{
+	return directory + name;
 }
 void Hashtable:: display()
 {
@@ -77,53 +228,188 @@ void Hashtable:: display()
 		current = current->next;
 	}
 }
-void  Hashtable::loadhashtable()
+// Visits the records of a credential file in order, hashed ones and those
+// from before passwords were hashed alike. False when a record is malformed.
+bool Hashtable::read_file(const string &path, const function<void(const Credential_Record &)> &stored,
+	const function<void(const Legacy_Credential &)> &legacy, unsigned long long *bytes)
 {
-	int acc = 0, r, pass;
-
-	ifstream read;
-	read.open("hashtable.txt");
-	while (!read.eof())
+	ifstream read(path.c_str(), ios::binary);
+	ostringstream text;
+	text << read.rdbuf();
+	string contents = text.str();
+	if (bytes != nullptr)
 	{
-
-		read >> acc;
-		read >> pass;
-		if (match(acc, pass))
+		*bytes = contents.size();
+	}
+	const char *in = contents.data();
+	const char *end = in + contents.size();
+	while (true)
+	{
+		while (in != end && (*in == '\r' || *in == '\n'))
 		{
-			continue;
+			in++;
 		}
-		if (acc!= -858993460 && pass!= -858993460)
+		if (in == end)
 		{
-			r = acc % 10;
-
-			Node * c = start;
-			while (c->data != r)
-			{
-				c = c->next;
-			}
-			Node_1 *temp = new Node_1(acc, pass);
-			if (c->pre == nullptr)
+			return true;
+		}
+		size_t name = sizeof(KDF_NAME) - 1;
+		if ((size_t)(end - in) > name && memcmp(in, KDF_NAME, name) == 0 && (in[name] == '\n' || in[name] == '\r'))
+		{
+			Credential_Record rec;
+			in = Credential_Schema::read_text(in, end, rec);
+			if (in == nullptr)
 			{
-				c->pre = temp;
+				return false;
 			}
-			else
+			stored(rec);
+		}
+		else
+		{
+			Legacy_Credential rec;
+			in = Legacy_Credential_Schema::read_text(in, end, rec);
+			if (in == nullptr)
 			{
-				Node_1 *root;
-				root = c->pre;
-				while (root->next != nullptr)
-				{
-					root = root->next;
-				}
-				root->next = temp;
+				return false;
 			}
+			legacy(rec);
 		}
-		else
+	}
+}
+void  Hashtable::loadhashtable()
+{
+	// the filter cannot answer for keys it has not seen yet, so it stays
+	// open while the chains are loaded and is rebuilt from them afterwards
+	filter.clear();
+	unsigned long long bytes = 0;
+	vector <Credential_Record> records;
+	vector <Legacy_Credential> legacy;
+	bool complete = read_file(file("hashtable.txt"), [&records](const Credential_Record &rec) {
+		records.push_back(rec);
+	}, [&legacy](const Legacy_Credential &rec) {
+		legacy.push_back(rec);
+	}, &bytes);
+	Metrics::count(Metrics::BYTES_READ, bytes);
+	if (!complete && bytes > 0)
+	{
+		cout << "NO password present" << endl;
+	}
+	if (!legacy.empty())
+	{
+		// passwords from before hashing are hashed once and the file rewritten
+		hash_legacy(legacy, records);
+		string text;
+		for (size_t i = 0; i < records.size(); i++)
 		{
-			cout << "NO password present" << endl;
+			Credential_Schema::append_text(records[i], text);
+		}
+		ofstream write;
+		write.open(file("temp.txt").c_str(), ios::trunc | ios::binary);
+		write.write(text.data(), text.size());
+		write.close();
+		Metrics::count(Metrics::BYTES_WRITTEN, text.size());
+		remove(file("hashtable.txt").c_str());
+		rename(file("temp.txt").c_str(), file("hashtable.txt").c_str());
+		Metrics::count(Metrics::FILES_REWRITTEN);
+		cout << "Hashed " << legacy.size() << " stored passwords." << endl;
+	}
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		insert(records[i]);
+	}
+	rebuild_filter();
+}
+// Adds a credential to its bucket; a later record for the same account
+// replaces the earlier one.
+void Hashtable::insert(const Credential_Record &rec)
+{
+	unsigned char salt[Kdf_Pool::SALT_SIZE];
+	unsigned char hash[Kdf_Pool::HASH_SIZE];
+	if (strcmp(rec.kdf, KDF_NAME) != 0 || rec.cost <= 0 || rec.cost > 30
+		|| !from_hex(rec.salt, sizeof(salt), salt) || !from_hex(rec.hash, sizeof(hash), hash))
+	{
+		return;
+	}
+	Node_1 *existing = find(rec.account_number);
+	if (existing != nullptr)
+	{
+		existing->cost = (unsigned)rec.cost;
+		memcpy(existing->salt, salt, sizeof(salt));
+		memcpy(existing->hash, hash, sizeof(hash));
+		return;
+	}
+	int r = rec.account_number % 10;
+	Node * c = start;
+	while (c->data != r)
+	{
+		c = c->next;
+	}
+	Node_1 *temp = new Node_1(rec.account_number, (unsigned)rec.cost, salt, hash);
+	if (c->pre == nullptr)
+	{
+		c->pre = temp;
+	}
+	else
+	{
+		Node_1 *root;
+		root = c->pre;
+		while (root->next != nullptr)
+		{
+			root = root->next;
+		}
+		root->next = temp;
+	}
+}
+Node_1* Hashtable::find(int a)
+{
+	int r = a % 10;
+	Node * c = start;
+	while (c != nullptr && c->data != r)
+	{
+		c = c->next;
+	}
+	for (Node_1 *c1 = c != nullptr ? c->pre : nullptr; c1 != nullptr; c1 = c1->next)
+	{
+		if (c1->accountNumber == a)
+		{
+			return c1;
+		}
+	}
+	return nullptr;
+}
+void Hashtable::clear_chains()
+{
+	for (Node *c = start; c != nullptr; c = c->next)
+	{
+		while (c->pre != nullptr)
+		{
+			Node_1 *next = c->pre->next;
+			delete c->pre;
+			c->pre = next;
+		}
+	}
+}
+void Hashtable::rebuild_filter()
+{
+	unsigned count = 0;
+	for (Node *c = start; c != nullptr; c = c->next)
+	{
+		for (Node_1 *c1 = c->pre; c1 != nullptr; c1 = c1->next)
+		{
+			count++;
+		}
+	}
+	filter.reset(2 * count);
+	for (Node *c = start; c != nullptr; c = c->next)
+	{
+		for (Node_1 *c1 = c->pre; c1 != nullptr; c1 = c1->next)
+		{
+			filter.add(c1->accountNumber);
 		}
 	}
-	read.close();
 }
+// Lists the accounts that have a password; only hashes are stored, so the
+// passwords themselves cannot be shown.
 void  Hashtable::displayPasswords()
 {
 	starthash();
@@ -133,8 +419,10 @@ void  Hashtable::displayPasswords()
 		Node_1 *c1 = c->pre;
 		while (c1 != nullptr)
 		{
+			char salt[2 * Kdf_Pool::SALT_SIZE + 1];
+			to_hex(c1->salt, Kdf_Pool::SALT_SIZE, salt);
 			cout<<c1->accountNumber<<endl;
-			cout<<c1->password<<endl<<endl;
+			cout<<KDF_NAME<<" 2^"<<c1->cost<<" salt "<<salt<<endl<<endl;
 			c1 = c1->next;
 		}
 		c = c->next;
@@ -142,37 +430,26 @@ void  Hashtable::displayPasswords()
 }
 void  Hashtable:: delete_password(int accountno)
 {
-	ifstream read;
-	read.open("hashtable.txt");
-	vector <int> v;
-	int acc=0,pass=0;
-	int i = 0;
-	while (!read.eof())
-	{
-		i++;
-		read >> acc;
-		read >> pass;
-		if (acc == accountno)
-		{	                                           // read both account number and password to skip them
-			continue;
+	string text;
+	unsigned long long bytes = 0;
+	read_file(file("hashtable.txt"), [&](const Credential_Record &rec) {
+		if (rec.account_number != accountno && rec.account_number != 0)
+		{
+			Credential_Schema::append_text(rec, text);
 		}
-		v.push_back(acc);
-		v.push_back(pass);
-	}
-	read.close();
-	ofstream write;
-	write.open("temp.txt", ios::app);
-	
-		for (int i = 0; i < v.size(); i++)
+	}, [&](const Legacy_Credential &rec) {
+		if (rec.account_number != accountno && rec.account_number != 0)
 		{
-			if (v[i] != 0)
-			{
-				write << v[i] << endl;
-			}
+			Legacy_Credential_Schema::append_text(rec, text);
 		}
-	
-	
+	}, &bytes);
+	Metrics::count(Metrics::BYTES_READ, bytes);
+	ofstream write;
+	write.open(file("temp.txt").c_str(), ios::trunc | ios::binary);
+	write.write(text.data(), text.size());
 	write.close();
-	remove("hashtable.txt");
-	rename("temp.txt", "hashtable.txt");
-}
\ No newline at end of file
+	Metrics::count(Metrics::BYTES_WRITTEN, text.size());
+	remove(file("hashtable.txt").c_str());
+	rename(file("temp.txt").c_str(), file("hashtable.txt").c_str());
+	Metrics::count(Metrics::FILES_REWRITTEN);
+}
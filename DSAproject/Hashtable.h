@@ -1,17 +1,67 @@
 #pragma once
 # include "Node.h"
 # include "Node_1.h"
+# include "Bloom_Filter.h"
+# include "Record_Schema.h"
+# include "Kdf_Pool.h"
+# include "Verify_Cache.h"
+# include <vector>
+# include <functional>
+
+// One credential in hashtable.txt: the scrypt hash of the password, with the
+// cost as log2 of the iterations and the salt, both hex.
+struct Credential_Record
+{
+	char kdf[8];
+	int account_number;
+	int cost;
+	char salt[2 * Kdf_Pool::SALT_SIZE + 1];
+	char hash[2 * Kdf_Pool::HASH_SIZE + 1];
+};
+typedef Record_Schema <Credential_Record, 2,
+	SCHEMA_FIELD(Credential_Record, kdf),
+	SCHEMA_FIELD(Credential_Record, account_number),
+	SCHEMA_FIELD(Credential_Record, cost),
+	SCHEMA_FIELD(Credential_Record, salt),
+	SCHEMA_FIELD(Credential_Record, hash)> Credential_Schema;
+
+// A line pair of hashtable.txt from before passwords were hashed. Loading a
+// file that has any rewrites it with them hashed.
+struct Legacy_Credential
+{
+	int account_number;
+	int password;
+};
+typedef Record_Schema <Legacy_Credential, 1,
+	SCHEMA_FIELD(Legacy_Credential, account_number),
+	SCHEMA_FIELD(Legacy_Credential, password)> Legacy_Credential_Schema;
 
 class Hashtable
 {
 public:
 	Node * start;
+	Bloom_Filter filter;
+	string directory;
 	Hashtable();
 	void starthash();
 	void loadhashtable();
 	void add(int,int);
 	bool match(int,int);
+	void match_all(const vector <pair <int, int> > &, vector <char> &);
 	void display();
 	void displayPasswords();
 	void delete_password(int);
+	void rebuild_filter();
+	string file(const char *);
+	static bool read_file(const string &, const function<void(const Credential_Record &)> &,
+		const function<void(const Legacy_Credential &)> &, unsigned long long *bytes = nullptr);
+
+	// log2 of the scrypt iterations for new hashes; 2^14 takes 16 MiB
+	static unsigned kdf_cost;
+	static const unsigned DEFAULT_KDF_COST = 14;
+
+private:
+	Node_1* find(int);
+	void insert(const Credential_Record &);
+	void clear_chains();
 };
\ No newline at end of file
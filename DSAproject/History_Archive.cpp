@@ -0,0 +1,754 @@
+# include "History_Archive.h"
+# include "Journal.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <fstream>
+# include <vector>
+# include <algorithm>
+# include <stddef.h>
+# include <string.h>
+# include <stdio.h>
+# include <stdlib.h>
+
+static const char SEGMENT_MAGIC[4] = { 'B', 'K', 'A', 'R' };
+static const unsigned char VERSION = 1;
+
+// A segment is written SEALING and flipped to SEALED in place once the entries
+// it holds have been cut from transaction.txt.
+enum Segment_State
+{
+	SEALING = 1,
+	SEALED = 2
+};
+
+// source_offset and source_hash describe the prefix of transaction.txt that
+// this and the earlier segments of the same seal were cut from.
+struct Segment_Header
+{
+	char magic[4];
+	unsigned char version;
+	unsigned char state;
+	unsigned char pad[2];
+	unsigned blocks;
+	unsigned pad2;
+	unsigned long long body_bytes;
+	unsigned long long source_offset;
+	unsigned long long source_hash;
+};
+
+struct Segment_Footer
+{
+	unsigned long long entries;
+	unsigned long long first_seq;
+	unsigned long long last_seq;
+	long long min_time;
+	long long max_time;
+	int min_account;
+	int max_account;
+	unsigned directory_checksum;
+	// header (with the state left out), then this footer up to here
+	unsigned checksum;
+};
+
+struct Block_Entry
+{
+	unsigned long long offset;
+	long long min_time;
+	unsigned bytes;
+	unsigned entries;
+	int min_account;
+	int max_account;
+	unsigned account_bytes;
+	unsigned seq_bytes;
+	unsigned amount_bytes;
+	unsigned time_bits;
+	unsigned checksum;
+	// 0 in blocks sealed before balances were recorded
+	unsigned balance_bytes;
+};
+
+const unsigned History_Archive::BLOCK_ENTRIES;
+const unsigned History_Archive::SEGMENT_ENTRIES;
+const int History_Archive::NO_BALANCE;
+
+static unsigned fnv(const void *data, size_t n, unsigned hash = 2166136261u)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < n; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+static unsigned long long fnv64(const char *data, size_t n, unsigned long long hash)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+static const unsigned long long FNV64_BASIS = 14695981039346656037ull;
+
+static unsigned segment_checksum(const Segment_Header &header, const Segment_Footer &footer)
+{
+	Segment_Header h = header;
+	h.state = 0;
+	unsigned hash = fnv(&h, sizeof(h));
+	return fnv(&footer, offsetof(Segment_Footer, checksum), hash);
+}
+
+static void put_varint(string &out, unsigned long long v)
+{
+	while (v >= 0x80)
+	{
+		out.push_back((char)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((char)v);
+}
+static void put_signed(string &out, long long v)
+{
+	put_varint(out, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+static bool get_varint(const unsigned char *&p, const unsigned char *end, unsigned long long &v)
+{
+	v = 0;
+	for (int shift = 0; shift < 64 && p < end; shift += 7)
+	{
+		unsigned char c = *p++;
+		v |= (unsigned long long)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Appends n entries, sorted by account and seq, as one block of columns.
+static void encode_block(const History_Entry *e, unsigned n, unsigned long long first_seq, string &body, Block_Entry &block)
+{
+	memset(&block, 0, sizeof(block));
+	block.offset = body.size();
+	block.entries = n;
+	block.min_account = e[0].account;
+	block.max_account = e[n - 1].account;
+	block.min_time = e[0].time;
+	long long max_time = e[0].time;
+	for (unsigned i = 1; i < n; i++)
+	{
+		block.min_time = min(block.min_time, e[i].time);
+		max_time = max(max_time, e[i].time);
+	}
+	unsigned long long range = (unsigned long long)(max_time - block.min_time);
+	while (block.time_bits < 64 && (range >> block.time_bits) != 0)
+	{
+		block.time_bits++;
+	}
+
+	string accounts, seqs, amounts, balances, times;
+	long long previous = block.min_account;
+	for (unsigned i = 0; i < n; )
+	{
+		unsigned j = i;
+		while (j < n && e[j].account == e[i].account)
+		{
+			j++;
+		}
+		put_varint(accounts, (unsigned long long)((long long)e[i].account - previous));
+		put_varint(accounts, j - i);
+		previous = e[i].account;
+		put_varint(seqs, e[i].seq - first_seq);
+		for (unsigned k = i + 1; k < j; k++)
+		{
+			put_varint(seqs, e[k].seq - e[k - 1].seq);
+		}
+		// the balance after the run, carried forward from its last known one
+		long long balance = History_Archive::NO_BALANCE;
+		for (unsigned k = i; k < j; k++)
+		{
+			if (e[k].balance != History_Archive::NO_BALANCE)
+				balance = e[k].balance;
+			else if (balance != History_Archive::NO_BALANCE)
+				balance += e[k].amount;
+		}
+		put_signed(balances, balance);
+		i = j;
+	}
+	unsigned char byte = 0;
+	unsigned used = 0;
+	for (unsigned i = 0; i < n; i++)
+	{
+		put_signed(amounts, e[i].amount);
+		unsigned long long v = (unsigned long long)(e[i].time - block.min_time);
+		for (unsigned left = block.time_bits; left > 0; )
+		{
+			unsigned take = left < 8 - used ? left : 8 - used;
+			byte |= (unsigned char)((v & ((1u << take) - 1)) << used);
+			v >>= take;
+			left -= take;
+			used += take;
+			if (used == 8)
+			{
+				times.push_back((char)byte);
+				byte = 0;
+				used = 0;
+			}
+		}
+	}
+	if (used > 0)
+	{
+		times.push_back((char)byte);
+	}
+
+	block.account_bytes = (unsigned)accounts.size();
+	block.seq_bytes = (unsigned)seqs.size();
+	block.amount_bytes = (unsigned)amounts.size();
+	block.balance_bytes = (unsigned)balances.size();
+	body += accounts;
+	body += seqs;
+	body += amounts;
+	body += balances;
+	body += times;
+	block.bytes = (unsigned)(body.size() - block.offset);
+	block.checksum = fnv(body.data() + block.offset, block.bytes);
+}
+
+static bool decode_block(const unsigned char *data, const Block_Entry &block, unsigned long long first_seq, vector <History_Entry> &out)
+{
+	if (fnv(data, block.bytes) != block.checksum
+		|| (unsigned long long)block.account_bytes + block.seq_bytes + block.amount_bytes + block.balance_bytes > block.bytes)
+	{
+		return false;
+	}
+	out.resize(block.entries);
+	const unsigned char *accounts = data;
+	const unsigned char *seqs = accounts + block.account_bytes;
+	const unsigned char *amounts = seqs + block.seq_bytes;
+	const unsigned char *balances = amounts + block.amount_bytes;
+	const unsigned char *times = balances + block.balance_bytes;
+	const unsigned char *end = data + block.bytes;
+	vector <unsigned> runs;
+
+	long long account = block.min_account;
+	unsigned i = 0;
+	while (i < block.entries)
+	{
+		unsigned long long delta, run, seq;
+		if (!get_varint(accounts, seqs, delta) || !get_varint(accounts, seqs, run) || run == 0 || run > block.entries - i)
+		{
+			return false;
+		}
+		account += (long long)delta;
+		runs.push_back(i + (unsigned)run);
+		for (unsigned k = 0; k < run; k++, i++)
+		{
+			if (!get_varint(seqs, amounts, seq))
+			{
+				return false;
+			}
+			out[i].account = (int)account;
+			out[i].seq = k == 0 ? first_seq + seq : out[i - 1].seq + seq;
+		}
+	}
+	unsigned used = 0;
+	for (i = 0; i < block.entries; i++)
+	{
+		unsigned long long u;
+		if (!get_varint(amounts, times, u))
+		{
+			return false;
+		}
+		out[i].amount = (int)(long long)((u >> 1) ^ (0 - (u & 1)));
+		unsigned long long v = 0;
+		for (unsigned got = 0; got < block.time_bits; )
+		{
+			if (times >= end)
+			{
+				return false;
+			}
+			unsigned take = block.time_bits - got < 8 - used ? block.time_bits - got : 8 - used;
+			v |= (unsigned long long)((*times >> used) & ((1u << take) - 1)) << got;
+			got += take;
+			used += take;
+			if (used == 8)
+			{
+				times++;
+				used = 0;
+			}
+		}
+		out[i].time = block.min_time + (long long)v;
+		out[i].balance = History_Archive::NO_BALANCE;
+	}
+	// walk each run back from the balance after it
+	for (size_t r = 0; r < runs.size() && block.balance_bytes > 0; r++)
+	{
+		unsigned long long u;
+		if (!get_varint(balances, times, u))
+		{
+			return false;
+		}
+		long long balance = (long long)((u >> 1) ^ (0 - (u & 1)));
+		if (balance == History_Archive::NO_BALANCE)
+		{
+			continue;
+		}
+		for (unsigned k = runs[r]; k > (r == 0 ? 0 : runs[r - 1]); k--)
+		{
+			out[k - 1].balance = (int)balance;
+			balance -= out[k - 1].amount;
+		}
+	}
+	return true;
+}
+
+// Visits the checked segments of an archive in order; returns the offset just
+// past the last good one.
+static unsigned long long walk(ifstream &read, const function<bool(unsigned long long, const Segment_Header &, const Segment_Footer &)> &visit)
+{
+	unsigned long long at = 0;
+	Segment_Header header;
+	Segment_Footer footer;
+	for (;;)
+	{
+		read.clear();
+		read.seekg((streamoff)at);
+		if (!read.read((char*)&header, sizeof(header)) || memcmp(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0
+			|| header.version != VERSION)
+		{
+			break;
+		}
+		read.seekg((streamoff)header.body_bytes, ios::cur);
+		if (!read.read((char*)&footer, sizeof(footer)) || footer.checksum != segment_checksum(header, footer))
+		{
+			break;
+		}
+		unsigned long long next = at + sizeof(header) + header.body_bytes + sizeof(footer) + (unsigned long long)header.blocks * sizeof(Block_Entry);
+		read.seekg(0, ios::end);
+		if ((unsigned long long)read.tellg() < next)
+		{
+			break;
+		}
+		Metrics::count(Metrics::BYTES_READ, sizeof(header) + sizeof(footer));
+		if (!visit(at, header, footer))
+		{
+			return next;
+		}
+		at = next;
+	}
+	read.clear();
+	return at;
+}
+
+static bool read_directory(ifstream &read, unsigned long long at, const Segment_Header &header, const Segment_Footer &footer, vector <Block_Entry> &directory)
+{
+	directory.resize(header.blocks);
+	read.clear();
+	read.seekg((streamoff)(at + sizeof(header) + header.body_bytes + sizeof(footer)));
+	if (header.blocks > 0 && !read.read((char*)directory.data(), header.blocks * sizeof(Block_Entry)))
+	{
+		return false;
+	}
+	Metrics::count(Metrics::BYTES_READ, header.blocks * sizeof(Block_Entry));
+	return fnv(directory.data(), directory.size() * sizeof(Block_Entry)) == footer.directory_checksum;
+}
+
+static unsigned long long file_size(const string &path)
+{
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	return probe ? (unsigned long long)probe.tellg() : 0;
+}
+
+// Replaces transaction.txt by what follows its first offset bytes.
+static bool cut_live(const string &live, unsigned long long offset)
+{
+	string temp = live + ".tmp";
+	ifstream read(live.c_str(), ios::binary);
+	ofstream write(temp.c_str(), ios::binary | ios::trunc);
+	read.seekg((streamoff)offset);
+	char buffer[1 << 16];
+	while (read.read(buffer, sizeof(buffer)) || read.gcount() > 0)
+	{
+		write.write(buffer, read.gcount());
+		Metrics::count(Metrics::BYTES_WRITTEN, (unsigned long long)read.gcount());
+	}
+	read.close();
+	write.close();
+	if (!write || !Journal::sync_path(temp))
+	{
+		return false;
+	}
+#ifdef _WIN32
+	remove(live.c_str());
+#endif
+	Metrics::count(Metrics::FILES_REWRITTEN);
+	return rename(temp.c_str(), live.c_str()) == 0;
+}
+
+static bool hash_prefix(const string &live, unsigned long long offset, unsigned long long &hash)
+{
+	ifstream read(live.c_str(), ios::binary);
+	hash = FNV64_BASIS;
+	char buffer[1 << 16];
+	while (offset > 0)
+	{
+		size_t n = offset < sizeof(buffer) ? (size_t)offset : sizeof(buffer);
+		if (!read.read(buffer, n))
+		{
+			return false;
+		}
+		hash = fnv64(buffer, n, hash);
+		offset -= n;
+	}
+	return true;
+}
+
+static bool mark_sealed(const string &archive, const vector <unsigned long long> &segments)
+{
+	if (segments.empty())
+	{
+		return true;
+	}
+	fstream write(archive.c_str(), ios::in | ios::out | ios::binary);
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		write.seekp((streamoff)(segments[i] + offsetof(Segment_Header, state)));
+		write.put((char)SEALED);
+	}
+	write.close();
+	return write && Journal::sync_path(archive);
+}
+
+// One entry of transaction.txt: "account amount seq time balance" on one line,
+// followed by the posting's idempotency key if it had one, the same without
+// the balance from before balances were recorded, or an entry from before
+// postings were stamped, with the account and the amount on two lines of
+// their own. Sealing keeps no keys.
+bool History_Archive::read_live(istream &read, History_Entry &entry, unsigned long long *key)
+{
+	string line;
+	if (key != nullptr)
+	{
+		*key = 0;
+	}
+	while (getline(read, line))
+	{
+		const char *p = line.c_str();
+		char *end;
+		long account = strtol(p, &end, 10);
+		if (end == p)
+		{
+			continue;
+		}
+		entry.account = (int)account;
+		p = end;
+		long amount = strtol(p, &end, 10);
+		if (end == p)
+		{
+			if (!getline(read, line))
+			{
+				return false;
+			}
+			entry.amount = (int)strtol(line.c_str(), nullptr, 10);
+			entry.seq = 0;
+			entry.time = 0;
+			entry.balance = NO_BALANCE;
+			return true;
+		}
+		entry.amount = (int)amount;
+		p = end;
+		entry.seq = strtoull(p, &end, 10);
+		p = end;
+		entry.time = strtoll(p, &end, 10);
+		p = end;
+		long balance = strtol(p, &end, 10);
+		entry.balance = end == p ? NO_BALANCE : (int)balance;
+		if (key != nullptr && end != p)
+		{
+			*key = strtoull(end, nullptr, 10);
+		}
+		return true;
+	}
+	return false;
+}
+
+void History_Archive::write_live(ostream &write, const History_Entry &entry, unsigned long long key)
+{
+	write << entry.account << " " << entry.amount << " " << entry.seq << " " << entry.time;
+	if (entry.balance != NO_BALANCE)
+	{
+		write << " " << entry.balance;
+		if (key != 0)
+		{
+			write << " " << key;
+		}
+	}
+	write << "\n";
+}
+
+// Finishes a seal that was interrupted: drops a torn segment at the end of the
+// archive and cuts the entries of unfinished segments from transaction.txt
+// unless that already happened.
+bool History_Archive::recover(const string &live, const string &archive)
+{
+	ifstream read(archive.c_str(), ios::binary);
+	if (!read)
+	{
+		return true;
+	}
+	vector <unsigned long long> sealing;
+	Segment_Header last;
+	memset(&last, 0, sizeof(last));
+	unsigned long long end = walk(read, [&](unsigned long long at, const Segment_Header &header, const Segment_Footer &) {
+		if (header.state == SEALING)
+		{
+			sealing.push_back(at);
+			last = header;
+		}
+		return true;
+	});
+	read.close();
+	if (file_size(archive) > end && !Journal::truncate_path(archive, end))
+	{
+		return false;
+	}
+	if (sealing.empty())
+	{
+		return true;
+	}
+	unsigned long long hash;
+	if (file_size(live) >= last.source_offset && hash_prefix(live, last.source_offset, hash) && hash == last.source_hash
+		&& !cut_live(live, last.source_offset))
+	{
+		return false;
+	}
+	return mark_sealed(archive, sealing);
+}
+
+unsigned long long History_Archive::next_seq(const string &archive)
+{
+	ifstream read(archive.c_str(), ios::binary);
+	unsigned long long seq = 1;
+	if (read)
+	{
+		walk(read, [&](unsigned long long, const Segment_Header &, const Segment_Footer &footer) {
+			seq = footer.last_seq + 1;
+			return true;
+		});
+	}
+	return seq;
+}
+
+// Moves all but the newest keep entries of transaction.txt into the archive.
+// The segments are synced before the live file is cut, and recover() finishes
+// the job after a crash in between.
+bool History_Archive::seal(const string &live, const string &archive, unsigned long long keep, Seal_Report &report)
+{
+	Trace_Span span("seal_history");
+	memset(&report, 0, sizeof(report));
+	if (!recover(live, archive))
+	{
+		return false;
+	}
+	ifstream read(live.c_str(), ios::binary);
+	if (!read)
+	{
+		return true;
+	}
+	History_Entry entry;
+	unsigned long long total = 0;
+	while (read_live(read, entry))
+	{
+		total++;
+	}
+	if (total <= keep)
+	{
+		return true;
+	}
+	read.clear();
+	read.seekg(0);
+
+	unsigned long long seq = next_seq(archive);
+	unsigned long long start = file_size(archive);
+	ofstream write(archive.c_str(), ios::binary | ios::app);
+	ifstream source(live.c_str(), ios::binary);
+	unsigned long long hash = FNV64_BASIS;
+	unsigned long long hashed = 0;
+	vector <unsigned long long> segments;
+	vector <History_Entry> chunk;
+	vector <Block_Entry> directory;
+	string body;
+	char buffer[1 << 16];
+	while (report.entries < total - keep)
+	{
+		chunk.clear();
+		while (chunk.size() < SEGMENT_ENTRIES && report.entries < total - keep && read_live(read, entry))
+		{
+			// entries from before postings were stamped are numbered here
+			if (entry.seq == 0)
+			{
+				entry.seq = seq++;
+			}
+			chunk.push_back(entry);
+			report.entries++;
+		}
+		if (chunk.empty())
+		{
+			break;
+		}
+		Segment_Header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+		header.version = VERSION;
+		header.state = SEALING;
+		header.source_offset = (unsigned long long)read.tellg();
+		while (hashed < header.source_offset)
+		{
+			size_t n = header.source_offset - hashed < sizeof(buffer) ? (size_t)(header.source_offset - hashed) : sizeof(buffer);
+			source.read(buffer, n);
+			hash = fnv64(buffer, n, hash);
+			hashed += n;
+		}
+		header.source_hash = hash;
+
+		Segment_Footer footer;
+		memset(&footer, 0, sizeof(footer));
+		footer.entries = chunk.size();
+		footer.first_seq = chunk[0].seq;
+		footer.last_seq = chunk[0].seq;
+		footer.min_time = chunk[0].time;
+		footer.max_time = chunk[0].time;
+		for (size_t i = 1; i < chunk.size(); i++)
+		{
+			footer.first_seq = min(footer.first_seq, chunk[i].seq);
+			footer.last_seq = max(footer.last_seq, chunk[i].seq);
+			footer.min_time = min(footer.min_time, chunk[i].time);
+			footer.max_time = max(footer.max_time, chunk[i].time);
+		}
+		sort(chunk.begin(), chunk.end(), [](const History_Entry &a, const History_Entry &b) {
+			return a.account != b.account ? a.account < b.account : a.seq < b.seq;
+		});
+		footer.min_account = chunk.front().account;
+		footer.max_account = chunk.back().account;
+
+		body.clear();
+		directory.clear();
+		for (size_t i = 0; i < chunk.size(); i += BLOCK_ENTRIES)
+		{
+			Block_Entry block;
+			unsigned n = (unsigned)min((size_t)BLOCK_ENTRIES, chunk.size() - i);
+			encode_block(&chunk[i], n, footer.first_seq, body, block);
+			directory.push_back(block);
+		}
+		header.blocks = (unsigned)directory.size();
+		header.body_bytes = body.size();
+		footer.directory_checksum = fnv(directory.data(), directory.size() * sizeof(Block_Entry));
+		footer.checksum = segment_checksum(header, footer);
+
+		segments.push_back(start + report.archive_bytes);
+		write.write((const char*)&header, sizeof(header));
+		write.write(body.data(), body.size());
+		write.write((const char*)&footer, sizeof(footer));
+		write.write((const char*)directory.data(), directory.size() * sizeof(Block_Entry));
+		report.archive_bytes += sizeof(header) + body.size() + sizeof(footer) + directory.size() * sizeof(Block_Entry);
+		report.segments++;
+	}
+	write.close();
+	read.close();
+	source.close();
+	report.text_bytes = hashed;
+	Metrics::count(Metrics::BYTES_WRITTEN, report.archive_bytes);
+	if (!write || !Journal::sync_path(archive))
+	{
+		return false;
+	}
+	if (report.segments == 0)
+	{
+		return true;
+	}
+	return cut_live(live, hashed) && mark_sealed(archive, segments);
+}
+
+// Visits the archived entries of one account stamped between from and to,
+// inclusive, in seq order.
+bool History_Archive::history(const string &archive, int account, long long from, long long to, const function<void(const History_Entry &)> &visit)
+{
+	return scan(archive, account, account, from, to, visit);
+}
+// Visits the archived entries of the accounts low to high stamped between from
+// and to, inclusive: segment by segment, and by account and seq in a segment.
+bool History_Archive::scan(const string &archive, int low, int high, long long from, long long to, const function<void(const History_Entry &)> &visit)
+{
+	ifstream read(archive.c_str(), ios::binary);
+	if (!read)
+	{
+		return true;
+	}
+	bool ok = true;
+	vector <Block_Entry> directory;
+	vector <unsigned char> data;
+	vector <History_Entry> entries;
+	walk(read, [&](unsigned long long at, const Segment_Header &header, const Segment_Footer &footer) {
+		if (high < footer.min_account || low > footer.max_account || footer.max_time < from || footer.min_time > to)
+		{
+			Metrics::count(Metrics::HISTORY_BLOCKS_SKIPPED, header.blocks);
+			return true;
+		}
+		if (!read_directory(read, at, header, footer, directory))
+		{
+			ok = false;
+			return false;
+		}
+		for (size_t b = 0; b < directory.size(); b++)
+		{
+			const Block_Entry &block = directory[b];
+			// the times of a block are all within 2^time_bits of its smallest
+			unsigned long long span = block.time_bits >= 63 ? ~0ull >> 1 : (1ull << block.time_bits) - 1;
+			bool before = from > block.min_time && (unsigned long long)(from - block.min_time) > span;
+			if (high < block.min_account || low > block.max_account || block.min_time > to || before)
+			{
+				Metrics::count(Metrics::HISTORY_BLOCKS_SKIPPED);
+				continue;
+			}
+			data.resize(block.bytes);
+			read.clear();
+			read.seekg((streamoff)(at + sizeof(header) + block.offset));
+			if (block.offset + block.bytes > header.body_bytes || !read.read((char*)data.data(), block.bytes)
+				|| !decode_block(data.data(), block, footer.first_seq, entries))
+			{
+				ok = false;
+				return false;
+			}
+			Metrics::count(Metrics::BYTES_READ, block.bytes);
+			Metrics::count(Metrics::HISTORY_BLOCKS_DECODED);
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				if (entries[i].account >= low && entries[i].account <= high && entries[i].time >= from && entries[i].time <= to)
+				{
+					visit(entries[i]);
+				}
+			}
+		}
+		return true;
+	});
+	return ok;
+}
+// The balance of an account after its last archived posting stamped at or
+// before time. False when the archive has no such posting with a known balance.
+bool History_Archive::balance_at(const string &archive, int account, long long time, int &balance)
+{
+	bool found = false;
+	unsigned long long seq = 0;
+	scan(archive, account, account, LLONG_MIN, time, [&](const History_Entry &entry) {
+		if (entry.balance != NO_BALANCE && (!found || entry.seq > seq))
+		{
+			found = true;
+			seq = entry.seq;
+			balance = entry.balance;
+		}
+	});
+	return found;
+}
@@ -0,0 +1,55 @@
+#pragma once
+# include <string>
+# include <istream>
+# include <ostream>
+# include <functional>
+# include <limits.h>
+using namespace std;
+
+// One posting in the transaction history. seq numbers the postings in the
+// order they were recorded; time is in microseconds since the epoch, or 0 when
+// the posting was recorded without one. balance is the account's balance after
+// the posting, or History_Archive::NO_BALANCE when it is not known.
+struct History_Entry
+{
+	unsigned long long seq;
+	long long time;
+	int account;
+	int amount;
+	int balance;
+};
+
+// Cold history sealed out of transaction.txt. The archive is a series of
+// segments. In a segment the entries are sorted by account and then by seq,
+// and cut into blocks that are stored column by column: account runs as
+// varint deltas, seq as varint deltas within an account, amounts as zigzag
+// varints and times as bit-packed offsets from the smallest time of the block.
+// A footer after the blocks holds the account and time range of the segment
+// and a directory of the blocks with their own ranges, so a history query
+// reads the footers and decodes only the blocks that can hold the account.
+// Every account run in a block also records the balance after its last entry,
+// a checkpoint from which the balances of the other entries follow.
+class History_Archive
+{
+public:
+	static const unsigned BLOCK_ENTRIES = 4096;
+	static const unsigned SEGMENT_ENTRIES = 1 << 20;
+	static const int NO_BALANCE = INT_MIN;
+
+	struct Seal_Report
+	{
+		unsigned long long entries;
+		unsigned segments;
+		unsigned long long text_bytes;
+		unsigned long long archive_bytes;
+	};
+
+	static bool seal(const string &, const string &, unsigned long long, Seal_Report &);
+	static bool recover(const string &, const string &);
+	static bool history(const string &, int, long long, long long, const function<void(const History_Entry &)> &);
+	static bool scan(const string &, int, int, long long, long long, const function<void(const History_Entry &)> &);
+	static bool balance_at(const string &, int, long long, int &);
+	static unsigned long long next_seq(const string &);
+	static bool read_live(istream &, History_Entry &, unsigned long long *key = nullptr);
+	static void write_live(ostream &, const History_Entry &, unsigned long long key = 0);
+};
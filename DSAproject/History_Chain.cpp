@@ -0,0 +1,624 @@
+# include "History_Chain.h"
+# include "Journal.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <fstream>
+# include <algorithm>
+# include <random>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <deque>
+# include <chrono>
+# include <string.h>
+# include <limits.h>
+# include <stdlib.h>
+
+static const char RECORD_MAGIC[4] = { 'B', 'K', 'H', '2' };
+// segments chained before balances were hashed
+static const char LEGACY_MAGIC[4] = { 'B', 'K', 'H', 'C' };
+// 0x00, seq, time, account, amount, balance; legacy leaves stop before the balance
+static const size_t LEAF_BYTES = 29;
+static const size_t LEGACY_LEAF_BYTES = 25;
+// 0x01, left, right
+static const size_t NODE_BYTES = 1 + 2 * Sha256::SIZE;
+
+const unsigned History_Chain::SEGMENT_ENTRIES;
+string History_Chain::key_file;
+
+static void put(unsigned char *p, unsigned long long v, unsigned bytes)
+{
+	for (unsigned i = 0; i < bytes; i++)
+	{
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+static bool legacy(const History_Chain::Record &record)
+{
+	return memcmp(record.magic, LEGACY_MAGIC, sizeof(LEGACY_MAGIC)) == 0;
+}
+static bool known_magic(const History_Chain::Record &record)
+{
+	return memcmp(record.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) == 0 || legacy(record);
+}
+// Writes the message a posting's leaf hashes and returns its length.
+static size_t leaf_message(const History_Entry &entry, unsigned char *m, bool with_balance)
+{
+	m[0] = 0;
+	put(m + 1, entry.seq, 8);
+	put(m + 9, (unsigned long long)entry.time, 8);
+	put(m + 17, (unsigned)entry.account, 4);
+	put(m + 21, (unsigned)entry.amount, 4);
+	if (!with_balance)
+	{
+		return LEGACY_LEAF_BYTES;
+	}
+	put(m + 25, (unsigned)entry.balance, 4);
+	return LEAF_BYTES;
+}
+static void leaf_hashes(const vector <History_Entry> &entries, bool with_balance, vector <unsigned char> &out)
+{
+	size_t bytes = with_balance ? LEAF_BYTES : LEGACY_LEAF_BYTES;
+	vector <unsigned char> messages(entries.size() * bytes);
+	vector <const unsigned char*> pointers(entries.size());
+	for (size_t i = 0; i < entries.size(); i++)
+	{
+		leaf_message(entries[i], &messages[i * bytes], with_balance);
+		pointers[i] = &messages[i * bytes];
+	}
+	out.resize(entries.size() * Sha256::SIZE);
+	Sha256::hash_many(pointers.data(), pointers.size(), bytes, out.data());
+}
+// Hashes the nodes of one level in pairs; a node without a sibling moves up as it is.
+static void next_level(const vector <unsigned char> &level, vector <unsigned char> &up)
+{
+	size_t n = level.size() / Sha256::SIZE;
+	size_t pairs = n / 2;
+	vector <unsigned char> messages(pairs * NODE_BYTES);
+	vector <const unsigned char*> pointers(pairs);
+	for (size_t i = 0; i < pairs; i++)
+	{
+		messages[i * NODE_BYTES] = 1;
+		memcpy(&messages[i * NODE_BYTES + 1], &level[2 * i * Sha256::SIZE], 2 * Sha256::SIZE);
+		pointers[i] = &messages[i * NODE_BYTES];
+	}
+	up.resize((n + 1) / 2 * Sha256::SIZE);
+	Sha256::hash_many(pointers.data(), pairs, NODE_BYTES, up.data());
+	if (n % 2 == 1)
+	{
+		memcpy(&up[pairs * Sha256::SIZE], &level[(n - 1) * Sha256::SIZE], Sha256::SIZE);
+	}
+}
+static void merkle_root(vector <unsigned char> level, unsigned char *root)
+{
+	vector <unsigned char> up;
+	while (level.size() > Sha256::SIZE)
+	{
+		next_level(level, up);
+		level.swap(up);
+	}
+	memcpy(root, level.data(), Sha256::SIZE);
+}
+static void chain_hash(const unsigned char *previous, const History_Chain::Record &record, unsigned char *out)
+{
+	unsigned char message[Sha256::SIZE + 36 + Sha256::SIZE];
+	memcpy(message, previous, Sha256::SIZE);
+	put(message + 32, record.first_seq, 8);
+	put(message + 40, record.last_seq, 8);
+	put(message + 48, (unsigned long long)record.first_time, 8);
+	put(message + 56, (unsigned long long)record.last_time, 8);
+	put(message + 64, record.count, 4);
+	memcpy(message + 68, record.root, Sha256::SIZE);
+	Sha256::hash(message, sizeof(message), out);
+}
+static bool signed_by(const History_Chain::Record &record, const vector <unsigned char> &key)
+{
+	unsigned char signature[Sha256::SIZE];
+	Sha256::hmac(key.data(), key.size(), record.chain, Sha256::SIZE, signature);
+	return memcmp(signature, record.signature, Sha256::SIZE) == 0;
+}
+// Reads the signing key, or makes a new one when create is set and there is none.
+static bool load_key(const string &path, bool create, vector <unsigned char> &key)
+{
+	ifstream read(path.c_str(), ios::binary);
+	key.assign(Sha256::SIZE, 0);
+	if (read.read((char*)key.data(), key.size()))
+	{
+		return true;
+	}
+	if (!create)
+	{
+		return false;
+	}
+	random_device random;
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		key[i] = (unsigned char)random();
+	}
+	ofstream write(path.c_str(), ios::binary | ios::trunc);
+	write.write((const char*)key.data(), key.size());
+	write.close();
+	return write && Journal::sync_path(path);
+}
+// The directory a path names, made absolute with its links resolved; empty
+// when it does not exist.
+static string absolute_directory(const string &path)
+{
+	char *full;
+#ifdef _WIN32
+	full = _fullpath(nullptr, path.c_str(), 0);
+#else
+	full = realpath(path.c_str(), nullptr);
+#endif
+	if (full == nullptr)
+	{
+		return "";
+	}
+	string out = full;
+	free(full);
+	for (size_t i = 0; i < out.size(); i++)
+	{
+		if (out[i] == '\\')
+		{
+			out[i] = '/';
+		}
+	}
+	if (out.empty() || out[out.size() - 1] != '/')
+	{
+		out += '/';
+	}
+	return out;
+}
+static string parent_of(const string &path)
+{
+	size_t slash = path.find_last_of("/\\");
+	return slash == string::npos ? "." : path.substr(0, slash + 1);
+}
+static bool read_records(const string &path, vector <History_Chain::Record> &records)
+{
+	ifstream read(path.c_str(), ios::binary | ios::ate);
+	records.clear();
+	if (!read)
+	{
+		return false;
+	}
+	unsigned long long size = (unsigned long long)read.tellg();
+	records.resize((size_t)(size / sizeof(History_Chain::Record)));
+	read.seekg(0);
+	if (!records.empty() && !read.read((char*)records.data(), records.size() * sizeof(History_Chain::Record)))
+	{
+		return false;
+	}
+	Metrics::count(Metrics::BYTES_READ, records.size() * sizeof(History_Chain::Record));
+	return true;
+}
+
+// True when the key file sits outside the directory of the chain and every
+// directory below it. A key next to the history it protects proves nothing.
+bool History_Chain::key_outside(const string &key_path, const string &chain)
+{
+	if (key_path.empty())
+	{
+		return false;
+	}
+	string key_dir = absolute_directory(parent_of(key_path));
+	string ledger_dir = absolute_directory(parent_of(chain));
+	return !key_dir.empty() && !ledger_dir.empty() && key_dir.compare(0, ledger_dir.size(), ledger_dir) != 0;
+}
+History_Chain::History_Chain()
+{
+	memset(&last, 0, sizeof(last));
+	chained = false;
+	first_seq = 0;
+	last_seq = 0;
+	first_time = 0;
+	last_time = 0;
+	last_offset = 0;
+	opened = false;
+}
+History_Chain::~History_Chain()
+{
+	close();
+}
+// Opens the chain and adds the stamped postings of transaction.txt that came
+// after its last segment, which a crash left out.
+bool History_Chain::open(const string &file, const string &key_path, const string &live)
+{
+	Trace_Span span("history_chain_open");
+	close();
+	path = file;
+	leaves.clear();
+	chained = false;
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	unsigned long long size = probe ? (unsigned long long)probe.tellg() : 0;
+	probe.close();
+	unsigned long long records = size / sizeof(Record);
+	if (size % sizeof(Record) != 0)
+	{
+		// a record torn by a crash; its postings are chained again below
+		Journal::truncate_path(path, records * sizeof(Record));
+	}
+	if (records > 0)
+	{
+		ifstream read(path.c_str(), ios::binary);
+		read.seekg((streamoff)((records - 1) * sizeof(Record)));
+		chained = read.read((char*)&last, sizeof(last)) && known_magic(last);
+	}
+	if (!key_outside(key_path, path) || !load_key(key_path, !chained, key))
+	{
+		return false;
+	}
+	opened = true;
+
+	unsigned long long covered = chained ? last.last_seq : 0;
+	ifstream source(live.c_str(), ios::binary);
+	History_Entry entry;
+	unsigned long long offset = 0;
+	if (chained)
+	{
+		source.seekg((streamoff)last.last_offset);
+		if (History_Archive::read_live(source, entry) && entry.seq == last.last_seq)
+		{
+			offset = (unsigned long long)source.tellg();
+		}
+		source.clear();
+		source.seekg((streamoff)offset);
+	}
+	while (History_Archive::read_live(source, entry))
+	{
+		if (entry.seq > covered)
+		{
+			add(entry, offset);
+		}
+		offset = (unsigned long long)source.tellg();
+	}
+	return true;
+}
+// Closes the pending segment, however short.
+void History_Chain::close()
+{
+	if (!opened)
+	{
+		return;
+	}
+	close_segment();
+	opened = false;
+}
+bool History_Chain::is_open()
+{
+	return opened;
+}
+// Adds the posting written at offset in transaction.txt.
+void History_Chain::add(const History_Entry &entry, unsigned long long offset)
+{
+	if (!opened || entry.seq == 0 || entry.balance == History_Archive::NO_BALANCE || (chained && entry.seq <= last.last_seq))
+	{
+		return;
+	}
+	if (leaves.empty())
+	{
+		first_seq = entry.seq;
+		first_time = entry.time;
+	}
+	unsigned char message[LEAF_BYTES];
+	leaf_message(entry, message, true);
+	leaves.resize(leaves.size() + Sha256::SIZE);
+	Sha256::hash(message, sizeof(message), &leaves[leaves.size() - Sha256::SIZE]);
+	last_seq = entry.seq;
+	last_time = entry.time;
+	last_offset = offset;
+	if (leaves.size() == SEGMENT_ENTRIES * Sha256::SIZE)
+	{
+		close_segment();
+	}
+}
+void History_Chain::close_segment()
+{
+	if (leaves.empty())
+	{
+		return;
+	}
+	Trace_Span span("history_chain_segment");
+	Record record;
+	memset(&record, 0, sizeof(record));
+	memcpy(record.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+	record.count = (unsigned)(leaves.size() / Sha256::SIZE);
+	record.first_seq = first_seq;
+	record.last_seq = last_seq;
+	record.first_time = first_time;
+	record.last_time = last_time;
+	record.last_offset = last_offset;
+	merkle_root(leaves, record.root);
+	unsigned char zero[Sha256::SIZE] = { 0 };
+	chain_hash(chained ? last.chain : zero, record, record.chain);
+	Sha256::hmac(key.data(), key.size(), record.chain, Sha256::SIZE, record.signature);
+
+	ofstream write(path.c_str(), ios::binary | ios::app);
+	write.write((const char*)&record, sizeof(record));
+	write.close();
+	Journal::sync_path(path);
+	Metrics::count(Metrics::BYTES_WRITTEN, sizeof(record));
+	last = record;
+	chained = true;
+	leaves.clear();
+}
+
+namespace
+{
+	struct Segment_Job
+	{
+		size_t record;
+		vector <History_Entry> entries;
+	};
+
+	// Hands complete segments from the reader to the hashing threads.
+	struct Segment_Queue
+	{
+		mutex lock;
+		condition_variable ready;
+		condition_variable room;
+		deque <Segment_Job> jobs;
+		size_t limit;
+		bool done;
+
+		void push(Segment_Job &job)
+		{
+			unique_lock <mutex> guard(lock);
+			room.wait(guard, [this]() { return jobs.size() < limit; });
+			jobs.push_back(Segment_Job());
+			jobs.back().record = job.record;
+			jobs.back().entries.swap(job.entries);
+			ready.notify_one();
+		}
+		bool pop(Segment_Job &job)
+		{
+			unique_lock <mutex> guard(lock);
+			ready.wait(guard, [this]() { return !jobs.empty() || done; });
+			if (jobs.empty())
+			{
+				return false;
+			}
+			job.record = jobs.front().record;
+			job.entries.swap(jobs.front().entries);
+			jobs.pop_front();
+			room.notify_one();
+			return true;
+		}
+		void finish()
+		{
+			lock_guard <mutex> guard(lock);
+			done = true;
+			ready.notify_all();
+		}
+	};
+}
+
+static bool by_seq(const History_Entry &a, const History_Entry &b)
+{
+	return a.seq < b.seq;
+}
+static bool segment_matches(vector <History_Entry> &entries, const History_Chain::Record &record)
+{
+	sort(entries.begin(), entries.end(), by_seq);
+	if (entries.size() != record.count || entries.front().seq != record.first_seq || entries.back().seq != record.last_seq)
+	{
+		return false;
+	}
+	vector <unsigned char> leaves;
+	leaf_hashes(entries, !legacy(record), leaves);
+	unsigned char root[Sha256::SIZE];
+	merkle_root(leaves, root);
+	return memcmp(root, record.root, Sha256::SIZE) == 0;
+}
+
+// Checks the links and signatures of every record, then reads the history
+// once, archive and transaction.txt, and hashes the segments as they fill up
+// on the given number of threads.
+bool History_Chain::verify(const string &chain, const string &key_path, const string &live, const string &archive, unsigned threads, Verify_Report &report)
+{
+	Trace_Span span("history_chain_verify");
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	memset(&report, 0, sizeof(report));
+	vector <unsigned char> key;
+	vector <Record> records;
+	report.links = key_outside(key_path, chain) && load_key(key_path, false, key) && read_records(chain, records);
+	unsigned char zero[Sha256::SIZE] = { 0 };
+	for (size_t i = 0; report.links && i < records.size(); i++)
+	{
+		const Record &r = records[i];
+		unsigned char expected[Sha256::SIZE];
+		chain_hash(i == 0 ? zero : records[i - 1].chain, r, expected);
+		if (!known_magic(r) || r.count == 0 || r.first_seq > r.last_seq
+			|| (i > 0 && r.first_seq <= records[i - 1].last_seq)
+			|| memcmp(expected, r.chain, Sha256::SIZE) != 0 || !signed_by(r, key))
+		{
+			report.links = false;
+		}
+	}
+	report.segments = records.size();
+
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+	Segment_Queue queue;
+	queue.limit = 4 * threads;
+	queue.done = false;
+	vector <char> good(records.size(), 0);
+	vector <unsigned> seen(records.size(), 0);
+	vector <vector <History_Entry> > buckets(records.size());
+	vector <thread> workers;
+	for (unsigned t = 0; t < threads; t++)
+	{
+		workers.push_back(thread([&]() {
+			Segment_Job job;
+			while (queue.pop(job))
+			{
+				good[job.record] = segment_matches(job.entries, records[job.record]) ? 1 : 0;
+			}
+		}));
+	}
+	Segment_Job job;
+	auto take = [&](const History_Entry &entry) {
+		if (entry.seq == 0)
+		{
+			return;
+		}
+		report.entries++;
+		if (records.empty() || entry.seq > records.back().last_seq)
+		{
+			report.unchained++;
+			return;
+		}
+		if (entry.seq < records.front().first_seq)
+		{
+			report.older++;
+			return;
+		}
+		vector <Record>::iterator r = upper_bound(records.begin(), records.end(), entry.seq,
+			[](unsigned long long seq, const Record &record) { return seq < record.first_seq; });
+		if (r == records.begin() || entry.seq > (r - 1)->last_seq)
+		{
+			report.strays++;
+			return;
+		}
+		size_t i = (r - 1) - records.begin();
+		// a segment goes to the threads once it has as many postings as its record says
+		if (++seen[i] == records[i].count)
+		{
+			buckets[i].push_back(entry);
+			job.record = i;
+			job.entries.swap(buckets[i]);
+			queue.push(job);
+		}
+		else if (seen[i] < records[i].count)
+		{
+			buckets[i].push_back(entry);
+		}
+	};
+	History_Archive::scan(archive, INT_MIN, INT_MAX, LLONG_MIN, LLONG_MAX, take);
+	ifstream read(live.c_str(), ios::binary);
+	History_Entry entry;
+	while (History_Archive::read_live(read, entry))
+	{
+		take(entry);
+	}
+	queue.finish();
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		// short or overfull segments were never hashed, or were hashed too early
+		if (!good[i] || seen[i] != records[i].count)
+		{
+			report.bad_segments++;
+		}
+	}
+	report.seconds = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - begin).count();
+	return report.links && report.bad_segments == 0 && report.strays == 0;
+}
+
+// Builds the proof for one posting: the record of its segment and the
+// sibling hashes on the way from its leaf to the segment's root.
+bool History_Chain::prove(const string &chain, const string &live, const string &archive, unsigned long long seq, Proof &proof)
+{
+	Trace_Span span("history_chain_prove");
+	vector <Record> records;
+	if (!read_records(chain, records))
+	{
+		return false;
+	}
+	vector <Record>::iterator r = upper_bound(records.begin(), records.end(), seq,
+		[](unsigned long long s, const Record &record) { return s < record.first_seq; });
+	if (r == records.begin() || seq > (r - 1)->last_seq)
+	{
+		return false;
+	}
+	--r;
+	proof.record = *r;
+	memset(proof.previous, 0, sizeof(proof.previous));
+	if (r != records.begin())
+	{
+		memcpy(proof.previous, (r - 1)->chain, Sha256::SIZE);
+	}
+
+	vector <History_Entry> entries;
+	auto take = [&](const History_Entry &entry) {
+		if (entry.seq >= proof.record.first_seq && entry.seq <= proof.record.last_seq)
+		{
+			entries.push_back(entry);
+		}
+	};
+	History_Archive::scan(archive, INT_MIN, INT_MAX, proof.record.first_time, proof.record.last_time, take);
+	ifstream read(live.c_str(), ios::binary);
+	History_Entry entry;
+	while (History_Archive::read_live(read, entry))
+	{
+		take(entry);
+	}
+	sort(entries.begin(), entries.end(), by_seq);
+	vector <History_Entry>::iterator at = lower_bound(entries.begin(), entries.end(), seq,
+		[](const History_Entry &e, unsigned long long s) { return e.seq < s; });
+	if (entries.size() != proof.record.count || at == entries.end() || at->seq != seq)
+	{
+		return false;
+	}
+	proof.entry = *at;
+	proof.position = (unsigned)(at - entries.begin());
+	proof.path.clear();
+	proof.right.clear();
+
+	vector <unsigned char> level, up;
+	leaf_hashes(entries, !legacy(proof.record), level);
+	for (size_t position = proof.position; level.size() > Sha256::SIZE; position /= 2)
+	{
+		size_t sibling = position ^ 1;
+		if (sibling < level.size() / Sha256::SIZE)
+		{
+			proof.path.insert(proof.path.end(), &level[sibling * Sha256::SIZE], &level[sibling * Sha256::SIZE] + Sha256::SIZE);
+			proof.right.push_back(sibling > position);
+		}
+		else
+		{
+			// no sibling at this level: the node moves up unchanged
+			proof.path.insert(proof.path.end(), Sha256::SIZE, 0);
+			proof.right.push_back(false);
+		}
+		next_level(level, up);
+		level.swap(up);
+	}
+	return true;
+}
+
+// Recomputes the root from the posting and the path, the chain hash from the
+// previous one, and checks the signature with the key.
+bool History_Chain::check(const Proof &proof, const string &key_path)
+{
+	vector <unsigned char> key;
+	if (!load_key(key_path, false, key))
+	{
+		return false;
+	}
+	unsigned char message[NODE_BYTES];
+	unsigned char node[Sha256::SIZE];
+	Sha256::hash(message, leaf_message(proof.entry, message, !legacy(proof.record)), node);
+	static const unsigned char none[Sha256::SIZE] = { 0 };
+	for (size_t i = 0; i < proof.right.size(); i++)
+	{
+		const unsigned char *sibling = &proof.path[i * Sha256::SIZE];
+		if (!proof.right[i] && memcmp(sibling, none, Sha256::SIZE) == 0)
+		{
+			continue;
+		}
+		message[0] = 1;
+		memcpy(message + 1, proof.right[i] ? node : sibling, Sha256::SIZE);
+		memcpy(message + 1 + Sha256::SIZE, proof.right[i] ? sibling : node, Sha256::SIZE);
+		Sha256::hash(message, NODE_BYTES, node);
+	}
+	unsigned char chain[Sha256::SIZE];
+	chain_hash(proof.previous, proof.record, chain);
+	return memcmp(node, proof.record.root, Sha256::SIZE) == 0 && memcmp(chain, proof.record.chain, Sha256::SIZE) == 0
+		&& signed_by(proof.record, key);
+}
@@ -0,0 +1,97 @@
+#pragma once
+# include "History_Archive.h"
+# include "Sha256.h"
+# include <string>
+# include <vector>
+using namespace std;
+
+// Tamper evidence for the transaction history. Every SEGMENT_ENTRIES stamped
+// postings, and whatever is pending when the ledger closes, form a segment.
+// history.chain gets one record per segment: the Merkle root over the hashes
+// of its postings, a chain hash over the previous record's chain hash and this
+// segment, and an HMAC of the chain hash under a secret key. A changed,
+// dropped or inserted posting changes a root; a changed or dropped record
+// breaks the chain or a signature, and the newest record signs the head.
+// The key must live outside the ledger directory, where whoever can edit the
+// history cannot read it: a key file in that directory or below it is refused,
+// and without a key the history is not chained.
+// Postings are hashed by seq, time, account, amount and the balance written
+// after them, which a seal keeps, so the chain covers archived and live
+// history alike and statements cannot be forged from edited balances.
+// Entries from before postings were stamped or carried balances are not
+// covered; segments chained before balances were hashed keep their old
+// record magic and are checked without them.
+class History_Chain
+{
+public:
+	static const unsigned SEGMENT_ENTRIES = 4096;
+
+	struct Record
+	{
+		char magic[4];
+		unsigned count;
+		unsigned long long first_seq;
+		unsigned long long last_seq;
+		long long first_time;
+		long long last_time;
+		// offset of the last posting in transaction.txt when it was written
+		unsigned long long last_offset;
+		unsigned char root[Sha256::SIZE];
+		unsigned char chain[Sha256::SIZE];
+		unsigned char signature[Sha256::SIZE];
+	};
+	// A posting, the record of its segment and the sibling hashes from its
+	// leaf up to the root; right[i] tells whether path[i] is the right sibling.
+	struct Proof
+	{
+		History_Entry entry;
+		Record record;
+		unsigned char previous[Sha256::SIZE];
+		unsigned position;
+		vector <unsigned char> path;
+		vector <bool> right;
+	};
+	struct Verify_Report
+	{
+		unsigned long long segments;
+		unsigned long long entries;
+		unsigned long long bad_segments;
+		unsigned long long strays;
+		unsigned long long older;
+		unsigned long long unchained;
+		bool links;
+		double seconds;
+	};
+
+	History_Chain();
+	~History_Chain();
+	bool open(const string &, const string &, const string &);
+	void close();
+	bool is_open();
+	void add(const History_Entry &, unsigned long long);
+	static bool verify(const string &, const string &, const string &, const string &, unsigned, Verify_Report &);
+	static bool prove(const string &, const string &, const string &, unsigned long long, Proof &);
+	static bool check(const Proof &, const string &);
+
+	static bool key_outside(const string &, const string &);
+
+	// the signing key; none unless set
+	static string key_file;
+
+private:
+	History_Chain(const History_Chain &);
+	History_Chain& operator=(const History_Chain &);
+	void close_segment();
+
+	string path;
+	vector <unsigned char> key;
+	vector <unsigned char> leaves;
+	Record last;
+	bool chained;
+	unsigned long long first_seq;
+	unsigned long long last_seq;
+	long long first_time;
+	long long last_time;
+	unsigned long long last_offset;
+	bool opened;
+};
@@ -0,0 +1,562 @@
+# include "History_Index.h"
+# include "Journal.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <fstream>
+# include <algorithm>
+# include <stddef.h>
+# include <string.h>
+# include <sstream>
+# include <iomanip>
+
+static const char PARTITION_MAGIC[4] = { 'B', 'K', 'T', '2' };
+
+// The last entry of the day is kept so open() can tell whether transaction.txt
+// still matches the index, or was cut by a seal since.
+struct Partition_Header
+{
+	char magic[4];
+	unsigned accounts;
+	long long day;
+	unsigned long long entries;
+	unsigned long long live_end;
+	unsigned long long last_offset;
+	unsigned long long last_seq;
+	int last_account;
+	int last_amount;
+	// 1 when the directory lists every account seen so far
+	unsigned full;
+	unsigned pad;
+	unsigned data_checksum;
+	unsigned checksum;
+};
+
+const long long History_Index::DAY_US;
+const unsigned History_Index::CHECKPOINT_DAYS;
+
+static unsigned fnv(const void *data, size_t n, unsigned hash = 2166136261u)
+{
+	const unsigned char *bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < n; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+History_Index::History_Index()
+{
+	next_seq = 1;
+	last_time = 0;
+	open_day = -1;
+	today_entries = 0;
+	live_start = LLONG_MAX;
+	closed_end = 0;
+	opened = false;
+}
+History_Index::~History_Index()
+{
+	close();
+}
+// Loads the partition list and indexes the entries after the last closed day.
+// first_seq is the seq the archive hands out next; entries without a seq of
+// their own are counted from there.
+bool History_Index::open(const string &file, const string &live_file, unsigned long long first_seq)
+{
+	Trace_Span span("history_index_open");
+	close();
+	path = file;
+	live = live_file;
+	next_seq = first_seq;
+	last_time = 0;
+	closed_end = 0;
+
+	ifstream read(path.c_str(), ios::binary);
+	ifstream source(live.c_str(), ios::binary);
+	unsigned long long size = 0;
+	if (read)
+	{
+		read.seekg(0, ios::end);
+		size = (unsigned long long)read.tellg();
+	}
+	unsigned long long at = 0;
+	Partition_Header header;
+	History_Entry last;
+	live_start = read_entry(source, 0, last) ? last.time : LLONG_MAX;
+	while (at + sizeof(header) <= size)
+	{
+		read.clear();
+		read.seekg((streamoff)at);
+		if (!read.read((char*)&header, sizeof(header)) || memcmp(header.magic, PARTITION_MAGIC, sizeof(PARTITION_MAGIC)) != 0
+			|| header.checksum != fnv(&header, offsetof(Partition_Header, checksum)))
+		{
+			break;
+		}
+		unsigned long long bytes = header.accounts * sizeof(Directory_Entry) + header.entries * sizeof(unsigned long long);
+		if (at + sizeof(header) + bytes > size)
+		{
+			break;
+		}
+		Metrics::count(Metrics::BYTES_READ, sizeof(header));
+		if (!read_entry(source, header.last_offset, last) || last.seq != header.last_seq
+			|| last.account != header.last_account || last.amount != header.last_amount)
+		{
+			// transaction.txt was cut by a seal or replaced: index it again from the start
+			partitions.clear();
+			at = 0;
+			break;
+		}
+		Partition p;
+		p.day = header.day;
+		p.at = at;
+		p.accounts = header.accounts;
+		p.entries = header.entries;
+		p.live_end = header.live_end;
+		p.last_seq = header.last_seq;
+		p.full = header.full != 0;
+		partitions.push_back(p);
+		at += sizeof(header) + bytes;
+	}
+	if (!partitions.empty())
+	{
+		// only the newest partition can be torn by a crash
+		Partition &p = partitions.back();
+		vector <char> data((size_t)(at - p.at - sizeof(header)));
+		read.clear();
+		read.seekg((streamoff)p.at);
+		if (!read.read((char*)&header, sizeof(header)) || !read.read(data.data(), (streamsize)data.size())
+			|| fnv(data.data(), data.size()) != header.data_checksum)
+		{
+			at = p.at;
+			partitions.pop_back();
+		}
+		Metrics::count(Metrics::BYTES_READ, data.size());
+	}
+	read.close();
+	source.close();
+
+	unsigned long long legacy = 0;
+	for (size_t i = 0; i < partitions.size(); i++)
+	{
+		if (partitions[i].day == 0)
+		{
+			legacy = partitions[i].entries;
+		}
+		next_seq = max(next_seq, partitions[i].last_seq + 1);
+		last_time = max(last_time, partitions[i].day * DAY_US);
+		closed_end = partitions[i].live_end;
+	}
+
+	// drop a torn partition, or all of them when they no longer match
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	if (!probe)
+	{
+		ofstream create(path.c_str(), ios::binary);
+	}
+	else if ((unsigned long long)probe.tellg() != at)
+	{
+		probe.close();
+		Journal::truncate_path(path, at);
+	}
+	load_balances();
+	opened = true;
+	return rebuild(first_seq, legacy);
+}
+// Reads the balances at the end of the closed days back from the newest full
+// checkpoint and the partitions after it.
+void History_Index::load_balances()
+{
+	size_t first = partitions.size();
+	while (first > 0 && !partitions[first - 1].full)
+	{
+		first--;
+	}
+	first = first > 0 ? first - 1 : 0;
+	ifstream read(path.c_str(), ios::binary);
+	vector <Directory_Entry> directory;
+	for (size_t i = first; i < partitions.size(); i++)
+	{
+		directory.resize(partitions[i].accounts);
+		read.clear();
+		read.seekg((streamoff)(partitions[i].at + sizeof(Partition_Header)));
+		if (!directory.empty() && !read.read((char*)directory.data(), directory.size() * sizeof(Directory_Entry)))
+		{
+			continue;
+		}
+		Metrics::count(Metrics::BYTES_READ, directory.size() * sizeof(Directory_Entry));
+		for (size_t j = 0; j < directory.size(); j++)
+		{
+			balances[directory[j].account] = directory[j].balance;
+		}
+	}
+}
+void History_Index::close()
+{
+	// the current day is not written; open() indexes it again from transaction.txt
+	partitions.clear();
+	today.clear();
+	balances.clear();
+	today_entries = 0;
+	open_day = -1;
+	opened = false;
+}
+bool History_Index::is_open()
+{
+	return opened;
+}
+// Indexes the entries of transaction.txt after the closed days.
+bool History_Index::rebuild(unsigned long long first_seq, unsigned long long legacy)
+{
+	ifstream read(live.c_str(), ios::binary);
+	if (!read)
+	{
+		return true;
+	}
+	read.seekg((streamoff)closed_end);
+	History_Entry entry;
+	unsigned long long offset = closed_end;
+	while (History_Archive::read_live(read, entry))
+	{
+		if (entry.seq == 0)
+		{
+			legacy++;
+		}
+		add(entry, offset);
+		offset = (unsigned long long)read.tellg();
+	}
+	read.clear();
+	read.seekg(0, ios::end);
+	Metrics::count(Metrics::BYTES_READ, (unsigned long long)read.tellg() - closed_end);
+	// entries without a seq are numbered from the archive's next seq when they
+	// are sealed, so new postings come after them
+	next_seq = max(next_seq, first_seq + legacy);
+	return true;
+}
+// An offset in transaction.txt at or before the first entry from a time on:
+// the end of the last closed day before that time's day.
+unsigned long long History_Index::offset_since(long long time)
+{
+	long long day = time / DAY_US;
+	unsigned long long offset = 0;
+	for (size_t i = 0; i < partitions.size() && partitions[i].day < day; i++)
+	{
+		offset = partitions[i].live_end;
+	}
+	return offset;
+}
+// Adds the entry written at offset in transaction.txt.
+void History_Index::add(const History_Entry &entry, unsigned long long offset)
+{
+	long long day = entry.time / DAY_US;
+	if (open_day >= 0 && day > open_day)
+	{
+		closed_end = offset;
+		close_day();
+	}
+	if (open_day < 0 || day > open_day)
+	{
+		open_day = day;
+	}
+	today[entry.account].push_back(offset);
+	today_entries++;
+	live_start = min(live_start, entry.time);
+	unordered_map <int, int>::iterator known = balances.find(entry.account);
+	if (entry.balance != History_Archive::NO_BALANCE)
+		balances[entry.account] = entry.balance;
+	else if (known == balances.end())
+		balances[entry.account] = History_Archive::NO_BALANCE;
+	else if (known->second != History_Archive::NO_BALANCE)
+		known->second += entry.amount;
+	if (entry.seq >= next_seq)
+	{
+		next_seq = entry.seq + 1;
+	}
+	last_time = max(last_time, entry.time);
+}
+// Writes the current day as a partition.
+void History_Index::close_day()
+{
+	if (today.empty())
+	{
+		return;
+	}
+	Trace_Span span("history_close_day");
+	size_t since = 0;
+	while (since < partitions.size() && !partitions[partitions.size() - 1 - since].full)
+	{
+		since++;
+	}
+	bool full = since == partitions.size() || since + 1 >= CHECKPOINT_DAYS;
+	vector <int> accounts;
+	if (full)
+	{
+		accounts.reserve(balances.size());
+		for (unordered_map <int, int>::iterator it = balances.begin(); it != balances.end(); ++it)
+		{
+			accounts.push_back(it->first);
+		}
+	}
+	else
+	{
+		accounts.reserve(today.size());
+		for (unordered_map <int, vector <unsigned long long> >::iterator it = today.begin(); it != today.end(); ++it)
+		{
+			accounts.push_back(it->first);
+		}
+	}
+	sort(accounts.begin(), accounts.end());
+	vector <Directory_Entry> directory(accounts.size());
+	vector <unsigned long long> offsets;
+	offsets.reserve((size_t)today_entries);
+	unsigned long long last_offset = 0;
+	for (size_t i = 0; i < accounts.size(); i++)
+	{
+		memset(&directory[i], 0, sizeof(Directory_Entry));
+		directory[i].account = accounts[i];
+		directory[i].balance = balances[accounts[i]];
+		directory[i].first = offsets.size();
+		unordered_map <int, vector <unsigned long long> >::iterator mine = today.find(accounts[i]);
+		if (mine == today.end())
+		{
+			continue;
+		}
+		directory[i].count = (unsigned)mine->second.size();
+		offsets.insert(offsets.end(), mine->second.begin(), mine->second.end());
+		last_offset = max(last_offset, mine->second.back());
+	}
+
+	Partition_Header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PARTITION_MAGIC, sizeof(PARTITION_MAGIC));
+	header.accounts = (unsigned)directory.size();
+	header.day = open_day;
+	header.entries = offsets.size();
+	header.live_end = closed_end;
+	header.last_offset = last_offset;
+	header.full = full ? 1 : 0;
+	History_Entry last;
+	ifstream source(live.c_str(), ios::binary);
+	if (read_entry(source, last_offset, last))
+	{
+		header.last_seq = last.seq;
+		header.last_account = last.account;
+		header.last_amount = last.amount;
+	}
+	unsigned hash = fnv(directory.data(), directory.size() * sizeof(Directory_Entry));
+	header.data_checksum = fnv(offsets.data(), offsets.size() * sizeof(unsigned long long), hash);
+	header.checksum = fnv(&header, offsetof(Partition_Header, checksum));
+
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	Partition p;
+	p.day = open_day;
+	p.at = probe ? (unsigned long long)probe.tellg() : 0;
+	p.accounts = header.accounts;
+	p.entries = header.entries;
+	p.live_end = header.live_end;
+	p.last_seq = header.last_seq;
+	p.full = full;
+	probe.close();
+	ofstream write(path.c_str(), ios::binary | ios::app);
+	write.write((const char*)&header, sizeof(header));
+	write.write((const char*)directory.data(), directory.size() * sizeof(Directory_Entry));
+	write.write((const char*)offsets.data(), offsets.size() * sizeof(unsigned long long));
+	write.close();
+	Metrics::count(Metrics::BYTES_WRITTEN, sizeof(header) + directory.size() * sizeof(Directory_Entry) + offsets.size() * sizeof(unsigned long long));
+	partitions.push_back(p);
+	today.clear();
+	today_entries = 0;
+}
+bool History_Index::read_entry(ifstream &read, unsigned long long offset, History_Entry &entry)
+{
+	read.clear();
+	read.seekg((streamoff)offset);
+	return History_Archive::read_live(read, entry);
+}
+// Binary search for the account in the directory of a day.
+bool History_Index::find_directory(ifstream &read, const Partition &p, int account, Directory_Entry &dir)
+{
+	unsigned lo = 0;
+	unsigned hi = p.accounts;
+	while (lo < hi)
+	{
+		unsigned mid = lo + (hi - lo) / 2;
+		read.clear();
+		read.seekg((streamoff)(p.at + sizeof(Partition_Header) + mid * sizeof(Directory_Entry)));
+		if (!read.read((char*)&dir, sizeof(dir)))
+		{
+			return false;
+		}
+		Metrics::count(Metrics::BYTES_READ, sizeof(dir));
+		if (dir.account == account)
+		{
+			return true;
+		}
+		if (dir.account < account)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return false;
+}
+bool History_Index::read_offsets(ifstream &read, const Partition &p, const Directory_Entry &dir, vector <unsigned long long> &offsets)
+{
+	offsets.resize(dir.count);
+	if (offsets.empty())
+	{
+		return true;
+	}
+	read.clear();
+	read.seekg((streamoff)(p.at + sizeof(Partition_Header) + p.accounts * sizeof(Directory_Entry) + dir.first * sizeof(unsigned long long)));
+	if (!read.read((char*)offsets.data(), offsets.size() * sizeof(unsigned long long)))
+	{
+		return false;
+	}
+	Metrics::count(Metrics::BYTES_READ, offsets.size() * sizeof(unsigned long long));
+	return true;
+}
+// Visits the entries of an account stamped between from and to, inclusive, in
+// seq order. Only the partitions of the days in that range are looked at.
+void History_Index::find(int account, long long from, long long to, const function<void(const History_Entry &)> &visit)
+{
+	ifstream source(live.c_str(), ios::binary);
+	ifstream read(path.c_str(), ios::binary);
+	long long first_day = from <= 0 ? 0 : from / DAY_US;
+	long long last_day = to < 0 ? -1 : to / DAY_US;
+	History_Entry entry;
+	vector <unsigned long long> offsets;
+	vector <Partition>::iterator p = lower_bound(partitions.begin(), partitions.end(), first_day,
+		[](const Partition &part, long long day) { return part.day < day; });
+	for (; p != partitions.end() && p->day <= last_day; ++p)
+	{
+		Directory_Entry dir;
+		if (!find_directory(read, *p, account, dir) || !read_offsets(read, *p, dir, offsets))
+		{
+			continue;
+		}
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			if (read_entry(source, offsets[i], entry) && entry.time >= from && entry.time <= to)
+			{
+				visit(entry);
+			}
+		}
+	}
+	unordered_map <int, vector <unsigned long long> >::iterator mine = today.find(account);
+	if (mine == today.end() || open_day < first_day || open_day > last_day)
+	{
+		return;
+	}
+	for (size_t i = 0; i < mine->second.size(); i++)
+	{
+		if (read_entry(source, mine->second[i], entry) && entry.time >= from && entry.time <= to)
+		{
+			visit(entry);
+		}
+	}
+}
+// The balance of an account at a time: the checkpoint of that day, or of the
+// last day before it on which the account posted, less what it posted later
+// that day. False when no checkpoint is found before a full one, or when
+// postings after time may have been sealed; balance is NO_BALANCE when the
+// entries were written before balances were recorded.
+bool History_Index::balance_at(int account, long long time, int &balance)
+{
+	if (time < live_start)
+	{
+		return false;
+	}
+	ifstream source(live.c_str(), ios::binary);
+	ifstream read(path.c_str(), ios::binary);
+	long long day = time < 0 ? -1 : time / DAY_US;
+	History_Entry entry;
+	vector <unsigned long long> offsets;
+	// what the account posted after time on the day of its checkpoint
+	auto later = [&](long long checkpoint) {
+		balance = (int)checkpoint;
+		if (checkpoint == History_Archive::NO_BALANCE)
+		{
+			return;
+		}
+		for (size_t i = 0; i < offsets.size(); i++)
+		{
+			if (read_entry(source, offsets[i], entry) && entry.time > time)
+			{
+				checkpoint -= entry.amount;
+			}
+		}
+		balance = (int)checkpoint;
+	};
+
+	unordered_map <int, vector <unsigned long long> >::iterator mine = today.find(account);
+	if (open_day >= 0 && open_day <= day && mine != today.end())
+	{
+		offsets = mine->second;
+		if (open_day < day)
+		{
+			offsets.clear();
+		}
+		later(balances[account]);
+		return true;
+	}
+	vector <Partition>::iterator p = upper_bound(partitions.begin(), partitions.end(), day,
+		[](long long d, const Partition &part) { return d < part.day; });
+	while (p != partitions.begin())
+	{
+		--p;
+		Directory_Entry dir;
+		if (find_directory(read, *p, account, dir))
+		{
+			offsets.clear();
+			if (p->day == day && !read_offsets(read, *p, dir, offsets))
+			{
+				return false;
+			}
+			later(dir.balance);
+			return true;
+		}
+		if (p->full)
+		{
+			break;
+		}
+	}
+	return false;
+}
+// Microseconds at the start of a YYYYMMDD date (UTC), or -1 if it is not a date.
+long long History_Index::date_start(int date)
+{
+	int y = date / 10000;
+	unsigned m = (unsigned)(date / 100 % 100);
+	unsigned d = (unsigned)(date % 100);
+	if (date <= 0 || y < 1970 || m < 1 || m > 12 || d < 1 || d > 31)
+	{
+		return -1;
+	}
+	// days from civil, proleptic Gregorian calendar
+	y -= m <= 2;
+	long long era = y / 400;
+	unsigned yoe = (unsigned)(y - era * 400);
+	unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return (era * 146097 + (long long)doe - 719468) * DAY_US;
+}
+// "YYYY-MM-DD hh:mm:ss" in UTC.
+string History_Index::format_time(long long us)
+{
+	long long days = us / DAY_US;
+	long long seconds = us % DAY_US / 1000000;
+	// civil from days
+	days += 719468;
+	long long era = days / 146097;
+	unsigned doe = (unsigned)(days - era * 146097);
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned d = doy - (153 * mp + 2) / 5 + 1;
+	unsigned m = mp < 10 ? mp + 3 : mp - 9;
+	long long y = (long long)yoe + era * 400 + (m <= 2);
+	ostringstream text;
+	text << setfill('0') << setw(4) << y << "-" << setw(2) << m << "-" << setw(2) << d << " "
+		<< setw(2) << seconds / 3600 << ":" << setw(2) << seconds / 60 % 60 << ":" << setw(2) << seconds % 60;
+	return text.str();
+}
@@ -0,0 +1,91 @@
+#pragma once
+# include "History_Archive.h"
+# include <string>
+# include <fstream>
+# include <vector>
+# include <unordered_map>
+# include <functional>
+using namespace std;
+
+// Time-partitioned index over transaction.txt. Every closed day is one
+// partition in history.tix: a directory of the accounts that posted that day,
+// sorted so an account is found by binary search, and the offsets of their
+// entries in transaction.txt. The current day is kept in memory and rebuilt
+// from the tail of transaction.txt on open. A query for one account between
+// two times visits only the partitions of those days and reads only that
+// account's entries. Entries written before they carried a time are indexed
+// under day 0.
+//
+// The directory also holds each account's balance at the end of the day, a
+// checkpoint for balance queries, and every CHECKPOINT_DAYS-th partition is
+// a full checkpoint listing every account seen so far. A balance as of some
+// time is then the last checkpoint before it, found within CHECKPOINT_DAYS
+// partitions, less what was posted later that same day.
+class History_Index
+{
+public:
+	static const long long DAY_US = 86400000000LL;
+	static const unsigned CHECKPOINT_DAYS = 7;
+
+	History_Index();
+	~History_Index();
+	bool open(const string &, const string &, unsigned long long);
+	void close();
+	bool is_open();
+	void add(const History_Entry &, unsigned long long);
+	void find(int, long long, long long, const function<void(const History_Entry &)> &);
+	bool balance_at(int, long long, int &);
+	unsigned long long offset_since(long long);
+	static long long date_start(int);
+	static string format_time(long long);
+
+	// seq for the next posting, and the latest time stamped so far
+	unsigned long long next_seq;
+	long long last_time;
+
+private:
+	struct Partition
+	{
+		long long day;
+		unsigned long long at;
+		unsigned accounts;
+		unsigned long long entries;
+		unsigned long long live_end;
+		unsigned long long last_seq;
+		bool full;
+	};
+	struct Directory_Entry
+	{
+		int account;
+		unsigned count;
+		// position of the account's first offset in the partition
+		unsigned long long first;
+		// balance at the end of the day
+		int balance;
+		unsigned reserved;
+	};
+
+	void close_day();
+	bool rebuild(unsigned long long, unsigned long long);
+	bool read_entry(ifstream &, unsigned long long, History_Entry &);
+	bool find_directory(ifstream &, const Partition &, int, Directory_Entry &);
+	bool read_offsets(ifstream &, const Partition &, const Directory_Entry &, vector <unsigned long long> &);
+	void load_balances();
+
+	string path;
+	string live;
+	vector <Partition> partitions;
+	long long open_day;
+	unordered_map <int, vector <unsigned long long> > today;
+	// latest balance of every account in transaction.txt
+	unordered_map <int, int> balances;
+	unsigned long long today_entries;
+	// time of the first entry in transaction.txt; what came before was sealed
+	long long live_start;
+	// offset in transaction.txt just past the last entry of the closed days
+	unsigned long long closed_end;
+	bool opened;
+
+	History_Index(const History_Index &);
+	History_Index& operator=(const History_Index &);
+};
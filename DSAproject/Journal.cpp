@@ -0,0 +1,241 @@
+# include "Journal.h"
+# include "Metrics.h"
+# include <fstream>
+# include <chrono>
+# include <string.h>
+# ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+# include <share.h>
+# include <sys/stat.h>
+# else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# endif
+
+static int open_file(const string &path, bool append)
+{
+	int fd = -1;
+#ifdef _WIN32
+	int flags = _O_RDWR | _O_CREAT | _O_BINARY | (append ? _O_APPEND : 0);
+	_sopen_s(&fd, path.c_str(), flags, _SH_DENYNO, _S_IREAD | _S_IWRITE);
+#else
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | (append ? O_APPEND : 0), 0644);
+#endif
+	return fd;
+}
+static void close_file(int fd)
+{
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+}
+static bool write_file(int fd, const char *data, size_t n)
+{
+	while (n > 0)
+	{
+#ifdef _WIN32
+		int wrote = _write(fd, data, (unsigned)n);
+#else
+		ssize_t wrote = ::write(fd, data, n);
+#endif
+		if (wrote <= 0)
+		{
+			return false;
+		}
+		data += wrote;
+		n -= (size_t)wrote;
+	}
+	return true;
+}
+static bool sync_file(int fd)
+{
+	Metrics::count(Metrics::FSYNCS);
+#ifdef _WIN32
+	return _commit(fd) == 0;
+#else
+	return fsync(fd) == 0;
+#endif
+}
+static bool truncate_file(int fd, unsigned long long size)
+{
+#ifdef _WIN32
+	return _chsize_s(fd, (long long)size) == 0;
+#else
+	return ftruncate(fd, (off_t)size) == 0;
+#endif
+}
+
+Journal::Journal()
+{
+	fd = -1;
+	next_seq = 1;
+	size = 0;
+	durable = 0;
+}
+Journal::~Journal()
+{
+	close();
+}
+unsigned Journal::checksum(const Journal_Record &rec)
+{
+	// FNV-1a over every field in front of the checksum, then over the flags
+	// if any are set, so records written before there were flags still match
+	const unsigned char *bytes = (const unsigned char*)&rec;
+	size_t n = (const char*)&rec.checksum - (const char*)&rec;
+	unsigned hash = 2166136261u;
+	for (size_t i = 0; i < n; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 16777619u;
+	}
+	const unsigned char *flags = (const unsigned char*)&rec.flags;
+	for (size_t i = 0; rec.flags != 0 && i < sizeof(rec.flags); i++)
+	{
+		hash ^= flags[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+// Wall-clock microseconds, comparable between processes on one machine.
+long long Journal::now_us()
+{
+	return (long long)chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+}
+bool Journal::open(const string &file)
+{
+	close();
+	path = file;
+	next_seq = 1;
+	size = 0;
+	fd = open_file(path, true);
+	if (fd < 0)
+	{
+		return false;
+	}
+	unsigned long long expected = 0;
+	scan(0, [&](const Journal_Record &rec, unsigned long long end) {
+		if (expected != 0 && rec.seq != expected)
+		{
+			return false;
+		}
+		expected = rec.seq + 1;
+		next_seq = expected;
+		size = end;
+		return true;
+	});
+	ifstream probe(path.c_str(), ios::binary | ios::ate);
+	unsigned long long on_disk = (unsigned long long)probe.tellg();
+	probe.close();
+	if (on_disk > size)
+	{
+		// drop the torn or unchecked tail of an interrupted write
+		truncate_file(fd, size);
+		sync_file(fd);
+	}
+	durable = size;
+	return true;
+}
+void Journal::close()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	sync();
+	close_file(fd);
+	fd = -1;
+}
+void Journal::append(Journal_Record &rec)
+{
+	rec.seq = next_seq++;
+	if (rec.time == 0)
+	{
+		rec.time = now_us();
+	}
+	rec.checksum = checksum(rec);
+	const char *bytes = (const char*)&rec;
+	pending.insert(pending.end(), bytes, bytes + sizeof(Journal_Record));
+}
+// Appends a record that already has its sequence number, as shipped from another journal.
+bool Journal::copy(const Journal_Record &rec)
+{
+	if (rec.checksum != checksum(rec) || rec.seq != next_seq)
+	{
+		return false;
+	}
+	next_seq++;
+	const char *bytes = (const char*)&rec;
+	pending.insert(pending.end(), bytes, bytes + sizeof(Journal_Record));
+	return true;
+}
+bool Journal::sync()
+{
+	if (pending.empty())
+	{
+		return true;
+	}
+	if (fd < 0 || !write_file(fd, pending.data(), pending.size()) || !sync_file(fd))
+	{
+		return false;
+	}
+	Metrics::count(Metrics::BYTES_WRITTEN, pending.size());
+	size += pending.size();
+	durable = size;
+	pending.clear();
+	return true;
+}
+bool Journal::scan(unsigned long long offset, const function<bool(const Journal_Record &, unsigned long long)> &visit)
+{
+	return scan_file(path, offset, visit);
+}
+// Reads checksummed records from offset until the first bad or partial one.
+bool Journal::scan_file(const string &path, unsigned long long offset, const function<bool(const Journal_Record &, unsigned long long)> &visit)
+{
+	ifstream read(path.c_str(), ios::binary);
+	if (!read)
+	{
+		return false;
+	}
+	read.seekg((streamoff)offset);
+	Journal_Record rec;
+	while (read.read((char*)&rec, sizeof(rec)))
+	{
+		if (rec.checksum != checksum(rec))
+		{
+			break;
+		}
+		offset += sizeof(rec);
+		Metrics::count(Metrics::BYTES_READ, sizeof(rec));
+		if (!visit(rec, offset))
+		{
+			break;
+		}
+	}
+	return true;
+}
+bool Journal::sync_path(const string &file)
+{
+	int handle = open_file(file, false);
+	if (handle < 0)
+	{
+		return false;
+	}
+	bool ok = sync_file(handle);
+	close_file(handle);
+	return ok;
+}
+bool Journal::truncate_path(const string &file, unsigned long long length)
+{
+	int handle = open_file(file, false);
+	if (handle < 0)
+	{
+		return false;
+	}
+	bool ok = truncate_file(handle, length);
+	close_file(handle);
+	return ok;
+}
@@ -0,0 +1,78 @@
+#pragma once
+# include <string>
+# include <vector>
+# include <functional>
+# include <atomic>
+using namespace std;
+
+// One committed change to a ledger. Balances are stored after the change, so
+// replaying a record is idempotent.
+struct Journal_Record
+{
+	enum Type
+	{
+		OPEN = 1,
+		CLOSE,
+		DEPOSIT,
+		WITHDRAW,
+		LOCAL_TRANSFER,
+		RESERVE,
+		CREDIT,
+		COMMIT,
+		ABORT,
+		ESCROW_DEPOSIT,
+		ESCROW_TRANSFER,
+		ESCROW_RELEASE
+	};
+	enum Flag
+	{
+		// the sending side of this RESERVE/CREDIT/COMMIT/ABORT is an escrow slot
+		FROM_ESCROW = 1
+	};
+
+	unsigned long long seq;
+	unsigned long long txid;
+	long long time;
+	int type;
+	int account;
+	int counterparty;
+	int amount;
+	int balance;
+	int counter_balance;
+	unsigned checksum;
+	unsigned flags;
+};
+
+// Append-only file of fixed-size, checksummed records. Appends are buffered
+// until sync(), which writes them and forces them to disk, so a batch of
+// records costs one fsync. A torn tail left by a crash is cut off on open.
+class Journal
+{
+public:
+	Journal();
+	~Journal();
+	bool open(const string &);
+	void close();
+	void append(Journal_Record &);
+	bool copy(const Journal_Record &);
+	bool sync();
+	bool scan(unsigned long long, const function<bool(const Journal_Record &, unsigned long long)> &);
+	static bool scan_file(const string &, unsigned long long, const function<bool(const Journal_Record &, unsigned long long)> &);
+	static bool sync_path(const string &);
+	static bool truncate_path(const string &, unsigned long long);
+	static unsigned checksum(const Journal_Record &);
+	static long long now_us();
+
+	string path;
+	unsigned long long next_seq;
+	unsigned long long size;
+	// bytes known to be on disk; safe to read from other threads
+	atomic<unsigned long long> durable;
+
+private:
+	Journal(const Journal &);
+	Journal& operator=(const Journal &);
+
+	int fd;
+	vector <char> pending;
+};
@@ -0,0 +1,120 @@
+# include "Kdf_Pool.h"
+# include "Scrypt.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include <random>
+
+const unsigned Kdf_Pool::MAX_THREADS;
+const unsigned Kdf_Pool::R;
+const unsigned Kdf_Pool::P;
+const unsigned Kdf_Pool::SALT_SIZE;
+const unsigned Kdf_Pool::HASH_SIZE;
+
+namespace
+{
+	// Jobs of one run() still to finish.
+	struct Batch
+	{
+		size_t left;
+	};
+}
+
+Kdf_Pool::Kdf_Pool()
+{
+	stopping = false;
+}
+Kdf_Pool::~Kdf_Pool()
+{
+	{
+		lock_guard <mutex> guard(pool_lock);
+		stopping = true;
+		ready.notify_all();
+	}
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+}
+// Derives the hash of every job and returns when all of them are done.
+void Kdf_Pool::run(const vector <Job *> &jobs)
+{
+	if (jobs.empty())
+	{
+		return;
+	}
+	Trace_Span span("kdf_run");
+	Batch batch;
+	batch.left = jobs.size();
+	unique_lock <mutex> guard(pool_lock);
+	if (workers.empty())
+	{
+		unsigned n = thread::hardware_concurrency();
+		n = n == 0 ? 1 : (n > MAX_THREADS ? MAX_THREADS : n);
+		for (unsigned i = 0; i < n; i++)
+		{
+			workers.push_back(thread(&Kdf_Pool::work, this));
+		}
+	}
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		jobs[i]->batch = &batch;
+		queue.push_back(jobs[i]);
+	}
+	ready.notify_all();
+	finished.wait(guard, [&batch]() { return batch.left == 0; });
+}
+unsigned Kdf_Pool::threads()
+{
+	lock_guard <mutex> guard(pool_lock);
+	return (unsigned)workers.size();
+}
+void Kdf_Pool::work()
+{
+	// each thread keeps its scrypt table between jobs
+	vector <unsigned> scratch;
+	unique_lock <mutex> guard(pool_lock);
+	while (true)
+	{
+		ready.wait(guard, [this]() { return stopping || !queue.empty(); });
+		if (queue.empty())
+		{
+			return;
+		}
+		Job *job = queue.front();
+		queue.pop_front();
+		guard.unlock();
+		derive(*job, scratch);
+		guard.lock();
+		if (--((Batch*)job->batch)->left == 0)
+		{
+			finished.notify_all();
+		}
+	}
+}
+void Kdf_Pool::derive(Job &job, vector <unsigned> &scratch)
+{
+	Metrics_Timer timer(Metrics::KDF);
+	unsigned char password[4];
+	for (unsigned i = 0; i < 4; i++)
+	{
+		password[i] = (unsigned char)((unsigned)job.password >> (8 * i));
+	}
+	Scrypt::derive(password, sizeof(password), job.salt, SALT_SIZE, job.cost, R, P, job.hash, HASH_SIZE, scratch);
+}
+void Kdf_Pool::make_salt(unsigned char *salt)
+{
+	random_device random;
+	for (unsigned i = 0; i < SALT_SIZE; i += 4)
+	{
+		unsigned v = random();
+		for (unsigned k = 0; k < 4; k++)
+		{
+			salt[i + k] = (unsigned char)(v >> (8 * k));
+		}
+	}
+}
+Kdf_Pool& Kdf_Pool::bank()
+{
+	static Kdf_Pool pool;
+	return pool;
+}
@@ -0,0 +1,53 @@
+#pragma once
+# include <vector>
+# include <deque>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+using namespace std;
+
+// Threads that run password derivations, so the menus and the kiosk owner
+// hand them off and a batch of them runs in parallel. Every derivation holds
+// 128 * R * 2^cost bytes while it runs, so the pool has at most MAX_THREADS
+// threads whatever the machine, and that bounds the memory at peak hours.
+// The threads are started on first use.
+class Kdf_Pool
+{
+public:
+	static const unsigned MAX_THREADS = 8;
+	// scrypt block size and parallelism; the cost is kept with each hash
+	static const unsigned R = 8;
+	static const unsigned P = 1;
+	static const unsigned SALT_SIZE = 16;
+	static const unsigned HASH_SIZE = 32;
+
+	struct Job
+	{
+		int password;
+		unsigned cost;
+		unsigned char salt[SALT_SIZE];
+		unsigned char hash[HASH_SIZE];
+		// set by run()
+		void *batch;
+	};
+
+	Kdf_Pool();
+	~Kdf_Pool();
+	void run(const vector <Job *> &);
+	unsigned threads();
+	static void derive(Job &, vector <unsigned> &);
+	static void make_salt(unsigned char *);
+	static Kdf_Pool& bank();
+
+private:
+	Kdf_Pool(const Kdf_Pool &);
+	Kdf_Pool& operator=(const Kdf_Pool &);
+	void work();
+
+	mutex pool_lock;
+	condition_variable ready;
+	condition_variable finished;
+	deque <Job *> queue;
+	vector <thread> workers;
+	bool stopping;
+};
@@ -0,0 +1,54 @@
+# include "Ledger_Lock.h"
+# ifdef _WIN32
+# include <io.h>
+# include <fcntl.h>
+# include <share.h>
+# include <sys/stat.h>
+# else
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/file.h>
+# endif
+
+Ledger_Lock::Ledger_Lock()
+{
+	fd = -1;
+}
+Ledger_Lock::~Ledger_Lock()
+{
+	release();
+}
+// Takes the directory without waiting; false when another process holds it.
+bool Ledger_Lock::acquire(const string &directory)
+{
+	release();
+	string path = directory + "ledger.lock";
+#ifdef _WIN32
+	_sopen_s(&fd, path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _SH_DENYRW, _S_IREAD | _S_IWRITE);
+#else
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		::close(fd);
+		fd = -1;
+	}
+#endif
+	return fd >= 0;
+}
+void Ledger_Lock::release()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+	fd = -1;
+}
+bool Ledger_Lock::held()
+{
+	return fd >= 0;
+}
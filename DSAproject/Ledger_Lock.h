@@ -0,0 +1,26 @@
+#pragma once
+# include <string>
+using namespace std;
+
+// Exclusive hold on a ledger directory for one writer process. Every process
+// that posts to the ledger in a directory (the staff and admin menus, the
+// kiosk table owner, sealing history, a restore) takes it first, so a
+// second writer is refused instead of posting from its own copy of the
+// accounts and overwriting the first. The hold is an OS lock on ledger.lock
+// (flock, or a file opened without sharing on Windows), so it is released
+// when the process exits, however it exits.
+class Ledger_Lock
+{
+public:
+	Ledger_Lock();
+	~Ledger_Lock();
+	bool acquire(const string &);
+	void release();
+	bool held();
+
+private:
+	Ledger_Lock(const Ledger_Lock &);
+	Ledger_Lock& operator=(const Ledger_Lock &);
+
+	int fd;
+};
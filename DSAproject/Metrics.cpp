@@ -0,0 +1,336 @@
+# include "Metrics.h"
+# include <atomic>
+# include <mutex>
+# include <vector>
+# include <fstream>
+# include <iomanip>
+
+static const char* operation_names[Metrics::OPERATIONS] =
+{
+	"search", "match", "deposit", "withdraw", "transfer",
+	"load_server", "update_server", "history_scan", "velocity_check",
+	"kdf", "interactive", "online", "batch",
+	"prefix_search"
+};
+static const char* counter_names[Metrics::COUNTERS] =
+{
+	"bytes_read", "bytes_written", "files_rewritten", "fsyncs",
+	"filter_lookups", "filter_negatives", "filter_false_positives",
+	"velocity_refusals", "cross_shard_transfers", "escrow_credits", "escrow_sweeps",
+	"account_writes", "batched_postings", "history_blocks_decoded", "history_blocks_skipped",
+	"snapshot_pages_saved", "sessions_opened", "sessions_expired",
+	"deduped_postings", "batch_deferred", "batch_shed"
+};
+static const char* gauge_names[Metrics::GAUGES] =
+{
+	"interactive_queue", "online_queue", "batch_queue", "interactive_p99_us"
+};
+static atomic<long long> gauges[Metrics::GAUGES];
+
+// Only the owning thread writes a block, so updates are plain relaxed
+// load/store pairs instead of locked read-modify-writes.
+struct Thread_Block
+{
+	atomic<unsigned long long> histogram[Metrics::OPERATIONS][Metrics::BUCKETS];
+	atomic<unsigned long long> total_ticks[Metrics::OPERATIONS];
+	atomic<unsigned long long> max_ticks[Metrics::OPERATIONS];
+	atomic<unsigned long long> counters[Metrics::COUNTERS];
+
+	Thread_Block()
+	{
+		for (unsigned op = 0; op < Metrics::OPERATIONS; op++)
+		{
+			for (unsigned b = 0; b < Metrics::BUCKETS; b++)
+			{
+				histogram[op][b].store(0, memory_order_relaxed);
+			}
+			total_ticks[op].store(0, memory_order_relaxed);
+			max_ticks[op].store(0, memory_order_relaxed);
+		}
+		for (unsigned c = 0; c < Metrics::COUNTERS; c++)
+		{
+			counters[c].store(0, memory_order_relaxed);
+		}
+	}
+};
+
+static mutex& registry_lock()
+{
+	static mutex lock;
+	return lock;
+}
+static vector <Thread_Block*>& registry()
+{
+	// blocks outlive their threads so a snapshot still sees finished work
+	static vector <Thread_Block*> blocks;
+	return blocks;
+}
+static thread_local Thread_Block *local_block = nullptr;
+static const unsigned long long origin_ticks = Metrics::now();
+static const chrono::steady_clock::time_point origin_time = chrono::steady_clock::now();
+
+static Thread_Block* local()
+{
+	if (local_block == nullptr)
+	{
+		local_block = new Thread_Block();
+		lock_guard <mutex> guard(registry_lock());
+		registry().push_back(local_block);
+	}
+	return local_block;
+}
+static void bump(atomic<unsigned long long> &value, unsigned long long n)
+{
+	value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+static unsigned highest_bit(unsigned long long v)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+	unsigned long i;
+	_BitScanReverse64(&i, v);
+	return i;
+#elif defined(_MSC_VER)
+	unsigned long i;
+	if (_BitScanReverse(&i, (unsigned long)(v >> 32)))
+		return i + 32;
+	_BitScanReverse(&i, (unsigned long)v);
+	return i;
+#else
+	return 63 - __builtin_clzll(v);
+#endif
+}
+
+unsigned Metrics::bucket(unsigned long long v)
+{
+	if (v < SUB_BUCKETS)
+	{
+		return (unsigned)v;
+	}
+	unsigned e = highest_bit(v);
+	return (e - 3) * SUB_BUCKETS + (unsigned)((v >> (e - 4)) & (SUB_BUCKETS - 1));
+}
+unsigned long long Metrics::bucket_value(unsigned b)
+{
+	if (b < SUB_BUCKETS)
+	{
+		return b;
+	}
+	unsigned e = b / SUB_BUCKETS + 3;
+	unsigned long long low = (unsigned long long)(SUB_BUCKETS + b % SUB_BUCKETS) << (e - 4);
+	return low + ((1ULL << (e - 4)) >> 1);
+}
+double Metrics::ns_per_tick()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	// calibrate the TSC against the steady clock over the process lifetime,
+	// waiting briefly if the process has only just started
+	chrono::steady_clock::time_point end = chrono::steady_clock::now();
+	while (end - origin_time < chrono::milliseconds(10))
+	{
+		end = chrono::steady_clock::now();
+	}
+	unsigned long long ticks = now() - origin_ticks;
+	double ns = (double)chrono::duration_cast<chrono::nanoseconds>(end - origin_time).count();
+	return ticks ? ns / ticks : 1.0;
+#else
+	return 1.0;
+#endif
+}
+void Metrics::record(Operation op, unsigned long long ticks)
+{
+	Thread_Block *block = local();
+	bump(block->histogram[op][bucket(ticks)], 1);
+	bump(block->total_ticks[op], ticks);
+	if (ticks > block->max_ticks[op].load(memory_order_relaxed))
+	{
+		block->max_ticks[op].store(ticks, memory_order_relaxed);
+	}
+}
+void Metrics::count(Counter c, unsigned long long n)
+{
+	bump(local()->counters[c], n);
+}
+Metrics::Summary Metrics::summary(Operation op)
+{
+	vector <unsigned long long> merged(BUCKETS, 0);
+	Summary s = { 0, 0, 0, 0, 0, 0, 0 };
+	{
+		lock_guard <mutex> guard(registry_lock());
+		for (unsigned i = 0; i < registry().size(); i++)
+		{
+			Thread_Block *block = registry()[i];
+			for (unsigned b = 0; b < BUCKETS; b++)
+			{
+				merged[b] += block->histogram[op][b].load(memory_order_relaxed);
+			}
+			s.total_ns += block->total_ticks[op].load(memory_order_relaxed);
+			unsigned long long m = block->max_ticks[op].load(memory_order_relaxed);
+			if (m > s.max_ns)
+			{
+				s.max_ns = m;
+			}
+		}
+	}
+	for (unsigned b = 0; b < BUCKETS; b++)
+	{
+		s.count += merged[b];
+	}
+	if (s.count == 0)
+	{
+		return s;
+	}
+	double scale = ns_per_tick();
+	s.total_ns = (unsigned long long)(s.total_ns * scale);
+	s.max_ns = (unsigned long long)(s.max_ns * scale);
+	unsigned long long *targets[4] = { &s.p50_ns, &s.p90_ns, &s.p99_ns, &s.p999_ns };
+	double quantiles[4] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned long long seen = 0;
+	unsigned q = 0;
+	for (unsigned b = 0; b < BUCKETS && q < 4; b++)
+	{
+		seen += merged[b];
+		while (q < 4 && seen >= (unsigned long long)(quantiles[q] * s.count + 0.5) && seen > 0)
+		{
+			unsigned long long value = (unsigned long long)(bucket_value(b) * scale);
+			*targets[q] = value < s.max_ns ? value : s.max_ns;
+			q++;
+		}
+	}
+	return s;
+}
+unsigned long long Metrics::total(Counter c)
+{
+	unsigned long long sum = 0;
+	lock_guard <mutex> guard(registry_lock());
+	for (unsigned i = 0; i < registry().size(); i++)
+	{
+		sum += registry()[i]->counters[c].load(memory_order_relaxed);
+	}
+	return sum;
+}
+void Metrics::set(Gauge g, long long v)
+{
+	gauges[g].store(v, memory_order_relaxed);
+}
+long long Metrics::value(Gauge g)
+{
+	return gauges[g].load(memory_order_relaxed);
+}
+const char* Metrics::name(Operation op)
+{
+	return operation_names[op];
+}
+const char* Metrics::name(Counter c)
+{
+	return counter_names[c];
+}
+const char* Metrics::name(Gauge g)
+{
+	return gauge_names[g];
+}
+void Metrics::print(ostream &out)
+{
+	out << left << setw(16) << "Operation" << right << setw(10) << "Count"
+		<< setw(12) << "Mean(us)" << setw(12) << "p50(us)" << setw(12) << "p99(us)"
+		<< setw(12) << "p99.9(us)" << setw(12) << "Max(us)" << "\n";
+	out << fixed << setprecision(2);
+	for (unsigned op = 0; op < OPERATIONS; op++)
+	{
+		Summary s = summary((Operation)op);
+		double mean = s.count ? (double)s.total_ns / s.count : 0.0;
+		out << left << setw(16) << operation_names[op] << right << setw(10) << s.count
+			<< setw(12) << mean / 1000.0 << setw(12) << s.p50_ns / 1000.0
+			<< setw(12) << s.p99_ns / 1000.0 << setw(12) << s.p999_ns / 1000.0
+			<< setw(12) << s.max_ns / 1000.0 << "\n";
+	}
+	out << "\n";
+	for (unsigned c = 0; c < COUNTERS; c++)
+	{
+		out << left << setw(24) << counter_names[c] << right << total((Counter)c) << "\n";
+	}
+	for (unsigned g = 0; g < GAUGES; g++)
+	{
+		out << left << setw(24) << gauge_names[g] << right << value((Gauge)g) << "\n";
+	}
+	unsigned long long negatives = total(FILTER_NEGATIVES);
+	unsigned long long false_positives = total(FILTER_FALSE_POSITIVES);
+	if (negatives + false_positives > 0)
+	{
+		out << left << setw(24) << "filter_fp_rate" << right
+			<< setprecision(4) << (double)false_positives / (negatives + false_positives) << "\n";
+	}
+	out.unsetf(ios::floatfield);
+	out << setprecision(6);
+}
+bool Metrics::write_json(const string &path)
+{
+	ofstream write(path.c_str());
+	if (!write)
+	{
+		return false;
+	}
+	write << "{\n  \"operations\": {\n";
+	for (unsigned op = 0; op < OPERATIONS; op++)
+	{
+		Summary s = summary((Operation)op);
+		write << "    \"" << operation_names[op] << "\": {"
+			<< "\"count\": " << s.count
+			<< ", \"total_ns\": " << s.total_ns
+			<< ", \"p50_ns\": " << s.p50_ns
+			<< ", \"p90_ns\": " << s.p90_ns
+			<< ", \"p99_ns\": " << s.p99_ns
+			<< ", \"p999_ns\": " << s.p999_ns
+			<< ", \"max_ns\": " << s.max_ns << "}"
+			<< (op + 1 < OPERATIONS ? ",\n" : "\n");
+	}
+	write << "  },\n  \"counters\": {\n";
+	for (unsigned c = 0; c < COUNTERS; c++)
+	{
+		write << "    \"" << counter_names[c] << "\": " << total((Counter)c)
+			<< (c + 1 < COUNTERS ? ",\n" : "\n");
+	}
+	write << "  },\n  \"gauges\": {\n";
+	for (unsigned g = 0; g < GAUGES; g++)
+	{
+		write << "    \"" << gauge_names[g] << "\": " << value((Gauge)g)
+			<< (g + 1 < GAUGES ? ",\n" : "\n");
+	}
+	write << "  }\n}\n";
+	write.close();
+	return true;
+}
+bool Metrics::write_prometheus(const string &path)
+{
+	ofstream write(path.c_str());
+	if (!write)
+	{
+		return false;
+	}
+	const char *quantiles[4] = { "0.5", "0.9", "0.99", "0.999" };
+	write << "# HELP bankcore_operation_latency_seconds Latency of engine operations.\n";
+	write << "# TYPE bankcore_operation_latency_seconds summary\n";
+	for (unsigned op = 0; op < OPERATIONS; op++)
+	{
+		Summary s = summary((Operation)op);
+		unsigned long long values[4] = { s.p50_ns, s.p90_ns, s.p99_ns, s.p999_ns };
+		for (unsigned q = 0; q < 4; q++)
+		{
+			write << "bankcore_operation_latency_seconds{op=\"" << operation_names[op]
+				<< "\",quantile=\"" << quantiles[q] << "\"} " << values[q] / 1e9 << "\n";
+		}
+		write << "bankcore_operation_latency_seconds_sum{op=\"" << operation_names[op] << "\"} " << s.total_ns / 1e9 << "\n";
+		write << "bankcore_operation_latency_seconds_count{op=\"" << operation_names[op] << "\"} " << s.count << "\n";
+	}
+	for (unsigned c = 0; c < COUNTERS; c++)
+	{
+		write << "# TYPE bankcore_" << counter_names[c] << "_total counter\n";
+		write << "bankcore_" << counter_names[c] << "_total " << total((Counter)c) << "\n";
+	}
+	for (unsigned g = 0; g < GAUGES; g++)
+	{
+		write << "# TYPE bankcore_" << gauge_names[g] << " gauge\n";
+		write << "bankcore_" << gauge_names[g] << " " << value((Gauge)g) << "\n";
+	}
+	write.close();
+	return true;
+}
@@ -0,0 +1,135 @@
+#pragma once
+# include <chrono>
+# include <ostream>
+# include <string>
+# if defined(_MSC_VER)
+# include <intrin.h>
+# elif defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# endif
+using namespace std;
+
+// Process-wide latency histograms, I/O counters and gauges. Every thread records into
+// its own block, so the hot path is a thread-local lookup and a relaxed store;
+// readers merge the blocks when a snapshot is taken. Latencies are recorded in
+// raw clock ticks (the invariant TSC on x86) and converted to nanoseconds only
+// when a summary is built.
+class Metrics
+{
+public:
+	enum Operation
+	{
+		SEARCH,
+		MATCH,
+		DEPOSIT,
+		WITHDRAW,
+		TRANSFER,
+		LOAD_SERVER,
+		UPDATE_SERVER,
+		HISTORY_SCAN,
+		VELOCITY_CHECK,
+		KDF,
+		INTERACTIVE,
+		ONLINE,
+		BATCH,
+		PREFIX_SEARCH,
+		OPERATIONS
+	};
+	enum Counter
+	{
+		BYTES_READ,
+		BYTES_WRITTEN,
+		FILES_REWRITTEN,
+		FSYNCS,
+		FILTER_LOOKUPS,
+		FILTER_NEGATIVES,
+		FILTER_FALSE_POSITIVES,
+		VELOCITY_REFUSALS,
+		CROSS_SHARD_TRANSFERS,
+		ESCROW_CREDITS,
+		ESCROW_SWEEPS,
+		ACCOUNT_WRITES,
+		BATCHED_POSTINGS,
+		HISTORY_BLOCKS_DECODED,
+		HISTORY_BLOCKS_SKIPPED,
+		SNAPSHOT_PAGES_SAVED,
+		SESSIONS_OPENED,
+		SESSIONS_EXPIRED,
+		DEDUPED_POSTINGS,
+		BATCH_DEFERRED,
+		BATCH_SHED,
+		COUNTERS
+	};
+	// point-in-time values, set by their owner rather than summed per thread
+	enum Gauge
+	{
+		INTERACTIVE_QUEUE,
+		ONLINE_QUEUE,
+		BATCH_QUEUE,
+		INTERACTIVE_P99_US,
+		GAUGES
+	};
+
+	// log-linear buckets: exact below 16 ns, then 16 sub-buckets per power of two
+	static const unsigned SUB_BUCKETS = 16;
+	static const unsigned BUCKETS = (64 - 3) * SUB_BUCKETS;
+
+	struct Summary
+	{
+		unsigned long long count;
+		unsigned long long total_ns;
+		unsigned long long max_ns;
+		unsigned long long p50_ns;
+		unsigned long long p90_ns;
+		unsigned long long p99_ns;
+		unsigned long long p999_ns;
+	};
+
+	static unsigned long long now();
+	static double ns_per_tick();
+	static void record(Operation, unsigned long long);
+	static void count(Counter, unsigned long long = 1);
+	static Summary summary(Operation);
+	static unsigned long long total(Counter);
+	static void set(Gauge, long long);
+	static long long value(Gauge);
+	static const char* name(Operation);
+	static const char* name(Counter);
+	static const char* name(Gauge);
+	static void print(ostream &);
+	static bool write_json(const string &);
+	static bool write_prometheus(const string &);
+	static unsigned bucket(unsigned long long);
+	static unsigned long long bucket_value(unsigned);
+};
+
+// Records the lifetime of the enclosing scope into an operation histogram.
+class Metrics_Timer
+{
+public:
+	Metrics_Timer(Metrics::Operation);
+	~Metrics_Timer();
+
+private:
+	Metrics::Operation op;
+	unsigned long long start;
+};
+
+inline unsigned long long Metrics::now()
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline Metrics_Timer::Metrics_Timer(Metrics::Operation op)
+{
+	this->op = op;
+	start = Metrics::now();
+}
+inline Metrics_Timer::~Metrics_Timer()
+{
+	Metrics::record(op, Metrics::now() - start);
+}
@@ -1,5 +1,6 @@
 
 # include"Node.h"
+# include "Placement.h"
 
 Node::Node()
 {
@@ -14,3 +15,11 @@ Node::Node(int d)//Parameterized Constructor
 	pre = nullptr;
 	data = d;
 }
+void* Node::operator new(size_t size)
+{
+	return Node_Arena::allocate(size);
+}
+void Node::operator delete(void *p, size_t size)
+{
+	Node_Arena::release(p, size);
+}
@@ -13,4 +13,6 @@ public:
 	int data;
 	Node();
 	Node(int);
+	static void* operator new(size_t);
+	static void operator delete(void *, size_t);
 };
\ No newline at end of file
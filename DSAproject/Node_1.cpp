@@ -1,15 +1,28 @@
-
 # include "Node_1.h"
+# include "Placement.h"
+# include <string.h>
 
 Node_1::Node_1()
 {
 	next = nullptr;
 	accountNumber = 0;
-	password = 0;
+	cost = 0;
+	memset(salt, 0, sizeof(salt));
+	memset(hash, 0, sizeof(hash));
 }
-Node_1::Node_1(int a, int p)
+Node_1::Node_1(int a, unsigned c, const unsigned char *s, const unsigned char *h)
 {
 	next = nullptr;
 	accountNumber = a;
-	password = p;
-}
\ No newline at end of file
+	cost = c;
+	memcpy(salt, s, sizeof(salt));
+	memcpy(hash, h, sizeof(hash));
+}
+void* Node_1::operator new(size_t size)
+{
+	return Node_Arena::allocate(size);
+}
+void Node_1::operator delete(void *p, size_t size)
+{
+	Node_Arena::release(p, size);
+}
@@ -1,11 +1,18 @@
 #pragma once
 #pragma once
+# include <stddef.h>
 class Node_1
 {
 public:
 	Node_1 * next;
 	int accountNumber;
-	int password;
+	// scrypt of the password: 2^cost iterations over the salt
+	unsigned cost;
+	unsigned char salt[16];
+	unsigned char hash[32];
 	Node_1();
-	Node_1(int, int);
-};
\ No newline at end of file
+	Node_1(int, unsigned, const unsigned char *, const unsigned char *);
+	// from the node arena, so the chains can sit on huge pages
+	static void* operator new(size_t);
+	static void operator delete(void *, size_t);
+};
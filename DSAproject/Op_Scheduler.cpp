@@ -0,0 +1,284 @@
+# include "Op_Scheduler.h"
+# include <algorithm>
+# include <thread>
+# include <chrono>
+
+const long long Op_Scheduler::DEFAULT_TARGET_US;
+const unsigned Op_Scheduler::DEFAULT_BATCH_QUEUE;
+const unsigned Op_Scheduler::SAMPLES;
+const long long Op_Scheduler::WINDOW_US;
+
+static const char* class_names[Op_Scheduler::CLASSES] = { "interactive", "online", "batch" };
+// the budget of each class when the caller gives none
+static const long long class_budgets[Op_Scheduler::CLASSES] = { 10000, 50000, 1000000 };
+// how long a computed p99 is reused
+static const long long RECHECK_US = 2000;
+// times this thread has entered without leaving
+static thread_local unsigned nested = 0;
+
+Op_Scheduler::Op_Scheduler()
+{
+	for (unsigned c = 0; c < CLASSES; c++)
+	{
+		waiting[c] = 0;
+	}
+	busy = false;
+	holder = INTERACTIVE;
+	holder_ticks = 0;
+	holder_arrived = 0;
+	next_seq = 0;
+	target_us = DEFAULT_TARGET_US;
+	batch_queue = DEFAULT_BATCH_QUEUE;
+	next_sample = 0;
+	p99_us = 0;
+	checked_at = -1;
+}
+void Op_Scheduler::configure(long long target, unsigned queue)
+{
+	lock_guard <mutex> guard(scheduler_lock);
+	target_us = target > 0 ? target : 0;
+	batch_queue = queue;
+	samples.clear();
+	next_sample = 0;
+	p99_us = 0;
+	checked_at = -1;
+	Metrics::set(Metrics::INTERACTIVE_P99_US, 0);
+}
+// Waits for the ledger. False when batch work is shed, which is only while
+// interactive operations are over the target.
+bool Op_Scheduler::enter(Class type, long long budget_us)
+{
+	if (nested > 0)
+	{
+		nested++;
+		return true;
+	}
+	if (budget_us <= 0)
+	{
+		budget_us = budget(type);
+	}
+	unique_lock <mutex> lock(scheduler_lock);
+	long long now = now_us();
+	if (type == BATCH && waiting[BATCH] >= batch_queue && overloaded_at(now))
+	{
+		Metrics::count(Metrics::BATCH_SHED);
+		return false;
+	}
+	Waiter waiter;
+	waiter.type = type;
+	waiter.arrived = now;
+	waiter.deadline = now + budget_us;
+	waiter.seq = next_seq++;
+	waiter.ticks = Metrics::now();
+	waiter.granted = false;
+	waiter.deferred = false;
+	waiters.push_back(&waiter);
+	waiting[type]++;
+	publish();
+	dispatch(now);
+	while (!waiter.granted)
+	{
+		if (type == BATCH)
+		{
+			// a deferred waiter has to look again as the load and its deadline change
+			waiter.wake.wait_for(lock, chrono::milliseconds(1));
+		}
+		else
+		{
+			waiter.wake.wait(lock);
+		}
+		if (!waiter.granted)
+		{
+			dispatch(now_us());
+		}
+	}
+	nested = 1;
+	return true;
+}
+void Op_Scheduler::leave()
+{
+	if (nested == 0)
+	{
+		return;
+	}
+	if (--nested > 0)
+	{
+		return;
+	}
+	lock_guard <mutex> guard(scheduler_lock);
+	long long now = now_us();
+	Metrics::record((Metrics::Operation)(Metrics::INTERACTIVE + holder), Metrics::now() - holder_ticks);
+	if (holder == INTERACTIVE)
+	{
+		Sample sample = { now, now - holder_arrived };
+		if (samples.size() < SAMPLES)
+		{
+			samples.push_back(sample);
+		}
+		else
+		{
+			samples[next_sample] = sample;
+		}
+		next_sample = (next_sample + 1) % SAMPLES;
+	}
+	busy = false;
+	dispatch(now);
+}
+// Holds batch work back between chunks that run outside the ledger while
+// interactive operations are over the target, for at most the batch budget.
+void Op_Scheduler::pause(Class type)
+{
+	if (type == BATCH && overloaded())
+	{
+		Metrics::count(Metrics::BATCH_DEFERRED);
+		long long until = now_us() + budget(BATCH);
+		while (now_us() < until && overloaded())
+		{
+			this_thread::sleep_for(chrono::milliseconds(1));
+		}
+	}
+	this_thread::yield();
+}
+bool Op_Scheduler::overloaded()
+{
+	lock_guard <mutex> guard(scheduler_lock);
+	return overloaded_at(now_us());
+}
+unsigned Op_Scheduler::depth(Class type)
+{
+	lock_guard <mutex> guard(scheduler_lock);
+	return waiting[type];
+}
+long long Op_Scheduler::target()
+{
+	lock_guard <mutex> guard(scheduler_lock);
+	return target_us;
+}
+long long Op_Scheduler::budget(Class type)
+{
+	return class_budgets[type];
+}
+const char* Op_Scheduler::name(Class type)
+{
+	return class_names[type];
+}
+Op_Scheduler& Op_Scheduler::bank()
+{
+	static Op_Scheduler scheduler;
+	return scheduler;
+}
+// Gives a free ledger to the first waiter in dispatch order, passing over
+// batch waiters that are deferred.
+void Op_Scheduler::dispatch(long long now)
+{
+	if (busy)
+	{
+		return;
+	}
+	list <Waiter*>::iterator best = waiters.end();
+	for (list <Waiter*>::iterator it = waiters.begin(); it != waiters.end(); ++it)
+	{
+		Waiter *w = *it;
+		if (w->type == BATCH && w->deadline > now && overloaded_at(now))
+		{
+			if (!w->deferred)
+			{
+				w->deferred = true;
+				Metrics::count(Metrics::BATCH_DEFERRED);
+			}
+			continue;
+		}
+		if (best == waiters.end() || before(*w, **best, now))
+		{
+			best = it;
+		}
+	}
+	if (best == waiters.end())
+	{
+		return;
+	}
+	Waiter *w = *best;
+	waiters.erase(best);
+	waiting[w->type]--;
+	busy = true;
+	holder = w->type;
+	holder_ticks = w->ticks;
+	holder_arrived = w->arrived;
+	w->granted = true;
+	w->wake.notify_one();
+	publish();
+}
+// The p99 of the interactive latencies within the window, against the target.
+bool Op_Scheduler::overloaded_at(long long now)
+{
+	if (target_us == 0)
+	{
+		return false;
+	}
+	if (checked_at < 0 || now - checked_at >= RECHECK_US)
+	{
+		vector <long long> recent;
+		recent.reserve(samples.size());
+		for (size_t i = 0; i < samples.size(); i++)
+		{
+			if (samples[i].time >= now - WINDOW_US)
+			{
+				recent.push_back(samples[i].latency);
+			}
+		}
+		p99_us = 0;
+		if (!recent.empty())
+		{
+			vector <long long>::iterator at = recent.begin() + (recent.size() - 1) * 99 / 100;
+			nth_element(recent.begin(), at, recent.end());
+			p99_us = *at;
+		}
+		checked_at = now;
+		Metrics::set(Metrics::INTERACTIVE_P99_US, p99_us);
+	}
+	return p99_us > target_us;
+}
+bool Op_Scheduler::before(const Waiter &a, const Waiter &b, long long now)
+{
+	bool a_late = a.deadline <= now;
+	bool b_late = b.deadline <= now;
+	if (a_late != b_late)
+	{
+		return a_late;
+	}
+	if (!a_late && a.type != b.type)
+	{
+		return a.type < b.type;
+	}
+	if (a.deadline != b.deadline)
+	{
+		return a.deadline < b.deadline;
+	}
+	return a.seq < b.seq;
+}
+void Op_Scheduler::publish()
+{
+	Metrics::set(Metrics::INTERACTIVE_QUEUE, waiting[INTERACTIVE]);
+	Metrics::set(Metrics::ONLINE_QUEUE, waiting[ONLINE]);
+	Metrics::set(Metrics::BATCH_QUEUE, waiting[BATCH]);
+}
+long long Op_Scheduler::now_us()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Op_Slot::Op_Slot(Op_Scheduler::Class type, long long budget_us)
+{
+	held = Op_Scheduler::bank().enter(type, budget_us);
+}
+Op_Slot::~Op_Slot()
+{
+	if (held)
+	{
+		Op_Scheduler::bank().leave();
+	}
+}
+bool Op_Slot::admitted()
+{
+	return held;
+}
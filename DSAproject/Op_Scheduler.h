@@ -0,0 +1,112 @@
+#pragma once
+# include "Metrics.h"
+# include <mutex>
+# include <condition_variable>
+# include <vector>
+# include <list>
+using namespace std;
+
+// Hands the ledger to one operation at a time, by priority class and
+// deadline. A waiter whose deadline has passed goes first, earliest deadline
+// first; otherwise the highest class goes first, and within a class the
+// earliest deadline, then the earliest arrival. The deadline is the arrival
+// plus a budget that defaults per class, so batch work that has waited past
+// its budget still gets a turn.
+//
+// Batch work runs in short chunks, entering and leaving between them, and
+// calls pause() between units that do not touch the ledger. Admission keeps
+// the latency (wait and service) of the interactive operations of the last
+// WINDOW_US; while their p99 is over the target, batch waiters are deferred
+// until their deadline passes, and a batch arrival that would make the batch
+// queue longer than its limit is shed. A target of 0 turns admission off.
+//
+// The latency of each class goes to the interactive, online and batch
+// operations of Metrics, and the queue depths and the interactive p99 to its
+// gauges. A thread that enters again while it holds the ledger just nests.
+class Op_Scheduler
+{
+public:
+	enum Class
+	{
+		INTERACTIVE,
+		ONLINE,
+		BATCH,
+		CLASSES
+	};
+
+	static const long long DEFAULT_TARGET_US = 20000;
+	static const unsigned DEFAULT_BATCH_QUEUE = 4;
+	static const unsigned SAMPLES = 512;
+	static const long long WINDOW_US = 1000000;
+
+	Op_Scheduler();
+	void configure(long long, unsigned);
+	bool enter(Class, long long budget_us = 0);
+	void leave();
+	void pause(Class);
+	bool overloaded();
+	unsigned depth(Class);
+	long long target();
+	static long long budget(Class);
+	static const char* name(Class);
+	// the scheduler in front of the ledger for the menus, the kiosk owner and
+	// the batch jobs
+	static Op_Scheduler& bank();
+
+private:
+	struct Waiter
+	{
+		Class type;
+		long long arrived;
+		long long deadline;
+		unsigned long long seq;
+		unsigned long long ticks;
+		bool granted;
+		bool deferred;
+		condition_variable wake;
+	};
+	struct Sample
+	{
+		long long time;
+		long long latency;
+	};
+
+	Op_Scheduler(const Op_Scheduler &);
+	Op_Scheduler& operator=(const Op_Scheduler &);
+	void dispatch(long long);
+	bool overloaded_at(long long);
+	bool before(const Waiter &, const Waiter &, long long);
+	void publish();
+	static long long now_us();
+
+	mutex scheduler_lock;
+	list <Waiter*> waiters;
+	unsigned waiting[CLASSES];
+	bool busy;
+	Class holder;
+	unsigned long long holder_ticks;
+	long long holder_arrived;
+	unsigned long long next_seq;
+	long long target_us;
+	unsigned batch_queue;
+	vector <Sample> samples;
+	size_t next_sample;
+	long long p99_us;
+	long long checked_at;
+};
+
+// Holds the ledger for the enclosing scope. admitted() is false when batch
+// work was shed; the scope then has nothing to release.
+class Op_Slot
+{
+public:
+	Op_Slot(Op_Scheduler::Class, long long budget_us = 0);
+	~Op_Slot();
+	bool admitted();
+
+private:
+	Op_Slot(const Op_Slot &);
+	Op_Slot& operator=(const Op_Slot &);
+
+	bool held;
+};
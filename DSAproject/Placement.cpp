@@ -0,0 +1,466 @@
+# include "Placement.h"
+# include <fstream>
+# include <string>
+# include <stdlib.h>
+# include <string.h>
+# ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+# include <psapi.h>
+# else
+# include <sys/mman.h>
+# include <unistd.h>
+# include <pthread.h>
+# include <sched.h>
+# endif
+# ifdef __linux__
+# include <sys/syscall.h>
+# include <sys/ioctl.h>
+# include <linux/perf_event.h>
+# endif
+
+const size_t Placement::HUGE_PAGE;
+const size_t Node_Arena::LARGEST;
+bool Placement::huge_pages = false;
+bool Placement::numa = false;
+
+static const size_t SMALL_PAGE = 4096;
+// the MPOL_BIND memory policy of mbind()
+static const int BIND_POLICY = 2;
+
+# ifdef __linux__
+// "0-3,8-11" as a list of numbers
+static vector <int> parse_list(const string &text)
+{
+	vector <int> out;
+	const char *p = text.c_str();
+	while (*p != '\0')
+	{
+		char *end;
+		long first = strtol(p, &end, 10);
+		if (end == p)
+		{
+			break;
+		}
+		long last = first;
+		p = end;
+		if (*p == '-')
+		{
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		for (long i = first; i <= last; i++)
+		{
+			out.push_back((int)i);
+		}
+		if (*p == ',')
+		{
+			p++;
+		}
+		else
+		{
+			break;
+		}
+	}
+	return out;
+}
+static string read_line(const string &path)
+{
+	ifstream read(path.c_str());
+	string line;
+	getline(read, line);
+	return line;
+}
+# endif
+# ifdef _WIN32
+// large pages need the lock-pages privilege, which is enabled once if held
+static bool large_pages_allowed()
+{
+	static int allowed = -1;
+	if (allowed < 0)
+	{
+		allowed = 0;
+		HANDLE token;
+		if (GetLargePageMinimum() > 0 && OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		{
+			TOKEN_PRIVILEGES privileges;
+			privileges.PrivilegeCount = 1;
+			privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+			if (LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+				&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+				&& GetLastError() == ERROR_SUCCESS)
+			{
+				allowed = 1;
+			}
+			CloseHandle(token);
+		}
+	}
+	return allowed == 1;
+}
+# endif
+
+// Zeroed memory of at least the size asked for, on a node when NUMA
+// placement is on and the node is given.
+Placement::Region Placement::allocate(size_t bytes, int node)
+{
+	Region region;
+	region.backing = PLAIN;
+	size_t unit = huge_pages ? HUGE_PAGE : SMALL_PAGE;
+	region.bytes = (bytes + unit - 1) / unit * unit;
+	bool bind = numa && node >= 0 && nodes() > 1;
+# ifdef _WIN32
+	DWORD type = MEM_RESERVE | MEM_COMMIT;
+	void *p = nullptr;
+	if (huge_pages && large_pages_allowed())
+	{
+		SIZE_T large = GetLargePageMinimum();
+		region.bytes = (bytes + large - 1) / large * large;
+		p = bind ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, region.bytes, type | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)node)
+			: VirtualAlloc(nullptr, region.bytes, type | MEM_LARGE_PAGES, PAGE_READWRITE);
+		region.backing = LARGE;
+	}
+	if (p == nullptr)
+	{
+		region.backing = PLAIN;
+		p = bind ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, region.bytes, type, PAGE_READWRITE, (DWORD)node)
+			: VirtualAlloc(nullptr, region.bytes, type, PAGE_READWRITE);
+	}
+	region.data = (char*)p;
+# else
+	void *p = MAP_FAILED;
+#  ifdef MAP_HUGETLB
+	if (huge_pages)
+	{
+		p = mmap(nullptr, region.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		region.backing = LARGE;
+	}
+#  endif
+	if (p == MAP_FAILED && huge_pages)
+	{
+		// over-map so the region can start on a huge page boundary
+		char *raw = (char*)mmap(nullptr, region.bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw != (char*)MAP_FAILED)
+		{
+			char *start = (char*)(((size_t)raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+			if (start > raw)
+			{
+				munmap(raw, start - raw);
+			}
+			munmap(start + region.bytes, raw + HUGE_PAGE - start);
+			p = start;
+			region.backing = PLAIN;
+#  ifdef MADV_HUGEPAGE
+			if (madvise(p, region.bytes, MADV_HUGEPAGE) == 0)
+			{
+				region.backing = TRANSPARENT_HUGE;
+			}
+#  endif
+		}
+	}
+	if (p == MAP_FAILED)
+	{
+		p = mmap(nullptr, region.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		region.backing = PLAIN;
+	}
+	region.data = p != MAP_FAILED ? (char*)p : nullptr;
+#  ifdef __linux__
+	if (region.data != nullptr && bind)
+	{
+		// the pages are not touched yet, so binding places every one of them
+		unsigned long mask[4] = { 0, 0, 0, 0 };
+		if ((unsigned)node < sizeof(mask) * 8)
+		{
+			mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+			syscall(SYS_mbind, region.data, region.bytes, BIND_POLICY, mask, sizeof(mask) * 8, 0);
+		}
+	}
+#  endif
+# endif
+	if (region.data == nullptr)
+	{
+		region.bytes = 0;
+	}
+	return region;
+}
+void Placement::release(Region &region)
+{
+	if (region.data == nullptr)
+	{
+		return;
+	}
+# ifdef _WIN32
+	VirtualFree(region.data, 0, MEM_RELEASE);
+# else
+	munmap(region.data, region.bytes);
+# endif
+	region.data = nullptr;
+	region.bytes = 0;
+}
+unsigned Placement::nodes()
+{
+	static unsigned count = 0;
+	if (count == 0)
+	{
+		count = 1;
+# if defined(_WIN32)
+		ULONG highest = 0;
+		if (GetNumaHighestNodeNumber(&highest))
+		{
+			count = (unsigned)highest + 1;
+		}
+# elif defined(__linux__)
+		vector <int> online = parse_list(read_line("/sys/devices/system/node/online"));
+		if (!online.empty())
+		{
+			count = (unsigned)online.back() + 1;
+		}
+# endif
+	}
+	return count;
+}
+// The node of partition i of n: contiguous runs of partitions per node, so
+// neighbouring account ranges share a node.
+int Placement::node_for(unsigned i, unsigned n)
+{
+	if (!numa || n == 0)
+	{
+		return -1;
+	}
+	return (int)((unsigned long long)i * nodes() / n);
+}
+// Keeps the calling thread on the processors of a node.
+bool Placement::pin(int node)
+{
+	if (node < 0)
+	{
+		return false;
+	}
+# if defined(_WIN32)
+	ULONGLONG mask = 0;
+	if (!GetNumaNodeProcessorMask((UCHAR)node, &mask) || mask == 0)
+	{
+		return false;
+	}
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+# elif defined(__linux__)
+	vector <int> cpus = parse_list(read_line("/sys/devices/system/node/node" + to_string(node) + "/cpulist"));
+	if (cpus.empty())
+	{
+		return false;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (size_t i = 0; i < cpus.size(); i++)
+	{
+		CPU_SET(cpus[i], &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+# else
+	return false;
+# endif
+}
+int Placement::current_node()
+{
+# if defined(_WIN32)
+	PROCESSOR_NUMBER processor;
+	GetCurrentProcessorNumberEx(&processor);
+	USHORT node = 0;
+	return GetNumaProcessorNodeEx(&processor, &node) ? (int)node : 0;
+# elif defined(__linux__)
+	unsigned cpu = 0, node = 0;
+	return syscall(SYS_getcpu, &cpu, &node, nullptr) == 0 ? (int)node : 0;
+# else
+	return 0;
+# endif
+}
+// The node holding the page of an address, or -1 when it is not resident.
+int Placement::node_of(const void *address)
+{
+# if defined(_WIN32)
+	PSAPI_WORKING_SET_EX_INFORMATION info;
+	info.VirtualAddress = (PVOID)address;
+	if (!QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) || !info.VirtualAttributes.Valid)
+	{
+		return -1;
+	}
+	return (int)info.VirtualAttributes.Node;
+# elif defined(__linux__)
+	void *page = (void*)((size_t)address & ~(SMALL_PAGE - 1));
+	int status = -1;
+	if (syscall(SYS_move_pages, 0, 1UL, &page, nullptr, &status, 0) != 0)
+	{
+		return -1;
+	}
+	return status >= 0 ? status : -1;
+# else
+	return address != nullptr ? 0 : -1;
+# endif
+}
+const char* Placement::describe(Backing backing)
+{
+	switch (backing)
+	{
+		case LARGE:
+			return "huge pages";
+		case TRANSPARENT_HUGE:
+			return "transparent huge pages";
+		default:
+			return "4 KiB pages";
+	}
+}
+
+namespace
+{
+	struct Free_Node
+	{
+		Free_Node *next;
+	};
+	struct Arena_State
+	{
+		vector <Placement::Region> chunks;
+		Free_Node *free[Node_Arena::LARGEST / 16 + 1];
+		// the unused tail of the newest chunk
+		char *next;
+		char *end;
+
+		Arena_State()
+		{
+			memset(free, 0, sizeof(free));
+			next = nullptr;
+			end = nullptr;
+		}
+	};
+}
+
+static Arena_State& arena()
+{
+	// never freed, so nodes can be released during static destruction
+	static Arena_State *state = new Arena_State();
+	return *state;
+}
+
+void* Node_Arena::allocate(size_t size)
+{
+	if (!Placement::huge_pages || size > LARGEST)
+	{
+		return ::operator new(size);
+	}
+	size_t rounded = (size + 15) & ~(size_t)15;
+	lock_guard <mutex> guard(lock());
+	Arena_State &state = arena();
+	Free_Node *&head = state.free[rounded / 16];
+	if (head != nullptr)
+	{
+		Free_Node *node = head;
+		head = node->next;
+		return node;
+	}
+	if (state.next == nullptr || (size_t)(state.end - state.next) < rounded)
+	{
+		Placement::Region chunk = Placement::allocate(Placement::HUGE_PAGE);
+		if (chunk.data == nullptr)
+		{
+			return ::operator new(size);
+		}
+		state.chunks.push_back(chunk);
+		state.next = chunk.data;
+		state.end = chunk.data + chunk.bytes;
+	}
+	void *out = state.next;
+	state.next += rounded;
+	return out;
+}
+void Node_Arena::release(void *p, size_t size)
+{
+	if (p == nullptr)
+	{
+		return;
+	}
+	if (size > LARGEST || !owns(p))
+	{
+		::operator delete(p);
+		return;
+	}
+	size_t rounded = (size + 15) & ~(size_t)15;
+	lock_guard <mutex> guard(lock());
+	Free_Node *node = (Free_Node*)p;
+	node->next = arena().free[rounded / 16];
+	arena().free[rounded / 16] = node;
+}
+bool Node_Arena::owns(const void *p)
+{
+	lock_guard <mutex> guard(lock());
+	const vector <Placement::Region> &chunks = arena().chunks;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if ((const char*)p >= chunks[i].data && (const char*)p < chunks[i].data + chunks[i].bytes)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+mutex& Node_Arena::lock()
+{
+	static mutex *arena_lock = new mutex();
+	return *arena_lock;
+}
+
+Tlb_Counter::Tlb_Counter()
+{
+	handle = -1;
+}
+Tlb_Counter::~Tlb_Counter()
+{
+# ifdef __linux__
+	if (handle >= 0)
+	{
+		close(handle);
+	}
+# endif
+}
+bool Tlb_Counter::start()
+{
+# ifdef __linux__
+	if (handle < 0)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		handle = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (handle < 0)
+	{
+		return false;
+	}
+	ioctl(handle, PERF_EVENT_IOC_RESET, 0);
+	ioctl(handle, PERF_EVENT_IOC_ENABLE, 0);
+	return true;
+# else
+	return false;
+# endif
+}
+long long Tlb_Counter::stop()
+{
+# ifdef __linux__
+	if (handle < 0)
+	{
+		return -1;
+	}
+	ioctl(handle, PERF_EVENT_IOC_DISABLE, 0);
+	long long count = 0;
+	if (read(handle, &count, sizeof(count)) != (ssize_t)sizeof(count))
+	{
+		return -1;
+	}
+	return count;
+# else
+	return -1;
+# endif
+}
@@ -0,0 +1,78 @@
+#pragma once
+# include <stddef.h>
+# include <vector>
+# include <mutex>
+using namespace std;
+
+// Where the account tables sit in memory. With huge pages on, the frames of
+// the index buffer pools and the nodes of the in-memory account and
+// credential tables come from 2 MiB pages: reserved hugetlb (large) pages
+// where the system has them, otherwise transparent huge pages, otherwise
+// plain pages. With NUMA on, a sharded ledger gives its shards (account
+// ranges) to the nodes in order, binds each shard's buffer pool to its node
+// and pins its applier thread to that node's processors. Both are off by
+// default, and on a machine with one node NUMA placement changes nothing.
+class Placement
+{
+public:
+	static const size_t HUGE_PAGE = 2 << 20;
+
+	enum Backing
+	{
+		PLAIN,
+		TRANSPARENT_HUGE,
+		LARGE
+	};
+	struct Region
+	{
+		char *data;
+		size_t bytes;
+		Backing backing;
+	};
+
+	static Region allocate(size_t, int node = -1);
+	static void release(Region &);
+	static unsigned nodes();
+	static int node_for(unsigned, unsigned);
+	static bool pin(int);
+	static int current_node();
+	static int node_of(const void *);
+	static const char* describe(Backing);
+
+	static bool huge_pages;
+	static bool numa;
+};
+
+// Small fixed-size nodes (account, credential and bucket nodes). While huge
+// pages are on they are carved from huge-page chunks, one free list per
+// 16-byte size class, so a table's nodes share a few TLB entries instead of
+// being spread over the heap; otherwise they come from the heap as before.
+class Node_Arena
+{
+public:
+	static const size_t LARGEST = 256;
+
+	static void* allocate(size_t);
+	static void release(void *, size_t);
+
+private:
+	static bool owns(const void *);
+	static mutex& lock();
+};
+
+// Counts the data TLB misses of the calling thread, where the processor and
+// the system let it (perf events on Linux). stop() gives -1 otherwise.
+class Tlb_Counter
+{
+public:
+	Tlb_Counter();
+	~Tlb_Counter();
+	bool start();
+	long long stop();
+
+private:
+	Tlb_Counter(const Tlb_Counter &);
+	Tlb_Counter& operator=(const Tlb_Counter &);
+
+	int handle;
+};
@@ -0,0 +1,416 @@
+# include "Prefix_Index.h"
+# include <limits.h>
+
+static const unsigned NONE = 0xFFFFFFFF;
+// dead label bytes tolerated before a compaction is worth its walk
+static const size_t MIN_DEAD_LABELS = 4096;
+
+Prefix_Index::Cursor::Cursor()
+{
+	account = INT_MIN;
+	started = false;
+}
+
+Prefix_Index::Prefix_Index()
+{
+	clear();
+}
+// Indexes every word of a text for an account.
+void Prefix_Index::add(const string &text, int account)
+{
+	string key = normalize(text);
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		if (i == 0 || key[i - 1] == ' ')
+		{
+			insert_key(key.substr(i), account);
+		}
+	}
+}
+void Prefix_Index::remove(const string &text, int account)
+{
+	string key = normalize(text);
+	for (size_t i = 0; i < key.size(); i++)
+	{
+		if (i == 0 || key[i - 1] == ' ')
+		{
+			remove_key(key.substr(i), account);
+		}
+	}
+	if (dead_labels >= MIN_DEAD_LABELS && dead_labels * 2 >= labels.size())
+	{
+		compact_labels();
+	}
+}
+void Prefix_Index::clear()
+{
+	nodes.clear();
+	free_nodes.clear();
+	values.clear();
+	free_values = NONE;
+	labels.clear();
+	dead_labels = 0;
+	entries = 0;
+	make_node(0, 0);
+}
+// Up to limit accounts whose text has a word starting with the prefix, from
+// just after the cursor on; the cursor moves to the last one. True when
+// there are more.
+bool Prefix_Index::find(const string &text, size_t limit, vector <int> &out, Cursor &cursor)
+{
+	out.clear();
+	string prefix = normalize(text);
+	unsigned node = 0;
+	size_t pos = 0;
+	string path;
+	while (pos < prefix.size())
+	{
+		unsigned child = nodes[node].child;
+		while (child != NONE && first(child) < (unsigned char)prefix[pos])
+		{
+			child = nodes[child].sibling;
+		}
+		if (child == NONE || first(child) != (unsigned char)prefix[pos])
+		{
+			return false;
+		}
+		const Node &n = nodes[child];
+		size_t m = 0;
+		while (m < n.length && pos + m < prefix.size() && labels[n.label + m] == prefix[pos + m])
+		{
+			m++;
+		}
+		if (m < n.length && pos + m < prefix.size())
+		{
+			return false;
+		}
+		path.append(labels, n.label, n.length);
+		pos += n.length;
+		node = child;
+	}
+	Cursor last = cursor;
+	bool more = visit(node, path, limit, out, cursor, last);
+	cursor = last;
+	cursor.started = true;
+	return more;
+}
+// Keys indexed, one per word.
+size_t Prefix_Index::size()
+{
+	return entries;
+}
+size_t Prefix_Index::memory()
+{
+	return nodes.capacity() * sizeof(Node) + free_nodes.capacity() * sizeof(unsigned)
+		+ values.capacity() * sizeof(Value) + labels.capacity();
+}
+string Prefix_Index::normalize(const string &text)
+{
+	string key;
+	key.reserve(text.size());
+	for (size_t i = 0; i < text.size(); i++)
+	{
+		unsigned char c = (unsigned char)text[i];
+		if (c >= 'A' && c <= 'Z')
+		{
+			key += (char)(c - 'A' + 'a');
+		}
+		else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80)
+		{
+			key += (char)c;
+		}
+		else if (!key.empty() && key[key.size() - 1] != ' ')
+		{
+			key += ' ';
+		}
+	}
+	if (!key.empty() && key[key.size() - 1] == ' ')
+	{
+		key.erase(key.size() - 1);
+	}
+	return key;
+}
+void Prefix_Index::insert_key(const string &key, int account)
+{
+	unsigned node = 0;
+	size_t pos = 0;
+	while (pos < key.size())
+	{
+		unsigned prev = NONE;
+		unsigned child = nodes[node].child;
+		while (child != NONE && first(child) < (unsigned char)key[pos])
+		{
+			prev = child;
+			child = nodes[child].sibling;
+		}
+		if (child == NONE || first(child) != (unsigned char)key[pos])
+		{
+			// a new leaf holds the rest of the key
+			unsigned label = (unsigned)labels.size();
+			labels.append(key, pos, string::npos);
+			unsigned leaf = make_node(label, (unsigned)(key.size() - pos));
+			nodes[leaf].sibling = child;
+			link(node, prev, leaf);
+			node = leaf;
+			break;
+		}
+		unsigned m = 0;
+		while (m < nodes[child].length && pos + m < key.size() && labels[nodes[child].label + m] == key[pos + m])
+		{
+			m++;
+		}
+		if (m < nodes[child].length)
+		{
+			// split the label where the key leaves it
+			unsigned mid = make_node(nodes[child].label, m);
+			nodes[mid].sibling = nodes[child].sibling;
+			nodes[mid].child = child;
+			nodes[child].label += m;
+			nodes[child].length -= m;
+			nodes[child].sibling = NONE;
+			link(node, prev, mid);
+			child = mid;
+		}
+		node = child;
+		pos += m;
+	}
+	unsigned prev = NONE;
+	unsigned v = nodes[node].values;
+	while (v != NONE && values[v].account < account)
+	{
+		prev = v;
+		v = values[v].next;
+	}
+	if (v != NONE && values[v].account == account)
+	{
+		return;
+	}
+	unsigned slot;
+	if (free_values != NONE)
+	{
+		slot = free_values;
+		free_values = values[slot].next;
+	}
+	else
+	{
+		slot = (unsigned)values.size();
+		values.push_back(Value());
+	}
+	values[slot].account = account;
+	values[slot].next = v;
+	if (prev == NONE)
+	{
+		nodes[node].values = slot;
+	}
+	else
+	{
+		values[prev].next = slot;
+	}
+	entries++;
+}
+// Takes an account off a key, then drops the nodes left without accounts or
+// children and merges those left with a single child into it.
+void Prefix_Index::remove_key(const string &key, int account)
+{
+	unsigned parent = NONE;
+	unsigned before = NONE;
+	unsigned node = 0;
+	size_t pos = 0;
+	while (pos < key.size())
+	{
+		unsigned prev = NONE;
+		unsigned child = nodes[node].child;
+		while (child != NONE && first(child) < (unsigned char)key[pos])
+		{
+			prev = child;
+			child = nodes[child].sibling;
+		}
+		if (child == NONE || first(child) != (unsigned char)key[pos]
+			|| key.compare(pos, nodes[child].length, labels, nodes[child].label, nodes[child].length) != 0)
+		{
+			return;
+		}
+		parent = node;
+		before = prev;
+		node = child;
+		pos += nodes[child].length;
+	}
+	unsigned prev = NONE;
+	unsigned v = nodes[node].values;
+	while (v != NONE && values[v].account != account)
+	{
+		prev = v;
+		v = values[v].next;
+	}
+	if (v == NONE)
+	{
+		return;
+	}
+	if (prev == NONE)
+	{
+		nodes[node].values = values[v].next;
+	}
+	else
+	{
+		values[prev].next = values[v].next;
+	}
+	values[v].next = free_values;
+	free_values = v;
+	entries--;
+	if (node == 0 || nodes[node].values != NONE)
+	{
+		return;
+	}
+	if (nodes[node].child == NONE)
+	{
+		if (before == NONE)
+		{
+			nodes[parent].child = nodes[node].sibling;
+		}
+		else
+		{
+			nodes[before].sibling = nodes[node].sibling;
+		}
+		free_node(node);
+		node = parent;
+		if (node == 0 || nodes[node].values != NONE)
+		{
+			return;
+		}
+	}
+	if (nodes[node].child != NONE && nodes[nodes[node].child].sibling == NONE)
+	{
+		merge(node);
+	}
+}
+unsigned char Prefix_Index::first(unsigned n)
+{
+	return (unsigned char)labels[nodes[n].label];
+}
+unsigned Prefix_Index::make_node(unsigned label, unsigned length)
+{
+	unsigned n;
+	if (!free_nodes.empty())
+	{
+		n = free_nodes.back();
+		free_nodes.pop_back();
+	}
+	else
+	{
+		n = (unsigned)nodes.size();
+		nodes.push_back(Node());
+	}
+	nodes[n].label = label;
+	nodes[n].length = length;
+	nodes[n].child = NONE;
+	nodes[n].sibling = NONE;
+	nodes[n].values = NONE;
+	return n;
+}
+void Prefix_Index::free_node(unsigned n)
+{
+	dead_labels += nodes[n].length;
+	free_nodes.push_back(n);
+}
+// Puts a node after prev among the children of parent, or first.
+void Prefix_Index::link(unsigned parent, unsigned prev, unsigned n)
+{
+	if (prev == NONE)
+	{
+		nodes[parent].child = n;
+	}
+	else
+	{
+		nodes[prev].sibling = n;
+	}
+}
+// Folds the only child of a node without accounts into it.
+void Prefix_Index::merge(unsigned n)
+{
+	unsigned c = nodes[n].child;
+	unsigned length = nodes[n].length + nodes[c].length;
+	if (nodes[n].label + nodes[n].length == nodes[c].label)
+	{
+		// the labels are still side by side from the split that made them
+		nodes[c].length = 0;
+	}
+	else
+	{
+		string joined = labels.substr(nodes[n].label, nodes[n].length) + labels.substr(nodes[c].label, nodes[c].length);
+		dead_labels += nodes[n].length;
+		nodes[n].label = (unsigned)labels.size();
+		labels += joined;
+	}
+	nodes[n].length = length;
+	nodes[n].child = nodes[c].child;
+	nodes[n].values = nodes[c].values;
+	free_node(c);
+}
+// Copies the labels of the nodes in the trie into a fresh array, leaving the
+// dead bytes behind.
+void Prefix_Index::compact_labels()
+{
+	string live;
+	live.reserve(labels.size() - dead_labels);
+	vector <unsigned> stack(1, 0);
+	while (!stack.empty())
+	{
+		unsigned n = stack.back();
+		stack.pop_back();
+		unsigned label = (unsigned)live.size();
+		live.append(labels, nodes[n].label, nodes[n].length);
+		nodes[n].label = label;
+		for (unsigned child = nodes[n].child; child != NONE; child = nodes[child].sibling)
+		{
+			stack.push_back(child);
+		}
+	}
+	labels.swap(live);
+	dead_labels = 0;
+}
+// Collects the accounts at and below a node in key order, skipping subtrees
+// that end before the cursor. True when the page filled with more to come.
+bool Prefix_Index::visit(unsigned node, string &path, size_t limit, vector <int> &out, Cursor &cursor, Cursor &last)
+{
+	int cmp = cursor.started ? path.compare(cursor.key) : 1;
+	if (cmp >= 0)
+	{
+		for (unsigned v = nodes[node].values; v != NONE; v = values[v].next)
+		{
+			int account = values[v].account;
+			if (cmp == 0 && account <= cursor.account)
+			{
+				continue;
+			}
+			bool seen = false;
+			for (size_t i = 0; i < out.size() && !seen; i++)
+			{
+				seen = out[i] == account;
+			}
+			if (seen)
+			{
+				continue;
+			}
+			if (out.size() == limit)
+			{
+				return true;
+			}
+			out.push_back(account);
+			last.key = path;
+			last.account = account;
+		}
+	}
+	for (unsigned child = nodes[node].child; child != NONE; child = nodes[child].sibling)
+	{
+		size_t length = path.size();
+		path.append(labels, nodes[child].label, nodes[child].length);
+		bool before = cursor.started && path.compare(cursor.key) < 0 && cursor.key.compare(0, path.size(), path) != 0;
+		bool more = !before && visit(child, path, limit, out, cursor, last);
+		path.resize(length);
+		if (more)
+		{
+			return true;
+		}
+	}
+	return false;
+}
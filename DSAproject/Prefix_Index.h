@@ -0,0 +1,79 @@
+#pragma once
+# include <string>
+# include <vector>
+# include <stddef.h>
+using namespace std;
+
+// Secondary index from text (a customer's name or address) to account
+// numbers, searchable by prefix. Text is normalised first: letters are case
+// folded, runs of spaces and punctuation become one space, and bytes outside
+// ASCII are kept as they are. Every word of the text starts a key, so "Ada
+// Lovelace" is found by "ada l" and by "love".
+//
+// The keys live in a radix trie with compressed paths: a node holds a label
+// of one or more bytes, its children in byte order as a sibling list, and
+// the accounts whose key ends there in account order. Nodes, accounts and
+// labels sit in flat arrays addressed by 32-bit index. Freed nodes and
+// accounts are reused; the labels of freed and merged nodes are left behind
+// and compacted away once they are half of the label bytes. A query walks the prefix and then the subtree below
+// it in key order, so it costs the prefix length plus the page, whatever
+// the number of keys. Pages go on from a cursor: the key and account of the
+// last result. An account that matches through two words can show on two
+// pages.
+class Prefix_Index
+{
+public:
+	struct Cursor
+	{
+		string key;
+		int account;
+		bool started;
+
+		Cursor();
+	};
+
+	Prefix_Index();
+	void add(const string &, int);
+	void remove(const string &, int);
+	void clear();
+	bool find(const string &, size_t, vector <int> &, Cursor &);
+	size_t size();
+	size_t memory();
+	static string normalize(const string &);
+
+private:
+	struct Node
+	{
+		unsigned label;
+		unsigned length;
+		unsigned child;
+		unsigned sibling;
+		unsigned values;
+	};
+	struct Value
+	{
+		int account;
+		unsigned next;
+	};
+
+	Prefix_Index(const Prefix_Index &);
+	Prefix_Index& operator=(const Prefix_Index &);
+	void insert_key(const string &, int);
+	void remove_key(const string &, int);
+	unsigned char first(unsigned);
+	unsigned make_node(unsigned, unsigned);
+	void free_node(unsigned);
+	void link(unsigned, unsigned, unsigned);
+	void merge(unsigned);
+	void compact_labels();
+	bool visit(unsigned, string &, size_t, vector <int> &, Cursor &, Cursor &);
+
+	vector <Node> nodes;
+	vector <unsigned> free_nodes;
+	vector <Value> values;
+	unsigned free_values;
+	string labels;
+	// label bytes no node points at
+	size_t dead_labels;
+	size_t entries;
+};
@@ -0,0 +1,299 @@
+#pragma once
+# include <stddef.h>
+# include <string.h>
+# include <limits.h>
+# include <string>
+# include <fstream>
+# include <sstream>
+using namespace std;
+
+// Compile-time description of a flat record. A schema lists the fields of a
+// struct in the order they are stored, and generates from that list:
+//
+//   text   one field per line, as in server.txt and hashtable.txt; blank lines
+//          between records are skipped, so files written by hand still load
+//   binary fixed size, integers little-endian, strings zero-padded
+//
+// Encoders write into a caller's buffer of TEXT_SIZE or BINARY_SIZE bytes and
+// decoders read from one, so neither allocates. Integers are formatted and
+// parsed by hand rather than through a stream or the C locale. LAYOUT
+// fingerprints the version and the type and width of every field in order;
+// files that store records in binary keep it next to them, so a file written
+// with another layout is refused instead of misread. Adding a field is one
+// SCHEMA_FIELD line, plus a VERSION bump where records are kept in binary.
+
+// Encoding of one field type: int and fixed char arrays.
+template <class T> struct Field_Codec;
+
+template <> struct Field_Codec <int>
+{
+	static const unsigned KIND = 1;
+	static const size_t BINARY_SIZE = 4;
+	// "-2147483648"
+	static const size_t TEXT_SIZE = 11;
+
+	static char* format(const int &value, char *out)
+	{
+		unsigned u = value < 0 ? 0u - (unsigned)value : (unsigned)value;
+		char digits[10];
+		int n = 0;
+		do
+		{
+			digits[n++] = (char)('0' + u % 10);
+			u /= 10;
+		} while (u != 0);
+		if (value < 0)
+		{
+			*out++ = '-';
+		}
+		while (n > 0)
+		{
+			*out++ = digits[--n];
+		}
+		return out;
+	}
+	// Skips blank space before the number, like >> does, and the rest of its
+	// line after it. Returns nullptr when there is no number or it overflows.
+	static const char* parse(const char *in, const char *end, int &value)
+	{
+		while (in != end && (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n'))
+		{
+			in++;
+		}
+		bool negative = in != end && *in == '-';
+		if (in != end && (*in == '-' || *in == '+'))
+		{
+			in++;
+		}
+		const char *digits = in;
+		unsigned long long u = 0;
+		while (in != end && *in >= '0' && *in <= '9' && u <= (unsigned long long)INT_MAX + 1)
+		{
+			u = u * 10 + (unsigned)(*in++ - '0');
+		}
+		if (in == digits || u > (unsigned long long)INT_MAX + (negative ? 1 : 0))
+		{
+			return nullptr;
+		}
+		value = negative ? (int)(0u - (unsigned)u) : (int)u;
+		while (in != end && (*in == ' ' || *in == '\t' || *in == '\r'))
+		{
+			in++;
+		}
+		if (in != end && *in != '\n')
+		{
+			return nullptr;
+		}
+		return in == end ? in : in + 1;
+	}
+	static char* encode(const int &value, char *out)
+	{
+		unsigned u = (unsigned)value;
+		out[0] = (char)u;
+		out[1] = (char)(u >> 8);
+		out[2] = (char)(u >> 16);
+		out[3] = (char)(u >> 24);
+		return out + BINARY_SIZE;
+	}
+	static const char* decode(const char *in, int &value)
+	{
+		const unsigned char *b = (const unsigned char*)in;
+		value = (int)((unsigned)b[0] | (unsigned)b[1] << 8 | (unsigned)b[2] << 16 | (unsigned)b[3] << 24);
+		return in + BINARY_SIZE;
+	}
+};
+
+// A string of at most N - 1 characters, zero-terminated in memory.
+template <size_t N> struct Field_Codec <char[N]>
+{
+	static const unsigned KIND = 2;
+	static const size_t BINARY_SIZE = N;
+	static const size_t TEXT_SIZE = N - 1;
+
+	static char* format(const char (&value)[N], char *out)
+	{
+		const char *stop = (const char*)memchr(value, '\0', N - 1);
+		size_t n = stop != nullptr ? stop - value : N - 1;
+		memcpy(out, value, n);
+		return out + n;
+	}
+	// The rest of the line; longer lines are cut to the field.
+	static const char* parse(const char *in, const char *end, char (&value)[N])
+	{
+		const char *line = (const char*)memchr(in, '\n', end - in);
+		const char *stop = line != nullptr ? line : end;
+		size_t n = stop - in;
+		if (n > 0 && in[n - 1] == '\r')
+		{
+			n--;
+		}
+		if (n > N - 1)
+		{
+			n = N - 1;
+		}
+		memcpy(value, in, n);
+		memset(value + n, 0, N - n);
+		return line != nullptr ? line + 1 : end;
+	}
+	static char* encode(const char (&value)[N], char *out)
+	{
+		size_t n = format(value, out) - out;
+		memset(out + n, 0, N - n);
+		return out + N;
+	}
+	static const char* decode(const char *in, char (&value)[N])
+	{
+		memcpy(value, in, N - 1);
+		value[N - 1] = '\0';
+		return in + N;
+	}
+};
+
+// One member of a record.
+template <class Record, class T, T Record::*Member> struct Field
+{
+	typedef Field_Codec <T> Codec;
+
+	static const T& get(const Record &record)
+	{
+		return record.*Member;
+	}
+	static T& get(Record &record)
+	{
+		return record.*Member;
+	}
+};
+# define SCHEMA_FIELD(record, member) Field <record, decltype(record::member), &record::member>
+
+template <class Record, class... Fields> struct Field_List;
+
+template <class Record> struct Field_List <Record>
+{
+	static const size_t BINARY_SIZE = 0;
+	static const size_t TEXT_SIZE = 0;
+
+	static constexpr unsigned long long layout(unsigned long long hash)
+	{
+		return hash;
+	}
+	static char* write_text(const Record &, char *out)
+	{
+		return out;
+	}
+	static const char* read_text(const char *in, const char *, Record &)
+	{
+		return in;
+	}
+	static char* write_binary(const Record &, char *out)
+	{
+		return out;
+	}
+	static const char* read_binary(const char *in, Record &)
+	{
+		return in;
+	}
+};
+
+template <class Record, class First, class... Rest> struct Field_List <Record, First, Rest...>
+{
+	typedef Field_List <Record, Rest...> Next;
+	static const size_t BINARY_SIZE = First::Codec::BINARY_SIZE + Next::BINARY_SIZE;
+	// each field ends with a newline
+	static const size_t TEXT_SIZE = First::Codec::TEXT_SIZE + 1 + Next::TEXT_SIZE;
+
+	static constexpr unsigned long long layout(unsigned long long hash)
+	{
+		return Next::layout((hash ^ (First::Codec::KIND << 24 | First::Codec::BINARY_SIZE)) * 1099511628211ull);
+	}
+	static char* write_text(const Record &record, char *out)
+	{
+		out = First::Codec::format(First::get(record), out);
+		*out++ = '\n';
+		return Next::write_text(record, out);
+	}
+	static const char* read_text(const char *in, const char *end, Record &record)
+	{
+		in = First::Codec::parse(in, end, First::get(record));
+		return in == nullptr ? nullptr : Next::read_text(in, end, record);
+	}
+	static char* write_binary(const Record &record, char *out)
+	{
+		return Next::write_binary(record, First::Codec::encode(First::get(record), out));
+	}
+	static const char* read_binary(const char *in, Record &record)
+	{
+		return Next::read_binary(First::Codec::decode(in, First::get(record)), record);
+	}
+};
+
+template <class Record, unsigned Version, class... Fields> struct Record_Schema
+{
+	typedef Field_List <Record, Fields...> List;
+	static const unsigned VERSION = Version;
+	static const size_t BINARY_SIZE = List::BINARY_SIZE;
+	static const size_t TEXT_SIZE = List::TEXT_SIZE;
+	static const unsigned long long LAYOUT = List::layout(14695981039346656037ull ^ Version);
+
+	// Writes at most TEXT_SIZE bytes; returns the end.
+	static char* write_text(const Record &record, char *out)
+	{
+		return List::write_text(record, out);
+	}
+	// Reads the next record, skipping blank lines before it. Returns the
+	// position after it, or nullptr at the end or on a malformed record.
+	static const char* read_text(const char *in, const char *end, Record &record)
+	{
+		while (in != end && (*in == '\r' || *in == '\n'))
+		{
+			in++;
+		}
+		if (in == end)
+		{
+			return nullptr;
+		}
+		memset(&record, 0, sizeof(record));
+		return List::read_text(in, end, record);
+	}
+	// Writes exactly BINARY_SIZE bytes.
+	static char* write_binary(const Record &record, char *out)
+	{
+		return List::write_binary(record, out);
+	}
+	static const char* read_binary(const char *in, Record &record)
+	{
+		memset(&record, 0, sizeof(record));
+		return List::read_binary(in, record);
+	}
+	static void append_text(const Record &record, string &out)
+	{
+		char buffer[TEXT_SIZE];
+		out.append(buffer, write_text(record, buffer) - buffer);
+	}
+	// Reads a whole text file and visits its records in order. False when the
+	// file cannot be read or a record in it is malformed; the records before
+	// it have been visited.
+	template <class Visit> static bool read_text_file(const string &path, Visit visit, unsigned long long *bytes = nullptr)
+	{
+		ifstream read(path.c_str(), ios::binary);
+		if (!read)
+		{
+			return false;
+		}
+		ostringstream text;
+		text << read.rdbuf();
+		string contents = text.str();
+		if (bytes != nullptr)
+		{
+			*bytes = contents.size();
+		}
+		const char *end = contents.data() + contents.size();
+		const char *at = contents.data();
+		Record record;
+		for (const char *in = at; (in = read_text(in, end, record)) != nullptr; at = in)
+		{
+			visit(record);
+		}
+		// only blank lines may follow the last record
+		return contents.find_first_not_of("\r\n", at - contents.data()) == string::npos;
+	}
+};
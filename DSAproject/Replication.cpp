@@ -0,0 +1,557 @@
+# include "Replication.h"
+# include <chrono>
+# include <algorithm>
+# include <stdlib.h>
+# include <string.h>
+# ifdef _WIN32
+# include <winsock2.h>
+# pragma comment(lib, "Ws2_32.lib")
+# else
+# include <sys/socket.h>
+# include <sys/un.h>
+# include <unistd.h>
+# endif
+
+const unsigned Journal_Shipper::BATCH;
+const unsigned Journal_Shipper::HEARTBEAT_MS;
+
+static const char MAGIC[4] = { 'B', 'K', 'R', 'P' };
+static const unsigned VERSION = 1;
+
+struct Frame_Header
+{
+	unsigned shard;
+	unsigned count;
+	unsigned long long head;
+};
+
+#ifdef _WIN32
+static bool init_sockets()
+{
+	static WSADATA data;
+	static bool ready = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	return ready;
+}
+static sockaddr_in local_address(const string &address)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons((unsigned short)atoi(address.c_str()));
+	return addr;
+}
+#else
+static bool init_sockets()
+{
+	return true;
+}
+static sockaddr_un local_address(const string &address)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, address.c_str(), min(address.size(), sizeof(addr.sun_path) - 1));
+	return addr;
+}
+#endif
+static void close_socket(long long s)
+{
+	if (s < 0)
+	{
+		return;
+	}
+#ifdef _WIN32
+	closesocket((SOCKET)s);
+#else
+	::close((int)s);
+#endif
+}
+static void shutdown_socket(long long s)
+{
+	if (s < 0)
+	{
+		return;
+	}
+#ifdef _WIN32
+	shutdown((SOCKET)s, SD_BOTH);
+#else
+	shutdown((int)s, SHUT_RDWR);
+#endif
+}
+static long long listen_on(const string &address)
+{
+	if (!init_sockets())
+	{
+		return -1;
+	}
+#ifdef _WIN32
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET)
+	{
+		return -1;
+	}
+	sockaddr_in addr = local_address(address);
+#else
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+	{
+		return -1;
+	}
+	sockaddr_un addr = local_address(address);
+	unlink(address.c_str());
+#endif
+	if (bind(s, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(s, 8) != 0)
+	{
+		close_socket((long long)s);
+		return -1;
+	}
+	return (long long)s;
+}
+static long long accept_on(long long listener)
+{
+#ifdef _WIN32
+	SOCKET s = accept((SOCKET)listener, nullptr, nullptr);
+	return s == INVALID_SOCKET ? -1 : (long long)s;
+#else
+	return accept((int)listener, nullptr, nullptr);
+#endif
+}
+static long long connect_to(const string &address)
+{
+	if (!init_sockets())
+	{
+		return -1;
+	}
+#ifdef _WIN32
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET)
+	{
+		return -1;
+	}
+	sockaddr_in addr = local_address(address);
+#else
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+	{
+		return -1;
+	}
+	sockaddr_un addr = local_address(address);
+#endif
+	if (connect(s, (sockaddr*)&addr, sizeof(addr)) != 0)
+	{
+		close_socket((long long)s);
+		return -1;
+	}
+	return (long long)s;
+}
+static bool send_all(long long s, const void *data, size_t n)
+{
+	const char *bytes = (const char*)data;
+	while (n > 0)
+	{
+#ifdef _WIN32
+		int sent = send((SOCKET)s, bytes, (int)n, 0);
+#elif defined(MSG_NOSIGNAL)
+		ssize_t sent = send((int)s, bytes, n, MSG_NOSIGNAL);
+#else
+		ssize_t sent = send((int)s, bytes, n, 0);
+#endif
+		if (sent <= 0)
+		{
+			return false;
+		}
+		bytes += sent;
+		n -= (size_t)sent;
+	}
+	return true;
+}
+static bool recv_all(long long s, void *data, size_t n)
+{
+	char *bytes = (char*)data;
+	while (n > 0)
+	{
+#ifdef _WIN32
+		int got = recv((SOCKET)s, bytes, (int)n, 0);
+#else
+		ssize_t got = recv((int)s, bytes, n, 0);
+#endif
+		if (got <= 0)
+		{
+			return false;
+		}
+		bytes += got;
+		n -= (size_t)got;
+	}
+	return true;
+}
+
+Journal_Shipper::Journal_Shipper()
+	: running(false)
+{
+	ledger = nullptr;
+	listener = -1;
+	generation = 0;
+}
+Journal_Shipper::~Journal_Shipper()
+{
+	stop();
+}
+bool Journal_Shipper::listen(const string &addr, Sharded_Ledger &primary)
+{
+	stop();
+	ledger = &primary;
+	address = addr;
+	listener = listen_on(address);
+	if (listener < 0)
+	{
+		return false;
+	}
+	running = true;
+	acceptor = thread(&Journal_Shipper::accept_loop, this);
+	return true;
+}
+void Journal_Shipper::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+	running = false;
+	notify();
+	shutdown_socket(listener);
+	close_socket(listener);
+	acceptor.join();
+	listener = -1;
+	{
+		lock_guard <mutex> guard(connection_lock);
+		for (size_t i = 0; i < sockets.size(); i++)
+		{
+			shutdown_socket(sockets[i]);
+		}
+	}
+	for (size_t i = 0; i < connections.size(); i++)
+	{
+		connections[i].join();
+	}
+	connections.clear();
+#ifndef _WIN32
+	unlink(address.c_str());
+#endif
+}
+// Wakes the connections after a group commit; wired to Sharded_Ledger::on_commit.
+void Journal_Shipper::notify()
+{
+	{
+		lock_guard <mutex> guard(commit_lock);
+		generation++;
+	}
+	committed.notify_all();
+}
+unsigned Journal_Shipper::standbys()
+{
+	lock_guard <mutex> guard(connection_lock);
+	return (unsigned)sockets.size();
+}
+void Journal_Shipper::accept_loop()
+{
+	while (running)
+	{
+		long long s = accept_on(listener);
+		if (s < 0)
+		{
+			if (!running)
+			{
+				break;
+			}
+			this_thread::sleep_for(chrono::milliseconds(10));
+			continue;
+		}
+		lock_guard <mutex> guard(connection_lock);
+		sockets.push_back(s);
+		connections.push_back(thread(&Journal_Shipper::serve, this, s));
+	}
+}
+void Journal_Shipper::serve(long long s)
+{
+	unsigned count = ledger->shard_count();
+	char magic[4];
+	unsigned version = 0, known = 0;
+	vector <unsigned long long> next(count, 1);
+	bool ok = recv_all(s, magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(magic)) == 0
+		&& recv_all(s, &version, sizeof(version)) && version == VERSION
+		&& recv_all(s, &known, sizeof(known)) && (known == 0 || known == count);
+	for (unsigned i = 0; ok && i < known; i++)
+	{
+		ok = recv_all(s, &next[i], sizeof(next[i]));
+	}
+	ok = ok && send_all(s, MAGIC, sizeof(MAGIC)) && send_all(s, &count, sizeof(count))
+		&& (ledger->splits.empty() || send_all(s, ledger->splits.data(), ledger->splits.size() * sizeof(int)));
+
+	unsigned long long seen = 0;
+	chrono::steady_clock::time_point beat = chrono::steady_clock::now();
+	vector <Journal_Record> batch;
+	while (ok && running)
+	{
+		bool sent = false;
+		for (unsigned i = 0; ok && i < count; i++)
+		{
+			Shard *shard = ledger->shard(i);
+			unsigned long long head = shard->journal.durable / sizeof(Journal_Record);
+			while (ok && next[i] <= head)
+			{
+				// seq n lives at offset (n - 1) * record size, so a resume point is a seek
+				batch.clear();
+				shard->journal.scan((next[i] - 1) * sizeof(Journal_Record), [&](const Journal_Record &rec, unsigned long long) {
+					if (rec.seq != next[i] + batch.size() || rec.seq > head)
+					{
+						return false;
+					}
+					batch.push_back(rec);
+					return batch.size() < BATCH;
+				});
+				if (batch.empty())
+				{
+					break;
+				}
+				Frame_Header frame;
+				frame.shard = i;
+				frame.count = (unsigned)batch.size();
+				frame.head = head;
+				ok = send_all(s, &frame, sizeof(frame)) && send_all(s, batch.data(), batch.size() * sizeof(Journal_Record));
+				next[i] += batch.size();
+				sent = true;
+			}
+		}
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (ok && now - beat >= chrono::milliseconds(HEARTBEAT_MS))
+		{
+			// an empty frame keeps the standby's view of the primary's head current
+			for (unsigned i = 0; ok && i < count; i++)
+			{
+				Frame_Header frame;
+				frame.shard = i;
+				frame.count = 0;
+				frame.head = ledger->shard(i)->journal.durable / sizeof(Journal_Record);
+				ok = send_all(s, &frame, sizeof(frame));
+			}
+			beat = now;
+		}
+		if (!sent)
+		{
+			unique_lock <mutex> guard(commit_lock);
+			committed.wait_for(guard, chrono::milliseconds(10), [&] { return !running || generation != seen; });
+			seen = generation;
+		}
+	}
+
+	lock_guard <mutex> guard(connection_lock);
+	for (size_t i = 0; i < sockets.size(); i++)
+	{
+		if (sockets[i] == s)
+		{
+			sockets.erase(sockets.begin() + i);
+			break;
+		}
+	}
+	close_socket(s);
+}
+
+Standby::Standby()
+	: running(false)
+{
+	fd = -1;
+	received = 0;
+	last_lag_us = 0;
+}
+Standby::~Standby()
+{
+	close();
+}
+bool Standby::open_shards()
+{
+	for (unsigned i = 0; i <= splits.size(); i++)
+	{
+		Shard *shard = new Shard();
+		shards.push_back(shard);
+		if (!shard->open(Sharded_Ledger::shard_prefix(directory, i), nullptr))
+		{
+			return false;
+		}
+	}
+	head.assign(shards.size(), 0);
+	applied.assign(shards.size(), 0);
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		applied[i] = shards[i]->journal.next_seq - 1;
+		head[i] = applied[i];
+	}
+	return true;
+}
+// Opens the replica in a directory; a new directory is set up on connect.
+bool Standby::open(const string &dir)
+{
+	close();
+	directory = dir;
+	if (!directory.empty() && directory[directory.size() - 1] != '/' && directory[directory.size() - 1] != '\\')
+	{
+		directory += '/';
+	}
+	if (Sharded_Ledger::read_splits(directory, splits))
+	{
+		return open_shards();
+	}
+	splits.clear();
+	return true;
+}
+bool Standby::connect(const string &address)
+{
+	stop();
+	fd = connect_to(address);
+	if (fd < 0)
+	{
+		return false;
+	}
+	unsigned known = (unsigned)shards.size();
+	bool ok = send_all(fd, MAGIC, sizeof(MAGIC)) && send_all(fd, &VERSION, sizeof(VERSION)) && send_all(fd, &known, sizeof(known));
+	for (unsigned i = 0; ok && i < known; i++)
+	{
+		unsigned long long next = shards[i]->journal.next_seq;
+		ok = send_all(fd, &next, sizeof(next));
+	}
+	char magic[4];
+	unsigned count = 0;
+	ok = ok && recv_all(fd, magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(magic)) == 0
+		&& recv_all(fd, &count, sizeof(count)) && count > 0;
+	vector <int> primary(ok ? count - 1 : 0);
+	ok = ok && (primary.empty() || recv_all(fd, primary.data(), primary.size() * sizeof(int)));
+	if (ok && shards.empty())
+	{
+		splits = primary;
+		ok = Sharded_Ledger::write_splits(directory, splits) && open_shards();
+	}
+	if (!ok || primary != splits)
+	{
+		close_socket(fd);
+		fd = -1;
+		return false;
+	}
+	running = true;
+	receiver = thread(&Standby::receive, this);
+	return true;
+}
+void Standby::receive()
+{
+	Frame_Header frame;
+	vector <Journal_Record> batch;
+	while (running && recv_all(fd, &frame, sizeof(frame)))
+	{
+		if (frame.shard >= shards.size() || frame.count > Journal_Shipper::BATCH)
+		{
+			break;
+		}
+		batch.resize(frame.count);
+		if (frame.count > 0 && (!recv_all(fd, batch.data(), frame.count * sizeof(Journal_Record)) || !shards[frame.shard]->replicate(batch)))
+		{
+			break;
+		}
+		long long now = Journal::now_us();
+		lock_guard <mutex> guard(status_lock);
+		head[frame.shard] = frame.head;
+		if (frame.count > 0)
+		{
+			applied[frame.shard] = batch.back().seq;
+			received += frame.count;
+			last_lag_us = now - batch.back().time;
+		}
+	}
+	running = false;
+}
+void Standby::stop()
+{
+	if (fd < 0)
+	{
+		return;
+	}
+	running = false;
+	shutdown_socket(fd);
+	if (receiver.joinable())
+	{
+		receiver.join();
+	}
+	close_socket(fd);
+	fd = -1;
+}
+void Standby::close()
+{
+	stop();
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		delete shards[i];
+	}
+	shards.clear();
+}
+bool Standby::connected()
+{
+	return running;
+}
+// Stops replicating and opens the replica as a writable ledger.
+bool Standby::promote(Sharded_Ledger &ledger)
+{
+	close();
+	return ledger.open(directory);
+}
+unsigned Standby::shard_count()
+{
+	return (unsigned)shards.size();
+}
+Shard* Standby::shard(unsigned i)
+{
+	return i < shards.size() ? shards[i] : nullptr;
+}
+Shard* Standby::shard_for(int accountno)
+{
+	if (shards.empty())
+	{
+		return nullptr;
+	}
+	return shards[upper_bound(splits.begin(), splits.end(), accountno) - splits.begin()];
+}
+bool Standby::balance(int accountno, int &balance)
+{
+	Shard *shard = shard_for(accountno);
+	if (shard == nullptr || !shard->balance(accountno, balance))
+	{
+		return false;
+	}
+	// credits to a hot account may still be in escrow on any shard
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		balance += shards[i]->escrow(accountno);
+	}
+	return true;
+}
+unsigned long long Standby::lag_records()
+{
+	lock_guard <mutex> guard(status_lock);
+	unsigned long long behind = 0;
+	for (size_t i = 0; i < head.size(); i++)
+	{
+		if (head[i] > applied[i])
+		{
+			behind += head[i] - applied[i];
+		}
+	}
+	return behind;
+}
+// Commit on the primary to apply here, for the last record applied.
+long long Standby::lag_us()
+{
+	lock_guard <mutex> guard(status_lock);
+	return last_lag_us;
+}
+unsigned long long Standby::applied_records()
+{
+	lock_guard <mutex> guard(status_lock);
+	return received;
+}
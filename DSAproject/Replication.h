@@ -0,0 +1,86 @@
+#pragma once
+# include "Sharded_Ledger.h"
+# include <atomic>
+# include <thread>
+
+// Streams the committed journal of every shard of a primary ledger to
+// standby processes over a local socket (a Unix domain socket path, or a
+// loopback TCP port on Windows). Only records that are durable on the
+// primary are sent. A standby says where each of its journals ends when it
+// connects, so a restarted standby resumes instead of starting over.
+class Journal_Shipper
+{
+public:
+	static const unsigned BATCH = 1024;
+	static const unsigned HEARTBEAT_MS = 100;
+
+	Journal_Shipper();
+	~Journal_Shipper();
+	bool listen(const string &, Sharded_Ledger &);
+	void stop();
+	void notify();
+	unsigned standbys();
+
+private:
+	Journal_Shipper(const Journal_Shipper &);
+	Journal_Shipper& operator=(const Journal_Shipper &);
+	void accept_loop();
+	void serve(long long);
+
+	Sharded_Ledger *ledger;
+	string address;
+	long long listener;
+	atomic<bool> running;
+	thread acceptor;
+	mutex connection_lock;
+	vector <thread> connections;
+	vector <long long> sockets;
+	mutex commit_lock;
+	condition_variable committed;
+	unsigned long long generation;
+};
+
+// A read-only copy of a sharded ledger, kept current from a primary's
+// journal stream. Shipped records are appended unchanged to the standby's
+// own shard journals and applied to its own indexes, so promotion is an
+// ordinary Sharded_Ledger::open that redoes only the tail after the last
+// checkpoint.
+class Standby
+{
+public:
+	Standby();
+	~Standby();
+	bool open(const string &);
+	bool connect(const string &);
+	void stop();
+	void close();
+	bool connected();
+	bool promote(Sharded_Ledger &);
+	bool balance(int, int &);
+	unsigned shard_count();
+	Shard* shard(unsigned);
+	Shard* shard_for(int);
+	unsigned long long lag_records();
+	long long lag_us();
+	unsigned long long applied_records();
+
+	string directory;
+	vector <int> splits;
+
+private:
+	Standby(const Standby &);
+	Standby& operator=(const Standby &);
+	bool open_shards();
+	void receive();
+
+	vector <Shard*> shards;
+	long long fd;
+	atomic<bool> running;
+	thread receiver;
+	// guards the replication status below
+	mutex status_lock;
+	vector <unsigned long long> head;
+	vector <unsigned long long> applied;
+	unsigned long long received;
+	long long last_lag_us;
+};
@@ -0,0 +1,146 @@
+# include "Scrypt.h"
+# include "Sha256.h"
+# include <string.h>
+# include <algorithm>
+
+static inline unsigned rotl(unsigned x, unsigned n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+static inline unsigned load32(const unsigned char *p)
+{
+	return (unsigned)p[0] | (unsigned)p[1] << 8 | (unsigned)p[2] << 16 | (unsigned)p[3] << 24;
+}
+static inline void store32(unsigned char *p, unsigned v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+// b = Salsa20/8(b ^ x)
+static void salsa_xor(unsigned b[16], const unsigned x[16])
+{
+	unsigned w[16];
+	for (unsigned i = 0; i < 16; i++)
+	{
+		b[i] ^= x[i];
+		w[i] = b[i];
+	}
+	for (unsigned round = 0; round < 8; round += 2)
+	{
+		w[4] ^= rotl(w[0] + w[12], 7);   w[8] ^= rotl(w[4] + w[0], 9);
+		w[12] ^= rotl(w[8] + w[4], 13);  w[0] ^= rotl(w[12] + w[8], 18);
+		w[9] ^= rotl(w[5] + w[1], 7);    w[13] ^= rotl(w[9] + w[5], 9);
+		w[1] ^= rotl(w[13] + w[9], 13);  w[5] ^= rotl(w[1] + w[13], 18);
+		w[14] ^= rotl(w[10] + w[6], 7);  w[2] ^= rotl(w[14] + w[10], 9);
+		w[6] ^= rotl(w[2] + w[14], 13);  w[10] ^= rotl(w[6] + w[2], 18);
+		w[3] ^= rotl(w[15] + w[11], 7);  w[7] ^= rotl(w[3] + w[15], 9);
+		w[11] ^= rotl(w[7] + w[3], 13);  w[15] ^= rotl(w[11] + w[7], 18);
+		w[1] ^= rotl(w[0] + w[3], 7);    w[2] ^= rotl(w[1] + w[0], 9);
+		w[3] ^= rotl(w[2] + w[1], 13);   w[0] ^= rotl(w[3] + w[2], 18);
+		w[6] ^= rotl(w[5] + w[4], 7);    w[7] ^= rotl(w[6] + w[5], 9);
+		w[4] ^= rotl(w[7] + w[6], 13);   w[5] ^= rotl(w[4] + w[7], 18);
+		w[11] ^= rotl(w[10] + w[9], 7);  w[8] ^= rotl(w[11] + w[10], 9);
+		w[9] ^= rotl(w[8] + w[11], 13);  w[10] ^= rotl(w[9] + w[8], 18);
+		w[12] ^= rotl(w[15] + w[14], 7); w[13] ^= rotl(w[12] + w[15], 9);
+		w[14] ^= rotl(w[13] + w[12], 13); w[15] ^= rotl(w[14] + w[13], 18);
+	}
+	for (unsigned i = 0; i < 16; i++)
+	{
+		b[i] += w[i];
+	}
+}
+// BlockMix of the 2r 64-byte blocks in b, written to y with the even blocks
+// first and the odd ones after.
+static void block_mix(const unsigned *b, unsigned *y, unsigned r)
+{
+	unsigned x[16];
+	memcpy(x, b + (2 * r - 1) * 16, sizeof(x));
+	for (unsigned i = 0; i < 2 * r; i++)
+	{
+		salsa_xor(x, b + i * 16);
+		memcpy(y + ((i % 2) * r + i / 2) * 16, x, sizeof(x));
+	}
+}
+static void ro_mix(unsigned char *block, unsigned r, unsigned long long n, vector <unsigned> &scratch)
+{
+	size_t words = 32 * r;
+	scratch.resize(words * (size_t)(n + 2));
+	unsigned *v = scratch.data();
+	unsigned *x = v + words * n;
+	unsigned *y = x + words;
+	for (size_t i = 0; i < words; i++)
+	{
+		x[i] = load32(block + 4 * i);
+	}
+	for (unsigned long long i = 0; i < n; i++)
+	{
+		memcpy(v + words * i, x, words * sizeof(unsigned));
+		block_mix(x, y, r);
+		swap(x, y);
+	}
+	for (unsigned long long i = 0; i < n; i++)
+	{
+		// Integerify: the first word of the last 64-byte block
+		unsigned long long j = x[(2 * r - 1) * 16] & (n - 1);
+		const unsigned *vj = v + words * j;
+		for (size_t k = 0; k < words; k++)
+		{
+			x[k] ^= vj[k];
+		}
+		block_mix(x, y, r);
+		swap(x, y);
+	}
+	for (size_t i = 0; i < words; i++)
+	{
+		store32(block + 4 * i, x[i]);
+	}
+}
+
+// PBKDF2-HMAC-SHA-256.
+void Scrypt::pbkdf2(const void *password, size_t password_length, const unsigned char *salt, size_t salt_length,
+	unsigned rounds, unsigned char *out, size_t length)
+{
+	vector <unsigned char> message(salt_length + 4);
+	if (salt_length > 0)
+	{
+		memcpy(message.data(), salt, salt_length);
+	}
+	const unsigned char *key = (const unsigned char*)password;
+	for (unsigned block = 1; length > 0; block++)
+	{
+		message[salt_length] = (unsigned char)(block >> 24);
+		message[salt_length + 1] = (unsigned char)(block >> 16);
+		message[salt_length + 2] = (unsigned char)(block >> 8);
+		message[salt_length + 3] = (unsigned char)block;
+		unsigned char u[Sha256::SIZE], t[Sha256::SIZE];
+		Sha256::hmac(key, password_length, message.data(), message.size(), u);
+		memcpy(t, u, sizeof(t));
+		for (unsigned i = 1; i < rounds; i++)
+		{
+			Sha256::hmac(key, password_length, u, sizeof(u), u);
+			for (unsigned k = 0; k < Sha256::SIZE; k++)
+			{
+				t[k] ^= u[k];
+			}
+		}
+		size_t take = length < Sha256::SIZE ? length : Sha256::SIZE;
+		memcpy(out, t, take);
+		out += take;
+		length -= take;
+	}
+}
+void Scrypt::derive(const void *password, size_t password_length, const unsigned char *salt, size_t salt_length,
+	unsigned log2_n, unsigned r, unsigned p, unsigned char *out, size_t length, vector <unsigned> &scratch)
+{
+	size_t block_bytes = 128 * (size_t)r;
+	vector <unsigned char> b(block_bytes * p);
+	pbkdf2(password, password_length, salt, salt_length, 1, b.data(), b.size());
+	for (unsigned i = 0; i < p; i++)
+	{
+		ro_mix(b.data() + i * block_bytes, r, 1ull << log2_n, scratch);
+	}
+	pbkdf2(password, password_length, b.data(), b.size(), 1, out, length);
+}
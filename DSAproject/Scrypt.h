@@ -0,0 +1,16 @@
+#pragma once
+# include <stddef.h>
+# include <vector>
+using namespace std;
+
+// scrypt (RFC 7914) over Sha256: PBKDF2-HMAC-SHA-256 around ROMix with
+// Salsa20/8. A derivation fills and then reads back 128 * r * 2^log2_n bytes
+// in an order that depends on the password, so guessing in parallel costs as
+// much memory as time. The scratch vector is reused between calls.
+class Scrypt
+{
+public:
+	static void derive(const void *, size_t, const unsigned char *, size_t, unsigned, unsigned, unsigned,
+		unsigned char *, size_t, vector <unsigned> &);
+	static void pbkdf2(const void *, size_t, const unsigned char *, size_t, unsigned, unsigned char *, size_t);
+};
@@ -0,0 +1,166 @@
+# include "Session_Table.h"
+# include "Journal.h"
+# include "Metrics.h"
+
+const unsigned Session_Table::SHARDS;
+const unsigned Session_Table::WHEEL_SLOTS;
+const long long Session_Table::DEFAULT_TTL_US;
+
+// A TTL covers half the wheel, so a session is usually filed once and drained
+// once; one used all along is filed again about twice per TTL.
+Session_Table::Session_Table(long long ttl)
+{
+	ttl_us = ttl > 0 ? ttl : DEFAULT_TTL_US;
+	tick_us = ttl_us / (WHEEL_SLOTS / 2);
+	if (tick_us < 1000)
+	{
+		tick_us = 1000;
+	}
+	for (unsigned i = 0; i < SHARDS; i++)
+	{
+		shards[i].wheel.resize(WHEEL_SLOTS);
+		shards[i].tick = -1;
+	}
+	random_device random;
+	tokens.seed(((unsigned long long)random() << 32) ^ random());
+}
+// Opens a session for an account whose credentials have been checked.
+unsigned long long Session_Table::open(int account, long long now_us)
+{
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	unsigned long long token = 0;
+	{
+		lock_guard <mutex> guard(token_lock);
+		while (token == 0)
+		{
+			token = tokens();
+		}
+	}
+	Shard &s = shard(token);
+	lock_guard <mutex> guard(s.lock);
+	advance(s, now_us);
+	Session &session = s.sessions[token];
+	session.account = account;
+	session.expires = now_us + ttl_us;
+	schedule(s, token, session.expires);
+	Metrics::count(Metrics::SESSIONS_OPENED);
+	return token;
+}
+// Gives the account of a live session and keeps it alive for another TTL.
+bool Session_Table::validate(unsigned long long token, int &account, long long now_us)
+{
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	Shard &s = shard(token);
+	lock_guard <mutex> guard(s.lock);
+	advance(s, now_us);
+	unordered_map <unsigned long long, Session>::iterator it = s.sessions.find(token);
+	if (it == s.sessions.end() || it->second.expires <= now_us)
+	{
+		return false;
+	}
+	it->second.expires = now_us + ttl_us;
+	account = it->second.account;
+	return true;
+}
+void Session_Table::close(unsigned long long token)
+{
+	Shard &s = shard(token);
+	lock_guard <mutex> guard(s.lock);
+	// the wheel entry is dropped when its slot comes due
+	s.sessions.erase(token);
+}
+// Ends every session of an account, after its password changed or it was
+// deleted. Sessions are found by handle only, so this looks at all of them.
+void Session_Table::revoke(int account)
+{
+	for (unsigned i = 0; i < SHARDS; i++)
+	{
+		lock_guard <mutex> guard(shards[i].lock);
+		unordered_map <unsigned long long, Session>::iterator it = shards[i].sessions.begin();
+		while (it != shards[i].sessions.end())
+		{
+			if (it->second.account == account)
+				it = shards[i].sessions.erase(it);
+			else
+				++it;
+		}
+	}
+}
+size_t Session_Table::size()
+{
+	size_t n = 0;
+	for (unsigned i = 0; i < SHARDS; i++)
+	{
+		lock_guard <mutex> guard(shards[i].lock);
+		n += shards[i].sessions.size();
+	}
+	return n;
+}
+long long Session_Table::ttl()
+{
+	return ttl_us;
+}
+Session_Table& Session_Table::bank()
+{
+	static Session_Table table;
+	return table;
+}
+Session_Table::Shard& Session_Table::shard(unsigned long long token)
+{
+	return shards[(token ^ (token >> 29)) % SHARDS];
+}
+// Files a session under the tick it expires in; one further away than the
+// wheel reaches goes in the farthest slot and is filed again from there.
+void Session_Table::schedule(Shard &s, unsigned long long token, long long expires)
+{
+	long long tick = expires / tick_us;
+	if (tick <= s.tick)
+	{
+		tick = s.tick + 1;
+	}
+	if (tick - s.tick >= (long long)WHEEL_SLOTS)
+	{
+		tick = s.tick + WHEEL_SLOTS - 1;
+	}
+	s.wheel[(size_t)(tick % WHEEL_SLOTS)].push_back(token);
+}
+// Drains the slots of the ticks that passed since the shard was last used.
+void Session_Table::advance(Shard &s, long long now_us)
+{
+	long long now_tick = now_us / tick_us;
+	if (s.tick < 0 || now_tick - s.tick > (long long)WHEEL_SLOTS)
+	{
+		// first use, or idle for a whole turn: every slot is due once
+		s.tick = s.tick < 0 ? now_tick : now_tick - WHEEL_SLOTS;
+	}
+	vector <unsigned long long> due;
+	while (s.tick < now_tick)
+	{
+		s.tick++;
+		due.clear();
+		due.swap(s.wheel[(size_t)(s.tick % WHEEL_SLOTS)]);
+		for (size_t i = 0; i < due.size(); i++)
+		{
+			unordered_map <unsigned long long, Session>::iterator it = s.sessions.find(due[i]);
+			if (it == s.sessions.end())
+			{
+				continue;
+			}
+			if (it->second.expires <= now_us)
+			{
+				s.sessions.erase(it);
+				Metrics::count(Metrics::SESSIONS_EXPIRED);
+			}
+			else
+			{
+				schedule(s, due[i], it->second.expires);
+			}
+		}
+	}
+}
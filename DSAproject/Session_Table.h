@@ -0,0 +1,61 @@
+#pragma once
+# include <vector>
+# include <unordered_map>
+# include <mutex>
+# include <random>
+using namespace std;
+
+// Signed-in customers. A session is opened once the credentials match and is
+// named by a random 64-bit handle; while it is live, the customer menu takes
+// the account from it instead of asking for the password again. Sessions live
+// in SHARDS independently locked hash tables picked by the handle, so
+// checking one is a lock and a hash probe. Each check moves the expiry TTL
+// ahead. Expiry is driven by a timing wheel per shard: a session is filed in
+// the slot of the tick it expires in, and the slots that have come due are
+// drained whenever the shard is next used. A session found there that was
+// used since is filed again under its new expiry, so nothing ever scans the
+// whole table. Sessions are kept in memory only.
+class Session_Table
+{
+public:
+	static const unsigned SHARDS = 16;
+	static const unsigned WHEEL_SLOTS = 64;
+	static const long long DEFAULT_TTL_US = 15 * 60 * 1000000LL;
+
+	Session_Table(long long ttl_us = DEFAULT_TTL_US);
+	unsigned long long open(int, long long now_us = 0);
+	bool validate(unsigned long long, int &, long long now_us = 0);
+	void close(unsigned long long);
+	void revoke(int);
+	size_t size();
+	long long ttl();
+	// the table used by the customer menu
+	static Session_Table& bank();
+
+private:
+	struct Session
+	{
+		int account;
+		long long expires;
+	};
+	struct Shard
+	{
+		mutex lock;
+		unordered_map <unsigned long long, Session> sessions;
+		vector <vector <unsigned long long> > wheel;
+		// last tick whose slot was drained
+		long long tick;
+	};
+
+	Session_Table(const Session_Table &);
+	Session_Table& operator=(const Session_Table &);
+	Shard& shard(unsigned long long);
+	void schedule(Shard &, unsigned long long, long long);
+	void advance(Shard &, long long);
+
+	long long ttl_us;
+	long long tick_us;
+	Shard shards[SHARDS];
+	mutex token_lock;
+	mt19937_64 tokens;
+};
@@ -0,0 +1,160 @@
+# include "Sha256.h"
+# include <string.h>
+# include <vector>
+
+static const unsigned K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+static const unsigned INITIAL[8] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+const unsigned Sha256::SIZE;
+const unsigned Sha256::LANES;
+
+static inline unsigned rotr(unsigned x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+// One block of every lane; w[i][lane] is word i of that lane's block.
+static void compress(unsigned state[8][Sha256::LANES], unsigned w[64][Sha256::LANES])
+{
+	const unsigned L = Sha256::LANES;
+	for (unsigned i = 16; i < 64; i++)
+	{
+		for (unsigned l = 0; l < L; l++)
+		{
+			unsigned s0 = rotr(w[i - 15][l], 7) ^ rotr(w[i - 15][l], 18) ^ (w[i - 15][l] >> 3);
+			unsigned s1 = rotr(w[i - 2][l], 17) ^ rotr(w[i - 2][l], 19) ^ (w[i - 2][l] >> 10);
+			w[i][l] = w[i - 16][l] + s0 + w[i - 7][l] + s1;
+		}
+	}
+	unsigned a[L], b[L], c[L], d[L], e[L], f[L], g[L], h[L];
+	for (unsigned l = 0; l < L; l++)
+	{
+		a[l] = state[0][l]; b[l] = state[1][l]; c[l] = state[2][l]; d[l] = state[3][l];
+		e[l] = state[4][l]; f[l] = state[5][l]; g[l] = state[6][l]; h[l] = state[7][l];
+	}
+	for (unsigned i = 0; i < 64; i++)
+	{
+		for (unsigned l = 0; l < L; l++)
+		{
+			unsigned t1 = h[l] + (rotr(e[l], 6) ^ rotr(e[l], 11) ^ rotr(e[l], 25)) + ((e[l] & f[l]) ^ (~e[l] & g[l])) + K[i] + w[i][l];
+			unsigned t2 = (rotr(a[l], 2) ^ rotr(a[l], 13) ^ rotr(a[l], 22)) + ((a[l] & b[l]) ^ (a[l] & c[l]) ^ (b[l] & c[l]));
+			h[l] = g[l];
+			g[l] = f[l];
+			f[l] = e[l];
+			e[l] = d[l] + t1;
+			d[l] = c[l];
+			c[l] = b[l];
+			b[l] = a[l];
+			a[l] = t1 + t2;
+		}
+	}
+	for (unsigned l = 0; l < L; l++)
+	{
+		state[0][l] += a[l]; state[1][l] += b[l]; state[2][l] += c[l]; state[3][l] += d[l];
+		state[4][l] += e[l]; state[5][l] += f[l]; state[6][l] += g[l]; state[7][l] += h[l];
+	}
+}
+
+// Hashes up to LANES messages of the same length.
+static void hash_lanes(const unsigned char *const *messages, unsigned count, size_t length, unsigned char *out)
+{
+	const unsigned L = Sha256::LANES;
+	size_t blocks = (length + 9 + 63) / 64;
+	vector <unsigned char> padded(blocks * 64);
+	unsigned state[8][L];
+	unsigned w[64][L];
+	for (unsigned i = 0; i < 8; i++)
+	{
+		for (unsigned l = 0; l < L; l++)
+		{
+			state[i][l] = INITIAL[i];
+		}
+	}
+	unsigned long long bits = (unsigned long long)length * 8;
+	for (size_t block = 0; block < blocks; block++)
+	{
+		for (unsigned l = 0; l < L; l++)
+		{
+			// lanes past count repeat the first message and are thrown away
+			const unsigned char *message = messages[l < count ? l : 0];
+			unsigned char bytes[64];
+			size_t at = block * 64;
+			for (unsigned j = 0; j < 64; j++, at++)
+			{
+				if (at < length)
+					bytes[j] = message[at];
+				else if (at == length)
+					bytes[j] = 0x80;
+				else if (at >= blocks * 64 - 8)
+					bytes[j] = (unsigned char)(bits >> (8 * (blocks * 64 - 1 - at)));
+				else
+					bytes[j] = 0;
+			}
+			for (unsigned i = 0; i < 16; i++)
+			{
+				w[i][l] = (unsigned)bytes[4 * i] << 24 | (unsigned)bytes[4 * i + 1] << 16 | (unsigned)bytes[4 * i + 2] << 8 | bytes[4 * i + 3];
+			}
+		}
+		compress(state, w);
+	}
+	for (unsigned l = 0; l < count; l++)
+	{
+		for (unsigned i = 0; i < 8; i++)
+		{
+			out[l * Sha256::SIZE + 4 * i] = (unsigned char)(state[i][l] >> 24);
+			out[l * Sha256::SIZE + 4 * i + 1] = (unsigned char)(state[i][l] >> 16);
+			out[l * Sha256::SIZE + 4 * i + 2] = (unsigned char)(state[i][l] >> 8);
+			out[l * Sha256::SIZE + 4 * i + 3] = (unsigned char)state[i][l];
+		}
+	}
+}
+
+void Sha256::hash(const void *data, size_t length, unsigned char *out)
+{
+	const unsigned char *message = (const unsigned char*)data;
+	hash_lanes(&message, 1, length, out);
+}
+// Hashes count messages of the same length into count consecutive digests.
+void Sha256::hash_many(const unsigned char *const *messages, size_t count, size_t length, unsigned char *out)
+{
+	for (size_t i = 0; i < count; i += LANES)
+	{
+		unsigned n = count - i < LANES ? (unsigned)(count - i) : LANES;
+		hash_lanes(messages + i, n, length, out + i * SIZE);
+	}
+}
+void Sha256::hmac(const unsigned char *key, size_t key_length, const void *data, size_t length, unsigned char *out)
+{
+	unsigned char block[64];
+	memset(block, 0, sizeof(block));
+	if (key_length > sizeof(block))
+		hash(key, key_length, block);
+	else
+		memcpy(block, key, key_length);
+	vector <unsigned char> inner(64 + length);
+	unsigned char outer[64 + SIZE];
+	for (unsigned i = 0; i < 64; i++)
+	{
+		inner[i] = block[i] ^ 0x36;
+		outer[i] = block[i] ^ 0x5c;
+	}
+	if (length > 0)
+	{
+		memcpy(inner.data() + 64, data, length);
+	}
+	hash(inner.data(), inner.size(), outer + 64);
+	hash(outer, sizeof(outer), out);
+}
@@ -0,0 +1,18 @@
+#pragma once
+# include <stddef.h>
+using namespace std;
+
+// SHA-256 and HMAC-SHA-256. Messages of the same length can be hashed LANES
+// at a time: the state of every message is kept word by word side by side,
+// so each step of the compression runs as one loop over the lanes, which the
+// compiler turns into vector instructions.
+class Sha256
+{
+public:
+	static const unsigned SIZE = 32;
+	static const unsigned LANES = 8;
+
+	static void hash(const void *, size_t, unsigned char *);
+	static void hash_many(const unsigned char *const *, size_t, size_t, unsigned char *);
+	static void hmac(const unsigned char *, size_t, const void *, size_t, unsigned char *);
+};
@@ -0,0 +1,732 @@
+# include "Shard.h"
+# include "Sharded_Ledger.h"
+# include "Metrics.h"
+# include "Tracer.h"
+# include "Placement.h"
+# include "Change_Feed.h"
+# include <fstream>
+# include <stdio.h>
+# include <string.h>
+
+static const char CHECKPOINT_MAGIC[4] = { 'B', 'K', 'C', 'P' };
+
+Shard::Shard()
+{
+	ledger = nullptr;
+	stopping = false;
+	max_txid = 0;
+	number = -1;
+	node = -1;
+	since_checkpoint = 0;
+}
+Shard::~Shard()
+{
+	close();
+}
+bool Shard::read_checkpoint(unsigned long long &seq, unsigned long long &offset)
+{
+	ifstream read((prefix + "checkpoint").c_str(), ios::binary);
+	char magic[4];
+	if (!read.read(magic, sizeof(magic)) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+	{
+		return false;
+	}
+	unsigned long long txid;
+	unsigned count;
+	read.read((char*)&seq, sizeof(seq));
+	read.read((char*)&offset, sizeof(offset));
+	read.read((char*)&txid, sizeof(txid));
+	read.read((char*)&count, sizeof(count));
+	for (unsigned i = 0; read && i < count; i++)
+	{
+		Journal_Record rec;
+		read.read((char*)&rec, sizeof(rec));
+		reservations[rec.txid] = rec;
+	}
+	read.read((char*)&count, sizeof(count));
+	for (unsigned i = 0; read && i < count; i++)
+	{
+		unsigned long long credit;
+		int sender;
+		read.read((char*)&credit, sizeof(credit));
+		read.read((char*)&sender, sizeof(sender));
+		credits[credit] = sender;
+	}
+	// checkpoints written before escrow slots end here
+	if (read && read.peek() == EOF)
+	{
+		read.clear();
+	}
+	else if (read.read((char*)&count, sizeof(count)))
+	{
+		for (unsigned i = 0; read && i < count; i++)
+		{
+			int accountno, balance;
+			read.read((char*)&accountno, sizeof(accountno));
+			read.read((char*)&balance, sizeof(balance));
+			slots[accountno] = balance;
+		}
+	}
+	if (!read)
+	{
+		// a checkpoint is renamed into place whole, so this is not ours; redo everything
+		seq = 0;
+		offset = 0;
+		reservations.clear();
+		credits.clear();
+		slots.clear();
+		return false;
+	}
+	max_txid = txid;
+	return true;
+}
+bool Shard::open(const string &file_prefix, Sharded_Ledger *owner)
+{
+	close();
+	prefix = file_prefix;
+	ledger = owner;
+	max_txid = 0;
+	since_checkpoint = 0;
+	reservations.clear();
+	credits.clear();
+	slots.clear();
+
+	unsigned long long seq = 0, offset = 0;
+	read_checkpoint(seq, offset);
+	if (node >= 0)
+	{
+		index.pool.place(node);
+	}
+	if (!index.open(prefix + "accounts.idx") || !journal.open(prefix + "journal.log"))
+	{
+		return false;
+	}
+	index.pool.before_write = [this]() { journal.sync(); };
+	if (offset > journal.size)
+	{
+		offset = 0;
+	}
+	journal.scan(offset, [&](const Journal_Record &rec, unsigned long long) {
+		if (rec.seq > seq)
+		{
+			redo(rec);
+			since_checkpoint++;
+		}
+		return true;
+	});
+	return true;
+}
+void Shard::start()
+{
+	stopping = false;
+	applier = thread(&Shard::run, this);
+}
+void Shard::stop()
+{
+	if (!applier.joinable())
+	{
+		return;
+	}
+	{
+		lock_guard <mutex> guard(queue_lock);
+		stopping = true;
+	}
+	queued.notify_one();
+	applier.join();
+}
+void Shard::close()
+{
+	stop();
+	if (!journal.path.empty() && index.is_open())
+	{
+		checkpoint();
+	}
+	index.close();
+	journal.close();
+}
+void Shard::submit(Shard_Request *request)
+{
+	request->owner = this;
+	request->state = Shard_Request::PENDING;
+	{
+		lock_guard <mutex> guard(queue_lock);
+		queue.push_back(request);
+	}
+	queued.notify_one();
+}
+bool Shard::wait(Shard_Request *request)
+{
+	unique_lock <mutex> guard(queue_lock);
+	published.wait(guard, [request] { return request->state != Shard_Request::PENDING; });
+	return request->state == Shard_Request::ACCEPTED;
+}
+bool Shard::ready(Shard_Request *request)
+{
+	lock_guard <mutex> guard(queue_lock);
+	return request->state != Shard_Request::PENDING;
+}
+bool Shard::balance(int accountno, int &balance)
+{
+	lock_guard <mutex> guard(state_lock);
+	Account_Record rec;
+	if (!index.find(accountno, rec))
+	{
+		return false;
+	}
+	balance = rec.balance;
+	return true;
+}
+bool Shard::outstanding(unsigned long long txid)
+{
+	lock_guard <mutex> guard(state_lock);
+	return reservations.count(txid) != 0;
+}
+bool Shard::credited(unsigned long long txid)
+{
+	lock_guard <mutex> guard(state_lock);
+	return credits.count(txid) != 0;
+}
+int Shard::escrow(int accountno)
+{
+	lock_guard <mutex> guard(state_lock);
+	return held(accountno);
+}
+vector <int> Shard::escrow_accounts()
+{
+	lock_guard <mutex> guard(state_lock);
+	vector <int> accounts;
+	for (unordered_map <int, int>::iterator it = slots.begin(); it != slots.end(); ++it)
+	{
+		accounts.push_back(it->first);
+	}
+	return accounts;
+}
+int Shard::held(int accountno)
+{
+	unordered_map <int, int>::iterator it = slots.find(accountno);
+	return it != slots.end() ? it->second : 0;
+}
+void Shard::hold(int accountno, int balance)
+{
+	if (balance == 0)
+	{
+		slots.erase(accountno);
+	}
+	else
+	{
+		slots[accountno] = balance;
+	}
+}
+vector <Journal_Record> Shard::in_doubt()
+{
+	lock_guard <mutex> guard(state_lock);
+	vector <Journal_Record> open;
+	for (map <unsigned long long, Journal_Record>::iterator it = reservations.begin(); it != reservations.end(); ++it)
+	{
+		open.push_back(it->second);
+	}
+	return open;
+}
+// Settles a reservation left open by a crash; only called before the applier starts.
+void Shard::resolve(const Journal_Record &reservation, bool commit)
+{
+	lock_guard <mutex> guard(state_lock);
+	Journal_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = commit ? Journal_Record::COMMIT : Journal_Record::ABORT;
+	rec.txid = reservation.txid;
+	rec.account = reservation.account;
+	rec.counterparty = reservation.counterparty;
+	rec.amount = reservation.amount;
+	rec.flags = reservation.flags;
+	apply(rec);
+	journal.sync();
+	reservations.erase(rec.txid);
+}
+// Appends records shipped from a primary unchanged and applies them. Used by
+// standbys, whose shards have no applier thread.
+bool Shard::replicate(const vector <Journal_Record> &records)
+{
+	{
+		lock_guard <mutex> guard(state_lock);
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			if (records[i].seq < journal.next_seq)
+			{
+				continue;
+			}
+			if (!journal.copy(records[i]))
+			{
+				return false;
+			}
+			redo(records[i]);
+			since_checkpoint++;
+		}
+	}
+	if (!journal.sync())
+	{
+		return false;
+	}
+	if (since_checkpoint >= CHECKPOINT_INTERVAL)
+	{
+		checkpoint();
+	}
+	return true;
+}
+// Validates a request against the index, logs it and then changes the index.
+// The caller holds state_lock.
+bool Shard::apply(Journal_Record &rec)
+{
+	Account_Record account, other;
+	bool found = index.find(rec.account, account);
+	bool from_escrow = (rec.flags & Journal_Record::FROM_ESCROW) != 0;
+	switch (rec.type)
+	{
+		case Journal_Record::OPEN:
+			if (found)
+			{
+				return false;
+			}
+			rec.balance = rec.amount;
+			journal.append(rec);
+			memset(&account, 0, sizeof(account));
+			account.account_number = rec.account;
+			account.balance = rec.balance;
+			index.insert(account);
+			break;
+		case Journal_Record::CLOSE:
+			if (!found)
+			{
+				return false;
+			}
+			for (map <unsigned long long, Journal_Record>::iterator it = reservations.begin(); it != reservations.end(); ++it)
+			{
+				// a pending refund needs the account
+				if (it->second.account == rec.account)
+				{
+					return false;
+				}
+			}
+			if (held(rec.account) != 0)
+			{
+				// the slot would be left without an account to go to
+				return false;
+			}
+			rec.balance = account.balance;
+			journal.append(rec);
+			index.remove(rec.account);
+			break;
+		case Journal_Record::DEPOSIT:
+		case Journal_Record::CREDIT:
+		case Journal_Record::ABORT:
+			if (rec.type == Journal_Record::ABORT && from_escrow)
+			{
+				// a sweep that did not arrive goes back into the slot
+				if (reservations.count(rec.txid) == 0)
+				{
+					return false;
+				}
+				rec.balance = held(rec.account) + rec.amount;
+				journal.append(rec);
+				hold(rec.account, rec.balance);
+				break;
+			}
+			if (!found || (rec.type == Journal_Record::ABORT && reservations.count(rec.txid) == 0))
+			{
+				return false;
+			}
+			rec.balance = account.balance + rec.amount;
+			journal.append(rec);
+			index.update_balance(rec.account, rec.balance);
+			if (rec.type == Journal_Record::CREDIT)
+			{
+				credits[rec.txid] = rec.counterparty;
+			}
+			break;
+		case Journal_Record::WITHDRAW:
+		case Journal_Record::RESERVE:
+			if (rec.type == Journal_Record::RESERVE && from_escrow)
+			{
+				// a sweep takes whatever the slot holds when it is applied
+				rec.amount = held(rec.account);
+				if (rec.amount <= 0)
+				{
+					return false;
+				}
+				rec.balance = 0;
+				journal.append(rec);
+				hold(rec.account, 0);
+				reservations[rec.txid] = rec;
+				break;
+			}
+			if (!found || account.balance < rec.amount)
+			{
+				return false;
+			}
+			rec.balance = account.balance - rec.amount;
+			journal.append(rec);
+			index.update_balance(rec.account, rec.balance);
+			if (rec.type == Journal_Record::RESERVE)
+			{
+				reservations[rec.txid] = rec;
+			}
+			break;
+		case Journal_Record::LOCAL_TRANSFER:
+			if (!found || account.balance < rec.amount || !index.find(rec.counterparty, other))
+			{
+				return false;
+			}
+			rec.balance = account.balance - rec.amount;
+			rec.counter_balance = other.balance + rec.amount;
+			journal.append(rec);
+			index.update_balance(rec.account, rec.balance);
+			index.update_balance(rec.counterparty, rec.counter_balance);
+			break;
+		case Journal_Record::COMMIT:
+			if (reservations.count(rec.txid) == 0)
+			{
+				return false;
+			}
+			rec.balance = found ? account.balance : 0;
+			journal.append(rec);
+			break;
+		case Journal_Record::ESCROW_DEPOSIT:
+			rec.balance = held(rec.account) + rec.amount;
+			journal.append(rec);
+			hold(rec.account, rec.balance);
+			break;
+		case Journal_Record::ESCROW_TRANSFER:
+			if (!found || account.balance < rec.amount)
+			{
+				return false;
+			}
+			rec.balance = account.balance - rec.amount;
+			rec.counter_balance = held(rec.counterparty) + rec.amount;
+			journal.append(rec);
+			index.update_balance(rec.account, rec.balance);
+			hold(rec.counterparty, rec.counter_balance);
+			break;
+		case Journal_Record::ESCROW_RELEASE:
+			rec.amount = held(rec.account);
+			if (!found || rec.amount <= 0)
+			{
+				return false;
+			}
+			rec.balance = account.balance + rec.amount;
+			rec.counter_balance = 0;
+			journal.append(rec);
+			index.update_balance(rec.account, rec.balance);
+			hold(rec.account, 0);
+			break;
+		default:
+			return false;
+	}
+	if (rec.txid > max_txid)
+	{
+		max_txid = rec.txid;
+	}
+	since_checkpoint++;
+	return true;
+}
+void Shard::redo(const Journal_Record &rec)
+{
+	Account_Record account;
+	switch (rec.type)
+	{
+		case Journal_Record::OPEN:
+			if (index.find(rec.account, account))
+			{
+				index.update_balance(rec.account, rec.balance);
+			}
+			else
+			{
+				memset(&account, 0, sizeof(account));
+				account.account_number = rec.account;
+				account.balance = rec.balance;
+				index.insert(account);
+			}
+			break;
+		case Journal_Record::CLOSE:
+			index.remove(rec.account);
+			break;
+		case Journal_Record::LOCAL_TRANSFER:
+			index.update_balance(rec.account, rec.balance);
+			index.update_balance(rec.counterparty, rec.counter_balance);
+			break;
+		case Journal_Record::COMMIT:
+			reservations.erase(rec.txid);
+			break;
+		case Journal_Record::ESCROW_DEPOSIT:
+			hold(rec.account, rec.balance);
+			break;
+		case Journal_Record::ESCROW_TRANSFER:
+			index.update_balance(rec.account, rec.balance);
+			hold(rec.counterparty, rec.counter_balance);
+			break;
+		case Journal_Record::ESCROW_RELEASE:
+			index.update_balance(rec.account, rec.balance);
+			hold(rec.account, 0);
+			break;
+		default:
+			if ((rec.flags & Journal_Record::FROM_ESCROW) && (rec.type == Journal_Record::RESERVE || rec.type == Journal_Record::ABORT))
+			{
+				hold(rec.account, rec.balance);
+			}
+			else
+			{
+				index.update_balance(rec.account, rec.balance);
+			}
+			break;
+	}
+	if (rec.type == Journal_Record::RESERVE)
+	{
+		reservations[rec.txid] = rec;
+	}
+	else if (rec.type == Journal_Record::ABORT)
+	{
+		reservations.erase(rec.txid);
+	}
+	else if (rec.type == Journal_Record::CREDIT)
+	{
+		credits[rec.txid] = rec.counterparty;
+	}
+	if (rec.txid > max_txid)
+	{
+		max_txid = rec.txid;
+	}
+}
+void Shard::run()
+{
+	vector <Shard_Request*> batch;
+	if (node >= 0)
+	{
+		Placement::pin(node);
+	}
+	for (;;)
+	{
+		{
+			unique_lock <mutex> guard(queue_lock);
+			queued.wait(guard, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+			{
+				return;
+			}
+			batch.assign(queue.begin(), queue.end());
+			queue.clear();
+		}
+		Trace_Span span("shard_batch");
+		size_t from = 0;
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			Shard_Request *request = batch[i];
+			if (request->after != nullptr)
+			{
+				if (!request->after->owner->ready(request->after))
+				{
+					// report what is done before blocking on another shard, which may be waiting on us
+					publish(batch, from, i);
+					from = i;
+				}
+				if (!request->after->owner->wait(request->after))
+				{
+					request->accepted = false;
+					continue;
+				}
+				if (request->rec.flags & Journal_Record::FROM_ESCROW)
+				{
+					// a sweep credits what the slot held when it was reserved
+					request->rec.amount = request->after->rec.amount;
+				}
+			}
+			lock_guard <mutex> guard(state_lock);
+			request->accepted = apply(request->rec);
+		}
+		publish(batch, from, batch.size());
+		if (since_checkpoint >= CHECKPOINT_INTERVAL)
+		{
+			checkpoint();
+		}
+	}
+}
+// Makes batch[from, to) durable, reports it, and hands the outcome of every
+// credit back to the sending shard.
+void Shard::publish(vector <Shard_Request*> &batch, size_t from, size_t to)
+{
+	if (from == to)
+	{
+		return;
+	}
+	journal.sync();
+	unsigned long long now = Metrics::now();
+	vector <Shard_Request*> settle;
+	vector <Shard*> settle_on;
+	vector <Shard_Request*> owned;
+	unsigned settled = 0;
+	{
+		lock_guard <mutex> guard(state_lock);
+		for (size_t i = from; i < to; i++)
+		{
+			const Journal_Record &rec = batch[i]->rec;
+			if (batch[i]->accepted && (rec.type == Journal_Record::COMMIT || rec.type == Journal_Record::ABORT))
+			{
+				reservations.erase(rec.txid);
+			}
+		}
+	}
+	if (Change_Feed::active())
+	{
+		for (size_t i = from; i < to; i++)
+		{
+			if (batch[i]->accepted)
+			{
+				Change_Feed::publish(batch[i]->rec, number);
+			}
+		}
+	}
+	for (size_t i = from; i < to; i++)
+	{
+		Shard_Request *request = batch[i];
+		if (request->rec.type == Journal_Record::CREDIT)
+		{
+			if (request->after->state != Shard_Request::ACCEPTED)
+			{
+				// nothing was reserved, so there is nothing to settle
+				settled++;
+				continue;
+			}
+			Shard_Request *second = new Shard_Request();
+			memset(&second->rec, 0, sizeof(second->rec));
+			second->rec.type = request->accepted ? Journal_Record::COMMIT : Journal_Record::ABORT;
+			second->rec.txid = request->rec.txid;
+			second->rec.account = request->rec.counterparty;
+			second->rec.counterparty = request->rec.account;
+			second->rec.amount = request->rec.amount;
+			second->rec.flags = request->rec.flags;
+			second->after = nullptr;
+			second->owned = true;
+			settle.push_back(second);
+			settle_on.push_back(request->after->owner);
+		}
+		if (request->owned)
+		{
+			owned.push_back(request);
+			settled++;
+		}
+	}
+	{
+		lock_guard <mutex> guard(queue_lock);
+		for (size_t i = from; i < to; i++)
+		{
+			if (!batch[i]->owned)
+			{
+				batch[i]->done_ticks = now;
+				batch[i]->state = batch[i]->accepted ? Shard_Request::ACCEPTED : Shard_Request::REJECTED;
+			}
+		}
+	}
+	// from here on a request that is not ours may already be gone
+	published.notify_all();
+	if (ledger != nullptr && ledger->on_commit)
+	{
+		ledger->on_commit();
+	}
+	for (size_t i = 0; i < owned.size(); i++)
+	{
+		delete owned[i];
+	}
+	for (size_t i = 0; i < settle.size(); i++)
+	{
+		settle_on[i]->submit(settle[i]);
+	}
+	for (unsigned i = 0; i < settled; i++)
+	{
+		ledger->settle();
+	}
+}
+// Flushes the index and records how far the journal is reflected in it,
+// together with the transfer state that recovery cannot rebuild from the
+// journal after this point.
+bool Shard::checkpoint()
+{
+	Trace_Span span("checkpoint");
+	vector <pair<unsigned long long, int> > keep;
+	{
+		lock_guard <mutex> guard(state_lock);
+		keep.assign(credits.begin(), credits.end());
+	}
+	// a credit is only needed while the sender may still be in doubt about it
+	size_t kept = 0;
+	for (size_t i = 0; i < keep.size(); i++)
+	{
+		Shard *sender = ledger != nullptr ? ledger->shard_for(keep[i].second) : nullptr;
+		bool open = sender == nullptr || sender->outstanding(keep[i].first);
+		if (sender == this)
+		{
+			// a sweep of this shard's own account came from one of its escrow slots elsewhere
+			open = false;
+			for (unsigned j = 0; j < ledger->shard_count() && !open; j++)
+			{
+				open = ledger->shard(j) != this && ledger->shard(j)->outstanding(keep[i].first);
+			}
+		}
+		if (open)
+		{
+			keep[kept++] = keep[i];
+		}
+	}
+	keep.resize(kept);
+
+	lock_guard <mutex> guard(state_lock);
+	journal.sync();
+	index.flush();
+	if (!Journal::sync_path(prefix + "accounts.idx"))
+	{
+		return false;
+	}
+	unsigned long long seq = journal.next_seq - 1;
+	unsigned long long offset = journal.size;
+	string path = prefix + "checkpoint";
+	string temp = path + ".tmp";
+	ofstream write(temp.c_str(), ios::binary | ios::trunc);
+	write.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	write.write((const char*)&seq, sizeof(seq));
+	write.write((const char*)&offset, sizeof(offset));
+	write.write((const char*)&max_txid, sizeof(max_txid));
+	unsigned count = (unsigned)reservations.size();
+	write.write((const char*)&count, sizeof(count));
+	for (map <unsigned long long, Journal_Record>::iterator it = reservations.begin(); it != reservations.end(); ++it)
+	{
+		write.write((const char*)&it->second, sizeof(Journal_Record));
+	}
+	count = (unsigned)keep.size();
+	write.write((const char*)&count, sizeof(count));
+	for (size_t i = 0; i < keep.size(); i++)
+	{
+		write.write((const char*)&keep[i].first, sizeof(keep[i].first));
+		write.write((const char*)&keep[i].second, sizeof(keep[i].second));
+	}
+	count = (unsigned)slots.size();
+	write.write((const char*)&count, sizeof(count));
+	for (unordered_map <int, int>::iterator it = slots.begin(); it != slots.end(); ++it)
+	{
+		write.write((const char*)&it->first, sizeof(it->first));
+		write.write((const char*)&it->second, sizeof(it->second));
+	}
+	write.close();
+	if (!write || !Journal::sync_path(temp))
+	{
+		return false;
+	}
+#ifdef _WIN32
+	// rename does not replace on Windows; without a checkpoint recovery redoes the whole journal
+	remove(path.c_str());
+#endif
+	if (rename(temp.c_str(), path.c_str()) != 0)
+	{
+		return false;
+	}
+	credits.clear();
+	credits.insert(keep.begin(), keep.end());
+	since_checkpoint = 0;
+	return true;
+}
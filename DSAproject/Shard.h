@@ -0,0 +1,104 @@
+#pragma once
+# include "BPlus_Tree.h"
+# include "Journal.h"
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <deque>
+# include <map>
+# include <unordered_map>
+
+class Shard;
+class Sharded_Ledger;
+
+// One posting queued on a shard. A CREDIT names the RESERVE it depends on and
+// is not applied before that reservation is durable on the sending shard.
+struct Shard_Request
+{
+	enum State
+	{
+		PENDING,
+		ACCEPTED,
+		REJECTED
+	};
+
+	Journal_Record rec;
+	Shard_Request *after;
+	Shard *owner;
+	int state;
+	bool accepted;
+	bool owned;
+	unsigned long long done_ticks;
+};
+
+// Owns one account-number range: a B+tree index, a journal and an applier
+// thread. The applier drains the whole queue as one batch and syncs the
+// journal once for it (group commit) before any request in it is reported.
+//
+// Every record is appended to the journal before the index page it changes
+// is touched, and the buffer pool forces the journal before writing a page,
+// so after a crash the index is never ahead of the journal. Recovery loads
+// the last checkpoint and redoes the journal after it; records carry the
+// balances they produced, so redoing one twice is harmless.
+//
+// A shard also holds escrow slots: money credited to a hot account that lives
+// in another shard (or in this one) but has not been moved into its balance.
+class Shard
+{
+public:
+	static const unsigned CHECKPOINT_INTERVAL = 65536;
+
+	Shard();
+	~Shard();
+	bool open(const string &, Sharded_Ledger *);
+	void start();
+	void stop();
+	void close();
+	void submit(Shard_Request *);
+	bool wait(Shard_Request *);
+	bool ready(Shard_Request *);
+	bool balance(int, int &);
+	bool outstanding(unsigned long long);
+	bool credited(unsigned long long);
+	int escrow(int);
+	vector <int> escrow_accounts();
+	vector <Journal_Record> in_doubt();
+	void resolve(const Journal_Record &, bool);
+	bool replicate(const vector <Journal_Record> &);
+	bool checkpoint();
+
+	BPlus_Tree index;
+	Journal journal;
+	string prefix;
+	unsigned long long max_txid;
+	// position in the ledger, carried by change events
+	int number;
+	// NUMA node of the pool and the applier, or -1 to leave them where they fall
+	int node;
+
+private:
+	Shard(const Shard &);
+	Shard& operator=(const Shard &);
+	void run();
+	bool apply(Journal_Record &);
+	void redo(const Journal_Record &);
+	int held(int);
+	void hold(int, int);
+	void publish(vector <Shard_Request*> &, size_t, size_t);
+	bool read_checkpoint(unsigned long long &, unsigned long long &);
+
+	Sharded_Ledger *ledger;
+	thread applier;
+	mutex queue_lock;
+	condition_variable queued;
+	condition_variable published;
+	deque <Shard_Request*> queue;
+	bool stopping;
+	// guards the index and the transfer state against readers
+	mutex state_lock;
+	map <unsigned long long, Journal_Record> reservations;
+	unordered_map <unsigned long long, int> credits;
+	// escrow slot balance per hot account
+	unordered_map <int, int> slots;
+	unsigned long long since_checkpoint;
+};
@@ -0,0 +1,455 @@
+# include "Sharded_Ledger.h"
+# include "Metrics.h"
+# include "Placement.h"
+# include <fstream>
+# include <sstream>
+# include <algorithm>
+# include <string.h>
+
+Ledger_Ticket::Ledger_Ticket()
+{
+	last = nullptr;
+}
+bool Ledger_Ticket::wait()
+{
+	return last != nullptr && last->owner->wait(last);
+}
+
+Sharded_Ledger::Sharded_Ledger()
+	: next_txid(1), hot_count(0)
+{
+	in_flight = 0;
+	auto_hot = true;
+	sampled = 0;
+	for (unsigned i = 0; i < MAX_HOT; i++)
+	{
+		hot[i] = 0;
+	}
+}
+Sharded_Ledger::~Sharded_Ledger()
+{
+	close();
+}
+static string with_slash(const string &dir)
+{
+	string prefix = dir;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+	{
+		prefix += '/';
+	}
+	return prefix;
+}
+bool Sharded_Ledger::write_splits(const string &dir, const vector <int> &points)
+{
+	for (size_t i = 1; i < points.size(); i++)
+	{
+		if (points[i] <= points[i - 1])
+		{
+			return false;
+		}
+	}
+	ofstream write((with_slash(dir) + "shards.cfg").c_str());
+	write << points.size() + 1 << "\n";
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		write << points[i] << "\n";
+	}
+	write.close();
+	return !write.fail();
+}
+bool Sharded_Ledger::read_splits(const string &dir, vector <int> &points)
+{
+	ifstream read((with_slash(dir) + "shards.cfg").c_str());
+	unsigned count = 0;
+	if (!(read >> count) || count == 0)
+	{
+		return false;
+	}
+	points.clear();
+	int point;
+	for (unsigned i = 1; i < count && read >> point; i++)
+	{
+		points.push_back(point);
+	}
+	return points.size() == count - 1;
+}
+string Sharded_Ledger::shard_prefix(const string &dir, unsigned i)
+{
+	ostringstream prefix;
+	prefix << with_slash(dir) << "shard" << i << "_";
+	return prefix.str();
+}
+bool Sharded_Ledger::create(const string &dir, const vector <int> &points)
+{
+	return write_splits(dir, points) && open(dir);
+}
+bool Sharded_Ledger::open(const string &dir)
+{
+	close();
+	directory = with_slash(dir);
+	if (!read_splits(directory, splits))
+	{
+		return false;
+	}
+	unsigned count = (unsigned)splits.size() + 1;
+
+	unsigned long long max_txid = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		Shard *shard = new Shard();
+		shards.push_back(shard);
+		shard->number = (int)i;
+		shard->node = Placement::node_for(i, count);
+		if (!shard->open(shard_prefix(directory, i), this))
+		{
+			close();
+			return false;
+		}
+		max_txid = max(max_txid, shard->max_txid);
+	}
+	next_txid = max_txid + 1;
+
+	// finish transfers a crash interrupted between reserve and commit
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		vector <Journal_Record> open = shards[i]->in_doubt();
+		for (size_t j = 0; j < open.size(); j++)
+		{
+			shards[i]->resolve(open[j], shard_for(open[j].counterparty)->credited(open[j].txid));
+		}
+	}
+	// accounts that still have money in escrow stay hot until they are swept
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		vector <int> held = shards[i]->escrow_accounts();
+		for (size_t j = 0; j < held.size(); j++)
+		{
+			set_hot(held[j], true);
+		}
+	}
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		shards[i]->start();
+	}
+	return true;
+}
+void Sharded_Ledger::close()
+{
+	{
+		unique_lock <mutex> guard(settle_lock);
+		settled.wait(guard, [this] { return in_flight == 0; });
+	}
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		shards[i]->stop();
+	}
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		shards[i]->close();
+	}
+	for (unsigned i = 0; i < shards.size(); i++)
+	{
+		delete shards[i];
+	}
+	shards.clear();
+	hot_count = 0;
+	samples.clear();
+	sampled = 0;
+}
+unsigned Sharded_Ledger::shard_count()
+{
+	return (unsigned)shards.size();
+}
+Shard* Sharded_Ledger::shard(unsigned i)
+{
+	return i < shards.size() ? shards[i] : nullptr;
+}
+Shard* Sharded_Ledger::shard_for(int accountno)
+{
+	if (shards.empty())
+	{
+		return nullptr;
+	}
+	return shards[upper_bound(splits.begin(), splits.end(), accountno) - splits.begin()];
+}
+// Called once a cross-shard transfer has committed or been refunded.
+void Sharded_Ledger::settle()
+{
+	{
+		lock_guard <mutex> guard(settle_lock);
+		in_flight--;
+	}
+	settled.notify_all();
+}
+static void prepare(Shard_Request &request, int type, int accountno, int counterparty, int amount)
+{
+	memset(&request.rec, 0, sizeof(request.rec));
+	request.rec.type = type;
+	request.rec.account = accountno;
+	request.rec.counterparty = counterparty;
+	request.rec.amount = amount;
+	request.after = nullptr;
+	request.owner = nullptr;
+	request.state = Shard_Request::PENDING;
+	request.accepted = false;
+	request.owned = false;
+	request.done_ticks = 0;
+}
+bool Sharded_Ledger::post(int type, int accountno, int amount, Ledger_Ticket *ticket)
+{
+	return post_on(shard_for(accountno), type, accountno, 0, amount, ticket);
+}
+bool Sharded_Ledger::post_on(Shard *shard, int type, int accountno, int counterparty, int amount, Ledger_Ticket *ticket)
+{
+	if (shard == nullptr)
+	{
+		return false;
+	}
+	Ledger_Ticket local;
+	Ledger_Ticket &t = ticket != nullptr ? *ticket : local;
+	prepare(t.first, type, accountno, counterparty, amount);
+	t.last = &t.first;
+	shard->submit(&t.first);
+	return ticket != nullptr || t.wait();
+}
+bool Sharded_Ledger::open_account(int accountno, int balance, Ledger_Ticket *ticket)
+{
+	return balance >= 0 && post(Journal_Record::OPEN, accountno, balance, ticket);
+}
+bool Sharded_Ledger::close_account(int accountno, Ledger_Ticket *ticket)
+{
+	if (is_hot(accountno) || escrow(accountno) != 0)
+	{
+		set_hot(accountno, false);
+		sweep(accountno);
+	}
+	return post(Journal_Record::CLOSE, accountno, 0, ticket);
+}
+bool Sharded_Ledger::deposit(int accountno, int amount, Ledger_Ticket *ticket)
+{
+	if (amount <= 0)
+	{
+		return false;
+	}
+	sample(accountno);
+	if (is_hot(accountno))
+	{
+		// spread over the slots in turn; each thread keeps its own turn
+		static thread_local unsigned turn = 0;
+		Metrics::count(Metrics::ESCROW_CREDITS);
+		return post_on(shards[turn++ % shards.size()], Journal_Record::ESCROW_DEPOSIT, accountno, 0, amount, ticket);
+	}
+	return post(Journal_Record::DEPOSIT, accountno, amount, ticket);
+}
+bool Sharded_Ledger::withdraw(int accountno, int amount, Ledger_Ticket *ticket)
+{
+	if (amount <= 0)
+	{
+		return false;
+	}
+	if (is_hot(accountno))
+	{
+		sweep(accountno);
+	}
+	return post(Journal_Record::WITHDRAW, accountno, amount, ticket);
+}
+bool Sharded_Ledger::transfer(int sender, int reciever, int amount, Ledger_Ticket *ticket)
+{
+	Shard *from = shard_for(sender);
+	Shard *to = shard_for(reciever);
+	if (from == nullptr || amount <= 0 || sender == reciever)
+	{
+		return false;
+	}
+	sample(reciever);
+	if (is_hot(sender))
+	{
+		sweep(sender);
+	}
+	if (is_hot(reciever))
+	{
+		Metrics::count(Metrics::ESCROW_CREDITS);
+		return post_on(from, Journal_Record::ESCROW_TRANSFER, sender, reciever, amount, ticket);
+	}
+	Ledger_Ticket local;
+	Ledger_Ticket &t = ticket != nullptr ? *ticket : local;
+	if (from == to)
+	{
+		prepare(t.first, Journal_Record::LOCAL_TRANSFER, sender, reciever, amount);
+		t.last = &t.first;
+		from->submit(&t.first);
+		return ticket != nullptr || t.wait();
+	}
+	Metrics::count(Metrics::CROSS_SHARD_TRANSFERS);
+	unsigned long long txid = next_txid++;
+	prepare(t.first, Journal_Record::RESERVE, sender, reciever, amount);
+	prepare(t.second, Journal_Record::CREDIT, reciever, sender, amount);
+	t.first.rec.txid = txid;
+	t.second.rec.txid = txid;
+	t.second.after = &t.first;
+	t.last = &t.second;
+	{
+		lock_guard <mutex> guard(settle_lock);
+		in_flight++;
+	}
+	{
+		lock_guard <mutex> guard(submit_lock);
+		from->submit(&t.first);
+		to->submit(&t.second);
+	}
+	return ticket != nullptr || t.wait();
+}
+bool Sharded_Ledger::balance(int accountno, int &balance)
+{
+	Shard *shard = shard_for(accountno);
+	if (shard == nullptr || !shard->balance(accountno, balance))
+	{
+		return false;
+	}
+	balance += escrow(accountno);
+	return true;
+}
+// Money credited to an account that is still in escrow slots.
+int Sharded_Ledger::escrow(int accountno)
+{
+	int total = 0;
+	for (size_t i = 0; i < shards.size(); i++)
+	{
+		total += shards[i]->escrow(accountno);
+	}
+	return total;
+}
+bool Sharded_Ledger::is_hot(int accountno)
+{
+	unsigned count = hot_count.load(memory_order_acquire);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (hot[i].load(memory_order_relaxed) == accountno)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+void Sharded_Ledger::set_hot(int accountno, bool on)
+{
+	lock_guard <mutex> guard(hot_lock);
+	unsigned count = hot_count.load(memory_order_relaxed);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (hot[i].load(memory_order_relaxed) == accountno)
+		{
+			if (!on)
+			{
+				// a reader racing with this may miss either account once; it then posts the usual way
+				hot[i].store(hot[count - 1].load(memory_order_relaxed), memory_order_relaxed);
+				hot_count.store(count - 1, memory_order_release);
+			}
+			return;
+		}
+	}
+	if (on && count < MAX_HOT && shards.size() > 1)
+	{
+		hot[count].store(accountno, memory_order_relaxed);
+		hot_count.store(count + 1, memory_order_release);
+	}
+}
+// Moves every escrow slot of an account into its home balance. Each slot is
+// emptied when its shard reaches the sweep, so credits queued before the
+// sweep are included. Blocks until the sweep is durable.
+void Sharded_Ledger::sweep(int accountno)
+{
+	Shard *home = shard_for(accountno);
+	if (home == nullptr)
+	{
+		return;
+	}
+	lock_guard <mutex> guard(sweep_lock);
+	vector <Ledger_Ticket> tickets(shards.size());
+	{
+		lock_guard <mutex> order(submit_lock);
+		for (size_t i = 0; i < shards.size(); i++)
+		{
+			Ledger_Ticket &t = tickets[i];
+			if (shards[i] == home)
+			{
+				prepare(t.first, Journal_Record::ESCROW_RELEASE, accountno, 0, 0);
+				t.last = &t.first;
+				home->submit(&t.first);
+				continue;
+			}
+			unsigned long long txid = next_txid++;
+			prepare(t.first, Journal_Record::RESERVE, accountno, accountno, 0);
+			prepare(t.second, Journal_Record::CREDIT, accountno, accountno, 0);
+			t.first.rec.txid = t.second.rec.txid = txid;
+			t.first.rec.flags = t.second.rec.flags = Journal_Record::FROM_ESCROW;
+			t.second.after = &t.first;
+			t.last = &t.second;
+			{
+				lock_guard <mutex> count(settle_lock);
+				in_flight++;
+			}
+			shards[i]->submit(&t.first);
+			home->submit(&t.second);
+		}
+	}
+	for (size_t i = 0; i < tickets.size(); i++)
+	{
+		if (tickets[i].wait())
+		{
+			Metrics::count(Metrics::ESCROW_SWEEPS);
+		}
+	}
+}
+// Counts a sample of the credits; at the end of each window makes the
+// accounts with the largest share hot and cools the ones that fell back.
+void Sharded_Ledger::sample(int accountno)
+{
+	static thread_local unsigned tick = 0;
+	if (!auto_hot || shards.size() < 2 || ++tick % HOT_SAMPLE != 0)
+	{
+		return;
+	}
+	vector <int> heated, cooled;
+	{
+		lock_guard <mutex> guard(hot_lock);
+		samples[accountno]++;
+		if (++sampled < HOT_WINDOW)
+		{
+			return;
+		}
+		unsigned count = hot_count.load(memory_order_relaxed);
+		for (unsigned i = 0; i < count; i++)
+		{
+			int account = hot[i].load(memory_order_relaxed);
+			if (samples[account] < HOT_WINDOW / 80)
+			{
+				cooled.push_back(account);
+			}
+		}
+		for (unordered_map <int, unsigned>::iterator it = samples.begin(); it != samples.end(); ++it)
+		{
+			if (it->second >= HOT_WINDOW / 20)
+			{
+				heated.push_back(it->first);
+			}
+		}
+		samples.clear();
+		sampled = 0;
+	}
+	for (size_t i = 0; i < heated.size(); i++)
+	{
+		// a slot would take deposits for an account that does not exist
+		int balance;
+		if (shard_for(heated[i])->balance(heated[i], balance))
+		{
+			set_hot(heated[i], true);
+		}
+	}
+	for (size_t i = 0; i < cooled.size(); i++)
+	{
+		// once it is no longer hot its debits stop sweeping, so empty the slots now
+		set_hot(cooled[i], false);
+		sweep(cooled[i]);
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+# include "Shard.h"
+# include <atomic>
+
+// Outcome of one ledger request. Passing a ticket to a posting call submits
+// the request without blocking; wait() then blocks until it is durable.
+class Ledger_Ticket
+{
+public:
+	Ledger_Ticket();
+	bool wait();
+
+	Shard_Request first;
+	Shard_Request second;
+	Shard_Request *last;
+};
+
+// Accounts split into shards by account-number range. Shard i owns the
+// numbers in [splits[i-1], splits[i]); the split points are kept in
+// shards.cfg next to the shard files. Experimental: only replays post to it,
+// the menus and kiosks post through BST_Tree.
+//
+// A transfer inside one shard is a single journal record. Across shards it is
+// a two-phase transfer: the sender's shard durably reserves the amount, the
+// receiver's shard credits it, and the sender's shard then commits. After a
+// crash every reservation left open is committed if the receiver recorded
+// the credit and refunded otherwise, so money is never lost or created.
+//
+// An account that draws a large share of all credits is made hot. Credits to
+// a hot account no longer queue on its home shard: a deposit goes to an
+// escrow slot on the next shard in turn, and a transfer to the slot on the
+// sender's own shard, which makes it a local posting. Its balance is the home
+// balance plus every slot. Before a hot account is debited, its slots are
+// swept home with the same two-phase transfer, so a debit sees all its money.
+class Sharded_Ledger
+{
+public:
+	static const unsigned MAX_HOT = 16;
+	// one credit in HOT_SAMPLE is counted; every HOT_WINDOW counted credits
+	// an account with a twentieth of them becomes hot, one below an eightieth cools
+	static const unsigned HOT_SAMPLE = 8;
+	static const unsigned HOT_WINDOW = 512;
+
+	Sharded_Ledger();
+	~Sharded_Ledger();
+	bool create(const string &, const vector <int> &);
+	bool open(const string &);
+	void close();
+	bool open_account(int, int, Ledger_Ticket *ticket = nullptr);
+	bool close_account(int, Ledger_Ticket *ticket = nullptr);
+	bool deposit(int, int, Ledger_Ticket *ticket = nullptr);
+	bool withdraw(int, int, Ledger_Ticket *ticket = nullptr);
+	bool transfer(int, int, int, Ledger_Ticket *ticket = nullptr);
+	bool balance(int, int &);
+	int escrow(int);
+	bool is_hot(int);
+	void set_hot(int, bool);
+	void sweep(int);
+	unsigned shard_count();
+	Shard* shard(unsigned);
+	Shard* shard_for(int);
+	void settle();
+	static bool write_splits(const string &, const vector <int> &);
+	static bool read_splits(const string &, vector <int> &);
+	static string shard_prefix(const string &, unsigned);
+
+	string directory;
+	vector <int> splits;
+	// runs on an applier thread after each group commit; set before open()
+	function<void()> on_commit;
+	// whether hot accounts are detected from credit rates
+	bool auto_hot;
+
+private:
+	Sharded_Ledger(const Sharded_Ledger &);
+	Sharded_Ledger& operator=(const Sharded_Ledger &);
+	bool post(int, int, int, Ledger_Ticket *);
+	bool post_on(Shard *, int, int, int, int, Ledger_Ticket *);
+	void sample(int);
+
+	vector <Shard*> shards;
+	// orders the two halves of cross-shard transfers the same way on every shard
+	mutex submit_lock;
+	atomic<unsigned long long> next_txid;
+	mutex settle_lock;
+	condition_variable settled;
+	long in_flight;
+	// the hot set is read without a lock; hot_lock orders its writers
+	atomic<int> hot[MAX_HOT];
+	atomic<unsigned> hot_count;
+	mutex hot_lock;
+	unordered_map <int, unsigned> samples;
+	unsigned sampled;
+	mutex sweep_lock;
+};
@@ -0,0 +1,595 @@
+# include "Shared_Table.h"
+# include "Velocity_Guard.h"
+# include "Op_Scheduler.h"
+# include <chrono>
+# include <string.h>
+# include <limits.h>
+# ifdef _WIN32
+# define WIN32_LEAN_AND_MEAN
+# define NOMINMAX
+# include <windows.h>
+# else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# endif
+
+static const char MAGIC[8] = { 'B', 'K', 'S', 'H', 'M', 'T', 'B', '1' };
+// version 2 added idempotency keys to requests
+static const unsigned VERSION = 2;
+// a client gives up on a request when the owner stops making progress for this long
+static const long long OWNER_TIMEOUT_MS = 2000;
+
+struct Shared_Table::Header
+{
+	char magic[8];
+	unsigned version;
+	unsigned capacity;
+	unsigned requests;
+	atomic<unsigned> alive;
+	atomic<unsigned> count;
+	atomic<unsigned long long> heartbeat;
+	char pad[24];
+};
+
+static string segment_name(const string &name)
+{
+#ifdef _WIN32
+	return "Local\\BankCore_" + name;
+#else
+	return name.empty() || name[0] != '/' ? "/" + name : name;
+#endif
+}
+
+Shared_Table::Shared_Table()
+{
+	owner = false;
+	base = nullptr;
+	bytes = 0;
+	handle = -1;
+	header = nullptr;
+	slots = nullptr;
+	requests = nullptr;
+	scan = 0;
+}
+Shared_Table::~Shared_Table()
+{
+	detach();
+}
+bool Shared_Table::create(const string &table, unsigned accounts)
+{
+	detach();
+	unsigned cap = 1024;
+	while (cap < accounts * 4)
+	{
+		cap <<= 1;
+	}
+	name = segment_name(table);
+	bytes = sizeof(Header) + cap * sizeof(Shared_Account) + REQUESTS * sizeof(Shared_Request);
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)bytes >> 32), (DWORD)bytes, name.c_str());
+	if (mapping == NULL)
+	{
+		return false;
+	}
+	base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+	if (base == NULL)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+	handle = (long long)(intptr_t)mapping;
+#else
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+	if (fd < 0)
+	{
+		return false;
+	}
+	if (ftruncate(fd, (off_t)bytes) != 0)
+	{
+		::close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED)
+	{
+		base = nullptr;
+		shm_unlink(name.c_str());
+		return false;
+	}
+#endif
+	owner = true;
+	memset(base, 0, bytes);
+	header = (Header*)base;
+	slots = (Shared_Account*)(header + 1);
+	requests = (Shared_Request*)(slots + cap);
+	header->version = VERSION;
+	header->capacity = cap;
+	header->requests = REQUESTS;
+	header->alive.store(1, memory_order_relaxed);
+	// the magic goes in last, so an attaching reader never sees a half-built header
+	atomic_thread_fence(memory_order_release);
+	memcpy(header->magic, MAGIC, sizeof(MAGIC));
+	return true;
+}
+bool Shared_Table::attach(const string &table)
+{
+	detach();
+	name = segment_name(table);
+#ifdef _WIN32
+	HANDLE mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+	if (mapping == NULL)
+	{
+		return false;
+	}
+	base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (base == NULL)
+	{
+		CloseHandle(mapping);
+		return false;
+	}
+	handle = (long long)(intptr_t)mapping;
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery(base, &info, sizeof(info));
+	bytes = info.RegionSize;
+#else
+	int fd = shm_open(name.c_str(), O_RDWR, 0);
+	if (fd < 0)
+	{
+		return false;
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(Header))
+	{
+		::close(fd);
+		return false;
+	}
+	bytes = (size_t)info.st_size;
+	base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (base == MAP_FAILED)
+	{
+		base = nullptr;
+		return false;
+	}
+#endif
+	header = (Header*)base;
+	if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION
+		|| sizeof(Header) + header->capacity * sizeof(Shared_Account) + header->requests * sizeof(Shared_Request) > bytes)
+	{
+		detach();
+		return false;
+	}
+	slots = (Shared_Account*)(header + 1);
+	requests = (Shared_Request*)(slots + header->capacity);
+	return true;
+}
+void Shared_Table::detach()
+{
+	if (base == nullptr)
+	{
+		return;
+	}
+	if (owner)
+	{
+		header->alive.store(0, memory_order_release);
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(base);
+	CloseHandle((HANDLE)(intptr_t)handle);
+#else
+	munmap(base, bytes);
+	if (owner)
+	{
+		shm_unlink(name.c_str());
+	}
+#endif
+	base = nullptr;
+	header = nullptr;
+	slots = nullptr;
+	requests = nullptr;
+	owner = false;
+	handle = -1;
+}
+bool Shared_Table::owner_alive()
+{
+	return header != nullptr && header->alive.load(memory_order_acquire) != 0;
+}
+unsigned Shared_Table::capacity()
+{
+	return header != nullptr ? header->capacity : 0;
+}
+unsigned Shared_Table::count()
+{
+	return header != nullptr ? header->count.load(memory_order_relaxed) : 0;
+}
+unsigned Shared_Table::home(int accountno)
+{
+	// Fibonacci hashing; capacity is a power of two
+	return (unsigned)(((unsigned)accountno * 2654435769u) >> 7) & (header->capacity - 1);
+}
+// Lock-free lookup; retries a slot while the owner is rewriting it.
+bool Shared_Table::find(int accountno, Shared_Account &out)
+{
+	if (header == nullptr)
+	{
+		return false;
+	}
+	unsigned mask = header->capacity - 1;
+	unsigned i = home(accountno);
+	for (unsigned probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+	{
+		Shared_Account &slot = slots[i];
+		for (;;)
+		{
+			unsigned before = slot.seq.load(memory_order_acquire);
+			if (before & 1)
+			{
+				continue;
+			}
+			out.state = slot.state;
+			out.account_number = slot.account_number;
+			out.balance = slot.balance;
+			memcpy(out.name, slot.name, sizeof(out.name));
+			atomic_thread_fence(memory_order_acquire);
+			if (slot.seq.load(memory_order_relaxed) == before)
+			{
+				break;
+			}
+		}
+		if (out.state == Shared_Account::EMPTY)
+		{
+			return false;
+		}
+		if (out.state == Shared_Account::LIVE && out.account_number == accountno)
+		{
+			out.name[sizeof(out.name) - 1] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+// Owner only: inserts or rewrites one account.
+void Shared_Table::publish(int accountno, int balance, const string &holder)
+{
+	unsigned mask = header->capacity - 1;
+	unsigned i = home(accountno);
+	Shared_Account *target = nullptr;
+	bool added = false;
+	for (unsigned probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+	{
+		Shared_Account &slot = slots[i];
+		if (slot.state == Shared_Account::LIVE && slot.account_number == accountno)
+		{
+			target = &slot;
+			added = false;
+			break;
+		}
+		if (slot.state != Shared_Account::LIVE && target == nullptr)
+		{
+			target = &slot;
+			added = true;
+		}
+		if (slot.state == Shared_Account::EMPTY)
+		{
+			break;
+		}
+	}
+	if (target == nullptr)
+	{
+		return;
+	}
+	unsigned seq = target->seq.load(memory_order_relaxed);
+	target->seq.store(seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	target->state = Shared_Account::LIVE;
+	target->account_number = accountno;
+	target->balance = balance;
+	memset(target->name, 0, sizeof(target->name));
+	memcpy(target->name, holder.c_str(), min(holder.size(), sizeof(target->name) - 1));
+	target->seq.store(seq + 2, memory_order_release);
+	if (added)
+	{
+		header->count.fetch_add(1, memory_order_relaxed);
+	}
+}
+// Owner only: leaves a tombstone so probe chains through the slot still work.
+void Shared_Table::remove(int accountno)
+{
+	unsigned mask = header->capacity - 1;
+	unsigned i = home(accountno);
+	for (unsigned probes = 0; probes <= mask; probes++, i = (i + 1) & mask)
+	{
+		Shared_Account &slot = slots[i];
+		if (slot.state == Shared_Account::EMPTY)
+		{
+			return;
+		}
+		if (slot.state == Shared_Account::LIVE && slot.account_number == accountno)
+		{
+			unsigned seq = slot.seq.load(memory_order_relaxed);
+			slot.seq.store(seq + 1, memory_order_relaxed);
+			atomic_thread_fence(memory_order_release);
+			slot.state = Shared_Account::DELETED;
+			slot.seq.store(seq + 2, memory_order_release);
+			header->count.fetch_sub(1, memory_order_relaxed);
+			return;
+		}
+	}
+}
+// Clears what a client wrote into a request slot, the password above all,
+// before the slot is freed for the next client.
+static void scrub(Shared_Request *request)
+{
+	request->op = 0;
+	request->account = 0;
+	request->password = 0;
+	request->counterparty = 0;
+	request->amount = 0;
+	request->result = 0;
+	request->balance = 0;
+	request->key = 0;
+}
+// Client side: queues a write for the owner and waits for its answer. Returns
+// 1 when it was applied, 0 when the owner refused it and -1 when the owner is gone.
+int Shared_Table::submit(Shared_Request::Operation op, int accountno, int password, int counterparty, int amount, int &balance, unsigned long long key)
+{
+	if (!owner_alive())
+	{
+		return -1;
+	}
+	unsigned long long beat = header->heartbeat.load(memory_order_relaxed);
+	chrono::steady_clock::time_point progress = chrono::steady_clock::now();
+	Shared_Request *request = nullptr;
+	while (request == nullptr)
+	{
+		for (unsigned i = 0; i < header->requests && request == nullptr; i++)
+		{
+			unsigned expected = Shared_Request::FREE;
+			if (requests[i].state.compare_exchange_strong(expected, Shared_Request::CLAIMED))
+			{
+				request = &requests[i];
+			}
+		}
+		if (request == nullptr)
+		{
+			this_thread::sleep_for(chrono::microseconds(100));
+		}
+		if (chrono::steady_clock::now() - progress > chrono::milliseconds(OWNER_TIMEOUT_MS))
+		{
+			return -1;
+		}
+	}
+	request->op = op;
+	request->account = accountno;
+	request->password = password;
+	request->counterparty = counterparty;
+	request->amount = amount;
+	request->key = key;
+	request->state.store(Shared_Request::READY, memory_order_release);
+
+	for (;;)
+	{
+		unsigned state = request->state.load(memory_order_acquire);
+		if (state == Shared_Request::DONE)
+		{
+			int result = request->result;
+			balance = request->balance;
+			scrub(request);
+			request->state.store(Shared_Request::FREE, memory_order_release);
+			return result;
+		}
+		unsigned long long now_beat = header->heartbeat.load(memory_order_relaxed);
+		if (now_beat != beat)
+		{
+			beat = now_beat;
+			progress = chrono::steady_clock::now();
+		}
+		else if (!owner_alive() || chrono::steady_clock::now() - progress > chrono::milliseconds(OWNER_TIMEOUT_MS))
+		{
+			// take the request back unless the owner is already working on it
+			unsigned expected = Shared_Request::READY;
+			if (request->state.compare_exchange_strong(expected, Shared_Request::CLAIMED))
+			{
+				scrub(request);
+				request->state.store(Shared_Request::FREE, memory_order_release);
+				return -1;
+			}
+			if (!owner_alive())
+			{
+				return -1;
+			}
+		}
+		this_thread::sleep_for(chrono::microseconds(50));
+	}
+}
+// Owner only: claims the next queued request, or returns nullptr when there is none.
+Shared_Request* Shared_Table::next_request()
+{
+	header->heartbeat.fetch_add(1, memory_order_relaxed);
+	for (unsigned n = 0; n < header->requests; n++)
+	{
+		Shared_Request &request = requests[(scan + n) % header->requests];
+		unsigned expected = Shared_Request::READY;
+		if (request.state.compare_exchange_strong(expected, Shared_Request::TAKEN, memory_order_acquire))
+		{
+			scan = (scan + n + 1) % header->requests;
+			return &request;
+		}
+	}
+	return nullptr;
+}
+void Shared_Table::finish(Shared_Request *request, int result, int balance)
+{
+	request->result = result;
+	request->balance = balance;
+	request->state.store(Shared_Request::DONE, memory_order_release);
+}
+
+Table_Owner::Table_Owner()
+	: running(false)
+{
+	applied = 0;
+	tree = nullptr;
+	passwords = nullptr;
+}
+Table_Owner::~Table_Owner()
+{
+	stop();
+}
+bool Table_Owner::start(const string &name, BST_Tree &t, Hashtable &h)
+{
+	stop();
+	tree = &t;
+	passwords = &h;
+	tree->load_Server();
+	if (!table.create(name, tree->index.count()))
+	{
+		return false;
+	}
+	tree->index.scan(INT_MIN, INT_MAX, [this](const Account_Record &rec) {
+		table.publish(rec.account_number, rec.balance, rec.name);
+		return true;
+	});
+	running = true;
+	worker = thread(&Table_Owner::run, this);
+	return true;
+}
+void Table_Owner::stop()
+{
+	if (!running)
+	{
+		return;
+	}
+	running = false;
+	worker.join();
+	table.detach();
+}
+unsigned Table_Owner::published()
+{
+	return table.count();
+}
+void Table_Owner::publish(int accountno)
+{
+	BST_Node *node = tree->search(tree->Root, accountno);
+	if (node != nullptr)
+	{
+		table.publish(accountno, node->balance, node->name);
+	}
+	else
+	{
+		table.remove(accountno);
+	}
+}
+// Applies the requests queued at the moment as one batch, so the ledger files
+// are written once for all of them, and only then answers them and publishes
+// the new balances. The passwords of the batch are checked together, so their
+// key derivations run in parallel on the pool.
+void Table_Owner::run()
+{
+	vector <Shared_Request*> batch;
+	vector <pair <int, int> > checks;
+	vector <char> matched;
+	vector <int> results;
+	vector <int> balances;
+	vector <int> touched;
+	while (running)
+	{
+		Shared_Request *request = table.next_request();
+		if (request == nullptr)
+		{
+			this_thread::sleep_for(chrono::microseconds(200));
+			continue;
+		}
+		batch.clear();
+		checks.clear();
+		results.clear();
+		balances.clear();
+		touched.clear();
+		while (request != nullptr)
+		{
+			batch.push_back(request);
+			checks.push_back(make_pair(request->account, request->password));
+			// the password stays in this process only
+			request->password = 0;
+			request = batch.size() < Shared_Table::REQUESTS ? table.next_request() : nullptr;
+		}
+		passwords->match_all(checks, matched);
+		Op_Slot slot(Op_Scheduler::ONLINE);
+		tree->begin_batch();
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			request = batch[i];
+			int result = 0;
+			int accountno = request->account;
+			int amount = request->amount;
+			BST_Node *account = nullptr;
+			if (matched[i])
+			{
+				account = tree->search(tree->Root, accountno);
+			}
+			int original;
+			if (account != nullptr && request->op != Shared_Request::LOGIN && tree->repeated(request->key, &original))
+			{
+				// a retry of a posting already made: answer as the first attempt was
+				results.push_back(1);
+				balances.push_back(original);
+				continue;
+			}
+			if (account != nullptr)
+			{
+				switch (request->op)
+				{
+					case Shared_Request::LOGIN:
+						result = 1;
+						break;
+					case Shared_Request::DEPOSIT:
+						if (amount > 0)
+						{
+							tree->deposit(accountno, amount, request->key);
+							result = 1;
+						}
+						break;
+					case Shared_Request::WITHDRAW:
+						if (amount > 0 && account->balance >= amount
+							&& Velocity_Guard::bank().admit(accountno, amount) == Velocity_Guard::ALLOWED)
+						{
+							tree->withdraw(accountno, amount, request->key);
+							result = 1;
+						}
+						break;
+					case Shared_Request::TRANSFER:
+						if (amount > 0 && account->balance >= amount && request->counterparty != accountno
+							&& tree->search(tree->Root, request->counterparty) != nullptr
+							&& Velocity_Guard::bank().admit(accountno, amount) == Velocity_Guard::ALLOWED)
+						{
+							tree->transfer(accountno, request->counterparty, amount, request->key);
+							touched.push_back(request->counterparty);
+							result = 1;
+						}
+						break;
+				}
+				if (result == 1)
+				{
+					touched.push_back(accountno);
+					applied++;
+				}
+			}
+			results.push_back(result);
+			balances.push_back(account != nullptr ? account->balance : 0);
+		}
+		tree->end_batch();
+		for (size_t i = 0; i < touched.size(); i++)
+		{
+			publish(touched[i]);
+		}
+		for (size_t i = 0; i < batch.size(); i++)
+		{
+			table.finish(batch[i], results[i], balances[i]);
+		}
+	}
+}
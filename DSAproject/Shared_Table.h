@@ -0,0 +1,125 @@
+#pragma once
+# include "BST_Tree.h"
+# include <atomic>
+# include <thread>
+# include <string>
+using namespace std;
+
+// One account in the shared table, one cache line. seq is odd while the
+// owner is rewriting the slot; a reader copies the slot and keeps the copy
+// only if seq was even and unchanged across the copy.
+struct Shared_Account
+{
+	enum State
+	{
+		EMPTY,
+		LIVE,
+		DELETED
+	};
+
+	atomic<unsigned> seq;
+	int state;
+	int account_number;
+	int balance;
+	char name[48];
+};
+
+// A write handed to the owner. Clients claim a FREE slot, fill it and mark
+// it READY; the owner marks it TAKEN while it works and DONE with the result.
+struct Shared_Request
+{
+	enum State
+	{
+		FREE,
+		CLAIMED,
+		READY,
+		TAKEN,
+		DONE
+	};
+	enum Operation
+	{
+		LOGIN = 1,
+		DEPOSIT,
+		WITHDRAW,
+		TRANSFER
+	};
+
+	atomic<unsigned> state;
+	int op;
+	int account;
+	// cleared by the owner as soon as it takes the request
+	int password;
+	int counterparty;
+	int amount;
+	int result;
+	int balance;
+	// idempotency key of a posting, 0 for none
+	unsigned long long key;
+	char pad[24];
+};
+
+// An account table in a named shared-memory segment (POSIX shm_open, or a
+// named file mapping on Windows). One owner process creates and updates it;
+// any number of reader processes map it read-mostly and look balances up
+// without a system call or a lock. Readers never write accounts: they queue
+// writes in the request slots and the owner applies them to its ledger.
+class Shared_Table
+{
+public:
+	static const unsigned REQUESTS = 64;
+
+	Shared_Table();
+	~Shared_Table();
+	bool create(const string &, unsigned);
+	bool attach(const string &);
+	void detach();
+	bool owner_alive();
+	bool find(int, Shared_Account &);
+	void publish(int, int, const string &);
+	void remove(int);
+	int submit(Shared_Request::Operation, int, int, int, int, int &, unsigned long long key = 0);
+	Shared_Request* next_request();
+	void finish(Shared_Request *, int, int);
+	unsigned capacity();
+	unsigned count();
+
+private:
+	struct Header;
+
+	Shared_Table(const Shared_Table &);
+	Shared_Table& operator=(const Shared_Table &);
+	unsigned home(int);
+
+	string name;
+	bool owner;
+	void *base;
+	size_t bytes;
+	long long handle;
+	Header *header;
+	Shared_Account *slots;
+	Shared_Request *requests;
+	unsigned scan;
+};
+
+// Keeps a Shared_Table in step with a BST_Tree and applies the writes that
+// readers queue, one at a time, on its own thread.
+class Table_Owner
+{
+public:
+	Table_Owner();
+	~Table_Owner();
+	bool start(const string &, BST_Tree &, Hashtable &);
+	void stop();
+	unsigned published();
+	unsigned long long applied;
+
+private:
+	void run();
+	void publish(int);
+
+	Shared_Table table;
+	BST_Tree *tree;
+	Hashtable *passwords;
+	atomic<bool> running;
+	thread worker;
+};
@@ -0,0 +1,363 @@
+# include "Statement_Batch.h"
+# include "History_Archive.h"
+# include "History_Index.h"
+# include "Metrics.h"
+# include "Op_Scheduler.h"
+# include "Tracer.h"
+# include <fstream>
+# include <sstream>
+# include <vector>
+# include <deque>
+# include <queue>
+# include <algorithm>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <unordered_map>
+# include <chrono>
+# include <limits.h>
+# include <stdio.h>
+# include <string.h>
+
+namespace
+{
+	struct By_Account
+	{
+		bool operator()(const History_Entry &a, const History_Entry &b) const
+		{
+			return a.account != b.account ? a.account < b.account : a.seq < b.seq;
+		}
+	};
+
+	// A sorted run, read back in chunks; the last run stays in memory.
+	struct Run_Reader
+	{
+		ifstream read;
+		vector <History_Entry> buffer;
+		size_t position;
+		bool in_memory;
+
+		bool next(History_Entry &entry)
+		{
+			if (position == buffer.size())
+			{
+				if (in_memory)
+				{
+					return false;
+				}
+				buffer.resize(4096);
+				read.read((char*)buffer.data(), buffer.size() * sizeof(History_Entry));
+				buffer.resize((size_t)read.gcount() / sizeof(History_Entry));
+				Metrics::count(Metrics::BYTES_READ, (unsigned long long)read.gcount());
+				position = 0;
+				if (buffer.empty())
+				{
+					return false;
+				}
+			}
+			entry = buffer[position++];
+			return true;
+		}
+	};
+
+	struct Statement_Job
+	{
+		Account_Record account;
+		long long opening;
+		vector <History_Entry> postings;
+	};
+
+	// Hands batches of statements from the merge to the writers.
+	struct Job_Queue
+	{
+		mutex lock;
+		condition_variable ready;
+		condition_variable room;
+		deque <vector <Statement_Job> > batches;
+		bool done;
+
+		Job_Queue()
+		{
+			done = false;
+		}
+		void push(vector <Statement_Job> &batch)
+		{
+			unique_lock <mutex> guard(lock);
+			room.wait(guard, [this]() { return batches.size() < 64; });
+			batches.push_back(vector <Statement_Job>());
+			batches.back().swap(batch);
+			ready.notify_one();
+		}
+		bool pop(vector <Statement_Job> &batch)
+		{
+			unique_lock <mutex> guard(lock);
+			ready.wait(guard, [this]() { return !batches.empty() || done; });
+			if (batches.empty())
+			{
+				return false;
+			}
+			batch.swap(batches.front());
+			batches.pop_front();
+			room.notify_one();
+			return true;
+		}
+		void finish()
+		{
+			lock_guard <mutex> guard(lock);
+			done = true;
+			ready.notify_all();
+		}
+	};
+}
+
+static string field(const char *text, size_t size)
+{
+	return string(text, find(text, text + size, '\0'));
+}
+
+static void write_statement(const Statement_Job &job, const string &directory, const string &period)
+{
+	ostringstream text;
+	text << "Statement for account " << job.account.account_number << "\n";
+	text << "Name:    " << field(job.account.name, sizeof(job.account.name)) << "\n";
+	text << "Address: " << field(job.account.adress, sizeof(job.account.adress)) << "\n";
+	text << "Period:  " << period << "\n\n";
+	text << "Opening balance: " << job.opening << "\n";
+	long long balance = job.opening;
+	for (size_t i = 0; i < job.postings.size(); i++)
+	{
+		const History_Entry &p = job.postings[i];
+		balance += p.amount;
+		text << History_Index::format_time(p.time) << "  ";
+		if (p.amount > 0)
+			text << "Deposit: +" << p.amount;
+		else
+			text << "Withdrawal: " << p.amount;
+		text << "  Balance: " << balance << "\n";
+	}
+	text << "Closing balance: " << balance << "\n";
+	string out = text.str();
+	ofstream write((directory + "/" + to_string(job.account.account_number) + ".txt").c_str(), ios::trunc);
+	write.write(out.data(), out.size());
+	Metrics::count(Metrics::BYTES_WRITTEN, out.size());
+}
+
+static string run_path(const string &directory, unsigned n)
+{
+	return directory + "/statements_run" + to_string(n) + ".tmp";
+}
+
+// postings read between pauses, and accounts joined while holding the ledger
+static const unsigned SCAN_CHUNK = 4096;
+static const unsigned JOIN_CHUNK = 256;
+
+// month is YYYYMM; memory is the budget for buffered postings in bytes.
+bool Statement_Batch::run(BST_Tree &tree, int month, const string &directory, size_t memory, unsigned threads, Report &report)
+{
+	Trace_Span span("statement_batch");
+	memset(&report, 0, sizeof(report));
+	int next = month % 100 == 12 ? (month / 100 + 1) * 100 + 1 : month + 1;
+	long long start = History_Index::date_start(month * 100 + 1);
+	long long end = History_Index::date_start(next * 100 + 1) - 1;
+	if (start < 0 || end < 0)
+	{
+		return false;
+	}
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	Op_Scheduler &scheduler = Op_Scheduler::bank();
+	// the statements are as of this cut in transaction.txt
+	streamoff cut = 0;
+	{
+		Op_Slot slot(Op_Scheduler::BATCH);
+		if (!slot.admitted())
+		{
+			return false;
+		}
+		tree.load_Server();
+		tree.end_batch();
+		tree.index.flush();
+		ifstream live(tree.file("transaction.txt").c_str(), ios::binary);
+		live.seekg(0, ios::end);
+		cut = live ? (streamoff)live.tellg() : 0;
+	}
+
+	// one pass over the history from the start of the month, spilling sorted runs
+	size_t capacity = max((size_t)1024, memory / sizeof(History_Entry));
+	vector <History_Entry> buffer;
+	buffer.reserve(capacity);
+	bool ok = true;
+	unsigned long long taken = 0;
+	auto take = [&](const History_Entry &entry) {
+		if (++taken % SCAN_CHUNK == 0)
+		{
+			scheduler.pause(Op_Scheduler::BATCH);
+		}
+		buffer.push_back(entry);
+		if (buffer.size() < capacity || !ok)
+		{
+			return;
+		}
+		sort(buffer.begin(), buffer.end(), By_Account());
+		ofstream spill(run_path(directory, report.runs).c_str(), ios::binary | ios::trunc);
+		spill.write((const char*)buffer.data(), buffer.size() * sizeof(History_Entry));
+		ok = (bool)spill;
+		report.spilled_bytes += buffer.size() * sizeof(History_Entry);
+		Metrics::count(Metrics::BYTES_WRITTEN, buffer.size() * sizeof(History_Entry));
+		report.runs++;
+		buffer.clear();
+	};
+	History_Archive::scan(tree.file("history.arc"), INT_MIN, INT_MAX, start, LLONG_MAX, take);
+	ifstream live(tree.file("transaction.txt").c_str(), ios::binary);
+	History_Entry entry;
+	while ((streamoff)live.tellg() < cut && History_Archive::read_live(live, entry))
+	{
+		if (entry.time >= start)
+		{
+			take(entry);
+		}
+	}
+	Metrics::count(Metrics::BYTES_READ, (unsigned long long)cut);
+	live.close();
+	sort(buffer.begin(), buffer.end(), By_Account());
+
+	vector <Run_Reader*> runs;
+	for (unsigned i = 0; i < report.runs; i++)
+	{
+		Run_Reader *reader = new Run_Reader();
+		reader->read.open(run_path(directory, i).c_str(), ios::binary);
+		reader->position = 0;
+		reader->in_memory = false;
+		runs.push_back(reader);
+	}
+	Run_Reader *resident = new Run_Reader();
+	resident->buffer.swap(buffer);
+	resident->position = 0;
+	resident->in_memory = true;
+	runs.push_back(resident);
+
+	// k-way merge by account and seq
+	typedef pair <History_Entry, size_t> Head;
+	auto later = [](const Head &a, const Head &b) { return By_Account()(b.first, a.first); };
+	priority_queue <Head, vector <Head>, decltype(later)> heads(later);
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		if (runs[i]->next(entry))
+		{
+			heads.push(Head(entry, i));
+		}
+	}
+
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+	Job_Queue queue;
+	vector <thread> writers;
+	string period = History_Index::format_time(start).substr(0, 10) + " to " + History_Index::format_time(end).substr(0, 10);
+	for (unsigned i = 0; i < threads; i++)
+	{
+		writers.push_back(thread([&queue, &directory, &period]() {
+			vector <Statement_Job> batch;
+			while (queue.pop(batch))
+			{
+				Op_Scheduler::bank().pause(Op_Scheduler::BATCH);
+				for (size_t j = 0; j < batch.size(); j++)
+				{
+					write_statement(batch[j], directory, period);
+				}
+			}
+		}));
+	}
+
+	// join the merged postings with the accounts, both in account order, a
+	// chunk of accounts at a time; postings made after the cut are taken back
+	// out of the balances so every opening balance is as of the cut
+	vector <Statement_Job> batch;
+	unordered_map <int, long long> late;
+	streamoff late_offset = cut;
+	int from = INT_MIN;
+	bool more = true;
+	while (more && ok)
+	{
+		{
+			Op_Slot slot(Op_Scheduler::BATCH);
+			if (!slot.admitted())
+			{
+				ok = false;
+				break;
+			}
+			ifstream tail(tree.file("transaction.txt").c_str(), ios::binary);
+			tail.seekg(late_offset);
+			while (tail && History_Archive::read_live(tail, entry))
+			{
+				late[entry.account] += entry.amount;
+				if (tail.tellg() >= 0)
+				{
+					late_offset = (streamoff)tail.tellg();
+				}
+			}
+			tail.close();
+			unsigned joined = 0;
+			more = false;
+			tree.index.scan(from, INT_MAX, [&](const Account_Record &rec) {
+				if (joined == JOIN_CHUNK)
+				{
+					from = rec.account_number;
+					more = true;
+					return false;
+				}
+				joined++;
+				Statement_Job job;
+				job.account = rec;
+				long long since = 0;
+				while (!heads.empty() && heads.top().first.account <= rec.account_number)
+				{
+					Head head = heads.top();
+					heads.pop();
+					if (head.first.account == rec.account_number)
+					{
+						since += head.first.amount;
+						if (head.first.time <= end)
+						{
+							job.postings.push_back(head.first);
+						}
+					}
+					if (runs[head.second]->next(entry))
+					{
+						heads.push(Head(entry, head.second));
+					}
+				}
+				unordered_map <int, long long>::iterator moved = late.find(rec.account_number);
+				if (moved != late.end())
+				{
+					since += moved->second;
+				}
+				job.opening = rec.balance - since;
+				report.statements++;
+				report.postings += job.postings.size();
+				batch.push_back(job);
+				return true;
+			});
+		}
+		if (!batch.empty())
+		{
+			queue.push(batch);
+		}
+		scheduler.pause(Op_Scheduler::BATCH);
+	}
+	queue.finish();
+	for (size_t i = 0; i < writers.size(); i++)
+	{
+		writers[i].join();
+	}
+	for (size_t i = 0; i < runs.size(); i++)
+	{
+		delete runs[i];
+	}
+	for (unsigned i = 0; i < report.runs; i++)
+	{
+		remove(run_path(directory, i).c_str());
+	}
+	report.seconds = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - begin).count();
+	return ok;
+}
@@ -0,0 +1,35 @@
+#pragma once
+# include "BST_Tree.h"
+# include <string>
+using namespace std;
+
+// Writes a statement for every account for one calendar month (UTC) in a
+// single pass over the history. The postings from the start of the month on
+// are streamed once, from the archive and from transaction.txt, and sorted by
+// account with an external merge sort: whenever the memory budget is full the
+// buffer is sorted and spilled to a run file, and the runs are merged at the
+// end. The merged stream is joined in account order against the account
+// index for the name, the address and the current balance; the opening
+// balance is the current balance less everything posted since the month
+// began. A pool of threads writes the statement files.
+//
+// The job runs as batch work under the operation scheduler: the scan pauses
+// every few thousand postings and the join holds the ledger for a few hundred
+// accounts at a time, so postings go on in between. The statements are as of
+// the end of transaction.txt when the job started; postings made after it are
+// read back before each chunk and taken out of its balances. A job shed by
+// the scheduler stops and returns false.
+class Statement_Batch
+{
+public:
+	struct Report
+	{
+		unsigned long long statements;
+		unsigned long long postings;
+		unsigned runs;
+		unsigned long long spilled_bytes;
+		double seconds;
+	};
+
+	static bool run(BST_Tree &, int, const string &, size_t, unsigned, Report &);
+};
@@ -0,0 +1,168 @@
+# include "Tracer.h"
+# include <mutex>
+# include <vector>
+# include <fstream>
+# include <iomanip>
+
+atomic<bool> Tracer::active(false);
+
+struct Trace_Event
+{
+	const char *name;
+	unsigned long long start;
+	unsigned long long ticks;
+};
+
+// Single-writer ring. The owner publishes each event by advancing head, and
+// a reader keeps only the slots that were not overwritten while it copied.
+struct Trace_Ring
+{
+	Trace_Event events[Tracer::RING_SIZE];
+	atomic<unsigned long long> head;
+	unsigned thread_id;
+	unsigned depth;
+	bool sampled;
+	unsigned long long seed;
+};
+
+static mutex& registry_lock()
+{
+	static mutex lock;
+	return lock;
+}
+static vector <Trace_Ring*>& registry()
+{
+	static vector <Trace_Ring*> rings;
+	return rings;
+}
+static thread_local Trace_Ring *local_ring = nullptr;
+static string output_path;
+static atomic<unsigned> sample_threshold(0);
+static unsigned long long base_ticks = 0;
+
+static Trace_Ring* local()
+{
+	if (local_ring == nullptr)
+	{
+		local_ring = new Trace_Ring();
+		local_ring->head.store(0, memory_order_relaxed);
+		local_ring->depth = 0;
+		local_ring->sampled = false;
+		lock_guard <mutex> guard(registry_lock());
+		local_ring->thread_id = (unsigned)registry().size() + 1;
+		local_ring->seed = Metrics::now() ^ ((unsigned long long)local_ring->thread_id << 32) ^ 0x9e3779b97f4a7c15ULL;
+		registry().push_back(local_ring);
+	}
+	return local_ring;
+}
+static unsigned next_random(Trace_Ring *ring)
+{
+	ring->seed ^= ring->seed << 13;
+	ring->seed ^= ring->seed >> 7;
+	ring->seed ^= ring->seed << 17;
+	return (unsigned)(ring->seed >> 32);
+}
+
+void Tracer::enable(const string &path, double sample_rate)
+{
+	if (sample_rate < 0.0)
+		sample_rate = 0.0;
+	if (sample_rate > 1.0)
+		sample_rate = 1.0;
+	{
+		lock_guard <mutex> guard(registry_lock());
+		output_path = path;
+		base_ticks = Metrics::now();
+	}
+	sample_threshold.store((unsigned)(sample_rate * 4294967295.0), memory_order_relaxed);
+	active.store(true, memory_order_release);
+}
+void Tracer::disable()
+{
+	active.store(false, memory_order_release);
+}
+bool Tracer::begin()
+{
+	Trace_Ring *ring = local();
+	if (ring->depth == 0)
+	{
+		unsigned threshold = sample_threshold.load(memory_order_relaxed);
+		ring->sampled = threshold != 0 && next_random(ring) <= threshold;
+	}
+	ring->depth++;
+	return ring->sampled;
+}
+void Tracer::end(const char *name, unsigned long long start, bool sampled)
+{
+	Trace_Ring *ring = local();
+	if (ring->depth > 0)
+	{
+		ring->depth--;
+	}
+	if (!sampled)
+	{
+		return;
+	}
+	unsigned long long head = ring->head.load(memory_order_relaxed);
+	Trace_Event &e = ring->events[head % RING_SIZE];
+	e.name = name;
+	e.start = start;
+	e.ticks = Metrics::now() - start;
+	ring->head.store(head + 1, memory_order_release);
+}
+bool Tracer::flush()
+{
+	string path;
+	unsigned long long base;
+	vector <Trace_Ring*> rings;
+	{
+		lock_guard <mutex> guard(registry_lock());
+		path = output_path;
+		base = base_ticks;
+		rings = registry();
+	}
+	if (path.empty())
+	{
+		return false;
+	}
+	ofstream write(path.c_str());
+	if (!write)
+	{
+		return false;
+	}
+	double us_per_tick = Metrics::ns_per_tick() / 1000.0;
+	bool first = true;
+	write << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	write << fixed << setprecision(3);
+	for (unsigned r = 0; r < rings.size(); r++)
+	{
+		Trace_Ring *ring = rings[r];
+		vector <Trace_Event> copy;
+		unsigned long long head = ring->head.load(memory_order_acquire);
+		unsigned long long from = head > RING_SIZE ? head - RING_SIZE : 0;
+		for (unsigned long long i = from; i < head; i++)
+		{
+			copy.push_back(ring->events[i % RING_SIZE]);
+		}
+		// anything the writer lapped during the copy is torn; drop it
+		unsigned long long after = ring->head.load(memory_order_acquire);
+		unsigned long long valid = after > RING_SIZE ? after - RING_SIZE : 0;
+		for (unsigned long long i = from; i < head; i++)
+		{
+			const Trace_Event &e = copy[(size_t)(i - from)];
+			if (i < valid || e.start < base)
+			{
+				continue;
+			}
+			write << (first ? "\n" : ",\n");
+			first = false;
+			write << "{\"name\":\"" << e.name << "\",\"cat\":\"bankcore\",\"ph\":\"X\""
+				<< ",\"ts\":" << (e.start - base) * us_per_tick
+				<< ",\"dur\":" << e.ticks * us_per_tick
+				<< ",\"pid\":1,\"tid\":" << ring->thread_id << "}";
+		}
+	}
+	write << "\n]}\n";
+	write.close();
+	return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+# include "Metrics.h"
+# include <atomic>
+# include <string>
+using namespace std;
+
+// Opt-in span recorder. Spans go into a fixed ring buffer per thread (the
+// oldest are overwritten) and flush() writes them as Chrome trace-event JSON
+// for chrome://tracing or Perfetto. Sampling is decided once per outermost
+// span, so a sampled operation is always recorded with all of its phases.
+class Tracer
+{
+public:
+	static const unsigned RING_SIZE = 8192;
+
+	static void enable(const string &, double);
+	static void disable();
+	static bool flush();
+	static bool begin();
+	static void end(const char *, unsigned long long, bool);
+
+	static atomic<bool> active;
+};
+
+// Records the enclosing scope as one span when tracing is enabled.
+class Trace_Span
+{
+public:
+	Trace_Span(const char *);
+	~Trace_Span();
+
+private:
+	const char *name;
+	unsigned long long start;
+	bool tracked;
+	bool sampled;
+};
+
+inline Trace_Span::Trace_Span(const char *name)
+{
+	this->name = name;
+	tracked = Tracer::active.load(memory_order_relaxed);
+	sampled = tracked && Tracer::begin();
+	start = sampled ? Metrics::now() : 0;
+}
+inline Trace_Span::~Trace_Span()
+{
+	if (tracked)
+	{
+		Tracer::end(name, start, sampled);
+	}
+}
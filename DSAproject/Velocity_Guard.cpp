@@ -0,0 +1,219 @@
+# include "Velocity_Guard.h"
+# include "Journal.h"
+# include "Metrics.h"
+# include <limits.h>
+# include <string.h>
+
+static const int EMPTY_ACCOUNT = INT_MIN;
+const unsigned Velocity_Guard::BUCKETS;
+
+// Starts with the bank's default rules: 20 debits or 100000 out in 10 minutes.
+Velocity_Guard::Velocity_Guard()
+{
+	rules.window_seconds = 600;
+	rules.max_debits = 20;
+	rules.max_outflow = 100000;
+	used = 0;
+	bucket_us = (long long)rules.window_seconds * 1000000LL / BUCKETS;
+}
+// Changing the rules starts every window over.
+void Velocity_Guard::configure(const Velocity_Rules &next)
+{
+	lock_guard <mutex> guard(guard_lock);
+	rules = next;
+	if (rules.window_seconds == 0)
+	{
+		rules.window_seconds = 600;
+	}
+	bucket_us = (long long)rules.window_seconds * 1000000LL / BUCKETS;
+	slots.clear();
+	used = 0;
+}
+bool Velocity_Guard::enabled()
+{
+	return rules.max_debits > 0 || rules.max_outflow > 0;
+}
+void Velocity_Guard::reserve(size_t accounts)
+{
+	lock_guard <mutex> guard(guard_lock);
+	size_t capacity = 16;
+	while (capacity * 7 / 10 < accounts)
+	{
+		capacity *= 2;
+	}
+	if (capacity > slots.size())
+	{
+		vector <Window> old;
+		old.swap(slots);
+		Window empty;
+		memset(&empty, 0, sizeof(empty));
+		empty.account = EMPTY_ACCOUNT;
+		slots.assign(capacity, empty);
+		used = 0;
+		for (size_t i = 0; i < old.size(); i++)
+		{
+			if (old[i].account != EMPTY_ACCOUNT)
+			{
+				find(old[i].account, old[i].last) = old[i];
+			}
+		}
+	}
+}
+// Checks a debit of amount against the rules and, if it is allowed, counts it.
+Velocity_Guard::Verdict Velocity_Guard::admit(int account, int amount, long long now_us)
+{
+	if (!enabled())
+	{
+		return ALLOWED;
+	}
+	Metrics_Timer timer(Metrics::VELOCITY_CHECK);
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	lock_guard <mutex> guard(guard_lock);
+	unsigned epoch = (unsigned)(now_us / bucket_us);
+	Window &w = find(account, epoch);
+	advance(w, epoch);
+	Verdict verdict = ALLOWED;
+	if (rules.max_debits > 0 && w.total_debits + 1 > rules.max_debits)
+	{
+		verdict = TOO_MANY_DEBITS;
+	}
+	else if (rules.max_outflow > 0 && (long long)w.total_outflow + amount > rules.max_outflow)
+	{
+		verdict = TOO_MUCH_OUTFLOW;
+	}
+	if (verdict != ALLOWED)
+	{
+		Metrics::count(Metrics::VELOCITY_REFUSALS);
+		return verdict;
+	}
+	unsigned bucket = w.last % BUCKETS;
+	if (w.debits[bucket] < USHRT_MAX)
+	{
+		w.debits[bucket]++;
+		w.total_debits++;
+	}
+	unsigned room = UINT_MAX - w.outflow[bucket];
+	unsigned added = amount > 0 ? ((unsigned)amount < room ? (unsigned)amount : room) : 0;
+	w.outflow[bucket] += added;
+	w.total_outflow += added;
+	return ALLOWED;
+}
+size_t Velocity_Guard::accounts()
+{
+	lock_guard <mutex> guard(guard_lock);
+	return used;
+}
+const char* Velocity_Guard::describe(Verdict verdict)
+{
+	switch (verdict)
+	{
+	case TOO_MANY_DEBITS:
+		return "too many withdrawals and transfers in the velocity window";
+	case TOO_MUCH_OUTFLOW:
+		return "outflow limit for the velocity window reached";
+	default:
+		return "allowed";
+	}
+}
+Velocity_Guard& Velocity_Guard::bank()
+{
+	static Velocity_Guard guard;
+	return guard;
+}
+// Returns the window of an account, adding an empty one if there is none.
+Velocity_Guard::Window& Velocity_Guard::find(int account, unsigned epoch)
+{
+	if ((used + 1) * 10 > slots.size() * 7)
+	{
+		grow(epoch);
+	}
+	size_t mask = slots.size() - 1;
+	unsigned h = (unsigned)account * 0x9E3779B1u;
+	size_t i = (h ^ (h >> 16)) & mask;
+	while (slots[i].account != account)
+	{
+		if (slots[i].account == EMPTY_ACCOUNT)
+		{
+			memset(&slots[i], 0, sizeof(Window));
+			slots[i].account = account;
+			slots[i].last = epoch;
+			used++;
+			break;
+		}
+		i = (i + 1) & mask;
+	}
+	return slots[i];
+}
+// Rehashes the table, leaving out accounts with nothing left in their window;
+// doubles it only if the live accounts would still fill it.
+void Velocity_Guard::grow(unsigned epoch)
+{
+	vector <Window> old;
+	old.swap(slots);
+	size_t live = 0;
+	for (size_t i = 0; i < old.size(); i++)
+	{
+		if (old[i].account != EMPTY_ACCOUNT && epoch - old[i].last < BUCKETS)
+		{
+			live++;
+		}
+	}
+	size_t capacity = old.empty() ? 1024 : old.size();
+	while ((live + 1) * 2 > capacity)
+	{
+		capacity *= 2;
+	}
+	Window empty;
+	memset(&empty, 0, sizeof(empty));
+	empty.account = EMPTY_ACCOUNT;
+	slots.assign(capacity, empty);
+	used = 0;
+	size_t mask = capacity - 1;
+	for (size_t j = 0; j < old.size(); j++)
+	{
+		if (old[j].account == EMPTY_ACCOUNT || epoch - old[j].last >= BUCKETS)
+		{
+			continue;
+		}
+		unsigned h = (unsigned)old[j].account * 0x9E3779B1u;
+		size_t i = (h ^ (h >> 16)) & mask;
+		while (slots[i].account != EMPTY_ACCOUNT)
+		{
+			i = (i + 1) & mask;
+		}
+		slots[i] = old[j];
+		used++;
+	}
+}
+// Expires the buckets that slid out of the window since the last posting.
+void Velocity_Guard::advance(Window &w, unsigned epoch)
+{
+	unsigned gap = epoch - w.last;
+	if (gap == 0 || gap > UINT_MAX / 2)
+	{
+		// same bucket, or the clock stepped back: keep counting into the last bucket
+		return;
+	}
+	if (gap >= BUCKETS)
+	{
+		memset(w.debits, 0, sizeof(w.debits));
+		memset(w.outflow, 0, sizeof(w.outflow));
+		w.total_debits = 0;
+		w.total_outflow = 0;
+	}
+	else
+	{
+		for (unsigned e = w.last + 1; e != epoch + 1; e++)
+		{
+			unsigned bucket = e % BUCKETS;
+			w.total_debits -= w.debits[bucket];
+			w.total_outflow -= w.outflow[bucket];
+			w.debits[bucket] = 0;
+			w.outflow[bucket] = 0;
+		}
+	}
+	w.last = epoch;
+}
@@ -0,0 +1,67 @@
+#pragma once
+# include <vector>
+# include <mutex>
+using namespace std;
+
+// Limits on the debits (withdrawals and outgoing transfers) of one account
+// within a sliding window. A limit of 0 is not checked.
+struct Velocity_Rules
+{
+	unsigned window_seconds;
+	unsigned max_debits;
+	long long max_outflow;
+};
+
+// Sliding-window velocity checks for the posting path. Each account has a
+// ring of BUCKETS buckets that together cover the window, plus running totals,
+// so a check is a hash probe, at most BUCKETS bucket expiries and two
+// comparisons, whatever the account's history. Accounts live in one flat
+// open-addressing table; accounts idle for a whole window are dropped when it
+// grows, so memory follows the accounts that are active, not all accounts.
+// The windows are kept in memory only and start empty in every process.
+class Velocity_Guard
+{
+public:
+	static const unsigned BUCKETS = 10;
+
+	enum Verdict
+	{
+		ALLOWED,
+		TOO_MANY_DEBITS,
+		TOO_MUCH_OUTFLOW
+	};
+
+	Velocity_Guard();
+	void configure(const Velocity_Rules &);
+	bool enabled();
+	void reserve(size_t);
+	Verdict admit(int, int, long long now_us = 0);
+	size_t accounts();
+	static const char* describe(Verdict);
+	// the guard used by the staff menu and the kiosk owner
+	static Velocity_Guard& bank();
+
+	Velocity_Rules rules;
+
+private:
+	struct Window
+	{
+		int account;
+		unsigned last;
+		unsigned total_debits;
+		unsigned short debits[BUCKETS];
+		unsigned outflow[BUCKETS];
+		unsigned long long total_outflow;
+	};
+
+	Velocity_Guard(const Velocity_Guard &);
+	Velocity_Guard& operator=(const Velocity_Guard &);
+	Window& find(int, unsigned);
+	void grow(unsigned);
+	void advance(Window &, unsigned);
+
+	mutex guard_lock;
+	vector <Window> slots;
+	size_t used;
+	long long bucket_us;
+};
@@ -0,0 +1,121 @@
+# include "Verify_Cache.h"
+# include "Journal.h"
+# include <random>
+
+const unsigned Verify_Cache::SLOTS;
+const long long Verify_Cache::TTL_US;
+
+static inline unsigned long long rotl(unsigned long long x, unsigned n)
+{
+	return (x << n) | (x >> (64 - n));
+}
+static inline void sip_round(unsigned long long v[4])
+{
+	v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+	v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+}
+// SipHash-2-4 of whole 64-bit words.
+static unsigned long long siphash(const unsigned long long key[2], const unsigned long long *words, unsigned count)
+{
+	unsigned long long v[4] =
+	{
+		key[0] ^ 0x736f6d6570736575ull, key[1] ^ 0x646f72616e646f6dull,
+		key[0] ^ 0x6c7967656e657261ull, key[1] ^ 0x7465646279746573ull
+	};
+	for (unsigned i = 0; i < count; i++)
+	{
+		v[3] ^= words[i];
+		sip_round(v);
+		sip_round(v);
+		v[0] ^= words[i];
+	}
+	unsigned long long last = (unsigned long long)(count * 8) << 56;
+	v[3] ^= last;
+	sip_round(v);
+	sip_round(v);
+	v[0] ^= last;
+	v[2] ^= 0xff;
+	for (unsigned i = 0; i < 4; i++)
+	{
+		sip_round(v);
+	}
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+Verify_Cache::Verify_Cache()
+{
+	hits = 0;
+	misses = 0;
+	random_device random;
+	for (unsigned i = 0; i < 2; i++)
+	{
+		key[i] = (unsigned long long)random() << 32 ^ random();
+	}
+	clear();
+}
+unsigned long long Verify_Cache::tag(int account, int password, const unsigned char *salt)
+{
+	unsigned long long words[3];
+	words[0] = (unsigned long long)(unsigned)account << 32 | (unsigned)password;
+	words[1] = 0;
+	words[2] = 0;
+	for (unsigned i = 0; i < 8; i++)
+	{
+		words[1] |= (unsigned long long)salt[i] << (8 * i);
+		words[2] |= (unsigned long long)salt[8 + i] << (8 * i);
+	}
+	// 0 marks an empty slot
+	unsigned long long t = siphash(key, words, 3);
+	return t != 0 ? t : 1;
+}
+bool Verify_Cache::hit(unsigned long long t, long long now_us)
+{
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	lock_guard <mutex> guard(cache_lock);
+	size_t set = (size_t)(t % (SLOTS / 2)) * 2;
+	for (size_t i = set; i < set + 2; i++)
+	{
+		if (slots[i].tag == t && now_us - slots[i].time < TTL_US)
+		{
+			hits++;
+			return true;
+		}
+	}
+	misses++;
+	return false;
+}
+// Fills the empty or older slot of the tag's set.
+void Verify_Cache::insert(unsigned long long t, long long now_us)
+{
+	if (now_us == 0)
+	{
+		now_us = Journal::now_us();
+	}
+	lock_guard <mutex> guard(cache_lock);
+	size_t set = (size_t)(t % (SLOTS / 2)) * 2;
+	size_t victim = slots[set].tag == t || slots[set].time <= slots[set + 1].time ? set : set + 1;
+	if (slots[set + 1].tag == t)
+	{
+		victim = set + 1;
+	}
+	slots[victim].tag = t;
+	slots[victim].time = now_us;
+}
+void Verify_Cache::clear()
+{
+	lock_guard <mutex> guard(cache_lock);
+	Slot empty;
+	empty.tag = 0;
+	empty.time = 0;
+	slots.assign(SLOTS, empty);
+}
+Verify_Cache& Verify_Cache::bank()
+{
+	static Verify_Cache cache;
+	return cache;
+}
@@ -0,0 +1,43 @@
+#pragma once
+# include <vector>
+# include <mutex>
+using namespace std;
+
+// Recent successful password checks, so a customer who signs in again or a
+// kiosk that sends the password with every request does not pay for another
+// key derivation. An entry is a SipHash-2-4 tag of the account, the password
+// and the salt of the stored hash under a key drawn when the process starts;
+// the password itself is never kept. A new password gets a new salt, so
+// entries for the old one stop matching. The cache is two-way set
+// associative with SLOTS entries, and entries are good for TTL_US.
+class Verify_Cache
+{
+public:
+	static const unsigned SLOTS = 4096;
+	static const long long TTL_US = 10 * 60 * 1000000LL;
+
+	Verify_Cache();
+	unsigned long long tag(int, int, const unsigned char *);
+	bool hit(unsigned long long, long long now_us = 0);
+	void insert(unsigned long long, long long now_us = 0);
+	void clear();
+	// the cache used for every credential check in the process
+	static Verify_Cache& bank();
+
+	unsigned long long hits;
+	unsigned long long misses;
+
+private:
+	struct Slot
+	{
+		unsigned long long tag;
+		long long time;
+	};
+
+	Verify_Cache(const Verify_Cache &);
+	Verify_Cache& operator=(const Verify_Cache &);
+
+	mutex cache_lock;
+	vector <Slot> slots;
+	unsigned long long key[2];
+};
@@ -0,0 +1,646 @@
+# include "Workload.h"
+# include "Backup.h"
+# include "Replication.h"
+# include "Metrics.h"
+# include "Velocity_Guard.h"
+# include "Change_Feed.h"
+# include <fstream>
+# include <mutex>
+# include <chrono>
+# include <thread>
+# include <vector>
+# include <map>
+# include <algorithm>
+# include <iomanip>
+# include <sstream>
+# include <random>
+# include <string.h>
+
+static const char MAGIC[4] = { 'B', 'K', 'W', 'L' };
+static const unsigned char VERSION = 1;
+
+static mutex trace_lock;
+static ofstream out;
+static bool active = false;
+static chrono::steady_clock::time_point last;
+static map <int, bool> touched;
+
+static void put_varint(ostream &write, unsigned long long v)
+{
+	while (v >= 0x80)
+	{
+		write.put((char)(v | 0x80));
+		v >>= 7;
+	}
+	write.put((char)v);
+}
+static void put_signed(ostream &write, long long v)
+{
+	put_varint(write, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+}
+static bool get_varint(istream &read, unsigned long long &v)
+{
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		int c = read.get();
+		if (c == EOF)
+		{
+			return false;
+		}
+		v |= (unsigned long long)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+static bool get_signed(istream &read, int &v)
+{
+	unsigned long long u;
+	if (!get_varint(read, u))
+	{
+		return false;
+	}
+	v = (int)(long long)((u >> 1) ^ (0 - (u & 1)));
+	return true;
+}
+// caller holds the lock
+static void put_header(Workload::Operation op)
+{
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+	out.put((char)op);
+	put_varint(out, (unsigned long long)chrono::duration_cast<chrono::microseconds>(now - last).count());
+	last = now;
+}
+static void seed(int accountno, int balance)
+{
+	if (touched.count(accountno))
+	{
+		return;
+	}
+	touched[accountno] = true;
+	put_header(Workload::SEED);
+	put_signed(out, accountno);
+	put_signed(out, balance);
+}
+
+bool Workload::start(const string &path)
+{
+	lock_guard <mutex> guard(trace_lock);
+	out.open(path.c_str(), ios::binary | ios::trunc);
+	if (!out)
+	{
+		return false;
+	}
+	out.write(MAGIC, sizeof(MAGIC));
+	out.put((char)VERSION);
+	last = chrono::steady_clock::now();
+	touched.clear();
+	active = true;
+	return true;
+}
+bool Workload::recording()
+{
+	return active;
+}
+void Workload::record_add(int accountno, int balance)
+{
+	lock_guard <mutex> guard(trace_lock);
+	if (!active)
+	{
+		return;
+	}
+	touched[accountno] = true;
+	put_header(ADD);
+	put_signed(out, accountno);
+	put_signed(out, balance);
+}
+void Workload::record_delete(int accountno, int balance)
+{
+	lock_guard <mutex> guard(trace_lock);
+	if (!active)
+	{
+		return;
+	}
+	seed(accountno, balance);
+	put_header(REMOVE);
+	put_signed(out, accountno);
+}
+void Workload::record_posting(Operation op, int accountno, int balance, int amount)
+{
+	lock_guard <mutex> guard(trace_lock);
+	if (!active)
+	{
+		return;
+	}
+	seed(accountno, balance);
+	put_header(op);
+	put_signed(out, accountno);
+	put_signed(out, amount);
+}
+void Workload::record_transfer(int sender, int sender_balance, int reciever, int reciever_balance, int amount)
+{
+	lock_guard <mutex> guard(trace_lock);
+	if (!active)
+	{
+		return;
+	}
+	seed(sender, sender_balance);
+	seed(reciever, reciever_balance);
+	put_header(TRANSFER);
+	put_signed(out, sender);
+	put_signed(out, reciever);
+	put_signed(out, amount);
+}
+void Workload::stop(BST_Tree &t)
+{
+	lock_guard <mutex> guard(trace_lock);
+	if (!active)
+	{
+		return;
+	}
+	active = false;
+	put_header(FINAL);
+	put_varint(out, touched.size());
+	for (map <int, bool>::iterator it = touched.begin(); it != touched.end(); ++it)
+	{
+		BST_Node *node = t.search(t.Root, it->first);
+		put_signed(out, it->first);
+		out.put(node != nullptr ? 1 : 0);
+		put_signed(out, node != nullptr ? node->balance : 0);
+	}
+	out.close();
+}
+struct Trace_Op
+{
+	int op;
+	int a;
+	int b;
+	int amount;
+	unsigned long long offset_us;
+};
+struct Expected
+{
+	int accountno;
+	bool present;
+	int balance;
+};
+
+// Reads a whole trace; returns false when it does not end with final balances.
+static bool load_trace(istream &read, vector <Trace_Op> &ops, vector <Expected> &expected)
+{
+	unsigned long long offset_us = 0;
+	int op;
+	while ((op = read.get()) != EOF)
+	{
+		unsigned long long delta;
+		Trace_Op t;
+		t.op = op;
+		t.a = t.b = t.amount = 0;
+		if (!get_varint(read, delta))
+		{
+			break;
+		}
+		offset_us += delta;
+		t.offset_us = offset_us;
+		if (op == Workload::FINAL)
+		{
+			unsigned long long count;
+			get_varint(read, count);
+			for (unsigned long long i = 0; i < count; i++)
+			{
+				Expected e;
+				get_signed(read, e.accountno);
+				e.present = read.get() == 1;
+				get_signed(read, e.balance);
+				expected.push_back(e);
+			}
+			return true;
+		}
+		get_signed(read, t.a);
+		if (op == Workload::TRANSFER)
+		{
+			get_signed(read, t.b);
+		}
+		if (op != Workload::REMOVE)
+		{
+			get_signed(read, t.amount);
+		}
+		ops.push_back(t);
+	}
+	return false;
+}
+// Checks the replayed balances and prints the report.
+static bool report(const vector <Expected> &expected, const function<bool(int, int &)> &lookup, vector <long long> &latencies, unsigned long long seeds, double elapsed, bool paced, bool complete, const string &mode)
+{
+	unsigned mismatches = 0;
+	for (unsigned i = 0; i < expected.size(); i++)
+	{
+		int balance = 0;
+		bool found = lookup(expected[i].accountno, balance);
+		bool ok = expected[i].present ? found && balance == expected[i].balance : !found;
+		if (!ok)
+		{
+			if (mismatches < 10)
+			{
+				cout << "Mismatch for account " << expected[i].accountno << ": expected ";
+				if (expected[i].present)
+					cout << expected[i].balance;
+				else
+					cout << "deleted";
+				cout << ", got ";
+				if (found)
+					cout << balance;
+				else
+					cout << "missing";
+				cout << "\n";
+			}
+			mismatches++;
+		}
+	}
+
+	sort(latencies.begin(), latencies.end());
+	size_t n = latencies.size();
+	cout << "\n--- Replay Report ---\n\n";
+	cout << "Requests replayed:   " << n << " (" << seeds << " accounts seeded)\n";
+	cout << "Ledger:              " << mode << "\n";
+	cout << "Mode:                " << (paced ? "recorded pacing" : "maximum speed") << "\n";
+	cout << fixed << setprecision(2);
+	cout << "Elapsed:             " << elapsed << " s\n";
+	cout << "Throughput:          " << (elapsed > 0 ? n / elapsed : 0.0) << " requests/s\n";
+	if (n > 0)
+	{
+		cout << "Latency p50:         " << latencies[n / 2] / 1000.0 << " us\n";
+		cout << "Latency p90:         " << latencies[n * 9 / 10] / 1000.0 << " us\n";
+		cout << "Latency p99:         " << latencies[n * 99 / 100] / 1000.0 << " us\n";
+		cout << "Latency max:         " << latencies[n - 1] / 1000.0 << " us\n";
+	}
+	if (!complete)
+	{
+		cout << "Trace has no final balances; it was not closed cleanly.\n";
+		return false;
+	}
+	cout << "Balances verified:   " << expected.size() - mismatches << "/" << expected.size() << "\n";
+	return mismatches == 0;
+}
+// Runs the bank's velocity rules over a debit on the trace's clock. The replay
+// only counts what they would refuse, so the balances still verify, but the
+// check stays inside the measured latency of the posting.
+static void check_velocity(Velocity_Guard &velocity, const Trace_Op &t, unsigned long long &flagged)
+{
+	if ((t.op == Workload::WITHDRAW || t.op == Workload::TRANSFER)
+		&& velocity.admit(t.a, t.amount, (long long)t.offset_us + 1) != Velocity_Guard::ALLOWED)
+	{
+		flagged++;
+	}
+}
+static bool report_feed(Feed_Check &check)
+{
+	bool ok = check.finish();
+	cout << "Change feed:         " << check.published << " published, " << check.delivered << " delivered, "
+		<< check.dropped << " dropped, " << check.gaps << " out of sequence" << (ok ? "" : " (FAILED)") << "\n";
+	return ok;
+}
+static void report_velocity(Velocity_Guard &velocity, unsigned long long flagged)
+{
+	if (!velocity.enabled())
+	{
+		return;
+	}
+	Metrics::Summary s = Metrics::summary(Metrics::VELOCITY_CHECK);
+	cout << "Velocity checks:     " << s.count << " (" << flagged << " over the limits, "
+		<< velocity.accounts() << " accounts tracked)\n";
+	cout << "Velocity check p50:  " << s.p50_ns / 1000.0 << " us\n";
+	cout << "Velocity check p99:  " << s.p99_ns / 1000.0 << " us\n";
+}
+// Replays against a sharded ledger split at quantiles of the traced accounts.
+// Requests are submitted without waiting, up to a window, so every shard's
+// applier stays busy; each shard still sees its requests in trace order.
+static bool replay_sharded(const vector <Trace_Op> &ops, const vector <Expected> &expected, bool complete, const string &directory, unsigned shard_count, bool paced, const string &serve, bool escrow, bool feed)
+{
+	vector <int> accounts;
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		if (ops[i].op == Workload::SEED || ops[i].op == Workload::ADD)
+		{
+			accounts.push_back(ops[i].a);
+		}
+	}
+	sort(accounts.begin(), accounts.end());
+	accounts.erase(unique(accounts.begin(), accounts.end()), accounts.end());
+	vector <int> splits;
+	for (unsigned i = 1; i < shard_count && !accounts.empty(); i++)
+	{
+		int point = accounts[accounts.size() * i / shard_count];
+		if (splits.empty() || point > splits.back())
+		{
+			splits.push_back(point);
+		}
+	}
+
+	Sharded_Ledger ledger;
+	string prefix = directory;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+	{
+		prefix += '/';
+	}
+	ifstream existing((prefix + "shards.cfg").c_str());
+	if (existing)
+	{
+		cout << "Error: replay directory must not contain a ledger.\n";
+		return false;
+	}
+	existing.close();
+	ledger.auto_hot = escrow;
+	Journal_Shipper shipper;
+	if (!serve.empty())
+	{
+		ledger.on_commit = [&shipper]() { shipper.notify(); };
+	}
+	if (!ledger.create(directory, splits))
+	{
+		cout << "Error: could not create a sharded ledger in " << (directory.empty() ? "." : directory) << ".\n";
+		return false;
+	}
+	if (!serve.empty() && !shipper.listen(serve, ledger))
+	{
+		cout << "Error: could not listen on " << serve << ".\n";
+		return false;
+	}
+
+	Velocity_Guard velocity;
+	velocity.configure(Velocity_Guard::bank().rules);
+	unsigned long long flagged = 0;
+
+	Feed_Check check;
+	if (feed)
+	{
+		check.start();
+	}
+	const size_t WINDOW = 4096;
+	vector <Ledger_Ticket> tickets(WINDOW);
+	vector <unsigned long long> submitted(WINDOW);
+	vector <bool> timed(WINDOW, false);
+	vector <long long> latencies;
+	double ns_per_tick = Metrics::ns_per_tick();
+	unsigned long long seeds = 0;
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		size_t slot = i % WINDOW;
+		if (i >= WINDOW)
+		{
+			tickets[slot].wait();
+			if (timed[slot])
+			{
+				latencies.push_back((long long)((tickets[slot].last->done_ticks - submitted[slot]) * ns_per_tick));
+			}
+		}
+		const Trace_Op &t = ops[i];
+		if (paced && t.op != Workload::SEED)
+		{
+			this_thread::sleep_until(begin + chrono::microseconds(t.offset_us));
+		}
+		submitted[slot] = Metrics::now();
+		timed[slot] = t.op != Workload::SEED;
+		check_velocity(velocity, t, flagged);
+		bool queued = false;
+		switch (t.op)
+		{
+			case Workload::SEED:
+				seeds++;
+				queued = ledger.open_account(t.a, t.amount, &tickets[slot]);
+				break;
+			case Workload::ADD:
+				queued = ledger.open_account(t.a, t.amount, &tickets[slot]);
+				break;
+			case Workload::REMOVE:
+				queued = ledger.close_account(t.a, &tickets[slot]);
+				break;
+			case Workload::DEPOSIT:
+				queued = ledger.deposit(t.a, t.amount, &tickets[slot]);
+				break;
+			case Workload::WITHDRAW:
+				queued = ledger.withdraw(t.a, t.amount, &tickets[slot]);
+				break;
+			case Workload::TRANSFER:
+				queued = ledger.transfer(t.a, t.b, t.amount, &tickets[slot]);
+				break;
+		}
+		if (!queued)
+		{
+			tickets[slot].last = nullptr;
+			timed[slot] = false;
+		}
+	}
+	for (size_t i = ops.size() > WINDOW ? ops.size() - WINDOW : 0; i < ops.size(); i++)
+	{
+		size_t slot = i % WINDOW;
+		tickets[slot].wait();
+		if (timed[slot])
+		{
+			latencies.push_back((long long)((tickets[slot].last->done_ticks - submitted[slot]) * ns_per_tick));
+		}
+	}
+	double elapsed = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - begin).count();
+
+	ostringstream mode;
+	mode << ledger.shard_count() << " shards";
+	bool verified = report(expected, [&](int accountno, int &balance) { return ledger.balance(accountno, balance); }, latencies, seeds, elapsed, paced, complete, mode.str());
+	report_velocity(velocity, flagged);
+	if (feed)
+	{
+		verified = report_feed(check) && verified;
+	}
+	// how evenly the shards shared the work, and what hot accounts took off them
+	cout << "Shard load:          ";
+	for (unsigned i = 0; i < ledger.shard_count(); i++)
+	{
+		cout << (i > 0 ? " / " : "") << ledger.shard(i)->journal.next_seq - 1;
+	}
+	cout << " records\n";
+	cout << "Cross-shard:         " << Metrics::total(Metrics::CROSS_SHARD_TRANSFERS) << " transfers\n";
+	cout << "Escrow:              " << Metrics::total(Metrics::ESCROW_CREDITS) << " credits, "
+		<< Metrics::total(Metrics::ESCROW_SWEEPS) << " sweeps\n";
+	if (!serve.empty())
+	{
+		cout << "\nServing the journal at " << serve << " to standbys. Press Enter to stop.\n";
+		cin.get();
+		shipper.stop();
+		ledger.on_commit = nullptr;
+	}
+	return verified;
+}
+bool Workload::replay(const string &path, const string &directory, bool paced, unsigned shards, const string &serve, bool escrow, unsigned batch, const string &backup_path, double retries, bool feed)
+{
+	ifstream read(path.c_str(), ios::binary);
+	char magic[4];
+	if (!read.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || read.get() != VERSION)
+	{
+		cout << "Error: " << path << " is not a workload trace.\n";
+		return false;
+	}
+	vector <Trace_Op> ops;
+	vector <Expected> expected;
+	bool complete = load_trace(read, ops, expected);
+	if (shards > 0)
+	{
+		return replay_sharded(ops, expected, complete, directory, shards, paced, serve, escrow, feed);
+	}
+
+	BST_Tree t;
+	t.set_directory(directory);
+	ifstream existing(t.file("accounts.idx").c_str());
+	if (existing)
+	{
+		cout << "Error: replay directory must not contain a ledger.\n";
+		return false;
+	}
+	existing.close();
+	t.load_Server();
+
+	Velocity_Guard velocity;
+	velocity.configure(Velocity_Guard::bank().rules);
+	unsigned long long flagged = 0;
+
+	// postings carry their position in the trace as their key
+	mt19937 retry_draw(47);
+	uniform_real_distribution <double> share(0.0, 1.0);
+	unsigned long long retried = 0;
+	unsigned long long repeats_posted = 0;
+
+	vector <long long> latencies;
+	unsigned long long seeds = 0;
+	unsigned long long batches = 0;
+	unsigned batched = 0;
+	Backup backup;
+	bool backing_up = false;
+	Feed_Check check;
+	if (feed)
+	{
+		check.start();
+	}
+	chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+	for (size_t i = 0; i < ops.size(); i++)
+	{
+		const Trace_Op &op = ops[i];
+		// the postings after the snapshot run while the backup streams
+		if (!backup_path.empty() && !backing_up && i >= ops.size() / 2 && !t.batching())
+		{
+			backing_up = true;
+			if (!backup.start(t, backup_path))
+			{
+				cout << "Error: Could not start the backup.\n";
+			}
+		}
+		if (op.op == SEED)
+		{
+			Account_Record rec;
+			memset(&rec, 0, sizeof(rec));
+			rec.account_number = op.a;
+			rec.balance = op.amount;
+			memcpy(rec.name, "replay", 6);
+			memcpy(rec.adress, "replay", 6);
+			t.index.insert(rec);
+			t.filter.add(op.a);
+			seeds++;
+			continue;
+		}
+		if (paced)
+		{
+			this_thread::sleep_until(begin + chrono::microseconds(op.offset_us));
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		if (batch > 1 && !t.batching())
+		{
+			t.begin_batch();
+		}
+		check_velocity(velocity, op, flagged);
+		switch (op.op)
+		{
+			case ADD:
+				t.add_Account("replay", "replay", op.a, 1, op.amount);
+				break;
+			case REMOVE:
+				if (t.search(t.Root, op.a) != nullptr)
+				{
+					t.Root = t.delete_Account(t.Root, op.a);
+					t.h.delete_password(op.a);
+				}
+				break;
+			case DEPOSIT:
+				t.deposit(op.a, op.amount, i + 1);
+				break;
+			case WITHDRAW:
+				t.withdraw(op.a, op.amount, i + 1);
+				break;
+			case TRANSFER:
+				t.transfer(op.a, op.b, op.amount, i + 1);
+				break;
+		}
+		if (retries > 0 && op.op >= DEPOSIT && op.op <= TRANSFER && share(retry_draw) < retries)
+		{
+			retried++;
+			bool posted = op.op == DEPOSIT ? t.deposit(op.a, op.amount, i + 1)
+				: op.op == WITHDRAW ? t.withdraw(op.a, op.amount, i + 1) : t.transfer(op.a, op.b, op.amount, i + 1);
+			repeats_posted += posted ? 1 : 0;
+		}
+		// the request that fills a batch pays for writing it out
+		if (t.batching() && (++batched == batch || i + 1 == ops.size()))
+		{
+			t.end_batch();
+			batches++;
+			batched = 0;
+		}
+		latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+	}
+	t.end_batch();
+	double elapsed = chrono::duration_cast<chrono::duration<double> >(chrono::steady_clock::now() - begin).count();
+	t.index.flush();
+
+	bool verified = report(expected, [&](int accountno, int &balance) {
+		BST_Node *node = t.search(t.Root, accountno);
+		if (node == nullptr)
+		{
+			return false;
+		}
+		balance = node->balance;
+		return true;
+	}, latencies, seeds, elapsed, paced, complete, "single tree");
+	if (feed)
+	{
+		verified = report_feed(check) && verified;
+	}
+	if (batch > 1)
+	{
+		cout << "Batches:             " << batches << " of up to " << batch << " requests ("
+			<< Metrics::total(Metrics::BATCHED_POSTINGS) << " postings, "
+			<< Metrics::total(Metrics::ACCOUNT_WRITES) << " account writes)\n";
+	}
+	else
+	{
+		cout << "Account writes:      " << Metrics::total(Metrics::ACCOUNT_WRITES) << "\n";
+	}
+	report_velocity(velocity, flagged);
+	if (retries > 0)
+	{
+		cout << "Retries:             " << retried << " postings sent twice, " << retried - repeats_posted << " answered from "
+			<< t.dedupe.size() << " keys (" << t.dedupe.memory() / 1024 << " KiB)\n";
+		verified = verified && repeats_posted == 0;
+	}
+	Backup::Report backed;
+	if (backing_up && backup.finish(backed))
+	{
+		cout << "Backup:              " << backed.bytes << " bytes up to posting " << backed.seq << " in " << backed.seconds << " s, "
+			<< backed.pages << " index pages (" << backed.pages_saved << " saved before being overwritten)\n";
+	}
+	else if (backing_up)
+	{
+		cout << "Error: The backup did not complete.\n";
+		verified = false;
+	}
+	return verified;
+}
@@ -0,0 +1,45 @@
+#pragma once
+# include "BST_Tree.h"
+# include <string>
+using namespace std;
+
+// Records every accepted engine request into a compact binary trace and
+// replays such a trace against a fresh ledger.
+//
+// Trace layout: "BKWL", a version byte, then one record per request: an
+// operation byte, the microseconds since the previous record and the
+// operands, all as (zigzag) varints. The first time an existing account is
+// touched a SEED record captures its opening balance, and the trace ends with
+// the final balance of every account it touched. Names, addresses and
+// passwords are never recorded.
+//
+// A replay normally drives a BST_Tree, optionally netting its postings in
+// batches of a given number of requests; given a shard count it drives a
+// Sharded_Ledger instead, whose journal can also be served to standbys. A
+// single-tree replay can also take an online backup halfway through, and can
+// send a share of its postings twice under the same idempotency key to check
+// that the retries are not posted again. Either kind can run a Feed_Check on
+// the change feed alongside the replay.
+class Workload
+{
+public:
+	enum Operation
+	{
+		SEED = 1,
+		ADD,
+		REMOVE,
+		DEPOSIT,
+		WITHDRAW,
+		TRANSFER,
+		FINAL
+	};
+
+	static bool start(const string &);
+	static bool recording();
+	static void record_add(int, int);
+	static void record_delete(int, int);
+	static void record_posting(Operation, int, int, int);
+	static void record_transfer(int, int, int, int, int);
+	static void stop(BST_Tree &);
+	static bool replay(const string &, const string &, bool, unsigned shards = 0, const string &serve = "", bool escrow = true, unsigned batch = 0, const string &backup = "", double retries = 0, bool feed = false);
+};
@@ -3,12 +3,16 @@
  * @brief Admin functionality for the Bank Management System
  * 
  * This file contains the admin interface and functionality for the Bank Management System.
- * Admins can add, delete, view, and edit accounts, as well as view account passwords.
+ * Admins can add, delete, view, and edit accounts, as well as view how account passwords are stored
+ * and engine statistics.
  */
 
 #pragma once
 #include "BST_Tree.h"
 #include "Hashtable.h"
+#include "Metrics.h"
+#include "Session_Table.h"
+#include "Ledger_Lock.h"
 #include <iostream>
 #include <string>
 #include <limits>
@@ -42,10 +46,11 @@ void displayAdminMenu()
     std::cout << "1. Add Account\n";
     std::cout << "2. Delete Account\n";
     std::cout << "3. View All Accounts\n";
-    std::cout << "4. View Account Passwords\n";
+    std::cout << "4. View Account Credentials\n";
     std::cout << "5. Edit Account\n";
-    std::cout << "6. Return to Main Menu\n\n";
-    std::cout << "Enter your choice (1-6): ";
+    std::cout << "6. View Engine Statistics\n";
+    std::cout << "7. Return to Main Menu\n\n";
+    std::cout << "Enter your choice (1-7): ";
 }
 
 /**
@@ -127,6 +132,7 @@ void deleteAccount(BST_Tree& t, Hashtable& h)
     if (confirm == 'y' || confirm == 'Y') {
         t.Root = t.delete_Account(t.Root, accountNumber);
         h.delete_password(accountNumber);
+        Session_Table::bank().revoke(accountNumber);
         t.update_server(t.Root);
         std::cout << "\nAccount deleted successfully!\n";
     } else {
@@ -164,7 +170,6 @@ void editAccount(BST_Tree& t, Hashtable& h)
     std::cout << "Name: " << account->name << "\n";
     std::cout << "Address: " << account->adress << "\n";
     std::cout << "Account Number: " << account->account_number << "\n";
-    std::cout << "Password: " << account->password << "\n";
     std::cout << "Balance: " << account->balance << "\n\n";
     
     // Edit menu
@@ -205,9 +210,9 @@ void editAccount(BST_Tree& t, Hashtable& h)
                 std::cout << "Invalid input. Please enter a number: ";
                 clearAdminInputBuffer();
             }
-            account->password = newPassword;
             h.delete_password(accountNumber);
             h.add(accountNumber, newPassword);
+            Session_Table::bank().revoke(accountNumber);
             break;
         }
         case 4:
@@ -219,6 +224,41 @@ void editAccount(BST_Tree& t, Hashtable& h)
     std::cout << "\nAccount updated successfully!\n";
 }
 
+/**
+ * @brief Show operation latencies and I/O counters, optionally exporting them
+ */
+void viewEngineStatistics()
+{
+    std::cout << "\n--- Engine Statistics ---\n\n";
+    Metrics::print(std::cout);
+    
+    int choice = 0;
+    std::cout << "\n1. Export as JSON\n";
+    std::cout << "2. Export as Prometheus text\n";
+    std::cout << "3. Back\n";
+    std::cout << "Enter your choice (1-3): ";
+    
+    while (!(std::cin >> choice) || choice < 1 || choice > 3) {
+        std::cout << "Invalid input. Please enter a number between 1 and 3: ";
+        clearAdminInputBuffer();
+    }
+    
+    if (choice == 3) {
+        return;
+    }
+    
+    std::string path;
+    std::cout << "Enter output file name: ";
+    std::cin >> path;
+    
+    bool written = (choice == 1) ? Metrics::write_json(path) : Metrics::write_prometheus(path);
+    if (written) {
+        std::cout << "\nStatistics written to " << path << "\n";
+    } else {
+        std::cout << "\nError: Could not write " << path << "\n";
+    }
+}
+
 /**
  * @brief Admin interface function
  */
@@ -227,8 +267,15 @@ void admin()
     BST_Tree t;
     Hashtable h;
     int choice = 0;
+    // one process posts to a ledger at a time
+    Ledger_Lock lock;
+    if (!lock.acquire(t.directory)) {
+        std::cout << "\nError: Another process is posting to this ledger, a kiosk table owner or another menu.\n"
+                  << "Try again when the other process has stopped.\n";
+        return;
+    }
     
-    while (choice != 6)
+    while (choice != 7)
     {
         displayAdminHeader();
         displayAdminMenu();
@@ -236,7 +283,7 @@ void admin()
         // Get user choice
         if (!(std::cin >> choice))
         {
-            std::cout << "\nInvalid input. Please enter a number between 1 and 6.\n";
+            std::cout << "\nInvalid input. Please enter a number between 1 and 7.\n";
             clearAdminInputBuffer();
             continue;
         }
@@ -253,25 +300,28 @@ void admin()
             case 3:
                 std::cout << "\n--- All Accounts ---\n\n";
                 t.load_Server();
-                t.printoinfo(t.Root);
+                t.print_accounts();
                 break;
             case 4:
-                std::cout << "\n--- Account Passwords ---\n\n";
+                std::cout << "\n--- Account Credentials ---\n\n";
                 h.displayPasswords();
                 break;
             case 5:
                 editAccount(t, h);
                 break;
             case 6:
+                viewEngineStatistics();
+                break;
+            case 7:
                 std::cout << "\nReturning to main menu...\n";
                 break;
             default:
-                std::cout << "\nInvalid choice. Please enter a number between 1 and 6.\n";
+                std::cout << "\nInvalid choice. Please enter a number between 1 and 7.\n";
                 break;
         }
         
         // Pause before showing the menu again (except when exiting)
-        if (choice != 6)
+        if (choice != 7)
         {
             std::cout << "\nPress Enter to continue...";
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -0,0 +1,537 @@
+/**
+ * @file bench.cpp
+ * @brief Benchmarks run from the command line
+ *
+ * Each benchmark builds its own data, times the engine against it, prints a
+ * report and returns the exit status of the --bench option that runs it.
+ */
+
+#include "bench.h"
+#include "BST_Tree.h"
+#include "Hashtable.h"
+#include "Verify_Cache.h"
+#include "Kdf_Pool.h"
+#include "Dedupe_Table.h"
+#include "Journal.h"
+#include "Metrics.h"
+#include "Op_Scheduler.h"
+#include "Statement_Batch.h"
+#include "Placement.h"
+#include "Prefix_Index.h"
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cctype>
+
+/**
+ * @brief Time the schema codecs for account records against iostream formatting
+ * @param count Number of synthetic records
+ * @return Exit status
+ */
+int benchRecords(int count)
+{
+    std::vector<Account_Record> records(count);
+    for (int i = 0; i < count; i++) {
+        Account_Record& rec = records[i];
+        std::memset(&rec, 0, sizeof(rec));
+        rec.account_number = 100000 + i;
+        rec.balance = (i * 7919) % 2000000 - 1000000;
+        std::snprintf(rec.name, sizeof(rec.name), "Customer %d", i);
+        std::snprintf(rec.adress, sizeof(rec.adress), "%d Main Street, Block %d", i % 500, i % 37);
+    }
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [count](const char* what, double s, size_t bytes) {
+        std::cout << std::left << std::setw(22) << what << std::right << std::setw(12) << (long long)(count / s) << " records/s "
+                  << std::setw(10) << bytes / s / (1 << 20) << " MiB/s\n";
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ostringstream stream;
+    for (int i = 0; i < count; i++) {
+        const Account_Record& rec = records[i];
+        stream << rec.name << std::endl << rec.adress << std::endl << rec.account_number << std::endl
+               << rec.balance << std::endl;
+    }
+    std::string streamText = stream.str();
+    report("iostream format", seconds(start), streamText.size());
+
+    start = std::chrono::steady_clock::now();
+    std::string text;
+    for (int i = 0; i < count; i++)
+        Account_Schema::append_text(records[i], text);
+    report("schema text format", seconds(start), text.size());
+
+    start = std::chrono::steady_clock::now();
+    std::istringstream read(streamText);
+    std::string name, adress;
+    int account, balance, parsed = 0;
+    while (std::getline(read, name) && std::getline(read, adress) && read >> account >> balance) {
+        read.ignore();
+        parsed++;
+    }
+    report("iostream parse", seconds(start), streamText.size());
+
+    start = std::chrono::steady_clock::now();
+    Account_Record rec;
+    int matched = 0;
+    const char* end = text.data() + text.size();
+    for (const char* in = text.data(); (in = Account_Schema::read_text(in, end, rec)) != nullptr; )
+        matched += std::memcmp(&rec, &records[matched], sizeof(rec)) == 0;
+    report("schema text parse", seconds(start), text.size());
+
+    start = std::chrono::steady_clock::now();
+    std::vector<char> binary((size_t)count * Account_Schema::BINARY_SIZE);
+    for (int i = 0; i < count; i++)
+        Account_Schema::write_binary(records[i], &binary[(size_t)i * Account_Schema::BINARY_SIZE]);
+    report("schema binary encode", seconds(start), binary.size());
+
+    start = std::chrono::steady_clock::now();
+    int decoded = 0;
+    for (int i = 0; i < count; i++) {
+        Account_Schema::read_binary(&binary[(size_t)i * Account_Schema::BINARY_SIZE], rec);
+        decoded += std::memcmp(&rec, &records[i], sizeof(rec)) == 0;
+    }
+    report("schema binary decode", seconds(start), binary.size());
+
+    std::cout << "Round trips: " << parsed << " iostream, " << matched << " text, " << decoded << " binary of " << count
+              << " (schema version " << Account_Schema::VERSION << ", layout " << std::hex << Account_Schema::LAYOUT << std::dec << ").\n";
+    return matched == count && decoded == count ? 0 : 1;
+}
+
+/**
+ * @brief Time credential checks with and without the verification cache
+ * @param count Number of accounts to create and sign in
+ * @param dir Existing directory without credentials that receives them
+ * @return Exit status
+ */
+int benchLogins(int count, const std::string& dir)
+{
+    Hashtable h;
+    h.directory = dir;
+    if (!h.directory.empty() && h.directory[h.directory.size() - 1] != '/' && h.directory[h.directory.size() - 1] != '\\')
+        h.directory += '/';
+    std::ifstream existing(h.file("hashtable.txt").c_str());
+    if (existing)
+    {
+        std::cout << "Error: --bench-dir must not contain hashtable.txt.\n";
+        return 1;
+    }
+    // plain passwords are hashed in parallel when the table first loads them
+    std::vector<std::pair<int, int> > logins;
+    std::string text;
+    for (int i = 0; i < count; i++)
+    {
+        Legacy_Credential rec;
+        rec.account_number = 100000 + i;
+        rec.password = 1000 + (i * 7919) % 9000;
+        Legacy_Credential_Schema::append_text(rec, text);
+        logins.push_back(std::make_pair(rec.account_number, rec.password));
+    }
+    std::ofstream write(h.file("hashtable.txt").c_str(), std::ios::binary);
+    write.write(text.data(), text.size());
+    write.close();
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [](const char* what, int n, double s) {
+        std::cout << std::left << std::setw(22) << what << std::right << std::setw(12) << (long long)(n / s) << " logins/s "
+                  << std::setw(10) << s * 1000000 / n << " us each\n";
+    };
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    h.starthash();
+    report("hash stored", count, seconds(start));
+
+    Verify_Cache& cache = Verify_Cache::bank();
+    std::vector<char> results;
+    int serial = count < 16 ? count : 16;
+    cache.clear();
+    start = std::chrono::steady_clock::now();
+    int accepted = 0;
+    for (int i = 0; i < serial; i++)
+        accepted += h.match(logins[i].first, logins[i].second);
+    report("cold, one at a time", serial, seconds(start));
+
+    cache.clear();
+    start = std::chrono::steady_clock::now();
+    h.match_all(logins, results);
+    report("cold, batched", count, seconds(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        accepted += h.match(logins[i].first, logins[i].second);
+    report("warm, one at a time", count, seconds(start));
+
+    int rejected = 0;
+    for (int i = 0; i < serial; i++)
+        rejected += !h.match(logins[i].first, logins[i].second + 1);
+    for (size_t i = 0; i < results.size(); i++)
+        accepted += results[i];
+    std::cout << "Accepted " << accepted << " of " << serial + 2 * count << " logins, rejected " << rejected << " of " << serial
+              << " wrong passwords (scrypt 2^" << Hashtable::kdf_cost << ", " << Kdf_Pool::bank().threads() << " threads, "
+              << cache.hits << " cache hits).\n";
+    return accepted == serial + 2 * count && rejected == serial ? 0 : 1;
+}
+
+/**
+ * @brief Time idempotency key checks against a dedupe table of many keys
+ * @param count Number of keys to add
+ * @return Exit status
+ */
+int benchDedupe(int count)
+{
+    Dedupe_Table table;
+    std::mt19937_64 draw(47);
+    std::vector<unsigned long long> keys(count);
+    for (int i = 0; i < count; i++)
+        keys[i] = draw() | 1;
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+    };
+    auto report = [count](const char* what, double s) {
+        std::cout << std::left << std::setw(22) << what << std::right << std::setw(12) << (long long)(count / s) << " keys/s "
+                  << std::setw(10) << s * 1000000000 / count << " ns each\n";
+    };
+
+    // postings check keys at the time they are stamped, so no clock is read here either
+    long long now = Journal::now_us();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        table.insert(keys[i], i, now);
+    report("insert", seconds(start));
+
+    std::shuffle(keys.begin(), keys.end(), draw);
+    int found = 0, result;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        found += table.find(keys[i], result, now);
+    report("find, repeated key", seconds(start));
+
+    int missed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        missed += !table.find(keys[i] + 1, result, now);
+    report("find, new key", seconds(start));
+
+    // a window later every key has aged out without a sweep
+    long long later = now + table.window() + table.window() / Dedupe_Table::TICKS;
+    int aged = 0;
+    for (int i = 0; i < count; i++)
+        aged += !table.find(keys[i], result, later);
+    std::cout << "Found " << found << ", missed " << missed << " new and " << aged << " aged-out of " << count << " keys in "
+              << table.memory() / (1 << 20) << " MiB (" << (double)table.memory() / count << " bytes per key, window "
+              << table.window() / 1000000 << " s).\n";
+    return found == count && missed == count && aged == count && table.size(later) == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Time interactive postings while statement jobs run alongside, without and with admission control
+ * @param count Number of interactive postings in each phase
+ * @param dir Scratch ledger the postings and statement jobs run against
+ * @param statementDir Existing directory that receives the statements
+ * @param target Interactive p99 target in microseconds for the last phase
+ * @return Exit status
+ */
+int benchScheduler(int count, const std::string& dir, const std::string& statementDir, long long target)
+{
+    BST_Tree T;
+    T.set_directory(dir);
+    T.load_Server();
+    std::vector<int> accounts;
+    T.index.scan(INT_MIN, INT_MAX, [&accounts](const Account_Record& rec) {
+        accounts.push_back(rec.account_number);
+        return true;
+    });
+    if (accounts.empty())
+    {
+        std::cout << "Error: --bench-dir must hold a ledger with accounts.\n";
+        return 1;
+    }
+    // statements for the current month, so the jobs read the recent history
+    std::string today = History_Index::format_time(Journal::now_us());
+    int month = std::atoi(today.substr(0, 4).c_str()) * 100 + std::atoi(today.substr(5, 2).c_str());
+
+    Op_Scheduler& scheduler = Op_Scheduler::bank();
+    unsigned queue = Op_Scheduler::DEFAULT_BATCH_QUEUE;
+    std::cout << std::left << std::setw(24) << "Phase" << std::right << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)"
+              << std::setw(10) << "Max(us)" << std::setw(8) << "Jobs" << std::setw(10) << "Chunks" << std::setw(10) << "Deferred" << "\n";
+    const char* phases[3] = { "alone", "batch, admission off", "batch, admission on" };
+    bool ok = true;
+    for (int phase = 0; phase < 3; phase++)
+    {
+        scheduler.configure(phase == 2 ? target : 0, queue);
+        unsigned long long chunks = Metrics::summary(Metrics::BATCH).count;
+        unsigned long long deferred = Metrics::total(Metrics::BATCH_DEFERRED);
+        std::atomic<bool> stop(false);
+        std::atomic<unsigned> jobs(0);
+        std::thread worker;
+        if (phase > 0)
+        {
+            worker = std::thread([&]() {
+                while (!stop)
+                {
+                    Statement_Batch::Report report;
+                    if (Statement_Batch::run(T, month, statementDir, (size_t)64 << 20, 1, report))
+                        jobs++;
+                }
+            });
+        }
+        // a deposit and then a withdrawal of 1, so the balances end where they started
+        std::mt19937 draw(48);
+        std::vector<long long> latencies;
+        for (int i = 0; i < count; i++)
+        {
+            int account = accounts[draw() % accounts.size()];
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                Op_Slot slot(Op_Scheduler::INTERACTIVE);
+                T.deposit(account, 1);
+                T.withdraw(account, 1);
+            }
+            latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+            // staff think between postings
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        stop = true;
+        if (worker.joinable())
+            worker.join();
+        ok = ok && (phase == 0 || jobs > 0);
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << std::left << std::setw(24) << phases[phase] << std::right
+                  << std::setw(10) << latencies[latencies.size() / 2]
+                  << std::setw(10) << latencies[(latencies.size() - 1) * 99 / 100]
+                  << std::setw(10) << latencies.back() << std::setw(8) << jobs
+                  << std::setw(10) << Metrics::summary(Metrics::BATCH).count - chunks
+                  << std::setw(10) << Metrics::total(Metrics::BATCH_DEFERRED) - deferred << "\n";
+    }
+    std::cout << "Interactive p99 target " << target << " us; " << accounts.size() << " accounts, "
+              << count << " postings per phase.\n";
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Time account lookups over per-node index partitions with and without huge pages and NUMA placement
+ * @param count Number of accounts, split into one range per partition
+ * @param dir Existing directory that receives the partition files
+ * @return Exit status
+ */
+int benchPlacement(int count, const std::string& dir)
+{
+    unsigned nodes = Placement::nodes();
+    unsigned partitions = nodes > 1 ? nodes : 2;
+    int per = count / (int)partitions;
+    if (per < 1)
+    {
+        std::cout << "Error: --bench-placement needs at least one account per partition.\n";
+        return 1;
+    }
+    // every page of a partition stays cached, so lookups only touch memory
+    unsigned frames = Buffer_Pool::default_frames;
+    Buffer_Pool::default_frames = (unsigned)(per / 8) + 256;
+    std::vector<std::string> paths;
+    for (unsigned p = 0; p < partitions; p++)
+    {
+        paths.push_back(dir + "/placement" + std::to_string(p) + ".idx");
+        std::remove(paths[p].c_str());
+        BPlus_Tree index;
+        if (!index.open(paths[p]))
+        {
+            std::cout << "Error: Could not create " << paths[p] << ".\n";
+            return 1;
+        }
+        Account_Record rec;
+        std::memset(&rec, 0, sizeof(rec));
+        for (int i = 0; i < per; i++)
+        {
+            rec.account_number = 100000 + (int)p * per + i;
+            rec.balance = i;
+            index.insert(rec);
+        }
+        index.close();
+    }
+
+    bool huge = Placement::huge_pages, numa = Placement::numa;
+    std::cout << std::left << std::setw(12) << "Placement" << std::setw(26) << "Backing" << std::right
+              << std::setw(14) << "Lookups/s" << std::setw(12) << "ns each" << std::setw(16) << "dTLB miss/op"
+              << std::setw(10) << "Remote" << "\n";
+    const char* modes[2] = { "default", "placed" };
+    bool ok = true;
+    for (int mode = 0; mode < 2; mode++)
+    {
+        Placement::huge_pages = mode == 1;
+        Placement::numa = mode == 1;
+        std::vector<BPlus_Tree*> indexes;
+        for (unsigned p = 0; p < partitions; p++)
+        {
+            BPlus_Tree* index = new BPlus_Tree();
+            index->pool.place(Placement::node_for(p, partitions));
+            ok = index->open(paths[p]) && ok;
+            // load every page from this thread, as opening a ledger does
+            index->scan(INT_MIN, INT_MAX, [](const Account_Record&) { return true; });
+            indexes.push_back(index);
+        }
+        std::vector<long long> misses(partitions, 0);
+        std::vector<int> home(partitions, 0);
+        std::vector<int> found(partitions, 0);
+        int lookups = per * 2;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (unsigned p = 0; p < partitions; p++)
+        {
+            workers.push_back(std::thread([&, p]() {
+                int node = Placement::node_for(p, partitions);
+                Placement::pin(node);
+                std::mt19937 draw(49 + p);
+                Tlb_Counter tlb;
+                bool counting = tlb.start();
+                Account_Record rec;
+                for (int i = 0; i < lookups; i++)
+                    found[p] += indexes[p]->find(100000 + (int)p * per + (int)(draw() % per), rec);
+                misses[p] = counting ? tlb.stop() : -1;
+                home[p] = node >= 0 ? node : Placement::current_node();
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        double seconds = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+
+        // the share of cached pages that sit on another node than their partition's worker
+        unsigned long long pages = 0, remote = 0;
+        long long missed = 0;
+        for (unsigned p = 0; p < partitions; p++)
+        {
+            for (unsigned id = 0; id < indexes[p]->pool.page_count; id++)
+            {
+                int node = Placement::node_of(indexes[p]->pool.pin(id));
+                indexes[p]->pool.unpin(id, false);
+                if (node < 0)
+                    continue;
+                pages++;
+                remote += node != home[p];
+            }
+            missed = (missed < 0 || misses[p] < 0) ? -1 : missed + misses[p];
+            ok = ok && found[p] == lookups;
+        }
+        long long total = (long long)lookups * partitions;
+        std::cout << std::left << std::setw(12) << modes[mode] << std::setw(26) << Placement::describe(indexes[0]->pool.backing)
+                  << std::right << std::setw(14) << (long long)(total / seconds) << std::setw(12) << std::fixed << std::setprecision(1)
+                  << seconds * 1e9 / total << std::setw(16);
+        if (missed >= 0)
+            std::cout << std::setprecision(3) << (double)missed / total;
+        else
+            std::cout << "n/a";
+        std::cout << std::setw(9) << std::setprecision(1) << (pages ? 100.0 * remote / pages : 0.0) << "%\n";
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(6);
+        for (unsigned p = 0; p < partitions; p++)
+            delete indexes[p];
+    }
+    for (unsigned p = 0; p < partitions; p++)
+        std::remove(paths[p].c_str());
+    Placement::huge_pages = huge;
+    Placement::numa = numa;
+    Buffer_Pool::default_frames = frames;
+    std::cout << count << " accounts in " << partitions << " partitions over " << nodes << " NUMA node(s).\n";
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Time prefix searches over a customer name index of many generated names
+ * @param count Number of customers to index
+ * @return Exit status
+ */
+int benchPrefix(int count)
+{
+    const char* syllables[] = { "an", "bel", "cor", "da", "el", "fin", "gar", "hal", "is", "jo", "ka", "lin",
+                                "mar", "nor", "o", "pet", "qui", "ros", "sa", "tor", "ul", "ven", "wil", "xa",
+                                "yor", "zel", "ber", "chri", "dan", "ed", "fre", "gil", "han", "ing", "jen", "kel" };
+    const unsigned SYLLABLES = sizeof(syllables) / sizeof(syllables[0]);
+    std::mt19937 draw(50);
+    auto name = [&]() {
+        std::string first = syllables[draw() % SYLLABLES];
+        first += syllables[draw() % SYLLABLES];
+        std::string last = syllables[draw() % SYLLABLES];
+        last += syllables[draw() % SYLLABLES];
+        last += syllables[draw() % SYLLABLES];
+        first[0] = (char)std::toupper(first[0]);
+        last[0] = (char)std::toupper(last[0]);
+        return first + " " + last;
+    };
+    std::vector<std::string> names;
+    names.reserve(count);
+    for (int i = 0; i < count; i++)
+        names.push_back(name());
+    auto seconds = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::steady_clock::now() - start).count();
+    };
+
+    Prefix_Index index;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++)
+        index.add(names[i], 100000 + i);
+    double built = seconds(start);
+    std::cout << "Indexed " << count << " names (" << index.size() << " keys) in " << built << " s, "
+              << (double)index.memory() / count << " bytes per customer.\n";
+
+    // first pages and second pages for prefixes of growing length
+    std::cout << std::left << std::setw(22) << "Query" << std::right << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)"
+              << std::setw(12) << "Results" << "\n";
+    const int QUERIES = 2000;
+    bool ok = true;
+    for (int length = 1; length <= 7; length += 2)
+    {
+        for (int page = 0; page < 2; page++)
+        {
+            std::vector<double> times;
+            size_t results = 0;
+            for (int q = 0; q < QUERIES; q++)
+            {
+                const std::string& target = names[draw() % names.size()];
+                std::string prefix = target.substr(0, std::min((size_t)length, target.size()));
+                Prefix_Index::Cursor cursor;
+                std::vector<int> accounts;
+                if (page == 1)
+                    index.find(prefix, 20, accounts, cursor);
+                start = std::chrono::steady_clock::now();
+                index.find(prefix, 20, accounts, cursor);
+                times.push_back(seconds(start) * 1e6);
+                results += accounts.size();
+                ok = ok && (page == 1 || !accounts.empty());
+            }
+            std::sort(times.begin(), times.end());
+            std::string label = "prefix of " + std::to_string(length) + (page ? ", page 2" : ", page 1");
+            std::cout << std::left << std::setw(22) << label << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << times[times.size() / 2] << std::setw(10) << times[times.size() * 99 / 100]
+                      << std::setw(12) << std::setprecision(1) << (double)results / QUERIES << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+        }
+    }
+
+    // renames move a customer's keys: out under the old name, in under the new
+    int renames = count < 100000 ? count : 100000;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < renames; i++)
+    {
+        std::string renamed = name();
+        index.remove(names[i], 100000 + i);
+        index.add(renamed, 100000 + i);
+        names[i] = renamed;
+    }
+    std::cout << "Renamed " << renames << " customers in " << seconds(start) * 1e6 / renames << " us each.\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+/**
+ * @file bench.h
+ * @brief Benchmarks run from the command line
+ *
+ * The --bench options in main.cpp dispatch to these; each returns the exit
+ * status of the run. See bench.cpp for what each one times.
+ */
+
+#pragma once
+#include <string>
+
+int benchRecords(int count);
+int benchLogins(int count, const std::string& dir);
+int benchDedupe(int count);
+int benchScheduler(int count, const std::string& dir, const std::string& statementDir, long long target);
+int benchPlacement(int count, const std::string& dir);
+int benchPrefix(int count);
@@ -3,12 +3,16 @@
  * @brief Customer functionality for the Bank Management System
  * 
  * This file contains the customer interface and functionality for the Bank Management System.
- * Customers can view their account details and transaction history.
+ * Customers sign in once per session and can view their account details and transaction history.
  */
 
 #pragma once
 #include "BST_Tree.h"
 #include "Hashtable.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "History_Index.h"
+#include "Session_Table.h"
 #include <iostream>
 #include <string>
 #include <limits>
@@ -42,20 +46,30 @@ void displayCustomerMenu()
     std::cout << "Please select an option:\n\n";
     std::cout << "1. View Account Details\n";
     std::cout << "2. View Transaction History\n";
-    std::cout << "3. Return to Main Menu\n\n";
-    std::cout << "Enter your choice (1-3): ";
+    std::cout << "3. Sign Out\n";
+    std::cout << "4. Return to Main Menu\n\n";
+    std::cout << "Enter your choice (1-4): ";
 }
 
 /**
- * @brief View account details for a customer
- * @param t BST_Tree object to search for the account
+ * @brief Get the account of the customer's session, signing in first if there is none
  * @param h Hashtable object to verify the password
+ * @param session Session handle, 0 when signed out; replaced on sign-in
+ * @param accountNumber Receives the account number
+ * @return True when the customer is signed in
  */
-void viewAccountDetails(BST_Tree& t, Hashtable& h)
+bool customerSession(Hashtable& h, unsigned long long& session, int& accountNumber)
 {
-    int accountNumber, password;
+    Session_Table& sessions = Session_Table::bank();
+    // a live session skips the password and the credential lookup
+    if (session != 0 && sessions.validate(session, accountNumber))
+        return true;
+    if (session != 0)
+        std::cout << "\nYour session has expired. Please sign in again.\n";
+    session = 0;
+    int password;
     
-    std::cout << "\n--- View Account Details ---\n\n";
+    std::cout << "\n--- Sign In ---\n\n";
     
     std::cout << "Enter Account Number: ";
     while (!(std::cin >> accountNumber)) {
@@ -72,11 +86,30 @@ void viewAccountDetails(BST_Tree& t, Hashtable& h)
     // Verify account and password
     if (!h.match(accountNumber, password)) {
         std::cout << "\nError: Invalid account number or password!\n";
-        return;
+        return false;
     }
+    session = sessions.open(accountNumber);
+    std::cout << "\nSigned in. The session ends after " << sessions.ttl() / 60000000
+              << " minutes without activity.\n";
+    return true;
+}
+
+/**
+ * @brief View account details for a customer
+ * @param t BST_Tree object to search for the account
+ * @param h Hashtable object to verify the password
+ * @param session Session handle of the customer
+ */
+void viewAccountDetails(BST_Tree& t, Hashtable& h, unsigned long long& session)
+{
+    int accountNumber;
+    
+    std::cout << "\n--- View Account Details ---\n";
+    
+    if (!customerSession(h, session, accountNumber))
+        return;
     
     // Get account details
-    t.load_Server();
     BST_Node* account = t.search(t.Root, accountNumber);
     
     if (account == nullptr) {
@@ -93,69 +126,73 @@ void viewAccountDetails(BST_Tree& t, Hashtable& h)
 }
 
 /**
- * @brief View transaction history for a customer
- * @param t BST_Tree object to search for the account
- * @param h Hashtable object to verify the password
+ * @brief Read an optional date range for a history query
+ * @param from Receives the first microsecond of the range
+ * @param to Receives the last microsecond of the range
  */
-void viewCustomerTransactionHistory(BST_Tree& t, Hashtable& h)
+void readCustomerDateRange(long long& from, long long& to)
 {
-    int accountNumber, password;
-    
-    std::cout << "\n--- Transaction History ---\n\n";
-    
-    std::cout << "Enter Account Number: ";
-    while (!(std::cin >> accountNumber)) {
-        std::cout << "Invalid input. Please enter a number: ";
+    int date;
+    from = 0;
+    to = std::numeric_limits<long long>::max();
+    std::cout << "Enter start date (YYYYMMDD, 0 for all): ";
+    while (!(std::cin >> date) || (date != 0 && History_Index::date_start(date) < 0)) {
+        std::cout << "Invalid date. Please enter YYYYMMDD or 0: ";
         clearCustomerInputBuffer();
     }
-    
-    std::cout << "Enter Password: ";
-    while (!(std::cin >> password)) {
-        std::cout << "Invalid input. Please enter a number: ";
+    if (date != 0)
+        from = History_Index::date_start(date);
+    std::cout << "Enter end date (YYYYMMDD, 0 for all): ";
+    while (!(std::cin >> date) || (date != 0 && History_Index::date_start(date) < 0)) {
+        std::cout << "Invalid date. Please enter YYYYMMDD or 0: ";
         clearCustomerInputBuffer();
     }
+    if (date != 0)
+        to = History_Index::date_start(date) + History_Index::DAY_US - 1;
+}
+
+/**
+ * @brief View transaction history for a customer
+ * @param t BST_Tree object to search for the account
+ * @param h Hashtable object to verify the password
+ * @param session Session handle of the customer
+ */
+void viewCustomerTransactionHistory(BST_Tree& t, Hashtable& h, unsigned long long& session)
+{
+    int accountNumber;
+    long long from, to;
     
-    // Verify account and password
-    if (!h.match(accountNumber, password)) {
-        std::cout << "\nError: Invalid account number or password!\n";
+    std::cout << "\n--- Transaction History ---\n";
+    
+    if (!customerSession(h, session, accountNumber))
         return;
-    }
     
     // Get account details
-    t.load_Server();
     BST_Node* account = t.search(t.Root, accountNumber);
     
     if (account == nullptr) {
         std::cout << "\nError: Account not found!\n";
         return;
     }
+    readCustomerDateRange(from, to);
     
     // Display transaction history
     std::cout << "\nTransaction History for Account " << accountNumber << ":\n\n";
     
-    std::ifstream read("transaction.txt");
-    if (!read) {
-        std::cout << "Error: Could not open transaction file.\n";
-        return;
-    }
-    
+    Metrics_Timer timer(Metrics::HISTORY_SCAN);
+    Trace_Span span("history_scan");
+    // sealed entries come from the archive, recent ones through the daily index
     bool found = false;
-    int acc, amount;
-    
-    while (read >> acc) {
-        read >> amount;
-        
-        if (acc == accountNumber) {
-            found = true;
-            if (amount > 0) {
-                std::cout << "Deposit: +" << amount << "\n";
-            } else {
-                std::cout << "Withdrawal: " << amount << "\n";
-            }
+    t.history(accountNumber, from, to, [&](const History_Entry& entry) {
+        found = true;
+        if (entry.time != 0)
+            std::cout << History_Index::format_time(entry.time) << "  ";
+        if (entry.amount > 0) {
+            std::cout << "Deposit: +" << entry.amount << "\n";
+        } else {
+            std::cout << "Withdrawal: " << entry.amount << "\n";
         }
-    }
-    
-    read.close();
+    });
     
     if (!found) {
         std::cout << "No transactions found for this account.\n";
@@ -169,9 +206,11 @@ void customer()
 {
     BST_Tree t;
     Hashtable h;
+    unsigned long long session = 0;
     int choice = 0;
     
-    while (choice != 3)
+    h.starthash();
+    while (choice != 4)
     {
         displayCustomerHeader();
         displayCustomerMenu();
@@ -179,7 +218,7 @@ void customer()
         // Get user choice
         if (!(std::cin >> choice))
         {
-            std::cout << "\nInvalid input. Please enter a number between 1 and 3.\n";
+            std::cout << "\nInvalid input. Please enter a number between 1 and 4.\n";
             clearCustomerInputBuffer();
             continue;
         }
@@ -188,21 +227,27 @@ void customer()
         switch (choice)
         {
             case 1:
-                viewAccountDetails(t, h);
+                viewAccountDetails(t, h, session);
                 break;
             case 2:
-                viewCustomerTransactionHistory(t, h);
+                viewCustomerTransactionHistory(t, h, session);
                 break;
             case 3:
+                Session_Table::bank().close(session);
+                session = 0;
+                std::cout << "\nSigned out.\n";
+                break;
+            case 4:
+                Session_Table::bank().close(session);
                 std::cout << "\nReturning to main menu...\n";
                 break;
             default:
-                std::cout << "\nInvalid choice. Please enter a number between 1 and 3.\n";
+                std::cout << "\nInvalid choice. Please enter a number between 1 and 4.\n";
                 break;
         }
         
         // Pause before showing the menu again (except when exiting)
-        if (choice != 3)
+        if (choice != 4)
         {
             std::cout << "\nPress Enter to continue...";
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -0,0 +1,207 @@
+/**
+ * @file kiosk.h
+ * @brief Shared-memory kiosk interface for the Bank Management System
+ *
+ * This file contains the menu of a kiosk process. A kiosk maps the account
+ * table that an owner process publishes with --publish and reads balances
+ * from it directly. Deposits, withdrawals and transfers are handed to the
+ * owner, which is the only process that writes the ledger.
+ */
+
+#pragma once
+#include "Shared_Table.h"
+#include "Metrics.h"
+#include <iostream>
+#include <string>
+#include <limits>
+#include <random>
+
+/**
+ * @brief Clear the input buffer and handle invalid input
+ */
+void clearKioskInputBuffer()
+{
+    std::cin.clear();
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+}
+
+/**
+ * @brief Read a number from the user
+ * @param prompt Text shown before the input
+ * @return The number entered
+ */
+int readKioskNumber(const char* prompt)
+{
+    int value;
+    std::cout << prompt;
+    while (!(std::cin >> value)) {
+        std::cout << "Invalid input. Please enter a number: ";
+        clearKioskInputBuffer();
+    }
+    return value;
+}
+
+/**
+ * @brief Display the kiosk menu
+ * @param accountNumber Account that is signed in
+ */
+void displayKioskMenu(int accountNumber)
+{
+    std::cout << "\n";
+    std::cout << "===================================\n";
+    std::cout << "           ACCOUNT KIOSK           \n";
+    std::cout << "===================================\n\n";
+    std::cout << "Signed in to account " << accountNumber << "\n\n";
+    std::cout << "Please select an option:\n\n";
+    std::cout << "1. View Balance\n";
+    std::cout << "2. Deposit Money\n";
+    std::cout << "3. Withdraw Money\n";
+    std::cout << "4. Transfer Money\n";
+    std::cout << "5. Exit\n\n";
+    std::cout << "Enter your choice (1-5): ";
+}
+
+/**
+ * @brief Report the outcome of a write handed to the owner
+ * @param result Result from Shared_Table::submit
+ * @param balance Balance after the request
+ */
+void reportKioskResult(int result, int balance)
+{
+    if (result < 0)
+        std::cout << "\nError: The ledger owner is not responding. Please try again later.\n";
+    else if (result == 0)
+        std::cout << "\nError: The request was refused. Check the amount and the accounts.\n";
+    else
+        std::cout << "\nDone. New balance: " << balance << "\n";
+}
+
+/**
+ * @brief Hand a posting to the owner, offering to retry it if the owner does not answer
+ *
+ * Every attempt of one posting carries the same idempotency key, so a retry
+ * of a posting the owner did make before it stopped answering is not made
+ * again; the owner answers it with the first attempt's balance.
+ *
+ * @param table Attached account table
+ * @param op Deposit, withdrawal or transfer
+ * @param accountNumber Account that is signed in
+ * @param password Its password
+ * @param counterparty Receiver of a transfer
+ * @param amount Amount of the posting
+ * @param balance Balance after the posting
+ * @return Result from Shared_Table::submit
+ */
+int submitKioskPosting(Shared_Table& table, Shared_Request::Operation op, int accountNumber, int password,
+                       int counterparty, int amount, int& balance)
+{
+    static std::mt19937_64 keys(((unsigned long long)std::random_device()() << 32) ^ std::random_device()());
+    unsigned long long key = 0;
+    while (key == 0)
+        key = keys();
+    int result = table.submit(op, accountNumber, password, counterparty, amount, balance, key);
+    while (result < 0)
+    {
+        char retry;
+        std::cout << "\nThe ledger owner did not answer. Try again? (y/n): ";
+        if (!(std::cin >> retry) || (retry != 'y' && retry != 'Y'))
+            break;
+        result = table.submit(op, accountNumber, password, counterparty, amount, balance, key);
+    }
+    return result;
+}
+
+/**
+ * @brief Kiosk interface function
+ * @param name Name of the shared-memory table
+ * @return Exit status
+ */
+int kiosk(const std::string& name)
+{
+    Shared_Table table;
+    if (!table.attach(name)) {
+        std::cout << "Error: No account table is published as " << name << ".\n";
+        return 1;
+    }
+
+    std::cout << "\n--- Kiosk Sign In ---\n\n";
+    int accountNumber = readKioskNumber("Enter Account Number: ");
+    int password = readKioskNumber("Enter Password: ");
+    int balance = 0;
+    int result = table.submit(Shared_Request::LOGIN, accountNumber, password, 0, 0, balance);
+    if (result != 1) {
+        if (result < 0)
+            std::cout << "\nError: The ledger owner is not responding.\n";
+        else
+            std::cout << "\nError: Invalid account number or password!\n";
+        return 1;
+    }
+
+    int choice = 0;
+    while (choice != 5)
+    {
+        displayKioskMenu(accountNumber);
+        if (!(std::cin >> choice))
+        {
+            if (std::cin.eof())
+                break;
+            std::cout << "\nInvalid input. Please enter a number between 1 and 5.\n";
+            clearKioskInputBuffer();
+            continue;
+        }
+
+        switch (choice)
+        {
+            case 1:
+            {
+                // read straight from the shared table, no request to the owner
+                Metrics_Timer timer(Metrics::SEARCH);
+                Shared_Account account;
+                if (table.find(accountNumber, account)) {
+                    std::cout << "\nName: " << account.name << "\n";
+                    std::cout << "Balance: " << account.balance << "\n";
+                } else {
+                    std::cout << "\nError: Account not found!\n";
+                }
+                break;
+            }
+            case 2:
+            {
+                int amount = readKioskNumber("\nEnter amount to deposit: ");
+                result = submitKioskPosting(table, Shared_Request::DEPOSIT, accountNumber, password, 0, amount, balance);
+                reportKioskResult(result, balance);
+                break;
+            }
+            case 3:
+            {
+                int amount = readKioskNumber("\nEnter amount to withdraw: ");
+                result = submitKioskPosting(table, Shared_Request::WITHDRAW, accountNumber, password, 0, amount, balance);
+                reportKioskResult(result, balance);
+                break;
+            }
+            case 4:
+            {
+                int receiver = readKioskNumber("\nEnter receiver's account number: ");
+                int amount = readKioskNumber("Enter amount to transfer: ");
+                result = submitKioskPosting(table, Shared_Request::TRANSFER, accountNumber, password, receiver, amount, balance);
+                reportKioskResult(result, balance);
+                break;
+            }
+            case 5:
+                std::cout << "\nGoodbye!\n";
+                break;
+            default:
+                std::cout << "\nInvalid choice. Please enter a number between 1 and 5.\n";
+                break;
+        }
+
+        // Pause before showing the menu again (except when exiting)
+        if (choice != 5)
+        {
+            std::cout << "\nPress Enter to continue...";
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cin.get();
+        }
+    }
+    return 0;
+}
@@ -12,9 +12,29 @@
 #include "admin.h"
 #include "staff.h"
 #include "customer.h"
+#include "standby.h"
+#include "kiosk.h"
+#include "Tracer.h"
+#include "Workload.h"
+#include "Change_Feed.h"
+#include "Velocity_Guard.h"
+#include "History_Archive.h"
+#include "Statement_Batch.h"
+#include "Backup.h"
+#include "History_Chain.h"
+#include "Op_Scheduler.h"
+#include "Placement.h"
+#include "Ledger_Lock.h"
+#include "bench.h"
 #include <iostream>
 #include <string>
 #include <limits>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <iomanip>
+#include <vector>
 
 /**
  * @brief Initialize the system by loading data from files
@@ -27,6 +47,728 @@ void initializeSystem()
     T.load_Server();
 }
 
+/**
+ * @brief Set the velocity rules of the bank from a command line value
+ * @param value "off", or the debit count and outflow limits with an optional window in seconds
+ * @return Whether the value was understood
+ */
+bool configureVelocity(const std::string& value)
+{
+    Velocity_Rules rules = Velocity_Guard::bank().rules;
+    if (value == "off") {
+        rules.max_debits = 0;
+        rules.max_outflow = 0;
+    } else {
+        unsigned debits = 0;
+        long long outflow = 0;
+        unsigned seconds = rules.window_seconds;
+        char colon = 0;
+        std::istringstream read(value);
+        if (!(read >> debits >> colon >> outflow) || colon != ':')
+            return false;
+        if (read >> colon && (colon != ':' || !(read >> seconds) || seconds == 0))
+            return false;
+        rules.max_debits = debits;
+        rules.max_outflow = outflow;
+        rules.window_seconds = seconds;
+    }
+    Velocity_Guard::bank().configure(rules);
+    return true;
+}
+
+/**
+ * @brief Print the balance changes committed to a ledger
+ *
+ * Follows the shard journals of a sharded ledger, or the transaction.txt of
+ * the ledger the menus and kiosks post to. Resumes at the position saved in
+ * the cursor file and saves the new position after every batch it prints.
+ *
+ * @param directory Ledger directory
+ * @param cursorPath Cursor file
+ * @param follow Whether to keep waiting for new changes
+ * @return Exit status
+ */
+int tailJournal(const std::string& directory, const std::string& cursorPath, bool follow)
+{
+    Journal_Tailer journals;
+    History_Tailer history;
+    std::vector<int> splits;
+    bool sharded = Sharded_Ledger::read_splits(directory, splits);
+    if (sharded ? !journals.open(directory, cursorPath) : !history.open(directory, cursorPath)) {
+        std::cout << "Error: No ledger in " << directory << " or a bad cursor in " << cursorPath << ".\n";
+        return 1;
+    }
+    auto print = [](const Change_Event& event) {
+        std::cout << event.shard << " " << event.seq << " " << event.time << " "
+                  << event.account << " " << event.delta << " " << event.balance << "\n";
+    };
+    for (;;) {
+        unsigned records = sharded ? journals.poll(print) : history.poll(print);
+        if (records > 0) {
+            std::cout.flush();
+            if (!(sharded ? journals.commit() : history.commit())) {
+                std::cout << "Error: Could not save the cursor to " << cursorPath << ".\n";
+                return 1;
+            }
+            continue;
+        }
+        if (!follow)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+/**
+ * @brief Move all but the newest entries of transaction.txt into the history archive
+ * @param keep Number of entries that stay in transaction.txt
+ * @return Exit status
+ */
+int sealHistory(unsigned long long keep)
+{
+    Ledger_Lock lock;
+    if (!lock.acquire("")) {
+        std::cout << "Error: Another process is posting to this ledger. Seal the history when it has stopped.\n";
+        return 1;
+    }
+    History_Archive::Seal_Report report;
+    if (!History_Archive::seal("transaction.txt", "history.arc", keep, report)) {
+        std::cout << "Error: Could not seal the transaction history.\n";
+        return 1;
+    }
+    if (report.entries == 0) {
+        std::cout << "Nothing to seal.\n";
+        return 0;
+    }
+    std::cout << "Sealed " << report.entries << " entries into " << report.segments << " segment(s): "
+              << report.text_bytes << " bytes of text became " << report.archive_bytes << " bytes";
+    if (report.archive_bytes > 0)
+        std::cout << " (" << (double)report.text_bytes / report.archive_bytes << "x smaller)";
+    std::cout << ".\n";
+    return 0;
+}
+
+/**
+ * @brief Write one statement file per account for a month
+ * @param month Month as YYYYMM
+ * @param dir Existing directory that receives the statements
+ * @param memoryMiB Memory for sorting postings before they spill to disk
+ * @return Exit status
+ */
+int generateStatements(int month, const std::string& dir, int memoryMiB)
+{
+    BST_Tree T;
+    Statement_Batch::Report report;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (!Statement_Batch::run(T, month, dir, (size_t)memoryMiB << 20, threads ? threads : 1, report)) {
+        std::cout << "Error: Could not write the statements for " << month << ".\n";
+        return 1;
+    }
+    std::cout << "Wrote " << report.statements << " statements with " << report.postings << " postings to "
+              << dir << " in " << report.seconds << " s";
+    if (report.runs > 0)
+        std::cout << " (" << report.runs << " sorted runs, " << report.spilled_bytes << " bytes spilled)";
+    std::cout << ".\n";
+    return 0;
+}
+
+/**
+ * @brief Print the balance of every account at the end of a date
+ * @param date Date as YYYYMMDD
+ * @return Exit status
+ */
+int printBalancesAt(int date)
+{
+    BST_Tree T;
+    unsigned threads = std::thread::hardware_concurrency();
+    T.balances_at(History_Index::date_start(date) + History_Index::DAY_US - 1, threads ? threads : 1, [](int account, int balance) {
+        std::cout << account << " " << balance << "\n";
+    });
+    return 0;
+}
+
+/**
+ * @brief Back up the ledger in the current directory
+ * @param path Backup file to write
+ * @return Exit status
+ */
+int backupLedger(const std::string& path)
+{
+    BST_Tree T;
+    Backup backup;
+    Backup::Report report;
+    if (!backup.start(T, path) || !backup.finish(report)) {
+        std::cout << "Error: Could not write the backup " << path << ".\n";
+        return 1;
+    }
+    std::cout << "Backed up " << report.pages << " index pages and the history up to posting " << report.seq
+              << " into " << path << " (" << report.bytes << " bytes in " << report.seconds << " s).\n";
+    return 0;
+}
+
+/**
+ * @brief Restore a backup into a directory and verify the restored ledger
+ * @param path Backup file to read
+ * @param dir Existing directory without a ledger
+ * @return Exit status
+ */
+int restoreLedger(const std::string& path, const std::string& dir)
+{
+    Backup::Report report;
+    if (!Backup::restore(path, dir, History_Chain::key_file, report)) {
+        std::cout << "Error: Could not restore " << path << " into " << dir
+                  << ". The backup is damaged, or the directory already holds a ledger";
+        if (report.segments > 0)
+            std::cout << ", or its history chain does not verify with the key given by --chain-key, which must be kept outside "
+                      << dir;
+        std::cout << ".\n";
+        return 1;
+    }
+    std::cout << "Restored the ledger up to posting " << report.seq << " into " << dir;
+    if (report.segments > 0)
+        std::cout << ", with " << report.segments << " signed history segment(s) verified";
+    std::cout << ".\n";
+    Backup::Verify_Report verify;
+    bool ok = Backup::verify(dir, verify);
+    std::cout << "Verified " << verify.accounts << " accounts: " << verify.checked << " balances checked against the history, "
+              << verify.mismatched << " mismatched, " << verify.without_credentials << " without credentials"
+              << (verify.ordered ? "" : ", index out of order") << ".\n";
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Check that a signing key was given and is kept away from the history it signs
+ * @param chain Path of the chain the key signs
+ * @return True when the key can be used
+ */
+bool chainKeyUsable(const std::string& chain)
+{
+    if (History_Chain::key_file.empty()) {
+        std::cout << "Error: The history chain needs its signing key; pass it with --chain-key <file>.\n";
+        return false;
+    }
+    if (!History_Chain::key_outside(History_Chain::key_file, chain)) {
+        std::cout << "Error: The key " << History_Chain::key_file
+                  << " must be kept outside the ledger directory, where the history's writers cannot read it.\n";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Check the hash chain over the transaction history in the current directory
+ * @return Exit status
+ */
+int verifyChain()
+{
+    if (!chainKeyUsable("history.chain"))
+        return 1;
+    unsigned threads = std::thread::hardware_concurrency();
+    std::string key = History_Chain::key_file;
+    History_Chain::Verify_Report report;
+    bool ok = History_Chain::verify("history.chain", key, "transaction.txt", "history.arc", threads ? threads : 1, report);
+    std::cout << "Checked " << report.segments << " segments over " << report.entries << " postings in " << report.seconds << " s: "
+              << (report.links ? "chain and signatures intact" : "chain or signatures broken") << ", "
+              << report.bad_segments << " segment(s) altered, " << report.strays << " posting(s) outside every segment, "
+              << report.older << " older posting(s) from before the chain, " << report.unchained << " newer posting(s) not yet chained.\n";
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Print the proof that one posting belongs to the signed history
+ * @param seq Sequence number of the posting
+ * @return Exit status
+ */
+int provePosting(unsigned long long seq)
+{
+    if (!chainKeyUsable("history.chain"))
+        return 1;
+    History_Chain::Proof proof;
+    if (!History_Chain::prove("history.chain", "transaction.txt", "history.arc", seq, proof)) {
+        std::cout << "Error: Posting " << seq << " is not in a complete chained segment.\n";
+        return 1;
+    }
+    auto hex = [](const unsigned char* bytes) {
+        std::ostringstream text;
+        for (unsigned i = 0; i < Sha256::SIZE; i++)
+            text << std::hex << std::setw(2) << std::setfill('0') << (int)bytes[i];
+        return text.str();
+    };
+    std::cout << "posting " << proof.entry.seq << " time " << proof.entry.time << " account " << proof.entry.account
+              << " amount " << proof.entry.amount << " balance " << proof.entry.balance << "\n";
+    std::cout << "segment " << proof.record.first_seq << "-" << proof.record.last_seq << ", leaf " << proof.position
+              << " of " << proof.record.count << "\n";
+    for (size_t i = 0; i < proof.right.size(); i++)
+        std::cout << (proof.right[i] ? "right " : "left  ") << hex(&proof.path[i * Sha256::SIZE]) << "\n";
+    std::cout << "root      " << hex(proof.record.root) << "\n";
+    std::cout << "previous  " << hex(proof.previous) << "\n";
+    std::cout << "chain     " << hex(proof.record.chain) << "\n";
+    std::cout << "signature " << hex(proof.record.signature) << "\n";
+    bool ok = History_Chain::check(proof, History_Chain::key_file);
+    std::cout << (ok ? "Proof checks out against the signing key.\n" : "Proof does not check out.\n");
+    return ok ? 0 : 1;
+}
+
+/**
+ * @brief Parse command line options
+ * @param argc Argument count
+ * @param argv Argument values
+ * 
+ * --trace <file>          record spans and write them as Chrome trace JSON on exit
+ * --trace-sample <rate>   fraction of operations to record (default 1.0)
+ * --record <file>         record every engine request into a workload trace
+ * --replay <file>         replay a workload trace and exit
+ * --replay-dir <dir>      empty directory that receives the replayed ledger (default .)
+ * --replay-paced          replay at the recorded pacing instead of maximum speed
+ * --replay-shards <n>     replay into an experimental ledger split into n shards
+ * --replay-batch <n>      net the postings of every n requests before writing them out
+ * --replay-backup <file>  take an online backup halfway through a single-tree replay
+ * --replay-retries <f>    send a fraction f of a single-tree replay's postings twice under the same key
+ * --replay-no-escrow      do not split hot accounts into escrow slots during a sharded replay
+ * --replay-feed           check the change feed from a subscriber while replaying
+ * --serve <address>       after a sharded replay, stream its journal to standbys
+ * --standby <dir>         run a read-only standby that keeps a replica in dir
+ * --primary <address>     journal stream the standby follows
+ * --publish <name>        own the ledger and publish its accounts in shared memory
+ * --kiosk <name>          run a kiosk on an account table published elsewhere
+ * --tail <dir>            print the balance changes committed to the ledger in dir
+ * --cursor <file>         where --tail keeps its position (default <dir>/tail.cursor)
+ * --follow                keep waiting for new changes instead of exiting
+ * --velocity <rules>      debit limits per account, as debits:outflow[:seconds], or off
+ * --seal-history <n>      move all but the newest n history entries into history.arc and exit
+ * --statements <YYYYMM>   write a statement per account for that month and exit
+ * --statements-dir <dir>  existing directory that receives the statements (default .)
+ * --statements-memory <n> MiB for sorting postings before they spill to disk (default 256)
+ * --balances-at <date>    print every account's balance at the end of a YYYYMMDD date and exit
+ * --backup <file>         back up the ledger into file and exit
+ * --restore <file>        restore a backup, verify it and exit
+ * --restore-dir <dir>     existing empty directory that receives the restored ledger (default .)
+ * --verify-chain          check the hash chain over the transaction history and exit
+ * --prove <seq>           print and check the proof that posting seq is in the signed history, then exit
+ * --chain-key <file>      key that signs the history chain, kept outside the ledger directory
+ * --bench-records <n>     time the account record codecs on n records against iostreams and exit
+ * --kdf-cost <n>          hash new passwords with 2^n scrypt iterations (default 14)
+ * --bench-logins <n>      time n credential checks with and without the verification cache and exit
+ * --bench-dir <dir>       existing directory without credentials for --bench-logins (default .)
+ * --dedupe-window <s>     seconds a posting's idempotency key is remembered (default 86400)
+ * --bench-dedupe <n>      time idempotency key checks against a table of n keys and exit
+ * --sched-target <us>     interactive p99 over which batch work is deferred or shed, 0 for off (default 20000)
+ * --batch-queue <n>       batch operations that may wait while interactive work is over target (default 4)
+ * --huge-pages            back the index pools and the account and credential nodes with 2 MiB pages
+ * --numa                  bind each shard's pool to a NUMA node and pin its applier there
+ * --pool-frames <n>       4 KiB frames in each index buffer pool (default 64)
+ * --bench-placement <n>   time lookups over n accounts in per-node partitions with and without placement and exit
+ * --bench-prefix <n>      time name prefix searches over n generated customers and exit
+ * --bench-scheduler <n>   time n interactive postings against the --bench-dir ledger with statement jobs alongside and exit
+ * 
+ * @return Exit status when the program should not start the menus, otherwise -1
+ */
+int parseOptions(int argc, char* argv[])
+{
+    std::string tracePath;
+    double sampleRate = 1.0;
+    std::string recordPath;
+    std::string replayPath;
+    std::string replayDir;
+    bool replayPaced = false;
+    bool replayEscrow = true;
+    bool replayFeed = false;
+    int replayShards = 0;
+    int replayBatch = 0;
+    std::string serveAddress;
+    std::string standbyDir;
+    std::string primaryAddress;
+    std::string publishName;
+    std::string kioskName;
+    std::string tailDir;
+    std::string cursorPath;
+    bool follow = false;
+    std::string velocity;
+    long long sealKeep = -1;
+    int statementMonth = 0;
+    std::string statementDir = ".";
+    int statementMemory = 256;
+    int balancesDate = 0;
+    std::string replayBackup;
+    double replayRetries = 0;
+    std::string backupPath;
+    std::string restorePath;
+    std::string restoreDir = ".";
+    bool verifyHistory = false;
+    unsigned long long proveSeq = 0;
+    int benchCount = 0;
+    int benchLoginCount = 0;
+    int kdfCost = 0;
+    long long dedupeWindow = 0;
+    int dedupeCount = 0;
+    long long schedTarget = Op_Scheduler::DEFAULT_TARGET_US;
+    int batchQueue = Op_Scheduler::DEFAULT_BATCH_QUEUE;
+    int schedulerCount = 0;
+    int poolFrames = 0;
+    int placementCount = 0;
+    int prefixCount = 0;
+    std::string benchDir = ".";
+    
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--replay-paced")
+        {
+            replayPaced = true;
+        }
+        else if (option == "--replay-no-escrow")
+        {
+            replayEscrow = false;
+        }
+        else if (option == "--replay-feed")
+        {
+            replayFeed = true;
+        }
+        else if (option == "--follow")
+        {
+            follow = true;
+        }
+        else if (option == "--verify-chain")
+        {
+            verifyHistory = true;
+        }
+        else if (option == "--trace" && hasValue)
+        {
+            tracePath = argv[++i];
+        }
+        else if (option == "--trace-sample" && hasValue)
+        {
+            sampleRate = std::atof(argv[++i]);
+        }
+        else if (option == "--record" && hasValue)
+        {
+            recordPath = argv[++i];
+        }
+        else if (option == "--replay" && hasValue)
+        {
+            replayPath = argv[++i];
+        }
+        else if (option == "--replay-dir" && hasValue)
+        {
+            replayDir = argv[++i];
+        }
+        else if (option == "--replay-shards" && hasValue)
+        {
+            replayShards = std::atoi(argv[++i]);
+        }
+        else if (option == "--replay-batch" && hasValue)
+        {
+            replayBatch = std::atoi(argv[++i]);
+        }
+        else if (option == "--serve" && hasValue)
+        {
+            serveAddress = argv[++i];
+        }
+        else if (option == "--standby" && hasValue)
+        {
+            standbyDir = argv[++i];
+        }
+        else if (option == "--primary" && hasValue)
+        {
+            primaryAddress = argv[++i];
+        }
+        else if (option == "--publish" && hasValue)
+        {
+            publishName = argv[++i];
+        }
+        else if (option == "--kiosk" && hasValue)
+        {
+            kioskName = argv[++i];
+        }
+        else if (option == "--tail" && hasValue)
+        {
+            tailDir = argv[++i];
+        }
+        else if (option == "--cursor" && hasValue)
+        {
+            cursorPath = argv[++i];
+        }
+        else if (option == "--velocity" && hasValue)
+        {
+            velocity = argv[++i];
+        }
+        else if (option == "--seal-history" && hasValue)
+        {
+            sealKeep = std::atoll(argv[++i]);
+        }
+        else if (option == "--statements" && hasValue)
+        {
+            statementMonth = std::atoi(argv[++i]);
+        }
+        else if (option == "--statements-dir" && hasValue)
+        {
+            statementDir = argv[++i];
+        }
+        else if (option == "--statements-memory" && hasValue)
+        {
+            statementMemory = std::atoi(argv[++i]);
+        }
+        else if (option == "--balances-at" && hasValue)
+        {
+            balancesDate = std::atoi(argv[++i]);
+        }
+        else if (option == "--replay-backup" && hasValue)
+        {
+            replayBackup = argv[++i];
+        }
+        else if (option == "--replay-retries" && hasValue)
+        {
+            replayRetries = std::atof(argv[++i]);
+        }
+        else if (option == "--backup" && hasValue)
+        {
+            backupPath = argv[++i];
+        }
+        else if (option == "--restore" && hasValue)
+        {
+            restorePath = argv[++i];
+        }
+        else if (option == "--restore-dir" && hasValue)
+        {
+            restoreDir = argv[++i];
+        }
+        else if (option == "--prove" && hasValue)
+        {
+            proveSeq = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (option == "--chain-key" && hasValue)
+        {
+            History_Chain::key_file = argv[++i];
+        }
+        else if (option == "--bench-records" && hasValue)
+        {
+            benchCount = std::atoi(argv[++i]);
+        }
+        else if (option == "--kdf-cost" && hasValue)
+        {
+            kdfCost = std::atoi(argv[++i]);
+        }
+        else if (option == "--bench-logins" && hasValue)
+        {
+            benchLoginCount = std::atoi(argv[++i]);
+        }
+        else if (option == "--bench-dir" && hasValue)
+        {
+            benchDir = argv[++i];
+        }
+        else if (option == "--dedupe-window" && hasValue)
+        {
+            dedupeWindow = std::atoll(argv[++i]);
+        }
+        else if (option == "--bench-dedupe" && hasValue)
+        {
+            dedupeCount = std::atoi(argv[++i]);
+        }
+        else if (option == "--sched-target" && hasValue)
+        {
+            schedTarget = std::atoll(argv[++i]);
+        }
+        else if (option == "--batch-queue" && hasValue)
+        {
+            batchQueue = std::atoi(argv[++i]);
+        }
+        else if (option == "--huge-pages")
+        {
+            Placement::huge_pages = true;
+        }
+        else if (option == "--numa")
+        {
+            Placement::numa = true;
+        }
+        else if (option == "--pool-frames" && hasValue)
+        {
+            poolFrames = std::atoi(argv[++i]);
+        }
+        else if (option == "--bench-placement" && hasValue)
+        {
+            placementCount = std::atoi(argv[++i]);
+        }
+        else if (option == "--bench-prefix" && hasValue)
+        {
+            prefixCount = std::atoi(argv[++i]);
+        }
+        else if (option == "--bench-scheduler" && hasValue)
+        {
+            schedulerCount = std::atoi(argv[++i]);
+        }
+    }
+    
+    if (!tracePath.empty())
+    {
+        Tracer::enable(tracePath, sampleRate);
+    }
+    if (kdfCost != 0)
+    {
+        if (kdfCost < 1 || kdfCost > 20)
+        {
+            std::cout << "Error: --kdf-cost takes a number from 1 to 20.\n";
+            return 1;
+        }
+        Hashtable::kdf_cost = (unsigned)kdfCost;
+    }
+    if (dedupeWindow != 0)
+    {
+        if (dedupeWindow < 1)
+        {
+            std::cout << "Error: --dedupe-window takes a number of seconds.\n";
+            return 1;
+        }
+        Dedupe_Table::window_us = dedupeWindow * 1000000LL;
+    }
+    if (schedTarget < 0 || batchQueue < 0)
+    {
+        std::cout << "Error: --sched-target and --batch-queue take a number of 0 or more.\n";
+        return 1;
+    }
+    Op_Scheduler::bank().configure(schedTarget, (unsigned)batchQueue);
+    if (poolFrames != 0)
+    {
+        if (poolFrames < 8)
+        {
+            std::cout << "Error: --pool-frames takes a number of 8 or more.\n";
+            return 1;
+        }
+        Buffer_Pool::default_frames = (unsigned)poolFrames;
+    }
+    if (!velocity.empty() && !configureVelocity(velocity))
+    {
+        std::cout << "Error: --velocity takes debits:outflow[:seconds] or off.\n";
+        return 1;
+    }
+    if (sealKeep >= 0)
+    {
+        return sealHistory((unsigned long long)sealKeep);
+    }
+    if (statementMonth != 0)
+    {
+        if (statementMonth % 100 < 1 || statementMonth % 100 > 12 || statementMemory <= 0)
+        {
+            std::cout << "Error: --statements takes a month as YYYYMM.\n";
+            return 1;
+        }
+        return generateStatements(statementMonth, statementDir, statementMemory);
+    }
+    if (balancesDate != 0)
+    {
+        if (History_Index::date_start(balancesDate) < 0)
+        {
+            std::cout << "Error: --balances-at takes a date as YYYYMMDD.\n";
+            return 1;
+        }
+        return printBalancesAt(balancesDate);
+    }
+    if (!backupPath.empty())
+    {
+        return backupLedger(backupPath);
+    }
+    if (!restorePath.empty())
+    {
+        return restoreLedger(restorePath, restoreDir);
+    }
+    if (verifyHistory)
+    {
+        return verifyChain();
+    }
+    if (proveSeq != 0)
+    {
+        return provePosting(proveSeq);
+    }
+    if (benchCount > 0)
+    {
+        return benchRecords(benchCount);
+    }
+    if (benchLoginCount > 0)
+    {
+        return benchLogins(benchLoginCount, benchDir);
+    }
+    if (dedupeCount > 0)
+    {
+        return benchDedupe(dedupeCount);
+    }
+    if (placementCount > 0)
+    {
+        return benchPlacement(placementCount, benchDir);
+    }
+    if (prefixCount > 0)
+    {
+        return benchPrefix(prefixCount);
+    }
+    if (schedulerCount > 0)
+    {
+        return benchScheduler(schedulerCount, benchDir, statementDir, schedTarget);
+    }
+    if (!tailDir.empty())
+    {
+        if (cursorPath.empty())
+            cursorPath = tailDir + "/tail.cursor";
+        return tailJournal(tailDir, cursorPath, follow);
+    }
+    if (!kioskName.empty())
+    {
+        return kiosk(kioskName);
+    }
+    if (!publishName.empty())
+    {
+        Hashtable H;
+        BST_Tree T;
+        // kiosks post through this process, so no menu may post alongside it
+        Ledger_Lock lock;
+        if (!lock.acquire(T.directory))
+        {
+            std::cout << "Error: Another process is posting to this ledger. Stop it before publishing the account table.\n";
+            return 1;
+        }
+        H.starthash();
+        Table_Owner owner;
+        if (!owner.start(publishName, T, H))
+        {
+            std::cout << "Error: Could not create the shared account table " << publishName << ".\n";
+            return 1;
+        }
+        std::cout << "Publishing " << owner.published() << " accounts as " << publishName
+                  << ". Kiosks can attach with --kiosk " << publishName << ". Press Enter to stop.\n";
+        std::cin.get();
+        owner.stop();
+        std::cout << "Applied " << owner.applied << " kiosk requests.\n";
+        Tracer::flush();
+        return 0;
+    }
+    if (!standbyDir.empty() || !primaryAddress.empty())
+    {
+        if (standbyDir.empty() || primaryAddress.empty())
+        {
+            std::cout << "Error: --standby and --primary must be given together.\n";
+            return 1;
+        }
+        int result = standby(standbyDir, primaryAddress);
+        Tracer::flush();
+        return result;
+    }
+    if (!replayPath.empty())
+    {
+        if (replayRetries > 0 && replayShards > 0)
+        {
+            std::cout << "Error: --replay-retries needs a single-tree replay.\n";
+            return 1;
+        }
+        bool verified = Workload::replay(replayPath, replayDir, replayPaced, replayShards > 0 ? replayShards : 0, serveAddress, replayEscrow,
+            replayBatch > 0 ? replayBatch : 0, replayBackup, replayRetries, replayFeed);
+        Tracer::flush();
+        return verified ? 0 : 1;
+    }
+    if (!recordPath.empty() && !Workload::start(recordPath))
+    {
+        std::cout << "Error: Could not open " << recordPath << " for recording.\n";
+        return 1;
+    }
+    return -1;
+}
+
 /**
  * @brief Clear the input buffer and handle invalid input
  */
@@ -62,11 +804,18 @@ void displayMenu()
 
 /**
  * @brief Main function
+ * @param argc Argument count
+ * @param argv Argument values
  * @return Exit status code
  */
-int main()
+int main(int argc, char* argv[])
 {
     // Initialize the system
+    int status = parseOptions(argc, argv);
+    if (status >= 0)
+    {
+        return status;
+    }
     initializeSystem();
     
     int choice = 0;
@@ -116,5 +865,11 @@ int main()
         }
     }
     
+    if (Workload::recording())
+    {
+        BST_Tree T;
+        Workload::stop(T);
+    }
+    Tracer::flush();
     return 0;
 }
@@ -4,17 +4,24 @@
  * 
  * This file contains the staff interface and functionality for the Bank Management System.
  * Staff can view transaction history, transfer money between accounts, withdraw money,
- * and deposit money.
+ * deposit money, and find customers by name or address.
  */
 
 #pragma once
 #include "BST_Tree.h"
 #include "Hashtable.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "History_Index.h"
+#include "Velocity_Guard.h"
+#include "Op_Scheduler.h"
+#include "Ledger_Lock.h"
 #include <iostream>
 #include <string>
 #include <limits>
 #include <fstream>
 #include <vector>
+#include <random>
 
 /**
  * @brief Clear the input buffer and handle invalid input
@@ -46,17 +53,46 @@ void displayStaffMenu()
     std::cout << "2. Transfer Money\n";
     std::cout << "3. Withdraw Money\n";
     std::cout << "4. Deposit Money\n";
-    std::cout << "5. Return to Main Menu\n\n";
-    std::cout << "Enter your choice (1-5): ";
+    std::cout << "5. Balance As Of Date\n";
+    std::cout << "6. Find Customer\n";
+    std::cout << "7. Return to Main Menu\n\n";
+    std::cout << "Enter your choice (1-7): ";
+}
+
+/**
+ * @brief Read an optional date range for a history query
+ * @param from Receives the first microsecond of the range
+ * @param to Receives the last microsecond of the range
+ */
+void readStaffDateRange(long long& from, long long& to)
+{
+    int date;
+    from = 0;
+    to = std::numeric_limits<long long>::max();
+    std::cout << "Enter start date (YYYYMMDD, 0 for all): ";
+    while (!(std::cin >> date) || (date != 0 && History_Index::date_start(date) < 0)) {
+        std::cout << "Invalid date. Please enter YYYYMMDD or 0: ";
+        clearStaffInputBuffer();
+    }
+    if (date != 0)
+        from = History_Index::date_start(date);
+    std::cout << "Enter end date (YYYYMMDD, 0 for all): ";
+    while (!(std::cin >> date) || (date != 0 && History_Index::date_start(date) < 0)) {
+        std::cout << "Invalid date. Please enter YYYYMMDD or 0: ";
+        clearStaffInputBuffer();
+    }
+    if (date != 0)
+        to = History_Index::date_start(date) + History_Index::DAY_US - 1;
 }
 
 /**
  * @brief View transaction history for an account
  * @param t BST_Tree object to search for the account
  */
-void viewTransactionHistory()
+void viewTransactionHistory(BST_Tree& t)
 {
     int accountNumber;
+    long long from, to;
     
     std::cout << "\n--- Transaction History ---\n\n";
     
@@ -65,38 +101,100 @@ void viewTransactionHistory()
         std::cout << "Invalid input. Please enter a number: ";
         clearStaffInputBuffer();
     }
+    readStaffDateRange(from, to);
     
     std::cout << "\nTransaction History for Account " << accountNumber << ":\n\n";
     
-    std::ifstream read("transaction.txt");
-    if (!read) {
-        std::cout << "Error: Could not open transaction file.\n";
-        return;
-    }
-    
+    Metrics_Timer timer(Metrics::HISTORY_SCAN);
+    Trace_Span span("history_scan");
+    // sealed entries come from the archive, recent ones through the daily index
     bool found = false;
-    int acc, amount;
-    
-    while (read >> acc) {
-        read >> amount;
-        
-        if (acc == accountNumber) {
-            found = true;
-            if (amount > 0) {
-                std::cout << "Deposit: +" << amount << "\n";
-            } else {
-                std::cout << "Withdrawal: " << amount << "\n";
-            }
+    t.history(accountNumber, from, to, [&](const History_Entry& entry) {
+        found = true;
+        if (entry.time != 0)
+            std::cout << History_Index::format_time(entry.time) << "  ";
+        if (entry.amount > 0) {
+            std::cout << "Deposit: +" << entry.amount << "\n";
+        } else {
+            std::cout << "Withdrawal: " << entry.amount << "\n";
         }
-    }
-    
-    read.close();
+    });
     
     if (!found) {
         std::cout << "No transactions found for this account.\n";
     }
 }
 
+/**
+ * @brief Show the balance an account had at the end of a date
+ * @param t BST_Tree object to query
+ */
+void viewBalanceAsOf(BST_Tree& t)
+{
+    int accountNumber, date, balance;
+    
+    std::cout << "\n--- Balance As Of Date ---\n\n";
+    
+    std::cout << "Enter Account Number: ";
+    while (!(std::cin >> accountNumber)) {
+        std::cout << "Invalid input. Please enter a number: ";
+        clearStaffInputBuffer();
+    }
+    std::cout << "Enter date (YYYYMMDD): ";
+    while (!(std::cin >> date) || History_Index::date_start(date) < 0) {
+        std::cout << "Invalid date. Please enter YYYYMMDD: ";
+        clearStaffInputBuffer();
+    }
+    
+    // the nearest balance checkpoint before the end of the day, plus what followed it
+    if (!t.balance_at(accountNumber, History_Index::date_start(date) + History_Index::DAY_US - 1, balance)) {
+        std::cout << "\nError: Account " << accountNumber << " not found.\n";
+        return;
+    }
+    std::cout << "\nBalance of account " << accountNumber << " at the end of " << date << ": " << balance << "\n";
+}
+
+/**
+ * @brief Idempotency key for a teller posting
+ *
+ * Every posting gets a fresh random key. When the teller enters the same posting
+ * as the last one and says it is a retry of it, the last key is used again, so a
+ * posting that did go through is not posted a second time.
+ * @param op 'T', 'W' or 'D'
+ * @param accountNumber Account the posting is on
+ * @param counterparty Receiver of a transfer, 0 otherwise
+ * @param amount Amount of the posting
+ * @param retry Set when the last key is used again
+ * @return Key to post with, never 0
+ */
+unsigned long long tellerKey(char op, int accountNumber, int counterparty, int amount, bool& retry)
+{
+    static std::mt19937_64 keys(((unsigned long long)std::random_device()() << 32) ^ std::random_device()());
+    static unsigned long long lastKey = 0;
+    static char lastOp = 0;
+    static int lastAccount = 0, lastCounterparty = 0, lastAmount = 0;
+
+    retry = false;
+    if (lastKey != 0 && op == lastOp && accountNumber == lastAccount && counterparty == lastCounterparty && amount == lastAmount) {
+        char answer;
+        std::cout << "\nThis is the same as the last posting. Is it a retry of that posting? (y/n): ";
+        std::cin >> answer;
+        if (answer == 'y' || answer == 'Y') {
+            retry = true;
+            return lastKey;
+        }
+    }
+    unsigned long long key = 0;
+    while (key == 0)
+        key = keys();
+    lastKey = key;
+    lastOp = op;
+    lastAccount = accountNumber;
+    lastCounterparty = counterparty;
+    lastAmount = amount;
+    return key;
+}
+
 /**
  * @brief Transfer money between accounts
  * @param t BST_Tree object to perform the transfer
@@ -140,6 +238,16 @@ void transferMoney(BST_Tree& t)
         clearStaffInputBuffer();
     }
     
+    // A retry of a transfer that went through only reports it
+    bool retry;
+    unsigned long long key = tellerKey('T', senderAccount, receiverAccount, amount, retry);
+    int balance;
+    if (retry && t.repeated(key, &balance)) {
+        std::cout << "\nThis transfer was already made; it was not made again.\n";
+        std::cout << "Balance for Account " << senderAccount << " after it: " << balance << "\n";
+        return;
+    }
+    
     // Check if sender has sufficient balance
     if (sender->balance < amount) {
         std::cout << "\nError: Insufficient balance in sender account!\n";
@@ -153,9 +261,19 @@ void transferMoney(BST_Tree& t)
     std::cin >> confirm;
     
     if (confirm == 'y' || confirm == 'Y') {
-        t.transfer(senderAccount, amount, receiverAccount);
+        // Check the sender's recent outflow before posting
+        Velocity_Guard::Verdict verdict = Velocity_Guard::bank().admit(senderAccount, amount);
+        if (verdict != Velocity_Guard::ALLOWED) {
+            std::cout << "\nError: Transfer refused, " << Velocity_Guard::describe(verdict) << "!\n";
+            return;
+        }
+        {
+            // Ahead of any batch work waiting for the ledger
+            Op_Slot slot(Op_Scheduler::INTERACTIVE);
+            t.transfer(senderAccount, receiverAccount, amount, key, &balance);
+        }
         std::cout << "\nTransfer completed successfully!\n";
-        std::cout << "New Balance for Account " << senderAccount << ": " << sender->balance << "\n";
+        std::cout << "New Balance for Account " << senderAccount << ": " << balance << "\n";
         std::cout << "New Balance for Account " << receiverAccount << ": " << receiver->balance << "\n";
     } else {
         std::cout << "\nTransfer cancelled.\n";
@@ -194,6 +312,16 @@ void withdrawMoney(BST_Tree& t)
         clearStaffInputBuffer();
     }
     
+    // A retry of a withdrawal that went through only reports it
+    bool retry;
+    unsigned long long key = tellerKey('W', accountNumber, 0, amount, retry);
+    int balance;
+    if (retry && t.repeated(key, &balance)) {
+        std::cout << "\nThis withdrawal was already made; it was not made again.\n";
+        std::cout << "Balance after it: " << balance << "\n";
+        return;
+    }
+    
     // Check if account has sufficient balance
     if (account->balance < amount) {
         std::cout << "\nError: Insufficient balance!\n";
@@ -206,9 +334,19 @@ void withdrawMoney(BST_Tree& t)
     std::cin >> confirm;
     
     if (confirm == 'y' || confirm == 'Y') {
-        t.withdraw(accountNumber, amount);
+        // Check the account's recent outflow before posting
+        Velocity_Guard::Verdict verdict = Velocity_Guard::bank().admit(accountNumber, amount);
+        if (verdict != Velocity_Guard::ALLOWED) {
+            std::cout << "\nError: Withdrawal refused, " << Velocity_Guard::describe(verdict) << "!\n";
+            return;
+        }
+        {
+            // Ahead of any batch work waiting for the ledger
+            Op_Slot slot(Op_Scheduler::INTERACTIVE);
+            t.withdraw(accountNumber, amount, key, &balance);
+        }
         std::cout << "\nWithdrawal completed successfully!\n";
-        std::cout << "New Balance: " << account->balance - amount << "\n";
+        std::cout << "New Balance: " << balance << "\n";
     } else {
         std::cout << "\nWithdrawal cancelled.\n";
     }
@@ -246,20 +384,78 @@ void depositMoney(BST_Tree& t)
         clearStaffInputBuffer();
     }
     
+    // A retry of a deposit that went through only reports it
+    bool retry;
+    unsigned long long key = tellerKey('D', accountNumber, 0, amount, retry);
+    int balance;
+    if (retry && t.repeated(key, &balance)) {
+        std::cout << "\nThis deposit was already made; it was not made again.\n";
+        std::cout << "Balance after it: " << balance << "\n";
+        return;
+    }
+    
     // Confirm deposit
     char confirm;
     std::cout << "\nDeposit " << amount << " into account " << accountNumber << "? (y/n): ";
     std::cin >> confirm;
     
     if (confirm == 'y' || confirm == 'Y') {
-        t.deposit(accountNumber, amount);
+        {
+            // Ahead of any batch work waiting for the ledger
+            Op_Slot slot(Op_Scheduler::INTERACTIVE);
+            t.deposit(accountNumber, amount, key, &balance);
+        }
         std::cout << "\nDeposit completed successfully!\n";
-        std::cout << "New Balance: " << account->balance + amount << "\n";
+        std::cout << "New Balance: " << balance << "\n";
     } else {
         std::cout << "\nDeposit cancelled.\n";
     }
 }
 
+/**
+ * @brief Find customers by the start of a word of their name or address, a page at a time
+ * @param t BST_Tree object to search
+ */
+void findCustomer(BST_Tree& t)
+{
+    std::string prefix;
+    int field = 0;
+    
+    std::cout << "\n--- Find Customer ---\n\n";
+    
+    std::cout << "Enter the start of a name or address: ";
+    std::cin.ignore();
+    std::getline(std::cin, prefix);
+    
+    std::cout << "Search by 1. Name or 2. Address: ";
+    while (!(std::cin >> field) || field < 1 || field > 2) {
+        std::cout << "Invalid input. Please enter 1 or 2: ";
+        clearStaffInputBuffer();
+    }
+    
+    Prefix_Index::Cursor cursor;
+    std::vector<Account_Record> page;
+    size_t shown = 0;
+    bool more = true;
+    while (more) {
+        more = t.find_customers(field == 2, prefix, 20, cursor, page);
+        for (size_t i = 0; i < page.size(); i++) {
+            std::cout << page[i].account_number << "  " << page[i].name << "  " << page[i].adress << "\n";
+        }
+        shown += page.size();
+        if (more) {
+            char next;
+            std::cout << "\nShow more? (y/n): ";
+            std::cin >> next;
+            more = (next == 'y' || next == 'Y');
+        }
+    }
+    
+    if (shown == 0) {
+        std::cout << "No customers found.\n";
+    }
+}
+
 /**
  * @brief Staff interface function
  */
@@ -268,8 +464,15 @@ void staff()
     BST_Tree t;
     Hashtable h;
     int choice = 0;
+    // one process posts to a ledger at a time
+    Ledger_Lock lock;
+    if (!lock.acquire(t.directory)) {
+        std::cout << "\nError: Another process is posting to this ledger, a kiosk table owner or another menu.\n"
+                  << "Post through a kiosk while a table is published, or try again when the other process has stopped.\n";
+        return;
+    }
     
-    while (choice != 5)
+    while (choice != 7)
     {
         displayStaffHeader();
         displayStaffMenu();
@@ -277,7 +480,7 @@ void staff()
         // Get user choice
         if (!(std::cin >> choice))
         {
-            std::cout << "\nInvalid input. Please enter a number between 1 and 5.\n";
+            std::cout << "\nInvalid input. Please enter a number between 1 and 7.\n";
             clearStaffInputBuffer();
             continue;
         }
@@ -286,7 +489,7 @@ void staff()
         switch (choice)
         {
             case 1:
-                viewTransactionHistory();
+                viewTransactionHistory(t);
                 break;
             case 2:
                 transferMoney(t);
@@ -298,15 +501,21 @@ void staff()
                 depositMoney(t);
                 break;
             case 5:
+                viewBalanceAsOf(t);
+                break;
+            case 6:
+                findCustomer(t);
+                break;
+            case 7:
                 std::cout << "\nReturning to main menu...\n";
                 break;
             default:
-                std::cout << "\nInvalid choice. Please enter a number between 1 and 5.\n";
+                std::cout << "\nInvalid choice. Please enter a number between 1 and 7.\n";
                 break;
         }
         
         // Pause before showing the menu again (except when exiting)
-        if (choice != 5)
+        if (choice != 7)
         {
             std::cout << "\nPress Enter to continue...";
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
@@ -0,0 +1,308 @@
+/**
+ * @file standby.h
+ * @brief Read-only standby interface for the Bank Management System
+ *
+ * This file contains the menu of a standby process. A standby follows the
+ * journal of a primary ledger and answers the balance and transaction history
+ * queries of the customer interface without touching the primary. Customers
+ * sign in against a copy of the primary's credential table kept in the replica
+ * directory, as they do on the customer interface. It can be promoted to a
+ * writable ledger when the primary is gone.
+ */
+
+#pragma once
+#include "Replication.h"
+#include "customer.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include <iostream>
+#include <string>
+#include <limits>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+/**
+ * @brief Clear the input buffer and handle invalid input
+ */
+void clearStandbyInputBuffer()
+{
+    std::cin.clear();
+    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+}
+
+/**
+ * @brief Display the standby menu header
+ * @param promoted Whether the standby has been promoted
+ */
+void displayStandbyHeader(bool promoted)
+{
+    std::cout << "\n";
+    std::cout << "===================================\n";
+    if (promoted)
+        std::cout << "     PROMOTED LEDGER (PRIMARY)     \n";
+    else
+        std::cout << "        STANDBY (READ-ONLY)        \n";
+    std::cout << "===================================\n\n";
+}
+
+/**
+ * @brief Display the standby menu options
+ */
+void displayStandbyMenu()
+{
+    std::cout << "Please select an option:\n\n";
+    std::cout << "1. View Account Balance\n";
+    std::cout << "2. View Transaction History\n";
+    std::cout << "3. View Replication Status\n";
+    std::cout << "4. Promote to Primary\n";
+    std::cout << "5. Sign Out\n";
+    std::cout << "6. Exit\n\n";
+    std::cout << "Enter your choice (1-6): ";
+}
+
+/**
+ * @brief Show the balance of an account from the replica or the promoted ledger
+ * @param standby Standby replica
+ * @param ledger Ledger opened by a promotion
+ * @param promoted Whether the standby has been promoted
+ * @param h Copy of the primary's credential table
+ * @param session Session handle of the customer
+ */
+void viewStandbyBalance(Standby& standby, Sharded_Ledger& ledger, bool promoted, Hashtable& h, unsigned long long& session)
+{
+    int accountNumber;
+    std::cout << "\n--- View Account Balance ---\n";
+    if (!customerSession(h, session, accountNumber))
+        return;
+
+    Metrics_Timer timer(Metrics::SEARCH);
+    int balance = 0;
+    bool found = promoted ? ledger.balance(accountNumber, balance) : standby.balance(accountNumber, balance);
+    if (!found) {
+        std::cout << "\nError: Account not found!\n";
+        return;
+    }
+    std::cout << "\nAccount Number: " << accountNumber << "\n";
+    std::cout << "Balance: " << balance << "\n";
+}
+
+/**
+ * @brief Show the transaction history of an account from the shard journals
+ *
+ * The account's own shard holds most of its history. Credits to a hot account
+ * are kept in escrow on other shards, so every journal is read and the lines
+ * are put in time order.
+ *
+ * @param standby Standby replica
+ * @param ledger Ledger opened by a promotion
+ * @param promoted Whether the standby has been promoted
+ * @param h Copy of the primary's credential table
+ * @param session Session handle of the customer
+ */
+void viewStandbyTransactionHistory(Standby& standby, Sharded_Ledger& ledger, bool promoted, Hashtable& h, unsigned long long& session)
+{
+    int accountNumber;
+    std::cout << "\n--- Transaction History ---\n";
+    if (!customerSession(h, session, accountNumber))
+        return;
+
+    unsigned shards = promoted ? ledger.shard_count() : standby.shard_count();
+    if (shards == 0) {
+        std::cout << "\nError: No ledger has been replicated yet.\n";
+        return;
+    }
+
+    std::cout << "\nTransaction History for Account " << accountNumber << ":\n\n";
+
+    Metrics_Timer timer(Metrics::HISTORY_SCAN);
+    Trace_Span span("history_scan");
+    std::vector<std::pair<long long, std::string> > lines;
+    for (unsigned i = 0; i < shards; i++) {
+        Shard* shard = promoted ? ledger.shard(i) : standby.shard(i);
+        shard->journal.scan(0, [&](const Journal_Record& rec, unsigned long long) {
+            bool sender = rec.account == accountNumber;
+            bool receiver = (rec.type == Journal_Record::LOCAL_TRANSFER || rec.type == Journal_Record::ESCROW_TRANSFER)
+                && rec.counterparty == accountNumber;
+            // sweeps move money between the account's own slots
+            if ((!sender && !receiver) || (rec.flags & Journal_Record::FROM_ESCROW) || rec.type == Journal_Record::ESCROW_RELEASE) {
+                return true;
+            }
+            std::ostringstream line;
+            switch (rec.type) {
+                case Journal_Record::OPEN:
+                    line << "Account opened: " << rec.amount;
+                    break;
+                case Journal_Record::CLOSE:
+                    line << "Account closed";
+                    break;
+                case Journal_Record::DEPOSIT:
+                case Journal_Record::ESCROW_DEPOSIT:
+                    line << "Deposit: +" << rec.amount;
+                    break;
+                case Journal_Record::WITHDRAW:
+                    line << "Withdrawal: -" << rec.amount;
+                    break;
+                case Journal_Record::LOCAL_TRANSFER:
+                case Journal_Record::ESCROW_TRANSFER:
+                case Journal_Record::RESERVE:
+                    if (sender)
+                        line << "Transfer to " << rec.counterparty << ": -" << rec.amount;
+                    else
+                        line << "Transfer from " << rec.account << ": +" << rec.amount;
+                    break;
+                case Journal_Record::CREDIT:
+                    line << "Transfer from " << rec.counterparty << ": +" << rec.amount;
+                    break;
+                case Journal_Record::ABORT:
+                    line << "Transfer refunded: +" << rec.amount;
+                    break;
+                default:
+                    return true;
+            }
+            lines.push_back(std::make_pair(rec.time, line.str()));
+            return true;
+        });
+    }
+
+    std::stable_sort(lines.begin(), lines.end(),
+        [](const std::pair<long long, std::string>& a, const std::pair<long long, std::string>& b) { return a.first < b.first; });
+    for (size_t i = 0; i < lines.size(); i++) {
+        std::cout << lines[i].second << "\n";
+    }
+    if (lines.empty()) {
+        std::cout << "No transactions found for this account.\n";
+    }
+}
+
+/**
+ * @brief Show how far the standby trails the primary
+ * @param standby Standby replica
+ * @param promoted Whether the standby has been promoted
+ */
+void viewReplicationStatus(Standby& standby, bool promoted)
+{
+    std::cout << "\n--- Replication Status ---\n\n";
+    if (promoted) {
+        std::cout << "This process has been promoted and no longer follows a primary.\n";
+        return;
+    }
+    std::cout << "Connected to primary:  " << (standby.connected() ? "yes" : "no") << "\n";
+    std::cout << "Records applied:       " << standby.applied_records() << "\n";
+    std::cout << "Lag (records):         " << standby.lag_records() << "\n";
+    std::cout << "Lag (microseconds):    " << standby.lag_us() << "\n";
+}
+
+/**
+ * @brief Promote the standby to a writable ledger
+ * @param standby Standby replica
+ * @param ledger Ledger that receives the promoted replica
+ * @return Whether the promotion succeeded
+ */
+bool promoteStandby(Standby& standby, Sharded_Ledger& ledger)
+{
+    std::cout << "\n--- Promote to Primary ---\n\n";
+    unsigned long long behind = standby.lag_records();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!standby.promote(ledger)) {
+        std::cout << "Error: The replica could not be opened as a ledger.\n";
+        return false;
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Promoted in " << ms << " ms (" << ledger.shard_count() << " shards).\n";
+    if (behind > 0) {
+        std::cout << "Warning: " << behind << " records committed on the primary had not arrived.\n";
+    }
+    return true;
+}
+
+/**
+ * @brief Standby interface function
+ * @param directory Directory that holds the replica
+ * @param primary Address of the primary's journal stream
+ */
+int standby(const std::string& directory, const std::string& primary)
+{
+    Standby replica;
+    Sharded_Ledger ledger;
+    if (!replica.open(directory)) {
+        std::cout << "Error: Could not open the replica in " << directory << ".\n";
+        return 1;
+    }
+    if (!replica.connect(primary)) {
+        std::cout << "Error: Could not follow the primary at " << primary << ".\n";
+        return 1;
+    }
+    // queries are answered only to customers who sign in
+    Hashtable h;
+    h.directory = replica.directory;
+    std::ifstream credentials(h.file("hashtable.txt").c_str());
+    if (!credentials) {
+        std::cout << "Warning: No credential table in " << directory << "; balance and history queries are refused.\n"
+                  << "Copy hashtable.txt from the primary's ledger directory to serve them.\n";
+    }
+    credentials.close();
+    h.starthash();
+    unsigned long long session = 0;
+
+    bool promoted = false;
+    int choice = 0;
+    while (choice != 6)
+    {
+        displayStandbyHeader(promoted);
+        displayStandbyMenu();
+
+        // Get user choice
+        if (!(std::cin >> choice))
+        {
+            if (std::cin.eof())
+                break;
+            std::cout << "\nInvalid input. Please enter a number between 1 and 6.\n";
+            clearStandbyInputBuffer();
+            continue;
+        }
+
+        // Process user choice
+        switch (choice)
+        {
+            case 1:
+                viewStandbyBalance(replica, ledger, promoted, h, session);
+                break;
+            case 2:
+                viewStandbyTransactionHistory(replica, ledger, promoted, h, session);
+                break;
+            case 3:
+                viewReplicationStatus(replica, promoted);
+                break;
+            case 4:
+                if (promoted)
+                    std::cout << "\nThis process is already the primary.\n";
+                else
+                    promoted = promoteStandby(replica, ledger);
+                break;
+            case 5:
+                Session_Table::bank().close(session);
+                session = 0;
+                std::cout << "\nSigned out.\n";
+                break;
+            case 6:
+                Session_Table::bank().close(session);
+                std::cout << "\nStopping the standby...\n";
+                break;
+            default:
+                std::cout << "\nInvalid choice. Please enter a number between 1 and 6.\n";
+                break;
+        }
+
+        // Pause before showing the menu again (except when exiting)
+        if (choice != 6)
+        {
+            std::cout << "\nPress Enter to continue...";
+            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            std::cin.get();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,162 @@
+# include "Check.h"
+# include "BPlus_Tree.h"
+# include <algorithm>
+# include <random>
+# include <stdio.h>
+# include <string.h>
+# include <limits.h>
+
+static const char *PATH = "test_accounts.idx";
+static const int ACCOUNTS = 20000;
+
+static Account_Record account(int number)
+{
+	Account_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.account_number = number;
+	rec.balance = number % 1000;
+	snprintf(rec.name, sizeof(rec.name), "name %d", number);
+	snprintf(rec.adress, sizeof(rec.adress), "street %d", number);
+	return rec;
+}
+// Visits every record in order and checks the keys are rising.
+static unsigned scan_ordered(BPlus_Tree &tree, bool &ordered)
+{
+	unsigned seen = 0;
+	int last = 0;
+	ordered = true;
+	tree.scan(INT_MIN, INT_MAX, [&](const Account_Record &rec) {
+		ordered = ordered && (seen == 0 || rec.account_number > last);
+		last = rec.account_number;
+		seen++;
+		return true;
+	});
+	return seen;
+}
+
+// Inserts in random order, so leaves and inner pages split all over the tree.
+TEST(bplus_insert_and_find)
+{
+	remove(PATH);
+	BPlus_Tree tree;
+	CHECK(tree.open(PATH));
+	CHECK(tree.created);
+	vector <int> numbers;
+	for (int i = 1; i <= ACCOUNTS; i++)
+	{
+		numbers.push_back(i * 7);
+	}
+	shuffle(numbers.begin(), numbers.end(), mt19937(26));
+	bool inserted = true;
+	for (size_t i = 0; i < numbers.size(); i++)
+	{
+		inserted = inserted && tree.insert(account(numbers[i]));
+	}
+	CHECK(inserted);
+	CHECK(!tree.insert(account(numbers[0])));
+	CHECK(tree.count() == (unsigned)ACCOUNTS);
+	CHECK(tree.height() > 2);
+
+	bool found = true;
+	Account_Record rec;
+	for (int i = 1; i <= ACCOUNTS; i++)
+	{
+		found = found && tree.find(i * 7, rec) && rec.balance == (i * 7) % 1000 && strcmp(rec.name, account(i * 7).name) == 0;
+	}
+	CHECK(found);
+	CHECK(!tree.find(8, rec));
+	CHECK(!tree.find(ACCOUNTS * 7 + 7, rec));
+	bool ordered;
+	CHECK(scan_ordered(tree, ordered) == (unsigned)ACCOUNTS);
+	CHECK(ordered);
+
+	// a range scan starts at the first key at or above its low end
+	vector <int> range;
+	tree.scan(700, 770, [&range](const Account_Record &r) {
+		range.push_back(r.account_number);
+		return true;
+	});
+	CHECK(range.size() == 11 && range.front() == 700 && range.back() == 770);
+	tree.close();
+	remove(PATH);
+}
+
+// Removes every other key in random order, then puts some back.
+TEST(bplus_remove_and_reinsert)
+{
+	remove(PATH);
+	BPlus_Tree tree;
+	CHECK(tree.open(PATH));
+	for (int i = 1; i <= ACCOUNTS; i++)
+	{
+		tree.insert(account(i));
+	}
+	vector <int> odd;
+	for (int i = 1; i <= ACCOUNTS; i += 2)
+	{
+		odd.push_back(i);
+	}
+	shuffle(odd.begin(), odd.end(), mt19937(46));
+	bool removed = true;
+	for (size_t i = 0; i < odd.size(); i++)
+	{
+		removed = removed && tree.remove(odd[i]);
+	}
+	CHECK(removed);
+	CHECK(!tree.remove(odd[0]));
+	CHECK(tree.count() == (unsigned)ACCOUNTS / 2);
+
+	Account_Record rec;
+	bool right = true;
+	for (int i = 1; i <= ACCOUNTS; i++)
+	{
+		right = right && tree.find(i, rec) == (i % 2 == 0);
+	}
+	CHECK(right);
+	bool ordered;
+	CHECK(scan_ordered(tree, ordered) == (unsigned)ACCOUNTS / 2);
+	CHECK(ordered);
+
+	// emptied leaves stay in the chain and take keys again
+	for (int i = 1; i <= 1001; i += 2)
+	{
+		tree.insert(account(i));
+	}
+	CHECK(tree.count() == (unsigned)ACCOUNTS / 2 + 501);
+	CHECK(scan_ordered(tree, ordered) == (unsigned)ACCOUNTS / 2 + 501);
+	CHECK(ordered);
+	tree.close();
+	remove(PATH);
+}
+
+// Updates and removals reach the file and are there after reopening.
+TEST(bplus_reopen)
+{
+	remove(PATH);
+	{
+		BPlus_Tree tree;
+		CHECK(tree.open(PATH));
+		for (int i = 1; i <= ACCOUNTS; i++)
+		{
+			tree.insert(account(i));
+		}
+		CHECK(tree.update_balance(5, 12345));
+		Account_Record rec = account(6);
+		snprintf(rec.name, sizeof(rec.name), "renamed");
+		CHECK(tree.update(rec));
+		CHECK(tree.remove(7));
+		CHECK(!tree.update_balance(7, 1));
+		tree.close();
+	}
+	BPlus_Tree tree;
+	CHECK(tree.open(PATH));
+	CHECK(!tree.created);
+	CHECK(tree.count() == (unsigned)ACCOUNTS - 1);
+	Account_Record rec;
+	CHECK(tree.find(5, rec) && rec.balance == 12345);
+	CHECK(tree.find(6, rec) && strcmp(rec.name, "renamed") == 0);
+	CHECK(!tree.find(7, rec));
+	CHECK(tree.find(ACCOUNTS, rec) && rec.balance == ACCOUNTS % 1000);
+	tree.close();
+	remove(PATH);
+}
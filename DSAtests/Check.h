@@ -0,0 +1,25 @@
+#pragma once
+# include <string>
+# include <vector>
+using namespace std;
+
+// A test is a function that runs CHECKs. TEST defines one and registers it
+// before main() runs; main() runs every test, or those whose name contains
+// the first argument, and exits with 1 if any check failed.
+struct Test_Case
+{
+	const char *name;
+	void (*run)();
+};
+
+vector <Test_Case>& test_cases();
+int register_test(const char *, void (*)());
+bool check(bool, const char *, const char *, int);
+string hex(const unsigned char *, size_t);
+
+# define TEST(name) \
+	static void name(); \
+	static int name##_registered = register_test(#name, name); \
+	static void name()
+
+# define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
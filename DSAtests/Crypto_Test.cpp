@@ -0,0 +1,79 @@
+# include "Check.h"
+# include "Sha256.h"
+# include "Scrypt.h"
+# include <string.h>
+
+static string sha256(const string &message)
+{
+	unsigned char digest[Sha256::SIZE];
+	Sha256::hash(message.data(), message.size(), digest);
+	return hex(digest, sizeof(digest));
+}
+
+// FIPS 180-2 examples, and a message over one block.
+TEST(sha256_vectors)
+{
+	CHECK(sha256("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	CHECK(sha256("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	CHECK(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")
+		== "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+	CHECK(sha256(string(1000000, 'a')) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+// Every lane of hash_many gives what hash gives for its message.
+TEST(sha256_lanes)
+{
+	const size_t LENGTH = 100;
+	const size_t COUNT = Sha256::LANES + 3;
+	vector <unsigned char> messages(COUNT * LENGTH);
+	vector <const unsigned char*> at(COUNT);
+	for (size_t i = 0; i < messages.size(); i++)
+	{
+		messages[i] = (unsigned char)(i * 31 + 7);
+	}
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		at[i] = &messages[i * LENGTH];
+	}
+	vector <unsigned char> digests(COUNT * Sha256::SIZE);
+	Sha256::hash_many(at.data(), COUNT, LENGTH, digests.data());
+	bool same = true;
+	for (size_t i = 0; i < COUNT; i++)
+	{
+		unsigned char digest[Sha256::SIZE];
+		Sha256::hash(at[i], LENGTH, digest);
+		same = same && memcmp(digest, &digests[i * Sha256::SIZE], Sha256::SIZE) == 0;
+	}
+	CHECK(same);
+}
+
+// RFC 4231 test cases 2 and 6.
+TEST(hmac_sha256_vectors)
+{
+	unsigned char mac[Sha256::SIZE];
+	const char *data = "what do ya want for nothing?";
+	Sha256::hmac((const unsigned char*)"Jefe", 4, data, strlen(data), mac);
+	CHECK(hex(mac, sizeof(mac)) == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+
+	vector <unsigned char> key(131, 0xaa);
+	const char *large = "Test Using Larger Than Block-Size Key - Hash Key First";
+	Sha256::hmac(key.data(), key.size(), large, strlen(large), mac);
+	CHECK(hex(mac, sizeof(mac)) == "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+}
+
+// RFC 7914 section 11 and 12.
+TEST(scrypt_vectors)
+{
+	unsigned char out[64];
+	Scrypt::pbkdf2("passwd", 6, (const unsigned char*)"salt", 4, 1, out, sizeof(out));
+	CHECK(hex(out, sizeof(out)) == "55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc"
+		"49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783");
+
+	vector <unsigned> scratch;
+	Scrypt::derive("", 0, (const unsigned char*)"", 0, 4, 1, 1, out, sizeof(out), scratch);
+	CHECK(hex(out, sizeof(out)) == "77d6576238657b203b19ca42c18a0497f16b4844e3074ae8dfdffa3fede21442"
+		"fcd0069ded0948f8326a753a0fc81f17e8d3e0fb2e0d3628cf35e20c38d18906");
+	Scrypt::derive("password", 8, (const unsigned char*)"NaCl", 4, 10, 8, 16, out, sizeof(out), scratch);
+	CHECK(hex(out, sizeof(out)) == "fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+		"2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640");
+}
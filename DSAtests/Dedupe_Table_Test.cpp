@@ -0,0 +1,76 @@
+# include "Check.h"
+# include "Dedupe_Table.h"
+
+static const long long WINDOW = 16 * 1000000LL;
+static const long long START = 1000000000000LL;
+
+TEST(dedupe_find_within_window)
+{
+	Dedupe_Table table(WINDOW);
+	CHECK(table.window() == WINDOW);
+	for (unsigned long long key = 1; key <= 10000; key++)
+	{
+		table.insert(key * 0x9e3779b97f4a7c15ull, (int)key, START);
+	}
+	CHECK(table.size(START) == 10000);
+	int result = 0;
+	bool found = true;
+	for (unsigned long long key = 1; key <= 10000; key++)
+	{
+		found = found && table.find(key * 0x9e3779b97f4a7c15ull, result, START + WINDOW / 2) && result == (int)key;
+	}
+	CHECK(found);
+	CHECK(!table.find(12345, result, START));
+
+	// a key already in the window takes the new result
+	table.insert(0x9e3779b97f4a7c15ull, -5, START + 1);
+	CHECK(table.find(0x9e3779b97f4a7c15ull, result, START + 2) && result == -5);
+	CHECK(table.size(START + 2) == 10000);
+}
+
+// Keys age out a tick at a time once the window has passed them.
+TEST(dedupe_ageing)
+{
+	Dedupe_Table table(WINDOW);
+	long long tick = WINDOW / Dedupe_Table::TICKS;
+	table.insert(1, 10, START);
+	table.insert(2, 20, START + 4 * tick);
+	int result;
+	CHECK(table.find(1, result, START + WINDOW - 1));
+	CHECK(!table.find(1, result, START + WINDOW + tick));
+	CHECK(table.find(2, result, START + WINDOW + tick) && result == 20);
+	CHECK(table.size(START + WINDOW + tick) == 1);
+	CHECK(!table.find(2, result, START + 2 * WINDOW));
+	CHECK(table.size(START + 2 * WINDOW) == 0);
+
+	// a clock that went back stays in the current tick
+	table.insert(3, 30, START + 2 * WINDOW);
+	CHECK(table.find(3, result, START));
+}
+
+// Aged-out slots are reused, so a steady stream of keys does not grow it.
+TEST(dedupe_reuses_slots)
+{
+	Dedupe_Table table(WINDOW);
+	long long tick = WINDOW / Dedupe_Table::TICKS;
+	unsigned long long key = 1;
+	for (long long t = 0; t < 4 * Dedupe_Table::TICKS; t++)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			table.insert(key++ * 0xbf58476d1ce4e5b9ull, i, START + t * tick);
+		}
+	}
+	size_t steady = table.memory();
+	for (long long t = 4 * Dedupe_Table::TICKS; t < 8 * Dedupe_Table::TICKS; t++)
+	{
+		for (int i = 0; i < 1000; i++)
+		{
+			table.insert(key++ * 0xbf58476d1ce4e5b9ull, i, START + t * tick);
+		}
+	}
+	CHECK(table.memory() == steady);
+	CHECK(table.size(START + 8 * Dedupe_Table::TICKS * tick) <= 1000 * (Dedupe_Table::TICKS + 1));
+	int result;
+	CHECK(table.find((key - 1) * 0xbf58476d1ce4e5b9ull, result, START + 8 * Dedupe_Table::TICKS * tick));
+}
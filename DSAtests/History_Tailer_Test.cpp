@@ -0,0 +1,91 @@
+# include "Check.h"
+# include "Change_Feed.h"
+# include "History_Archive.h"
+# include <stdio.h>
+# include <fstream>
+
+// The ledger lives in the working directory.
+static void remove_history()
+{
+	remove("./transaction.txt");
+	remove("./history.arc");
+	remove("./tail.cursor");
+}
+// Appends the postings first..last to transaction.txt.
+static void post(unsigned long long first, unsigned long long last)
+{
+	ofstream write("./transaction.txt", ios::binary | ios::app);
+	for (unsigned long long seq = first; seq <= last; seq++)
+	{
+		History_Entry entry = { seq, (long long)seq * 1000, 100 + (int)(seq % 3), (int)seq, (int)seq * 10 };
+		History_Archive::write_live(write, entry);
+	}
+}
+// Opens a tailer on the saved cursor, reads what is new and saves it.
+static vector <unsigned long long> tail()
+{
+	vector <unsigned long long> seqs;
+	History_Tailer tailer;
+	if (!tailer.open(".", "./tail.cursor"))
+	{
+		return seqs;
+	}
+	tailer.poll([&](const Change_Event &event) { seqs.push_back(event.seq); });
+	tailer.commit();
+	return seqs;
+}
+static bool runs(const vector <unsigned long long> &seqs, unsigned long long first, unsigned long long last)
+{
+	if (seqs.size() != last - first + 1)
+	{
+		return false;
+	}
+	for (unsigned i = 0; i < seqs.size(); i++)
+	{
+		if (seqs[i] != first + i)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+TEST(history_tailer_resumes)
+{
+	remove_history();
+	post(1, 10);
+	CHECK(runs(tail(), 1, 10));
+	CHECK(tail().empty());
+	post(11, 15);
+	CHECK(runs(tail(), 11, 15));
+	remove_history();
+}
+
+TEST(history_tailer_survives_seal)
+{
+	remove_history();
+	post(1, 10);
+	CHECK(runs(tail(), 1, 10));
+	post(11, 20);
+	// 11..17 are sealed before the tailer reads them
+	History_Archive::Seal_Report report;
+	CHECK(History_Archive::seal("./transaction.txt", "./history.arc", 3, report));
+	CHECK(report.entries == 17);
+	CHECK(runs(tail(), 11, 20));
+	post(21, 22);
+	CHECK(History_Archive::seal("./transaction.txt", "./history.arc", 1, report));
+	CHECK(runs(tail(), 21, 22));
+	remove_history();
+}
+
+TEST(history_tailer_waits_for_whole_lines)
+{
+	remove_history();
+	post(1, 2);
+	{
+		ofstream write("./transaction.txt", ios::binary | ios::app);
+		write << "100 5";
+	}
+	CHECK(runs(tail(), 1, 2));
+	remove_history();
+}
@@ -0,0 +1,58 @@
+# include "Check.h"
+# include "Prefix_Index.h"
+# include <algorithm>
+
+static string customer(int i, int round)
+{
+	return "Customer " + to_string(i) + (round % 2 ? " Lovelace" : " Hopper");
+}
+
+TEST(prefix_finds_words)
+{
+	Prefix_Index index;
+	index.add("Ada Lovelace", 1);
+	index.add("Grace Hopper", 2);
+	index.add("Adam Smith", 3);
+	Prefix_Index::Cursor cursor;
+	vector <int> accounts;
+	index.find("ad", 10, accounts, cursor);
+	sort(accounts.begin(), accounts.end());
+	CHECK(accounts.size() == 2 && accounts[0] == 1 && accounts[1] == 3);
+	Prefix_Index::Cursor other;
+	index.find("LOVE", 10, accounts, other);
+	CHECK(accounts.size() == 1 && accounts[0] == 1);
+	index.remove("Ada Lovelace", 1);
+	Prefix_Index::Cursor again;
+	index.find("love", 10, accounts, again);
+	CHECK(accounts.empty());
+	CHECK(index.size() == 4);
+}
+
+TEST(prefix_renames_keep_memory_bounded)
+{
+	Prefix_Index index;
+	const int CUSTOMERS = 1000;
+	for (int i = 0; i < CUSTOMERS; i++)
+	{
+		index.add(customer(i, 0), 100000 + i);
+	}
+	size_t keys = index.size();
+	size_t before = index.memory();
+	for (int round = 1; round <= 200; round++)
+	{
+		for (int i = 0; i < CUSTOMERS; i++)
+		{
+			index.remove(customer(i, round - 1), 100000 + i);
+			index.add(customer(i, round), 100000 + i);
+		}
+	}
+	CHECK(index.size() == keys);
+	CHECK(index.memory() < 2 * before);
+	Prefix_Index::Cursor cursor;
+	vector <int> accounts;
+	index.find("hopper", 2 * CUSTOMERS, accounts, cursor);
+	CHECK(accounts.size() == (size_t)CUSTOMERS);
+	Prefix_Index::Cursor other;
+	index.find("customer 99", 20, accounts, other);
+	CHECK(accounts.size() == 11);
+}
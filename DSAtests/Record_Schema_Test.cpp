@@ -0,0 +1,66 @@
+# include "Check.h"
+# include "BPlus_Tree.h"
+# include <string.h>
+# include <stdio.h>
+
+static Account_Record sample()
+{
+	Account_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.account_number = -2147483647 - 1;
+	rec.balance = 2147483647;
+	snprintf(rec.name, sizeof(rec.name), "Ada Lovelace");
+	snprintf(rec.adress, sizeof(rec.adress), "12 St James's Square");
+	return rec;
+}
+
+// Text is one field per line in schema order, and reads back the same.
+TEST(schema_text_round_trip)
+{
+	Account_Record rec = sample();
+	char buffer[Account_Schema::TEXT_SIZE];
+	char *end = Account_Schema::write_text(rec, buffer);
+	string text(buffer, end - buffer);
+	CHECK(text == "Ada Lovelace\n12 St James's Square\n-2147483648\n2147483647\n");
+
+	// blank lines before a record are skipped
+	string file = "\n\r\n" + text + text;
+	Account_Record read;
+	const char *in = Account_Schema::read_text(file.data(), file.data() + file.size(), read);
+	CHECK(in != nullptr && memcmp(&read, &rec, sizeof(rec)) == 0);
+	in = Account_Schema::read_text(in, file.data() + file.size(), read);
+	CHECK(in == file.data() + file.size() && read.balance == rec.balance);
+	CHECK(Account_Schema::read_text(in, file.data() + file.size(), read) == nullptr);
+}
+
+TEST(schema_text_malformed)
+{
+	Account_Record read;
+	string bad = "name\nadress\n12x\n5\n";
+	CHECK(Account_Schema::read_text(bad.data(), bad.data() + bad.size(), read) == nullptr);
+	string overflow = "name\nadress\n2147483648\n5\n";
+	CHECK(Account_Schema::read_text(overflow.data(), overflow.data() + overflow.size(), read) == nullptr);
+	string cut = "name\nadress\n12\n";
+	CHECK(Account_Schema::read_text(cut.data(), cut.data() + cut.size(), read) == nullptr);
+}
+
+// Binary is fixed width, integers little-endian, strings zero-padded.
+TEST(schema_binary_round_trip)
+{
+	Account_Record rec = sample();
+	char buffer[Account_Schema::BINARY_SIZE];
+	CHECK(Account_Schema::write_binary(rec, buffer) == buffer + sizeof(buffer));
+	CHECK(sizeof(buffer) == 64 + 116 + 4 + 4);
+	CHECK(memcmp(buffer + 180, "\x00\x00\x00\x80", 4) == 0);
+	CHECK(buffer[12] == 0 && buffer[63] == 0);
+	Account_Record read;
+	CHECK(Account_Schema::read_binary(buffer, read) == buffer + sizeof(buffer));
+	CHECK(memcmp(&read, &rec, sizeof(rec)) == 0);
+}
+
+// Dropping the password changed the layout, so an old index is not misread.
+TEST(schema_layouts_differ)
+{
+	CHECK(Account_Schema::LAYOUT != Legacy_Account_Schema::LAYOUT);
+	CHECK(Account_Schema::VERSION == 2 && Legacy_Account_Schema::VERSION == 1);
+}
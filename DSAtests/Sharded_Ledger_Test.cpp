@@ -0,0 +1,127 @@
+# include "Check.h"
+# include "Sharded_Ledger.h"
+# include <stdio.h>
+# include <fstream>
+# include <string.h>
+
+// The ledger lives in the working directory: shard 0 holds accounts below
+// 1000 and shard 1 the rest.
+static const int SENDER = 10;
+static const int RECEIVER = 2000;
+static const unsigned long long TXID = 1000000;
+
+static void remove_ledger()
+{
+	remove("./shards.cfg");
+	const char *files[] = { "accounts.idx", "journal.log", "checkpoint", "checkpoint.tmp" };
+	for (unsigned i = 0; i < 2; i++)
+	{
+		for (unsigned j = 0; j < sizeof(files) / sizeof(files[0]); j++)
+		{
+			remove((Sharded_Ledger::shard_prefix(".", i) + files[j]).c_str());
+		}
+	}
+}
+// Two accounts with 1000 and 500, closed cleanly.
+static bool make_ledger()
+{
+	remove_ledger();
+	Sharded_Ledger ledger;
+	vector <int> splits(1, 1000);
+	bool ok = ledger.create(".", splits) && ledger.open_account(SENDER, 1000) && ledger.open_account(RECEIVER, 500);
+	ledger.close();
+	return ok;
+}
+// Leaves a shard's journal as a crash would: the record is durable, the
+// index pages it changes were never written.
+static bool crash_with(unsigned shard, int type, int account, int counterparty, int amount, int balance)
+{
+	Journal journal;
+	if (!journal.open(Sharded_Ledger::shard_prefix(".", shard) + "journal.log"))
+	{
+		return false;
+	}
+	Journal_Record rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	rec.txid = TXID;
+	rec.account = account;
+	rec.counterparty = counterparty;
+	rec.amount = amount;
+	rec.balance = balance;
+	journal.append(rec);
+	bool ok = journal.sync();
+	journal.close();
+	return ok;
+}
+static bool balances(int sender, int receiver)
+{
+	Sharded_Ledger ledger;
+	int a = 0, b = 0;
+	bool ok = ledger.open(".") && ledger.balance(SENDER, a) && ledger.balance(RECEIVER, b);
+	bool settled = ledger.shard(0)->in_doubt().empty() && ledger.shard(1)->in_doubt().empty();
+	ledger.close();
+	return ok && settled && a == sender && b == receiver;
+}
+
+TEST(sharded_transfer_survives_reopen)
+{
+	CHECK(make_ledger());
+	{
+		Sharded_Ledger ledger;
+		CHECK(ledger.open("."));
+		CHECK(ledger.transfer(SENDER, RECEIVER, 300));
+		CHECK(!ledger.transfer(SENDER, RECEIVER, 5000));
+		ledger.close();
+	}
+	CHECK(balances(700, 800));
+	remove_ledger();
+}
+
+// Crash after the sender's shard reserved the amount and before the receiver
+// credited it: recovery refunds the sender, once.
+TEST(sharded_crash_between_reserve_and_credit)
+{
+	CHECK(make_ledger());
+	CHECK(crash_with(0, Journal_Record::RESERVE, SENDER, RECEIVER, 300, 700));
+	CHECK(balances(1000, 500));
+	// the refund was journaled, so a second recovery does not refund again
+	CHECK(balances(1000, 500));
+	remove_ledger();
+}
+
+// Crash after the receiver credited and before the sender committed:
+// recovery commits, and the money is neither lost nor created.
+TEST(sharded_crash_between_credit_and_commit)
+{
+	CHECK(make_ledger());
+	CHECK(crash_with(0, Journal_Record::RESERVE, SENDER, RECEIVER, 300, 700));
+	CHECK(crash_with(1, Journal_Record::CREDIT, RECEIVER, SENDER, 300, 800));
+	CHECK(balances(700, 800));
+	CHECK(balances(700, 800));
+	remove_ledger();
+}
+
+// A record torn by a crash is cut off on open, and the ledger goes on from
+// the last whole one.
+TEST(sharded_torn_journal_tail)
+{
+	CHECK(make_ledger());
+	string path = Sharded_Ledger::shard_prefix(".", 0) + "journal.log";
+	{
+		char torn[sizeof(Journal_Record) / 2];
+		memset(torn, 0x5a, sizeof(torn));
+		ofstream append(path.c_str(), ios::binary | ios::app);
+		append.write(torn, sizeof(torn));
+		CHECK(!append.fail());
+	}
+	{
+		Sharded_Ledger ledger;
+		CHECK(ledger.open("."));
+		CHECK(ledger.shard(0)->journal.size % sizeof(Journal_Record) == 0);
+		CHECK(ledger.deposit(SENDER, 1));
+		ledger.close();
+	}
+	CHECK(balances(1001, 500));
+	remove_ledger();
+}
@@ -0,0 +1,60 @@
+# include "Check.h"
+# include <iostream>
+# include <string.h>
+using namespace std;
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+vector <Test_Case>& test_cases()
+{
+	static vector <Test_Case> cases;
+	return cases;
+}
+int register_test(const char *name, void (*run)())
+{
+	Test_Case test = { name, run };
+	test_cases().push_back(test);
+	return (int)test_cases().size();
+}
+bool check(bool passed, const char *condition, const char *file, int line)
+{
+	checks++;
+	if (!passed)
+	{
+		failures++;
+		cout << file << ":" << line << ": failed: " << condition << endl;
+	}
+	return passed;
+}
+string hex(const unsigned char *bytes, size_t length)
+{
+	static const char digits[] = "0123456789abcdef";
+	string out;
+	for (size_t i = 0; i < length; i++)
+	{
+		out += digits[bytes[i] >> 4];
+		out += digits[bytes[i] & 15];
+	}
+	return out;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = argc > 1 ? argv[1] : "";
+	unsigned ran = 0;
+	for (size_t i = 0; i < test_cases().size(); i++)
+	{
+		const Test_Case &test = test_cases()[i];
+		if (strstr(test.name, filter) == nullptr)
+		{
+			continue;
+		}
+		unsigned before = failures;
+		test.run();
+		ran++;
+		cout << (failures == before ? "ok     " : "FAILED ") << test.name << endl;
+	}
+	cout << ran << " tests, " << checks << " checks, " << failures << " failed" << endl;
+	return failures == 0 && ran > 0 ? 0 : 1;
+}